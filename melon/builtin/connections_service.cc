@@ -19,6 +19,7 @@
 
 
 
+#include <inttypes.h>                        // PRId64
 #include <ostream>
 #include <iomanip>
 #include <netinet/tcp.h>
@@ -125,7 +126,8 @@ namespace melon {
             if (is_channel_conn) {
                 os << "<th>Local</th>"
                       "<th>RecentErr</th>"
-                      "<th>nbreak</th>";
+                      "<th>nbreak</th>"
+                      "<th>PoolHit/Miss</th>";
             }
             os << "<th>SSL</th>"
                   "<th>Protocol</th>"
@@ -144,7 +146,7 @@ namespace melon {
         } else {
             os << "CreatedTime               |RemoteSide         |";
             if (is_channel_conn) {
-                os << "Local|RecentErr|nbreak|";
+                os << "Local|RecentErr|nbreak|PoolHit/Miss   |";
             }
             os << "SSL|Protocol    |fd   |"
                   "InBytes/s|In/s  |InBytes/m |In/m    |"
@@ -181,7 +183,8 @@ namespace melon {
                 if (is_channel_conn) {
                     os << min_width(ptr->local_side().port, 5) << bar
                        << min_width(ptr->recent_error_count(), 10) << bar
-                       << min_width(ptr->isolated_times(), 7) << bar;
+                       << min_width(ptr->isolated_times(), 7) << bar
+                       << min_width("-", 15) << bar;
                 }
                 os << min_width("-", 3) << bar
                    << min_width("-", 12) << bar
@@ -208,12 +211,19 @@ namespace melon {
                 int pref_index = ptr->preferred_index();
                 SocketUniquePtr first_sub;
                 int pooled_count = -1;
+                char pool_hits[32] = "-";
                 if (ptr->HasSocketPool()) {
                     int numfree = 0;
                     int numinflight = 0;
                     if (ptr->GetPooledSocketStats(&numfree, &numinflight)) {
                         pooled_count = numfree + numinflight;
                     }
+                    int64_t nhit = 0;
+                    int64_t nmiss = 0;
+                    if (ptr->GetPooledSocketHits(&nhit, &nmiss)) {
+                        snprintf(pool_hits, sizeof(pool_hits), "%" PRId64 "/%" PRId64,
+                                 nhit, nmiss);
+                    }
                     // Check preferred_index of any pooled sockets.
                     ptr->ListPooledSockets(&first_id, 1);
                     if (!first_id.empty()) {
@@ -277,7 +287,8 @@ namespace melon {
                         os << min_width("-", 5) << bar;
                     }
                     os << min_width(ptr->recent_error_count(), 10) << bar
-                       << min_width(ptr->isolated_times(), 7) << bar;
+                       << min_width(ptr->isolated_times(), 7) << bar
+                       << min_width(pool_hits, 15) << bar;
                 }
                 os << SSLStateToYesNo(ptr->ssl_state(), use_html) << bar;
                 char protname[32];
@@ -24,9 +24,11 @@
 #include <melon/rpc/controller.h>           // Controller
 #include <melon/builtin/common.h>
 #include <melon/builtin/fibers_service.h>
+#include <melon/fiber/config.h>             // FLAGS_show_fiber_sched_latency_in_vars
 
 namespace fiber {
     void print_task(std::ostream &os, fiber_t tid);
+    void print_sched_latency(std::ostream &os);
 }
 
 
@@ -44,6 +46,10 @@ namespace melon {
 
         if (constraint.empty()) {
             os << "Use /fibers/<fiber_session>";
+            if (::fiber::FLAGS_show_fiber_sched_latency_in_vars) {
+                os << "\n\n";
+                ::fiber::print_sched_latency(os);
+            }
         } else {
             char *endptr = NULL;
             fiber_t tid = strtoull(constraint.c_str(), &endptr, 10);
@@ -19,6 +19,7 @@
 
 
 #include <melon/utility/time.h>
+#include <melon/utility/iobuf_block_pool.h>     // describe_block_pool
 #include <turbo/log/logging.h>
 #include <melon/rpc/controller.h>           // Controller
 #include <melon/rpc/closure_guard.h>        // ClosureGuard
@@ -70,13 +71,21 @@ namespace melon {
         cntl->http_response().set_content_type("text/plain");
         mutil::IOBuf &resp = cntl->response_attachment();
 
-        if (IsTCMallocEnabled()) {
+        if (mutil::iobuf::block_pool_enabled()) {
             mutil::IOBufBuilder os;
-            get_tcmalloc_memory_info(resp);
-        } else {
+            mutil::iobuf::describe_block_pool(os);
+            os.move_to(resp);
+        }
+        if (IsTCMallocEnabled()) {
+            mutil::IOBuf tc_info;
+            get_tcmalloc_memory_info(tc_info);
+            resp.append(tc_info);
+        } else if (resp.empty()) {
             resp.append("tcmalloc is not enabled");
             cntl->http_response().set_status_code(HTTP_STATUS_FORBIDDEN);
             return;
+        } else {
+            resp.append("tcmalloc is not enabled\n");
         }
     }
 
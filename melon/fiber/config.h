@@ -68,9 +68,24 @@ namespace fiber {
     // TaskGroup will be grouped by number ntags default 1
     DECLARE_int32(task_group_ntags);
 
+    // Max microseconds idle workers spin for new tasks before parking,
+    // applied to all tags default 0(off)
+    DECLARE_int64(fiber_busy_poll_us);
+
     // When this flags is on, The time from fiber creation to first run will be recorded and shown in /vars default false
     DECLARE_bool(show_fiber_creation_in_vars);
 
+    // When this flag is on, time spent by fibers in runqueues and on cpu is
+    // recorded per tag and per entry function and shown in /vars default false
+    DECLARE_bool(show_fiber_sched_latency_in_vars);
+
+    // Order tasks of the global TimerThread with a hierarchical timing wheel
+    // instead of a heap default false
+    DECLARE_bool(fiber_timer_use_timing_wheel);
+
+    // Granularity of the timing wheel of the global TimerThread default 1(us)
+    DECLARE_int64(fiber_timer_wheel_tick_us);
+
     // Show per-worker usage in /vars/fiber_per_worker_usage_<tid> default false
     DECLARE_bool(show_per_worker_usage_in_vars);
 
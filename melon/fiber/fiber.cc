@@ -42,6 +42,11 @@ namespace fiber {
     DEFINE_int32(fiber_concurrency_by_tag, 0,
                  "Number of pthread workers of FLAGS_fiber_current_tag");
 
+    DEFINE_int64(fiber_busy_poll_us, 0,
+                 "Max microseconds idle workers spin for new tasks before parking,"
+                 " applied to all tags, 0 to disable. Use fiber_set_busy_poll_by_tag()"
+                 " to set it for a tag");
+
     static bool never_set_fiber_concurrency = true;
     static bool never_set_fiber_concurrency_by_tag = true;
 
@@ -72,6 +77,12 @@ namespace fiber {
             ::google::RegisterFlagValidator(&FLAGS_fiber_concurrency_by_tag,
                                             validate_fiber_concurrency_by_tag);
 
+    static bool validate_fiber_busy_poll_us(const char *, int64_t val);
+
+    const int ALLOW_UNUSED register_FLAGS_fiber_busy_poll_us =
+            ::google::RegisterFlagValidator(&FLAGS_fiber_busy_poll_us,
+                                            validate_fiber_busy_poll_us);
+
     MELON_CASSERT(sizeof(TaskControl *) == sizeof(mutil::atomic<TaskControl *>), atomic_size_match);
 
     pthread_mutex_t g_task_control_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -165,6 +176,20 @@ namespace fiber {
         return fiber_setconcurrency_by_tag(val, FLAGS_fiber_current_tag) == 0;
     }
 
+    static bool validate_fiber_busy_poll_us(const char *, int64_t val) {
+        if (val < 0) {
+            return false;
+        }
+        MELON_SCOPED_LOCK(g_task_control_mutex);
+        auto c = get_task_control();
+        if (c != NULL) {
+            for (int i = 0; i < FLAGS_task_group_ntags; ++i) {
+                c->set_busy_poll_us(val, i);
+            }
+        }
+        return true;
+    }
+
     __thread TaskGroup *tls_task_group_nosignal = NULL;
 
     MUTIL_FORCE_INLINE int
@@ -227,6 +252,14 @@ namespace fiber {
         }
     };
 
+    // Used by /fibers
+    void print_sched_latency(std::ostream &os) {
+        TaskControl *c = get_task_control();
+        if (c != NULL) {
+            c->print_sched_latency(os);
+        }
+    }
+
 }  // namespace fiber
 
 extern "C" {
@@ -413,6 +446,30 @@ int fiber_setconcurrency_by_tag(int num, fiber_tag_t tag) {
     return (num == tag_ngroup ? 0 : EPERM);
 }
 
+int fiber_set_busy_poll_by_tag(int64_t max_spin_us, fiber_tag_t tag) {
+    if (max_spin_us < 0 || tag < FIBER_TAG_DEFAULT ||
+        tag >= fiber::FLAGS_task_group_ntags) {
+        return EINVAL;
+    }
+    auto c = fiber::get_or_new_task_control();
+    if (c == NULL) {
+        return ENOMEM;
+    }
+    c->set_busy_poll_us(max_spin_us, tag);
+    return 0;
+}
+
+int64_t fiber_get_busy_poll_by_tag(fiber_tag_t tag) {
+    if (tag < FIBER_TAG_DEFAULT || tag >= fiber::FLAGS_task_group_ntags) {
+        return -1;
+    }
+    auto c = fiber::get_task_control();
+    if (c == NULL) {
+        return fiber::FLAGS_fiber_busy_poll_us;
+    }
+    return c->busy_poll_us(tag);
+}
+
 int fiber_about_to_quit() {
     fiber::TaskGroup *g = fiber::tls_task_group;
     if (g != NULL) {
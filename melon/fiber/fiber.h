@@ -151,6 +151,17 @@ extern int fiber_getconcurrency_by_tag(fiber_tag_t tag);
 // Set number of worker pthreads to `num' for specified tag
 extern int fiber_setconcurrency_by_tag(int num, fiber_tag_t tag);
 
+// Let idle workers of `tag' spin for at most `max_spin_us' microseconds
+// looking for new tasks before parking, which trades CPU for lower latency
+// of waking up workers. The actual spinning time adapts to recent hits.
+// 0 disables busy polling, which is the default unless -fiber_busy_poll_us
+// is set.
+// Returns 0 on success, error code otherwise.
+extern int fiber_set_busy_poll_by_tag(int64_t max_spin_us, fiber_tag_t tag);
+
+// Get max spinning microseconds of idle workers of `tag', -1 on invalid tag.
+extern int64_t fiber_get_busy_poll_by_tag(fiber_tag_t tag);
+
 // Yield processor to another fiber.
 // Notice that current implementation is not fair, which means that 
 // even if fiber_yield() is called, suspended threads may still starve.
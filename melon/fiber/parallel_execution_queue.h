@@ -0,0 +1,233 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+//
+
+
+#ifndef  MELON_FIBER_PARALLEL_EXECUTION_QUEUE_H_
+#define  MELON_FIBER_PARALLEL_EXECUTION_QUEUE_H_
+
+#include <vector>
+#include <melon/utility/atomicops.h>             // mutil::atomic
+#include <melon/utility/macros.h>                // DISALLOW_COPY_AND_ASSIGN
+#include <melon/utility/third_party/murmurhash3/murmurhash3.h>  // fmix64
+#include <melon/fiber/execution_queue.h>
+
+namespace fiber {
+
+// ParallelExecutionQueue runs tasks with N consumers. Tasks are dispatched to
+// N ExecutionQueues, so producers stay wait-free as ExecutionQueue and each
+// consumer is still auto started and auto quits.
+//
+// - Tasks executed with the same key are executed by the same consumer in
+//   the FIFO order, tasks with different keys run in parallel.
+// - Tasks executed without a key are spread over consumers in round-robin
+//   and have no ordering guarantee.
+// - Each call to |execute| gets all tasks pending in the consumer as a batch,
+//   consumers may call |execute| concurrently with the same |meta|.
+// - |execute| is called with TaskIterator::is_queue_stopped() being true
+//   exactly once after tasks of all consumers have been executed.
+//
+// Example:
+//   fiber::ParallelExecutionQueue<Task> q;
+//   fiber::ParallelExecutionQueueOptions options;
+//   options.num_consumers = 8;
+//   q.start(&options, apply_tasks, meta);
+//   q.execute(region_id, task);   // ordered in the same region
+//   ...
+//   q.stop();
+//   q.join();
+
+struct ParallelExecutionQueueOptions : public ExecutionQueueOptions {
+    ParallelExecutionQueueOptions();
+
+    // Number of consumers, fiber_getconcurrency() if non-positive.
+    // default: 0
+    int num_consumers;
+};
+
+template <typename T>
+class ParallelExecutionQueue {
+DISALLOW_COPY_AND_ASSIGN(ParallelExecutionQueue);
+public:
+    typedef int (*execute_func_t)(void* meta, TaskIterator<T>& iter);
+
+    ParallelExecutionQueue();
+    ~ParallelExecutionQueue();
+
+    // Start consumers. If |options| is NULL, the queue will be created with
+    // the default options.
+    // Returns 0 on success, errno otherwise.
+    int start(const ParallelExecutionQueueOptions* options,
+              execute_func_t execute, void* meta);
+
+    // Stop all consumers, following calls to |execute| fail.
+    // Returns 0 on success, errno otherwise.
+    int stop();
+
+    // Wait until the stop task has been executed by all consumers.
+    // Returns 0 on success, errno otherwise.
+    int join();
+
+    // Thread-safe and Wait-free.
+    // Execute a task on any consumer.
+    int execute(typename mutil::add_const_reference<T>::type task) {
+        return execute(task, NULL, NULL);
+    }
+    int execute(typename mutil::add_const_reference<T>::type task,
+                const TaskOptions* options, TaskHandle* handle) {
+        return execute_on(next_consumer(), task, options, handle);
+    }
+
+    // Thread-safe and Wait-free.
+    // Execute a task after all the tasks executed before with the same |key|.
+    int execute_by_key(uint64_t key,
+                       typename mutil::add_const_reference<T>::type task) {
+        return execute_by_key(key, task, NULL, NULL);
+    }
+    int execute_by_key(uint64_t key,
+                       typename mutil::add_const_reference<T>::type task,
+                       const TaskOptions* options, TaskHandle* handle) {
+        // Mix the key so that keys sharing low bits, e.g. multiples of the
+        // number of consumers, do not pile up in one consumer.
+        return execute_on(mutil::fmix64(key), task, options, handle);
+    }
+
+    // Number of consumers, 0 before start().
+    size_t num_consumers() const { return _queues.size(); }
+
+private:
+    size_t next_consumer() {
+        return _next.fetch_add(1, mutil::memory_order_relaxed);
+    }
+
+    // Execute |task| on the consumer at |n| % num_consumers().
+    int execute_on(uint64_t n,
+                   typename mutil::add_const_reference<T>::type task,
+                   const TaskOptions* options, TaskHandle* handle) {
+        if (_queues.empty()) {
+            return EINVAL;
+        }
+        return execution_queue_execute(_queues[n % _queues.size()], task,
+                                       options, handle);
+    }
+
+    // Hides stop tasks of consumers except the last one from user.
+    static int execute_tasks(void* arg, TaskIterator<T>& iter);
+
+    execute_func_t _execute;
+    void* _meta;
+    std::vector<ExecutionQueueId<T> > _queues;
+    mutil::atomic<size_t> _next;
+    mutil::atomic<int> _nrunning;
+};
+
+// ---------------------- Implementation -------------------------
+
+inline ParallelExecutionQueueOptions::ParallelExecutionQueueOptions()
+    : num_consumers(0)
+{}
+
+template <typename T>
+ParallelExecutionQueue<T>::ParallelExecutionQueue()
+    : _execute(NULL)
+    , _meta(NULL)
+    , _next(0)
+    , _nrunning(0)
+{}
+
+template <typename T>
+ParallelExecutionQueue<T>::~ParallelExecutionQueue() {
+    stop();
+    join();
+}
+
+template <typename T>
+int ParallelExecutionQueue<T>::start(const ParallelExecutionQueueOptions* options,
+                                     execute_func_t execute, void* meta) {
+    if (!_queues.empty()) {
+        LOG(ERROR) << "Already started";
+        return EINVAL;
+    }
+    if (execute == NULL) {
+        return EINVAL;
+    }
+    ParallelExecutionQueueOptions opt;
+    if (options) {
+        opt = *options;
+    }
+    int n = opt.num_consumers;
+    if (n <= 0) {
+        n = fiber_getconcurrency();
+    }
+    _execute = execute;
+    _meta = meta;
+    _nrunning.store(n, mutil::memory_order_relaxed);
+    _queues.reserve(n);
+    for (int i = 0; i < n; ++i) {
+        ExecutionQueueId<T> id;
+        const int rc = execution_queue_start(&id, &opt, execute_tasks, this);
+        if (rc != 0) {
+            // None of the started consumers passes its stop task to user.
+            _nrunning.store(i + 1, mutil::memory_order_relaxed);
+            stop();
+            join();
+            _queues.clear();
+            return rc;
+        }
+        _queues.push_back(id);
+    }
+    return 0;
+}
+
+template <typename T>
+int ParallelExecutionQueue<T>::stop() {
+    int ret = 0;
+    for (size_t i = 0; i < _queues.size(); ++i) {
+        const int rc = execution_queue_stop(_queues[i]);
+        if (rc != 0 && ret == 0) {
+            ret = rc;
+        }
+    }
+    return ret;
+}
+
+template <typename T>
+int ParallelExecutionQueue<T>::join() {
+    int ret = 0;
+    for (size_t i = 0; i < _queues.size(); ++i) {
+        const int rc = execution_queue_join(_queues[i]);
+        if (rc != 0 && ret == 0) {
+            ret = rc;
+        }
+    }
+    return ret;
+}
+
+template <typename T>
+int ParallelExecutionQueue<T>::execute_tasks(void* arg, TaskIterator<T>& iter) {
+    ParallelExecutionQueue* q = static_cast<ParallelExecutionQueue*>(arg);
+    if (iter.is_queue_stopped() &&
+        q->_nrunning.fetch_sub(1, mutil::memory_order_acq_rel) != 1) {
+        return 0;
+    }
+    return q->_execute(q->_meta, iter);
+}
+
+}  // namespace fiber
+
+#endif  // MELON_FIBER_PARALLEL_EXECUTION_QUEUE_H_
@@ -23,12 +23,14 @@
 #include <turbo/log/logging.h>
 #include <melon/utility/threading/platform_thread.h>
 #include <melon/utility/third_party/murmurhash3/murmurhash3.h>
+#include <melon/utility/third_party/symbolize/symbolize.h>  // Symbolize
 #include <melon/fiber/sys_futex.h>            // futex_wake_private
 #include <melon/fiber/interrupt_pthread.h>
 #include <melon/fiber/processor.h>            // cpu_relax
 #include <melon/fiber/task_group.h>           // TaskGroup
 #include <melon/fiber/task_control.h>
 #include <melon/fiber/timer_thread.h>         // global_timer_thread
+#include <melon/fiber/config.h>               // FLAGS_fiber_busy_poll_us
 #include <gflags/gflags.h>
 #include <melon/fiber/log.h>
 
@@ -146,6 +148,23 @@ namespace fiber {
         return c->get_cumulated_worker_time_with_tag(t);
     }
 
+    static double get_cumulated_busy_poll_time_from_this_with_tag(void *arg) {
+        auto a = static_cast<CumulatedWithTagArgs *>(arg);
+        return a->c->get_cumulated_busy_poll_time_with_tag(a->t);
+    }
+
+    struct BusyPollHitRatioArgs {
+        melon::var::Adder<int64_t> *hit;
+        melon::var::Adder<int64_t> *miss;
+    };
+
+    static double get_busy_poll_hit_ratio(void *arg) {
+        auto a = static_cast<BusyPollHitRatioArgs *>(arg);
+        const int64_t hit = a->hit->get_value();
+        const int64_t total = hit + a->miss->get_value();
+        return total > 0 ? (double) hit / total : 0;
+    }
+
     static int64_t get_cumulated_switch_count_from_this(void *arg) {
         return static_cast<TaskControl *>(arg)->get_cumulated_switch_count();
     }
@@ -156,7 +175,9 @@ namespace fiber {
 
     TaskControl::TaskControl()
     // NOTE: all fileds must be initialized before the vars.
-            : _tagged_ngroup(FLAGS_task_group_ntags), _tagged_groups(FLAGS_task_group_ntags), _init(false),
+            : _tagged_ngroup(FLAGS_task_group_ntags), _tagged_busy_poll_us(FLAGS_task_group_ntags),
+              _tagged_nbusy_polling(FLAGS_task_group_ntags), _tagged_sched_latency(FLAGS_task_group_ntags),
+              _tagged_groups(FLAGS_task_group_ntags), _init(false),
               _stop(false), _concurrency(0), _next_worker_id(0), _nworkers("fiber_worker_count"), _pending_time(NULL)
             // Delay exposure of following two vars because they rely on TC which
             // is not initialized yet.
@@ -189,6 +210,18 @@ namespace fiber {
             _tagged_worker_usage_second.push_back(new melon::var::PerSecond<melon::var::PassiveStatus<double>>(
                     "fiber_worker_usage", tag_str, _tagged_cumulated_worker_time[i], 1));
             _tagged_nfibers.push_back(new melon::var::Adder<int64_t>("fiber_count", tag_str));
+            _tagged_busy_poll_us[i].store(FLAGS_fiber_busy_poll_us, mutil::memory_order_relaxed);
+            _tagged_nbusy_polling[i].store(0, mutil::memory_order_relaxed);
+            _tagged_sched_latency[i].store(NULL, mutil::memory_order_relaxed);
+            _tagged_busy_poll_hit.push_back(new melon::var::Adder<int64_t>("fiber_busy_poll_hit", tag_str));
+            _tagged_busy_poll_miss.push_back(new melon::var::Adder<int64_t>("fiber_busy_poll_miss", tag_str));
+            _tagged_busy_poll_hit_ratio.push_back(new melon::var::PassiveStatus<double>(
+                    "fiber_busy_poll_hit_ratio", tag_str, get_busy_poll_hit_ratio,
+                    new BusyPollHitRatioArgs{_tagged_busy_poll_hit[i], _tagged_busy_poll_miss[i]}));
+            _tagged_cumulated_busy_poll_time.push_back(new melon::var::PassiveStatus<double>(
+                    get_cumulated_busy_poll_time_from_this_with_tag, new CumulatedWithTagArgs{this, i}));
+            _tagged_busy_poll_usage.push_back(new melon::var::PerSecond<melon::var::PassiveStatus<double>>(
+                    "fiber_busy_poll_usage", tag_str, _tagged_cumulated_busy_poll_time[i], 1));
         }
 
         // Make sure TimerThread is ready.
@@ -303,6 +336,12 @@ namespace fiber {
         // NOTE: g_task_control is not destructed now because the situation
         //       is extremely racy.
         delete _pending_time.exchange(NULL, mutil::memory_order_relaxed);
+        for (size_t i = 0; i < _tagged_sched_latency.size(); ++i) {
+            delete _tagged_sched_latency[i].exchange(NULL, mutil::memory_order_relaxed);
+        }
+        for (auto it = _fn_sched_latency.begin(); it != _fn_sched_latency.end(); ++it) {
+            delete it->second;
+        }
         _worker_usage_second.hide();
         _switch_per_second.hide();
         _signal_per_second.hide();
@@ -418,6 +457,56 @@ namespace fiber {
         return stolen;
     }
 
+    bool TaskControl::begin_busy_poll(fiber_tag_t tag) {
+        // Like the Go scheduler, at most half of the workers spin, more
+        // spinners burn CPU without reducing latency further.
+        const int max_spinning = std::max(tag_ngroup(tag).load(mutil::memory_order_relaxed) / 2,
+                                          (size_t) 1);
+        auto &n = _tagged_nbusy_polling[tag];
+        int cur = n.load(mutil::memory_order_relaxed);
+        do {
+            if (cur >= max_spinning) {
+                return false;
+            }
+        } while (!n.compare_exchange_weak(cur, cur + 1, mutil::memory_order_relaxed));
+        return true;
+    }
+
+    void TaskControl::end_busy_poll(fiber_tag_t tag) {
+        auto &n = _tagged_nbusy_polling[tag];
+        int cur = n.load(mutil::memory_order_relaxed);
+        // If all spinning workers were claimed, the caller takes over one of
+        // the claims by checking runqueues again after this function.
+        while (cur > 0 && !n.compare_exchange_weak(cur, cur - 1, mutil::memory_order_relaxed)) {}
+        // Pairs with the fence in claim_busy_polling_worker(), tasks pushed
+        // before a claim are visible to the following steal_task().
+        mutil::atomic_thread_fence(mutil::memory_order_seq_cst);
+    }
+
+    bool TaskControl::claim_busy_polling_worker(fiber_tag_t tag) {
+        if (busy_poll_us(tag) <= 0) {
+            return false;
+        }
+        // Make the pushed task visible to the worker we're going to claim.
+        mutil::atomic_thread_fence(mutil::memory_order_seq_cst);
+        auto &n = _tagged_nbusy_polling[tag];
+        int cur = n.load(mutil::memory_order_relaxed);
+        while (cur > 0) {
+            if (n.compare_exchange_weak(cur, cur - 1, mutil::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void TaskControl::add_busy_poll_result(bool hit, fiber_tag_t tag) {
+        if (hit) {
+            *_tagged_busy_poll_hit[tag] << 1;
+        } else {
+            *_tagged_busy_poll_miss[tag] << 1;
+        }
+    }
+
     void TaskControl::signal_task(int num_task, fiber_tag_t tag) {
         if (num_task <= 0) {
             return;
@@ -429,6 +518,11 @@ namespace fiber {
         if (num_task > 2) {
             num_task = 2;
         }
+        // A spinning worker picks up the task without being woken up, saving
+        // a futex wake and a context switch.
+        if (claim_busy_polling_worker(tag) && --num_task == 0) {
+            return;
+        }
         auto &pl = tag_pl(tag);
         int start_index = mutil::fmix64(pthread_numeric_id()) % PARKING_LOT_NUM;
         num_task -= pl[start_index].signal(1);
@@ -496,6 +590,19 @@ namespace fiber {
         return cputime_ns / 1000000000.0;
     }
 
+    double TaskControl::get_cumulated_busy_poll_time_with_tag(fiber_tag_t tag) {
+        int64_t busy_poll_ns = 0;
+        MELON_SCOPED_LOCK(_modify_group_mutex);
+        const size_t ngroup = tag_ngroup(tag).load(mutil::memory_order_relaxed);
+        auto &groups = tag_group(tag);
+        for (size_t i = 0; i < ngroup; ++i) {
+            if (groups[i]) {
+                busy_poll_ns += groups[i]->cumulated_busy_poll_ns();
+            }
+        }
+        return busy_poll_ns / 1000000000.0;
+    }
+
     int64_t TaskControl::get_cumulated_switch_count() {
         int64_t c = 0;
         MELON_SCOPED_LOCK(_modify_group_mutex);
@@ -534,4 +641,80 @@ namespace fiber {
         return pt;
     }
 
+    SchedLatencyRecorder *TaskControl::create_tag_sched_latency(fiber_tag_t tag) {
+        MELON_SCOPED_LOCK(_sched_latency_mutex);
+        SchedLatencyRecorder *r = _tagged_sched_latency[tag].load(mutil::memory_order_consume);
+        if (!r) {
+            r = new SchedLatencyRecorder;
+            const std::string tag_str = std::to_string(tag);
+            r->rq_wait.expose("fiber_rq_wait", tag_str);
+            r->oncpu.expose("fiber_oncpu", tag_str);
+            _tagged_sched_latency[tag].store(r, mutil::memory_order_release);
+        }
+        return r;
+    }
+
+    // Max number of entry functions having their own recorders, to bound
+    // the number of exposed vars.
+    static const size_t MAX_FN_SCHED_LATENCY = 128;
+
+    // Name of `fn' without arguments, or its address if there's no symbol.
+    static std::string entry_fn_name(void *fn) {
+        char buf[512];
+        if (google::Symbolize(fn, buf, sizeof(buf))) {
+            mutil::StringPiece name(buf);
+            name.remove_prefix(name.starts_with("(anonymous namespace)::") ? 23 : 0);
+            const size_t pos = name.find('(');
+            if (pos != mutil::StringPiece::npos) {
+                name.remove_suffix(name.size() - pos);
+            }
+            return name.as_string();
+        }
+        snprintf(buf, sizeof(buf), "%p", fn);
+        return buf;
+    }
+
+    SchedLatencyRecorder *TaskControl::fn_sched_latency(void *(*fn)(void *)) {
+        MELON_SCOPED_LOCK(_sched_latency_mutex);
+        auto it = _fn_sched_latency.find((void *) fn);
+        if (it != _fn_sched_latency.end()) {
+            return it->second;
+        }
+        if (_fn_sched_latency.size() >= MAX_FN_SCHED_LATENCY) {
+            return NULL;
+        }
+        SchedLatencyRecorder *r = new SchedLatencyRecorder;
+        const std::string prefix = "fiber_fn_" + entry_fn_name((void *) fn);
+        r->rq_wait.expose(prefix, "rq_wait");
+        r->oncpu.expose(prefix, "oncpu");
+        _fn_sched_latency[(void *) fn] = r;
+        return r;
+    }
+
+    static void print_sched_latency_recorder(std::ostream &os, const SchedLatencyRecorder &r) {
+        os << " rq_wait(us): count=" << r.rq_wait.count()
+           << " avg=" << r.rq_wait.latency()
+           << " p99=" << r.rq_wait.latency_percentile(0.99)
+           << " max=" << r.rq_wait.max_latency()
+           << " | oncpu(us): count=" << r.oncpu.count()
+           << " avg=" << r.oncpu.latency()
+           << " p99=" << r.oncpu.latency_percentile(0.99)
+           << " max=" << r.oncpu.max_latency() << '\n';
+    }
+
+    void TaskControl::print_sched_latency(std::ostream &os) {
+        MELON_SCOPED_LOCK(_sched_latency_mutex);
+        for (size_t i = 0; i < _tagged_sched_latency.size(); ++i) {
+            SchedLatencyRecorder *r = _tagged_sched_latency[i].load(mutil::memory_order_consume);
+            if (r) {
+                os << "tag=" << i;
+                print_sched_latency_recorder(os, *r);
+            }
+        }
+        for (auto it = _fn_sched_latency.begin(); it != _fn_sched_latency.end(); ++it) {
+            os << "fn=" << entry_fn_name(it->first);
+            print_sched_latency_recorder(os, *it->second);
+        }
+    }
+
 }  // namespace fiber
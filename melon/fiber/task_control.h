@@ -28,6 +28,8 @@
 #endif
 
 #include <stddef.h>                             // size_t
+#include <map>
+#include <ostream>
 #include <vector>
 #include <array>
 #include <memory>
@@ -42,6 +44,15 @@ namespace fiber {
 
     class TaskGroup;
 
+    // Scheduling latencies of fibers in microseconds, recorded when
+    // -show_fiber_sched_latency_in_vars is on.
+    struct SchedLatencyRecorder {
+        // Time from being pushed into a runqueue to running.
+        melon::var::LatencyRecorder rq_wait;
+        // Cputime of a fiber in its whole life.
+        melon::var::LatencyRecorder oncpu;
+    };
+
     // Control all task groups
     class TaskControl {
         friend class TaskGroup;
@@ -89,6 +100,21 @@ namespace fiber {
         // If this method is called after init(), it never returns NULL.
         TaskGroup *choose_one_group(fiber_tag_t tag = FIBER_TAG_DEFAULT);
 
+        // Max microseconds that idle workers of `tag' spin for new tasks
+        // before parking, 0 means busy polling is off.
+        int64_t busy_poll_us(fiber_tag_t tag) const {
+            return _tagged_busy_poll_us[tag].load(mutil::memory_order_relaxed);
+        }
+
+        void set_busy_poll_us(int64_t us, fiber_tag_t tag) {
+            _tagged_busy_poll_us[tag].store(us, mutil::memory_order_relaxed);
+        }
+
+        double get_cumulated_busy_poll_time_with_tag(fiber_tag_t tag);
+
+        // Print recorded scheduling latencies of all tags and entry functions.
+        void print_sched_latency(std::ostream &os);
+
     private:
         typedef std::array<TaskGroup *, FIBER_MAX_CONCURRENCY> TaggedGroups;
         static const int PARKING_LOT_NUM = 4;
@@ -111,6 +137,18 @@ namespace fiber {
 
         static void delete_task_group(void *arg);
 
+        // Called by TaskGroup::busy_poll() around spinning. begin_busy_poll()
+        // returns false if enough workers of `tag' are spinning already.
+        bool begin_busy_poll(fiber_tag_t tag);
+
+        void end_busy_poll(fiber_tag_t tag);
+
+        void add_busy_poll_result(bool hit, fiber_tag_t tag);
+
+        // Let a spinning worker of `tag' take a new task instead of waking
+        // up a parked one. Returns true if such worker was claimed.
+        bool claim_busy_polling_worker(fiber_tag_t tag);
+
         static void *worker_thread(void *task_control);
 
         template<typename F>
@@ -120,11 +158,24 @@ namespace fiber {
 
         melon::var::LatencyRecorder *create_exposed_pending_time();
 
+        // Recorders of fibers in `tag', created and exposed on first call.
+        SchedLatencyRecorder *tag_sched_latency(fiber_tag_t tag);
+
+        SchedLatencyRecorder *create_tag_sched_latency(fiber_tag_t tag);
+
+        // Recorders of fibers running `fn', created and exposed on first call.
+        // Returns NULL when too many entry functions were recorded.
+        SchedLatencyRecorder *fn_sched_latency(void *(*fn)(void *));
+
         melon::var::Adder<int64_t> &tag_nworkers(fiber_tag_t tag);
 
         melon::var::Adder<int64_t> &tag_nfibers(fiber_tag_t tag);
 
         std::vector<mutil::atomic<size_t>> _tagged_ngroup;
+        std::vector<mutil::atomic<int64_t>> _tagged_busy_poll_us;
+        // Number of spinning workers which were not claimed by signal_task().
+        std::vector<mutil::atomic<int>> _tagged_nbusy_polling;
+        std::vector<mutil::atomic<SchedLatencyRecorder *>> _tagged_sched_latency;
         std::vector<TaggedGroups> _tagged_groups;
         mutil::Mutex _modify_group_mutex;
 
@@ -137,6 +188,8 @@ namespace fiber {
         melon::var::Adder<int64_t> _nworkers;
         mutil::Mutex _pending_time_mutex;
         mutil::atomic<melon::var::LatencyRecorder *> _pending_time;
+        mutil::Mutex _sched_latency_mutex;
+        std::map<void *, SchedLatencyRecorder *> _fn_sched_latency;
         melon::var::PassiveStatus<double> _cumulated_worker_time;
         melon::var::PerSecond<melon::var::PassiveStatus<double> > _worker_usage_second;
         melon::var::PassiveStatus<int64_t> _cumulated_switch_count;
@@ -150,6 +203,11 @@ namespace fiber {
         std::vector<melon::var::PassiveStatus<double> *> _tagged_cumulated_worker_time;
         std::vector<melon::var::PerSecond<melon::var::PassiveStatus<double>> *> _tagged_worker_usage_second;
         std::vector<melon::var::Adder<int64_t> *> _tagged_nfibers;
+        std::vector<melon::var::Adder<int64_t> *> _tagged_busy_poll_hit;
+        std::vector<melon::var::Adder<int64_t> *> _tagged_busy_poll_miss;
+        std::vector<melon::var::PassiveStatus<double> *> _tagged_busy_poll_hit_ratio;
+        std::vector<melon::var::PassiveStatus<double> *> _tagged_cumulated_busy_poll_time;
+        std::vector<melon::var::PerSecond<melon::var::PassiveStatus<double>> *> _tagged_busy_poll_usage;
 
         std::vector<TaggedParkingLot> _pl;
     };
@@ -162,6 +220,14 @@ namespace fiber {
         return *pt;
     }
 
+    inline SchedLatencyRecorder *TaskControl::tag_sched_latency(fiber_tag_t tag) {
+        SchedLatencyRecorder *r = _tagged_sched_latency[tag].load(mutil::memory_order_consume);
+        if (!r) {
+            r = create_tag_sched_latency(tag);
+        }
+        return r;
+    }
+
     inline melon::var::Adder<int64_t> &TaskControl::tag_nworkers(fiber_tag_t tag) {
         return *_tagged_nworkers[tag];
     }
@@ -50,6 +50,13 @@ const bool ALLOW_UNUSED dummy_show_fiber_creation_in_vars =
     ::google::RegisterFlagValidator(&FLAGS_show_fiber_creation_in_vars,
                                     pass_bool);
 
+DEFINE_bool(show_fiber_sched_latency_in_vars, false, "When this flag is on, "
+            "time spent by fibers in runqueues and on cpu is recorded per tag "
+            "and per entry function and shown in /vars");
+const bool ALLOW_UNUSED dummy_show_fiber_sched_latency_in_vars =
+    ::google::RegisterFlagValidator(&FLAGS_show_fiber_sched_latency_in_vars,
+                                    pass_bool);
+
 DEFINE_bool(show_per_worker_usage_in_vars, false,
             "Show per-worker usage in /vars/fiber_per_worker_usage_<tid>");
 const bool ALLOW_UNUSED dummy_show_per_worker_usage_in_vars =
@@ -69,7 +76,7 @@ extern void return_keytable(fiber_keytable_pool_t*, KeyTable*);
 // overhead of creation keytable, may be removed later.
 MELON_VOLATILE_THREAD_LOCAL(void*, tls_unique_user_ptr, NULL);
 
-const TaskStatistics EMPTY_STAT = { 0, 0 };
+const TaskStatistics EMPTY_STAT = { 0, 0, 0 };
 
 const size_t OFFSET_TABLE[] = {
 #include "melon/fiber/offset_inl.list"
@@ -120,7 +127,13 @@ bool TaskGroup::wait_task(fiber_t* tid) {
         if (_last_pl_state.stopped()) {
             return false;
         }
-        _pl->wait(_last_pl_state);
+        if (busy_poll(tid)) {
+            return true;
+        }
+        // busy_poll() refreshes _last_pl_state, don't wait on a stopped one.
+        if (!_last_pl_state.stopped()) {
+            _pl->wait(_last_pl_state);
+        }
         if (steal_task(tid)) {
             return true;
         }
@@ -132,11 +145,58 @@ bool TaskGroup::wait_task(fiber_t* tid) {
         if (steal_task(tid)) {
             return true;
         }
+        if (busy_poll(tid)) {
+            return true;
+        }
         _pl->wait(st);
 #endif
     } while (true);
 }
 
+bool TaskGroup::busy_poll(fiber_t* tid) {
+    const int64_t max_ns = _control->busy_poll_us(_tag) * 1000L;
+    if (max_ns <= 0) {
+        return false;
+    }
+    // Spin at least 1/32 of the max time so that a group that missed many
+    // times still gets the chance to grow its budget again.
+    const int64_t min_ns = std::max(max_ns / 32, (int64_t)1000);
+    if (_busy_poll_budget_ns < min_ns || _busy_poll_budget_ns > max_ns) {
+        _busy_poll_budget_ns = max_ns;
+    }
+    if (!_control->begin_busy_poll(_tag)) {
+        return false;
+    }
+    const int64_t begin_ns = mutil::cpuwide_time_ns();
+    const int64_t deadline_ns = begin_ns + _busy_poll_budget_ns;
+    bool found = false;
+    int64_t now_ns = begin_ns;
+    do {
+        for (int i = 0; i < 32; ++i) {
+            cpu_relax();
+        }
+        if (_pl->get_state().stopped()) {
+            break;
+        }
+        found = steal_task(tid);
+        now_ns = mutil::cpuwide_time_ns();
+    } while (!found && now_ns < deadline_ns);
+    _control->end_busy_poll(_tag);
+    if (!found) {
+        // signal_task() may skip waking up workers after seeing us spinning,
+        // check again after we stopped spinning.
+        found = steal_task(tid);
+    }
+    _cumulated_busy_poll_ns += now_ns - begin_ns;
+    if (found) {
+        _busy_poll_budget_ns = std::min(_busy_poll_budget_ns * 2, max_ns);
+    } else {
+        _busy_poll_budget_ns = std::max(_busy_poll_budget_ns / 2, min_ns);
+    }
+    _control->add_busy_poll_result(found, _tag);
+    return found;
+}
+
 static double get_cumulated_cputime_from_this(void* arg) {
     return static_cast<TaskGroup*>(arg)->cumulated_cputime_ns() / 1000000000.0;
 }
@@ -180,6 +240,8 @@ TaskGroup::TaskGroup(TaskControl* c)
     , _nsignaled(0)
     , _last_run_ns(mutil::cpuwide_time_ns())
     , _cumulated_cputime_ns(0)
+    , _cumulated_busy_poll_ns(0)
+    , _busy_poll_budget_ns(0)
     , _nswitch(0)
     , _last_context_remained(NULL)
     , _last_context_remained_arg(NULL)
@@ -236,6 +298,8 @@ int TaskGroup::init(size_t runqueue_capacity) {
     m->local_storage = LOCAL_STORAGE_INIT;
     m->cpuwide_start_ns = mutil::cpuwide_time_ns();
     m->stat = EMPTY_STAT;
+    m->ready_ns = 0;
+    m->fn_sched_latency = NULL;
     m->attr = FIBER_ATTR_TASKGROUP;
     m->tid = make_tid(*m->version_butex, slot);
     m->set_stack(stk);
@@ -299,6 +363,10 @@ void TaskGroup::task_runner(intptr_t skip_remained) {
         // Group is probably changed
         g =  MELON_GET_VOLATILE_THREAD_LOCAL(tls_task_group);
 
+        if (FLAGS_show_fiber_sched_latency_in_vars) {
+            g->record_oncpu(m);
+        }
+
         // TODO: Save thread_return
         (void)thread_return;
 
@@ -384,6 +452,8 @@ int TaskGroup::start_foreground(TaskGroup** pg,
     }
     m->cpuwide_start_ns = start_ns;
     m->stat = EMPTY_STAT;
+    m->ready_ns = 0;
+    m->fn_sched_latency = NULL;
     m->tid = make_tid(*m->version_butex, slot);
     *th = m->tid;
     if (using_attr.flags & FIBER_LOG_START_AND_FINISH) {
@@ -443,6 +513,8 @@ int TaskGroup::start_background(fiber_t* __restrict th,
     }
     m->cpuwide_start_ns = start_ns;
     m->stat = EMPTY_STAT;
+    m->ready_ns = 0;
+    m->fn_sched_latency = NULL;
     m->tid = make_tid(*m->version_butex, slot);
     *th = m->tid;
     if (using_attr.flags & FIBER_LOG_START_AND_FINISH) {
@@ -591,6 +663,12 @@ void TaskGroup::sched_to(TaskGroup** pg, TaskMeta* next_meta) {
     }
     ++cur_meta->stat.nswitch;
     ++ g->_nswitch;
+    if (next_meta->ready_ns) {
+        if (FLAGS_show_fiber_sched_latency_in_vars) {
+            g->record_rq_wait(next_meta, now);
+        }
+        next_meta->ready_ns = 0;
+    }
     // Switch to the task
     if (__builtin_expect(next_meta != cur_meta, 1)) {
         g->_cur_meta = next_meta;
@@ -643,6 +721,41 @@ void TaskGroup::sched_to(TaskGroup** pg, TaskMeta* next_meta) {
     *pg = g;
 }
 
+SchedLatencyRecorder* TaskGroup::fn_sched_latency(TaskMeta* m) {
+    if (m->fn_sched_latency == NULL && m->fn != NULL) {
+        void* const key = (void*)m->fn;
+        auto it = _fn_sched_latency_cache.find(key);
+        if (it != _fn_sched_latency_cache.end()) {
+            m->fn_sched_latency = it->second;
+        } else {
+            m->fn_sched_latency = _control->fn_sched_latency(m->fn);
+            _fn_sched_latency_cache[key] = m->fn_sched_latency;
+        }
+    }
+    return m->fn_sched_latency;
+}
+
+void TaskGroup::record_rq_wait(TaskMeta* m, int64_t now_ns) {
+    const int64_t wait_ns = now_ns - m->ready_ns;
+    m->stat.rq_wait_ns += wait_ns;
+    _control->tag_sched_latency(_tag)->rq_wait << wait_ns / 1000L;
+    SchedLatencyRecorder* r = fn_sched_latency(m);
+    if (r) {
+        r->rq_wait << wait_ns / 1000L;
+    }
+}
+
+void TaskGroup::record_oncpu(TaskMeta* m) {
+    // Time slice of the ending run is not added to stat.cputime_ns yet.
+    const int64_t cputime_us =
+        (m->stat.cputime_ns + mutil::cpuwide_time_ns() - _last_run_ns) / 1000L;
+    _control->tag_sched_latency(_tag)->oncpu << cputime_us;
+    SchedLatencyRecorder* r = fn_sched_latency(m);
+    if (r) {
+        r->oncpu << cputime_us;
+    }
+}
+
 void TaskGroup::destroy_self() {
     if (_control) {
         _control->_destroy_group(this);
@@ -674,6 +787,7 @@ void TaskGroup::flush_nosignal_tasks() {
 }
 
 void TaskGroup::ready_to_run_remote(fiber_t tid, bool nosignal) {
+    mark_ready(tid);
     _remote_rq._mutex.lock();
     while (!_remote_rq.push_locked(tid)) {
         flush_nosignal_tasks_remote_locked(_remote_rq._mutex);
@@ -920,7 +1034,7 @@ void print_task(std::ostream& os, fiber_t tid) {
     fiber_attr_t attr = FIBER_ATTR_NORMAL;
     bool has_tls = false;
     int64_t cpuwide_start_ns = 0;
-    TaskStatistics stat = {0, 0};
+    TaskStatistics stat = {0, 0, 0};
     {
         MELON_SCOPED_LOCK(m->version_lock);
         if (given_ver == *m->version_butex) {
@@ -950,7 +1064,8 @@ void print_task(std::ostream& os, fiber_t tid) {
            << "}\nhas_tls=" << has_tls
            << "\nuptime_ns=" << mutil::cpuwide_time_ns() - cpuwide_start_ns
            << "\ncputime_ns=" << stat.cputime_ns
-           << "\nnswitch=" << stat.nswitch;
+           << "\nnswitch=" << stat.nswitch
+           << "\nrq_wait_ns=" << stat.rq_wait_ns;
     }
 }
 
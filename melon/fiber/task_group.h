@@ -21,7 +21,9 @@
 #ifndef MELON_FIBER_TASK_GROUP_H_
 #define MELON_FIBER_TASK_GROUP_H_
 
+#include <unordered_map>
 #include <melon/utility/time.h>                             // cpuwide_time_ns
+#include <melon/fiber/config.h>                        // FLAGS_show_fiber_sched_latency_in_vars
 #include <melon/fiber/task_control.h>
 #include <melon/fiber/task_meta.h>                     // fiber_t, TaskMeta
 #include <melon/fiber/work_stealing_queue.h>           // WorkStealingQueue
@@ -149,6 +151,9 @@ public:
     // Active time in nanoseconds spent by this TaskGroup.
     int64_t cumulated_cputime_ns() const { return _cumulated_cputime_ns; }
 
+    // Time in nanoseconds spent by this TaskGroup on busy polling.
+    int64_t cumulated_busy_poll_ns() const { return _cumulated_busy_poll_ns; }
+
     // Push a fiber into the runqueue
     void ready_to_run(fiber_t tid, bool nosignal = false);
     // Flush tasks pushed to rq but signalled.
@@ -212,6 +217,10 @@ friend class TaskControl;
     // loop calling this function should end.
     bool wait_task(fiber_t* tid);
 
+    // Spin for a while looking for tasks before parking, if busy polling
+    // is enabled for the tag of this group. Returns true if a task was found.
+    bool busy_poll(fiber_t* tid);
+
     bool steal_task(fiber_t* tid) {
         if (_remote_rq.pop(tid)) {
             return true;
@@ -224,6 +233,19 @@ friend class TaskControl;
 
     void set_tag(fiber_tag_t tag) { _tag = tag; }
 
+    // Set TaskMeta.ready_ns of `tid' before it's pushed into a runqueue.
+    static void mark_ready(fiber_t tid);
+
+    // Record time spent by `m' in the runqueue until `now_ns'.
+    void record_rq_wait(TaskMeta* m, int64_t now_ns);
+
+    // Record cputime of `m' which is about to quit.
+    void record_oncpu(TaskMeta* m);
+
+    // Latency recorders of the entry function of `m', NULL if too many
+    // entry functions were recorded.
+    SchedLatencyRecorder* fn_sched_latency(TaskMeta* m);
+
     void set_pl(ParkingLot* pl) { _pl = pl; }
 
     TaskMeta* _cur_meta;
@@ -235,6 +257,10 @@ friend class TaskControl;
     // last scheduling time
     int64_t _last_run_ns;
     int64_t _cumulated_cputime_ns;
+    int64_t _cumulated_busy_poll_ns;
+    // Adaptive spinning time of next busy polling, doubled on hit and
+    // halved on miss.
+    int64_t _busy_poll_budget_ns;
 
     size_t _nswitch;
     RemainedFn _last_context_remained;
@@ -254,6 +280,8 @@ friend class TaskControl;
     int _remote_nsignaled;
 
     int _sched_recursive_guard;
+    // Cache of TaskControl::fn_sched_latency() to avoid locking.
+    std::unordered_map<void*, SchedLatencyRecorder*> _fn_sched_latency_cache;
     // tag of this taskgroup
     fiber_tag_t _tag;
 };
@@ -77,7 +77,14 @@ inline void TaskGroup::sched_to(TaskGroup** pg, fiber_t next_tid) {
     sched_to(pg, next_meta);
 }
 
+inline void TaskGroup::mark_ready(fiber_t tid) {
+    if (FLAGS_show_fiber_sched_latency_in_vars) {
+        address_meta(tid)->ready_ns = mutil::cpuwide_time_ns();
+    }
+}
+
 inline void TaskGroup::push_rq(fiber_t tid) {
+    mark_ready(tid);
     while (!_rq.push(tid)) {
         // Created too many fibers: a promising approach is to insert the
         // task into another TaskGroup, but we don't use it because:
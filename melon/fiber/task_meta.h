@@ -32,10 +32,14 @@ namespace fiber {
 struct TaskStatistics {
     int64_t cputime_ns;
     int64_t nswitch;
+    // Time spent in runqueues, only counted when
+    // -show_fiber_sched_latency_in_vars is on.
+    int64_t rq_wait_ns;
 };
 
 class KeyTable;
 struct ButexWaiter;
+struct SchedLatencyRecorder;
 
 struct LocalStorage {
     KeyTable* keytable;
@@ -85,6 +89,12 @@ struct TaskMeta {
     int64_t cpuwide_start_ns;
     TaskStatistics stat;
 
+    // When the task was pushed into a runqueue, 0 if it's not in any
+    // runqueue or -show_fiber_sched_latency_in_vars is off.
+    int64_t ready_ns;
+    // Latency recorders of `fn', resolved at the first run.
+    SchedLatencyRecorder* fn_sched_latency;
+
     // fiber local storage, sync with tls_bls (defined in task_group.cpp)
     // when the fiber is created or destroyed.
     // DO NOT use this field directly, use tls_bls instead.
@@ -19,7 +19,9 @@
 
 
 
+#include <string.h>                        // memset
 #include <queue>                           // heap functions
+#include <gflags/gflags.h>
 #include <melon/utility/scoped_lock.h>
 #include <turbo/log/logging.h>
 #include <melon/utility/third_party/murmurhash3/murmurhash3.h>   // fmix64
@@ -32,13 +34,19 @@
 
 namespace fiber {
 
+    DEFINE_bool(fiber_timer_use_timing_wheel, false,
+                "Order tasks of the global TimerThread with a hierarchical "
+                "timing wheel instead of a heap");
+    DEFINE_int64(fiber_timer_wheel_tick_us, 1,
+                 "Granularity of the timing wheel of the global TimerThread");
+
     // Defined in task_control.cpp
     void run_worker_startfn();
 
     const TimerThread::TaskId TimerThread::INVALID_TASK_ID = 0;
 
     TimerThreadOptions::TimerThreadOptions()
-            : num_buckets(13) {
+            : num_buckets(13), use_timing_wheel(false), timing_wheel_tick_us(1) {
     }
 
     // A task contains the necessary information for running fn(arg).
@@ -97,6 +105,173 @@ namespace fiber {
         Task *_task_head;
     };
 
+    // Hierarchical timing wheel with 4 levels of 256 slots. Level l holds
+    // tasks whose ticks share all digits above l with the current tick, so
+    // a task is moved at most 3 times before it expires. Tasks too far away
+    // for the wheel are kept in an overflow list which is re-inserted every
+    // 2^32 ticks. Bitmaps of non-empty slots let the wheel jump over empty
+    // ticks instead of visiting each of them.
+    // Only accessed by the timer thread.
+    class TimerThread::Wheel {
+    public:
+        static const int NLEVEL = 4;
+        static const int SLOT_BITS = 8;
+        static const int NSLOT = 1 << SLOT_BITS;
+
+        Wheel(int64_t tick_us, int64_t now_us)
+                : _tick_us(tick_us), _cur(now_us / tick_us), _overflow(NULL) {
+            memset(_slots, 0, sizeof(_slots));
+            memset(_bitmap, 0, sizeof(_bitmap));
+        }
+
+        // Put the task into the wheel.
+        // Returns false if the task is already expired, in which case it's
+        // not added and should be run by the caller.
+        bool add(Task *task) {
+            const int64_t tick = tick_of(task);
+            if (tick < (int64_t) _cur) {
+                return false;
+            }
+            insert(task, (uint64_t) tick);
+            return true;
+        }
+
+        // Append all tasks expired at realtime `now_us' to `expired'.
+        void advance(int64_t now_us, std::vector<Task *> *expired) {
+            const uint64_t target = now_us / _tick_us;
+            while (_cur <= target) {
+                const uint64_t next = next_tick();
+                if (next > target) {
+                    set_cur(target + 1);
+                    break;
+                }
+                if (next > _cur) {
+                    set_cur(next);
+                }
+                const int idx = _cur & (NSLOT - 1);
+                Task *p = _slots[0][idx];
+                if (p) {
+                    _slots[0][idx] = NULL;
+                    _bitmap[0][idx / 64] &= ~(1UL << (idx % 64));
+                    while (p) {
+                        Task *next_task = p->next;
+                        expired->push_back(p);
+                        p = next_task;
+                    }
+                }
+                set_cur(_cur + 1);
+            }
+        }
+
+        // Realtime of the next tick that has something to do, which may be
+        // earlier than the earliest task since higher levels are cascaded
+        // at the beginning of their slots.
+        int64_t next_run_time() const {
+            const uint64_t tick = next_tick();
+            if (tick == std::numeric_limits<uint64_t>::max()) {
+                return std::numeric_limits<int64_t>::max();
+            }
+            return (int64_t) tick * _tick_us;
+        }
+
+    private:
+        // Round up so that tasks never run before their run_time.
+        int64_t tick_of(const Task *task) const {
+            return (task->run_time + _tick_us - 1) / _tick_us;
+        }
+
+        void insert(Task *task, uint64_t tick) {
+            for (int l = 0; l < NLEVEL; ++l) {
+                const int upper = SLOT_BITS * (l + 1);
+                if ((tick >> upper) == (_cur >> upper)) {
+                    const int idx = (tick >> (SLOT_BITS * l)) & (NSLOT - 1);
+                    task->next = _slots[l][idx];
+                    _slots[l][idx] = task;
+                    _bitmap[l][idx / 64] |= (1UL << (idx % 64));
+                    return;
+                }
+            }
+            task->next = _overflow;
+            _overflow = task;
+        }
+
+        // Re-insert tasks in `head' relative to _cur, dropping unscheduled ones.
+        void reinsert(Task *head) {
+            while (head) {
+                Task *next_task = head->next;
+                if (!head->try_delete()) {
+                    insert(head, tick_of(head));
+                }
+                head = next_task;
+            }
+        }
+
+        void cascade(int level, int idx) {
+            Task *head = _slots[level][idx];
+            if (head) {
+                _slots[level][idx] = NULL;
+                _bitmap[level][idx / 64] &= ~(1UL << (idx % 64));
+                reinsert(head);
+            }
+        }
+
+        // Move _cur to `tick'. Callers never jump over a non-empty slot, so
+        // only the slots starting exactly at `tick' need to be cascaded.
+        void set_cur(uint64_t tick) {
+            _cur = tick;
+            if ((tick & 0xFFFFFFFFUL) == 0 && _overflow) {
+                Task *head = _overflow;
+                _overflow = NULL;
+                reinsert(head);
+            }
+            for (int l = NLEVEL - 1; l >= 1; --l) {
+                const int shift = SLOT_BITS * l;
+                if ((tick & ((1UL << shift) - 1)) == 0) {
+                    cascade(l, (tick >> shift) & (NSLOT - 1));
+                }
+            }
+        }
+
+        // Index of the first non-empty slot >= `from' in `level', -1 if none.
+        int find_next(int level, int from) const {
+            for (int w = from / 64; w < NSLOT / 64; ++w) {
+                uint64_t bits = _bitmap[level][w];
+                if (w == from / 64) {
+                    bits &= (~0UL << (from % 64));
+                }
+                if (bits) {
+                    return w * 64 + __builtin_ctzll(bits);
+                }
+            }
+            return -1;
+        }
+
+        uint64_t next_tick() const {
+            int idx = find_next(0, _cur & (NSLOT - 1));
+            if (idx >= 0) {
+                return (_cur & ~(uint64_t) (NSLOT - 1)) | idx;
+            }
+            for (int l = 1; l < NLEVEL; ++l) {
+                const int shift = SLOT_BITS * l;
+                idx = find_next(l, ((_cur >> shift) & (NSLOT - 1)) + 1);
+                if (idx >= 0) {
+                    const int upper = shift + SLOT_BITS;
+                    return ((_cur >> upper) << upper) | ((uint64_t) idx << shift);
+                }
+            }
+            if (_overflow) {
+                return ((_cur >> 32) + 1) << 32;
+            }
+            return std::numeric_limits<uint64_t>::max();
+        }
+
+        const int64_t _tick_us;
+        uint64_t _cur;    // the earliest tick not expired yet
+        Task *_overflow;
+        Task *_slots[NLEVEL][NSLOT];
+        uint64_t _bitmap[NLEVEL][NSLOT / 64];
+    };
+
     // Utilies for making and extracting TaskId.
     inline TimerThread::TaskId make_task_id(
             mutil::ResourceId<TimerThread::Task> slot, uint32_t version) {
@@ -124,7 +299,7 @@ namespace fiber {
     }
 
     TimerThread::TimerThread()
-            : _started(false), _stop(false), _buckets(NULL), _nearest_run_time(std::numeric_limits<int64_t>::max()),
+            : _started(false), _stop(false), _buckets(NULL), _wheel(NULL), _nearest_run_time(std::numeric_limits<int64_t>::max()),
               _nsignals(0), _thread(0) {
     }
 
@@ -132,6 +307,8 @@ namespace fiber {
         stop_and_join();
         delete[] _buckets;
         _buckets = NULL;
+        delete _wheel;
+        _wheel = NULL;
     }
 
     int TimerThread::start(const TimerThreadOptions *options_in) {
@@ -154,6 +331,19 @@ namespace fiber {
             LOG(ERROR) << "Fail to new _buckets";
             return ENOMEM;
         }
+        if (_options.use_timing_wheel) {
+            if (_options.timing_wheel_tick_us <= 0) {
+                LOG(ERROR) << "timing_wheel_tick_us=" << _options.timing_wheel_tick_us
+                           << " must be positive";
+                return EINVAL;
+            }
+            _wheel = new(std::nothrow) Wheel(_options.timing_wheel_tick_us,
+                                             mutil::gettimeofday_us());
+            if (NULL == _wheel) {
+                LOG(ERROR) << "Fail to new _wheel";
+                return ENOMEM;
+            }
+        }
         const int ret = pthread_create(&_thread, NULL, TimerThread::run_this, this);
         if (ret) {
             return ret;
@@ -317,6 +507,11 @@ namespace fiber {
         // min heap of tasks (ordered by run_time)
         std::vector<Task *> tasks;
         tasks.reserve(4096);
+        // tasks expired in the timing wheel
+        std::vector<Task *> expired;
+        if (_wheel) {
+            expired.reserve(4096);
+        }
 
         // vars
         size_t nscheduled = 0;
@@ -352,13 +547,32 @@ namespace fiber {
                     Task *next_task = p->next;
 
                     if (!p->try_delete()) { // remove the task if it's unscheduled
-                        tasks.push_back(p);
-                        std::push_heap(tasks.begin(), tasks.end(), task_greater);
+                        if (_wheel) {
+                            if (!_wheel->add(p)) {
+                                expired.push_back(p);
+                            }
+                        } else {
+                            tasks.push_back(p);
+                            std::push_heap(tasks.begin(), tasks.end(), task_greater);
+                        }
                     }
                     p = next_task;
                 }
             }
 
+            if (_wheel) {
+                // Tasks expired in the wheel are run in one batch without
+                // checking _nearest_run_time before each of them. Tasks
+                // scheduled meanwhile are pulled in the next round.
+                _wheel->advance(mutil::gettimeofday_us(), &expired);
+                for (size_t i = 0; i < expired.size(); ++i) {
+                    if (expired[i]->run_and_delete()) {
+                        ++ntriggered;
+                    }
+                }
+                expired.clear();
+            }
+
             bool pull_again = false;
             while (!tasks.empty()) {
                 Task *task1 = tasks[0];  // the about-to-run task
@@ -396,7 +610,9 @@ namespace fiber {
 
             // The realtime to wait for.
             int64_t next_run_time = std::numeric_limits<int64_t>::max();
-            if (!tasks.empty()) {
+            if (_wheel) {
+                next_run_time = _wheel->next_run_time();
+            } else if (!tasks.empty()) {
                 next_run_time = tasks[0]->run_time;
             }
             // Similarly with the situation before running tasks, we check
@@ -458,6 +674,8 @@ namespace fiber {
         }
         TimerThreadOptions options;
         options.var_prefix = "fiber_timer";
+        options.use_timing_wheel = FLAGS_fiber_timer_use_timing_wheel;
+        options.timing_wheel_tick_us = FLAGS_fiber_timer_wheel_tick_us;
         const int rc = g_timer_thread->start(&options);
         if (rc != 0) {
             LOG(FATAL) << "Fail to start timer_thread, " << berror(rc);
@@ -43,6 +43,19 @@ struct TimerThreadOptions {
     // Default: ""
     std::string var_prefix;
 
+    // Order pulled tasks with a hierarchical timing wheel instead of a
+    // binary heap. Inserting into the wheel is O(1) and all tasks expiring
+    // at the same tick are dispatched in one batch, which keeps the timer
+    // thread cheap when millions of timeouts are scheduled per second.
+    // Default: false
+    bool use_timing_wheel;
+
+    // Granularity of the timing wheel in microseconds. Tasks never run
+    // before their scheduled time, but may be delayed by up to one tick.
+    // Bigger ticks put more tasks into one batch.
+    // Default: 1
+    int64_t timing_wheel_tick_us;
+
     // Constructed with default options.
     TimerThreadOptions();
 };
@@ -54,6 +67,7 @@ class TimerThread {
 public:
     struct Task;
     class Bucket;
+    class Wheel;
 
     typedef uint64_t TaskId;
     const static TaskId INVALID_TASK_ID;
@@ -95,6 +109,7 @@ private:
 
     TimerThreadOptions _options;
     Bucket* _buckets;        // list of tasks to be run
+    Wheel* _wheel;           // NULL unless options.use_timing_wheel is true
     internal::FastPthreadMutex _mutex;    // protect _nearest_run_time
     int64_t _nearest_run_time;
     // the futex for wake up timer thread. can't use _nearest_run_time because
@@ -0,0 +1,103 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+//
+
+#pragma once
+
+#include <melon/utility/iobuf.h>
+#include <melon/json2pb/pb_to_json.h>
+
+namespace json2pb {
+
+    // Output stream of rapidjson writers appending into IOBuf by
+    // IOBufAppender, which is cheaper than Next()/BackUp() of
+    // ZeroCopyOutputStream for the small pieces written by writers.
+    // If `chunk_writer' is not NULL, the output is handed to it whenever
+    // the output reaches the chunk size.
+    class IOBufStreamWriter {
+    public:
+        typedef char Ch;
+
+        explicit IOBufStreamWriter(JsonChunkWriter *chunk_writer = NULL)
+                : _chunk_writer(chunk_writer),
+                  _chunk_size(chunk_writer ? chunk_writer->chunk_size() : (size_t) -1),
+                  _size(0), _failed(false) {}
+
+        void Put(char c) {
+            _appender.push_back(c);
+            if (__builtin_expect(++_size >= _chunk_size, 0)) {
+                FlushChunk();
+            }
+        }
+
+        void PutN(char c, size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                Put(c);
+            }
+        }
+
+        void Puts(const char *str, size_t length) {
+            _appender.append(str, length);
+            _size += length;
+            if (_size >= _chunk_size) {
+                FlushChunk();
+            }
+        }
+
+        void Flush() {}
+
+        char Peek() { return 0; }
+
+        char Take() { return 0; }
+
+        size_t Tell() { return 0; }
+
+        char *PutBegin() { return nullptr; }
+
+        size_t PutEnd(char *) { return 0; }
+
+        // Hand the output so far to the chunk writer. Output is dropped
+        // after the chunk writer failed.
+        void FlushChunk() {
+            mutil::IOBuf chunk;
+            _appender.move_to(chunk);
+            _size = 0;
+            if (!_failed && !chunk.empty() &&
+                _chunk_writer->WriteChunk(&chunk) != 0) {
+                _failed = true;
+            }
+        }
+
+        // Append the output so far to `out'.
+        void MoveTo(mutil::IOBuf *out) {
+            out->append(mutil::IOBuf::Movable(_appender.buf()));
+            _size = 0;
+        }
+
+        // True if the chunk writer failed.
+        const bool &failed() const { return _failed; }
+
+    private:
+        mutil::IOBufAppender _appender;
+        JsonChunkWriter *_chunk_writer;
+        const size_t _chunk_size;
+        size_t _size;
+        bool _failed;
+    };
+
+}  // namespace json2pb
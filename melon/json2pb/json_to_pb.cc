@@ -25,7 +25,9 @@
 #include <time.h>
 #include <typeinfo>
 #include <limits>
+#include <memory>
 #include <google/protobuf/descriptor.h>
+#include <melon/utility/macros.h>
 #include <melon/utility/strings/string_number_conversions.h>
 #include <melon/utility/third_party/rapidjson/error/error.h>
 #include <melon/utility/third_party/rapidjson/rapidjson.h>
@@ -35,6 +37,7 @@
 #include <turbo/strings/escaping.h>
 #include <melon/utility/string_printf.h>
 #include <melon/json2pb/protobuf_map.h>
+#include <melon/json2pb/message_codec.h>
 #include <melon/json2pb/rapidjson.h>
 
 
@@ -269,11 +272,12 @@ namespace json2pb {
         return true;
     }
 
-    bool JsonValueToProtoMessage(const MUTIL_RAPIDJSON_NAMESPACE::Value &json_value,
-                                 google::protobuf::Message *message,
-                                 const Json2PbOptions &options,
-                                 std::string *err,
-                                 bool root_val = false);
+    static bool JsonValueToProtoMessage(const MUTIL_RAPIDJSON_NAMESPACE::Value &json_value,
+                                        google::protobuf::Message *message,
+                                        const Json2PbOptions &options,
+                                        MessageCodecs *codecs,
+                                        std::string *err,
+                                        bool root_val = false);
 
 //Json value to protobuf convert rules for type:
 //Json value type                 Protobuf type                convert rules
@@ -298,44 +302,26 @@ namespace json2pb {
             match_type;                                             \
         })
 
-
-    static bool JsonValueToProtoField(const MUTIL_RAPIDJSON_NAMESPACE::Value &value,
-                                      const google::protobuf::FieldDescriptor *field,
-                                      google::protobuf::Message *message,
-                                      const Json2PbOptions &options,
-                                      std::string *err) {
-        if (value.IsNull()) {
-            if (field->is_required()) {
-                J2PERROR(err, "Missing required field: %s", field->full_name().c_str());
-                return false;
-            }
-            return true;
-        }
-
-        if (field->is_repeated()) {
-            if (!value.IsArray()) {
-                J2PERROR(err, "Invalid value for repeated field: %s",
-                         field->full_name().c_str());
-                return false;
-            }
-        }
-
-        const google::protobuf::Reflection *reflection = message->GetReflection();
+    // Set `item' into the non-message `field', or add it when `repeated'
+    // is true.
+    static bool JsonItemToProtoField(const MUTIL_RAPIDJSON_NAMESPACE::Value &item,
+                                     bool repeated,
+                                     const google::protobuf::FieldDescriptor *field,
+                                     google::protobuf::Message *message,
+                                     const google::protobuf::Reflection *reflection,
+                                     const Json2PbOptions &options,
+                                     std::string *err) {
         switch (field->cpp_type()) {
 #define CASE_FIELD_TYPE(cpptype, method, jsontype)                      \
         case google::protobuf::FieldDescriptor::CPPTYPE_##cpptype: {                      \
-            if (field->is_repeated()) {                                 \
-                const MUTIL_RAPIDJSON_NAMESPACE::SizeType size = value.Size();          \
-                for (MUTIL_RAPIDJSON_NAMESPACE::SizeType index = 0; index < size; ++index) { \
-                    const MUTIL_RAPIDJSON_NAMESPACE::Value & item = value[index];       \
-                    if (TYPE_MATCH == J2PCHECKTYPE(item, cpptype, jsontype)) { \
-                        reflection->Add##method(message, field, item.Get##jsontype()); \
-                    }                                                   \
+            if (TYPE_MATCH == J2PCHECKTYPE(item, cpptype, jsontype)) {  \
+                if (repeated) {                                         \
+                    reflection->Add##method(message, field, item.Get##jsontype()); \
+                } else {                                                \
+                    reflection->Set##method(message, field, item.Get##jsontype()); \
                 }                                                       \
-            } else if (TYPE_MATCH == J2PCHECKTYPE(value, cpptype, jsontype)) { \
-                reflection->Set##method(message, field, value.Get##jsontype()); \
             }                                                           \
-            break;                                                      \
+            return true;                                                \
         }                                                               \
 
             CASE_FIELD_TYPE(INT32, Int32, Int);
@@ -344,92 +330,20 @@ namespace json2pb {
 #undef CASE_FIELD_TYPE
 
             case google::protobuf::FieldDescriptor::CPPTYPE_INT64:
-                if (field->is_repeated()) {
-                    const MUTIL_RAPIDJSON_NAMESPACE::SizeType size = value.Size();
-                    for (MUTIL_RAPIDJSON_NAMESPACE::SizeType index = 0; index < size;
-                         ++index) {
-                        const MUTIL_RAPIDJSON_NAMESPACE::Value &item = value[index];
-                        if (!convert_int64_type(item, true, message, field, reflection,
-                                                err)) {
-                            return false;
-                        }
-                    }
-                } else if (!convert_int64_type(value, false, message, field, reflection,
-                                               err)) {
-                    return false;
-                }
-                break;
+                return convert_int64_type(item, repeated, message, field, reflection, err);
 
             case google::protobuf::FieldDescriptor::CPPTYPE_UINT64:
-                if (field->is_repeated()) {
-                    const MUTIL_RAPIDJSON_NAMESPACE::SizeType size = value.Size();
-                    for (MUTIL_RAPIDJSON_NAMESPACE::SizeType index = 0; index < size;
-                         ++index) {
-                        const MUTIL_RAPIDJSON_NAMESPACE::Value &item = value[index];
-                        if (!convert_uint64_type(item, true, message, field, reflection,
-                                                 err)) {
-                            return false;
-                        }
-                    }
-                } else if (!convert_uint64_type(value, false, message, field, reflection,
-                                                err)) {
-                    return false;
-                }
-                break;
+                return convert_uint64_type(item, repeated, message, field, reflection, err);
 
             case google::protobuf::FieldDescriptor::CPPTYPE_FLOAT:
-                if (field->is_repeated()) {
-                    const MUTIL_RAPIDJSON_NAMESPACE::SizeType size = value.Size();
-                    for (MUTIL_RAPIDJSON_NAMESPACE::SizeType index = 0; index < size; ++index) {
-                        const MUTIL_RAPIDJSON_NAMESPACE::Value &item = value[index];
-                        if (!convert_float_type(item, true, message, field,
-                                                reflection, err)) {
-                            return false;
-                        }
-                    }
-                } else if (!convert_float_type(value, false, message, field,
-                                               reflection, err)) {
-                    return false;
-                }
-                break;
+                return convert_float_type(item, repeated, message, field, reflection, err);
 
             case google::protobuf::FieldDescriptor::CPPTYPE_DOUBLE:
-                if (field->is_repeated()) {
-                    const MUTIL_RAPIDJSON_NAMESPACE::SizeType size = value.Size();
-                    for (MUTIL_RAPIDJSON_NAMESPACE::SizeType index = 0; index < size; ++index) {
-                        const MUTIL_RAPIDJSON_NAMESPACE::Value &item = value[index];
-                        if (!convert_double_type(item, true, message, field,
-                                                 reflection, err)) {
-                            return false;
-                        }
-                    }
-                } else if (!convert_double_type(value, false, message, field,
-                                                reflection, err)) {
-                    return false;
-                }
-                break;
+                return convert_double_type(item, repeated, message, field, reflection, err);
 
             case google::protobuf::FieldDescriptor::CPPTYPE_STRING:
-                if (field->is_repeated()) {
-                    const MUTIL_RAPIDJSON_NAMESPACE::SizeType size = value.Size();
-                    for (MUTIL_RAPIDJSON_NAMESPACE::SizeType index = 0; index < size; ++index) {
-                        const MUTIL_RAPIDJSON_NAMESPACE::Value &item = value[index];
-                        if (TYPE_MATCH == J2PCHECKTYPE(item, string, String)) {
-                            std::string str(item.GetString(), item.GetStringLength());
-                            if (field->type() == google::protobuf::FieldDescriptor::TYPE_BYTES &&
-                                options.base64_to_bytes) {
-                                std::string str_decoded;
-                                if (!turbo::base64_decode(str, &str_decoded)) {
-                                    J2PERROR_WITH_PB(message, err, "Fail to decode base64 string=%s", str.c_str());
-                                    return false;
-                                }
-                                str = str_decoded;
-                            }
-                            reflection->AddString(message, field, str);
-                        }
-                    }
-                } else if (TYPE_MATCH == J2PCHECKTYPE(value, string, String)) {
-                    std::string str(value.GetString(), value.GetStringLength());
+                if (TYPE_MATCH == J2PCHECKTYPE(item, string, String)) {
+                    std::string str(item.GetString(), item.GetStringLength());
                     if (field->type() == google::protobuf::FieldDescriptor::TYPE_BYTES &&
                         options.base64_to_bytes) {
                         std::string str_decoded;
@@ -439,52 +353,85 @@ namespace json2pb {
                         }
                         str = str_decoded;
                     }
-                    reflection->SetString(message, field, str);
+                    if (repeated) {
+                        reflection->AddString(message, field, str);
+                    } else {
+                        reflection->SetString(message, field, str);
+                    }
                 }
-                break;
+                return true;
 
             case google::protobuf::FieldDescriptor::CPPTYPE_ENUM:
-                if (field->is_repeated()) {
-                    const MUTIL_RAPIDJSON_NAMESPACE::SizeType size = value.Size();
-                    for (MUTIL_RAPIDJSON_NAMESPACE::SizeType index = 0; index < size; ++index) {
-                        const MUTIL_RAPIDJSON_NAMESPACE::Value &item = value[index];
-                        if (!convert_enum_type(item, true, message, field,
-                                               reflection, err)) {
-                            return false;
-                        }
-                    }
-                } else if (!convert_enum_type(value, false, message, field,
-                                              reflection, err)) {
-                    return false;
-                }
-                break;
+                return convert_enum_type(item, repeated, message, field, reflection, err);
 
             case google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE:
-                if (field->is_repeated()) {
-                    const MUTIL_RAPIDJSON_NAMESPACE::SizeType size = value.Size();
-                    for (MUTIL_RAPIDJSON_NAMESPACE::SizeType index = 0; index < size; ++index) {
-                        const MUTIL_RAPIDJSON_NAMESPACE::Value &item = value[index];
-                        if (TYPE_MATCH == J2PCHECKTYPE(item, message, Object)) {
-                            if (!JsonValueToProtoMessage(
-                                    item, reflection->AddMessage(message, field), options, err)) {
-                                return false;
-                            }
+                break;
+        }
+        return true;
+    }
+
+    static bool JsonValueToProtoField(const MUTIL_RAPIDJSON_NAMESPACE::Value &value,
+                                      const google::protobuf::FieldDescriptor *field,
+                                      google::protobuf::Message *message,
+                                      const Json2PbOptions &options,
+                                      MessageCodecs *codecs,
+                                      std::string *err) {
+        if (value.IsNull()) {
+            if (field->is_required()) {
+                J2PERROR(err, "Missing required field: %s", field->full_name().c_str());
+                return false;
+            }
+            return true;
+        }
+
+        if (field->is_repeated()) {
+            if (!value.IsArray()) {
+                J2PERROR(err, "Invalid value for repeated field: %s",
+                         field->full_name().c_str());
+                return false;
+            }
+        }
+
+        const google::protobuf::Reflection *reflection = message->GetReflection();
+        if (field->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE) {
+            if (field->is_repeated()) {
+                const MUTIL_RAPIDJSON_NAMESPACE::SizeType size = value.Size();
+                for (MUTIL_RAPIDJSON_NAMESPACE::SizeType index = 0; index < size; ++index) {
+                    const MUTIL_RAPIDJSON_NAMESPACE::Value &item = value[index];
+                    if (TYPE_MATCH == J2PCHECKTYPE(item, message, Object)) {
+                        if (!JsonValueToProtoMessage(
+                                item, reflection->AddMessage(message, field), options,
+                                codecs, err)) {
+                            return false;
                         }
                     }
-                } else if (!JsonValueToProtoMessage(
-                        value, reflection->MutableMessage(message, field), options, err)) {
+                }
+            } else if (!JsonValueToProtoMessage(
+                    value, reflection->MutableMessage(message, field), options,
+                    codecs, err)) {
+                return false;
+            }
+        } else if (field->is_repeated()) {
+            const MUTIL_RAPIDJSON_NAMESPACE::SizeType size = value.Size();
+            for (MUTIL_RAPIDJSON_NAMESPACE::SizeType index = 0; index < size; ++index) {
+                if (!JsonItemToProtoField(value[index], true, field, message,
+                                          reflection, options, err)) {
                     return false;
                 }
-                break;
+            }
+        } else if (!JsonItemToProtoField(value, false, field, message,
+                                         reflection, options, err)) {
+            return false;
         }
         return true;
     }
 
-    bool JsonMapToProtoMap(const MUTIL_RAPIDJSON_NAMESPACE::Value &value,
-                           const google::protobuf::FieldDescriptor *map_desc,
-                           google::protobuf::Message *message,
-                           const Json2PbOptions &options,
-                           std::string *err) {
+    static bool JsonMapToProtoMap(const MUTIL_RAPIDJSON_NAMESPACE::Value &value,
+                                  const google::protobuf::FieldDescriptor *map_desc,
+                                  google::protobuf::Message *message,
+                                  const Json2PbOptions &options,
+                                  MessageCodecs *codecs,
+                                  std::string *err) {
         if (!value.IsObject()) {
             J2PERROR(err, "Non-object value for map field: %s",
                      map_desc->full_name().c_str());
@@ -493,9 +440,9 @@ namespace json2pb {
 
         const google::protobuf::Reflection *reflection = message->GetReflection();
         const google::protobuf::FieldDescriptor *key_desc =
-                map_desc->message_type()->FindFieldByName(KEY_NAME);
+                map_desc->message_type()->field(KEY_INDEX);
         const google::protobuf::FieldDescriptor *value_desc =
-                map_desc->message_type()->FindFieldByName(VALUE_NAME);
+                map_desc->message_type()->field(VALUE_INDEX);
 
         for (MUTIL_RAPIDJSON_NAMESPACE::Value::ConstMemberIterator it =
                 value.MemberBegin(); it != value.MemberEnd(); ++it) {
@@ -504,18 +451,19 @@ namespace json2pb {
             entry_reflection->SetString(
                     entry, key_desc, std::string(it->name.GetString(),
                                                  it->name.GetStringLength()));
-            if (!JsonValueToProtoField(it->value, value_desc, entry, options, err)) {
+            if (!JsonValueToProtoField(it->value, value_desc, entry, options, codecs, err)) {
                 return false;
             }
         }
         return true;
     }
 
-    bool JsonValueToProtoMessage(const MUTIL_RAPIDJSON_NAMESPACE::Value &json_value,
-                                 google::protobuf::Message *message,
-                                 const Json2PbOptions &options,
-                                 std::string *err,
-                                 bool root_val) {
+    static bool JsonValueToProtoMessage(const MUTIL_RAPIDJSON_NAMESPACE::Value &json_value,
+                                        google::protobuf::Message *message,
+                                        const Json2PbOptions &options,
+                                        MessageCodecs *codecs,
+                                        std::string *err,
+                                        bool root_val) {
         const google::protobuf::Descriptor *descriptor = message->GetDescriptor();
         if (!json_value.IsObject() &&
             !(json_value.IsArray() && options.array_to_single_repeated && root_val)) {
@@ -524,28 +472,33 @@ namespace json2pb {
         }
 
         const google::protobuf::Reflection *reflection = message->GetReflection();
-
-        std::vector<const google::protobuf::FieldDescriptor *> fields;
-        fields.reserve(64);
-        for (int i = 0; i < descriptor->extension_range_count(); ++i) {
-            const google::protobuf::Descriptor::ExtensionRange *
-                    ext_range = descriptor->extension_range(i);
-            for (int tag_number = ext_range->start; tag_number < ext_range->end;
-                 ++tag_number) {
-                const google::protobuf::FieldDescriptor *field =
-                        reflection->FindKnownExtensionByNumber(tag_number);
-                if (field) {
-                    fields.push_back(field);
+        const MessageCodec *codec = codecs->Get(descriptor);
+        const std::vector<FieldCodec> &fields = codec->fields();
+
+        // Extensions are converted before other fields.
+        std::vector<const google::protobuf::FieldDescriptor *> ext_fields;
+        if (codec->has_extension_ranges()) {
+            for (int i = 0; i < descriptor->extension_range_count(); ++i) {
+                const google::protobuf::Descriptor::ExtensionRange *
+                        ext_range = descriptor->extension_range(i);
+                for (int tag_number = ext_range->start; tag_number < ext_range->end;
+                     ++tag_number) {
+                    const google::protobuf::FieldDescriptor *field =
+                            reflection->FindKnownExtensionByNumber(tag_number);
+                    if (field) {
+                        ext_fields.push_back(field);
+                    }
                 }
             }
         }
-        for (int i = 0; i < descriptor->field_count(); ++i) {
-            fields.push_back(descriptor->field(i));
-        }
 
         if (json_value.IsArray()) {
-            if (fields.size() == 1 && fields.front()->is_repeated()) {
-                return JsonValueToProtoField(json_value, fields.front(), message, options, err);
+            if (ext_fields.size() + fields.size() == 1) {
+                const google::protobuf::FieldDescriptor *field =
+                        (ext_fields.empty() ? fields.front().field : ext_fields.front());
+                if (field->is_repeated()) {
+                    return JsonValueToProtoField(json_value, field, message, options, codecs, err);
+                }
             }
 
             J2PERROR_WITH_PB(message, err, "the input json can't be array here");
@@ -553,15 +506,11 @@ namespace json2pb {
         }
 
         std::string field_name_str_temp;
-        const MUTIL_RAPIDJSON_NAMESPACE::Value *value_ptr = NULL;
-        for (size_t i = 0; i < fields.size(); ++i) {
-            const google::protobuf::FieldDescriptor *field = fields[i];
-
+        for (size_t i = 0; i < ext_fields.size(); ++i) {
+            const google::protobuf::FieldDescriptor *field = ext_fields[i];
             const std::string &orig_name = field->name();
             bool res = decode_name(orig_name, field_name_str_temp);
             const std::string &field_name_str = (res ? field_name_str_temp : orig_name);
-
-#ifndef RAPIDJSON_VERSION_0_1
             MUTIL_RAPIDJSON_NAMESPACE::Value::ConstMemberIterator member =
                     json_value.FindMember(field_name_str.data());
             if (member == json_value.MemberEnd()) {
@@ -571,27 +520,52 @@ namespace json2pb {
                 }
                 continue;
             }
-            value_ptr = &(member->value);
-#else
-            const MUTIL_RAPIDJSON_NAMESPACE::Value::Member* member =
-                    json_value.FindMember(field_name_str.data());
-            if (member == NULL) {
-                if (field->is_required()) {
-                    J2PERROR(err, "Missing required field: %s", field->full_name().c_str());
+            if (!JsonValueToProtoField(member->value, field, message, options, codecs, err)) {
+                return false;
+            }
+        }
+
+        // Find values of fields by walking through members once instead of
+        // looking up every field in members. The first member wins when
+        // names are duplicated, which is same with FindMember().
+        const size_t field_count = fields.size();
+        const MUTIL_RAPIDJSON_NAMESPACE::Value *stack_values[32];
+        std::unique_ptr<const MUTIL_RAPIDJSON_NAMESPACE::Value *[]> heap_values;
+        const MUTIL_RAPIDJSON_NAMESPACE::Value **values = stack_values;
+        if (field_count > arraysize(stack_values)) {
+            heap_values.reset(new const MUTIL_RAPIDJSON_NAMESPACE::Value *[field_count]);
+            values = heap_values.get();
+        }
+        for (size_t i = 0; i < field_count; ++i) {
+            values[i] = NULL;
+        }
+        for (MUTIL_RAPIDJSON_NAMESPACE::Value::ConstMemberIterator it =
+                json_value.MemberBegin(); it != json_value.MemberEnd(); ++it) {
+            const int index = codec->FindField(it->name.GetString(),
+                                               it->name.GetStringLength());
+            if (index >= 0 && values[index] == NULL) {
+                values[index] = &it->value;
+            }
+        }
+
+        for (size_t i = 0; i < field_count; ++i) {
+            const FieldCodec &f = fields[i];
+            const MUTIL_RAPIDJSON_NAMESPACE::Value *value_ptr = values[i];
+            if (value_ptr == NULL) {
+                if (f.field->is_required()) {
+                    J2PERROR(err, "Missing required field: %s", f.field->full_name().c_str());
                     return false;
                 }
                 continue;
             }
-            value_ptr = &(member->value);
-#endif
 
-            if (IsProtobufMap(field) && value_ptr->IsObject()) {
+            if (f.is_map && value_ptr->IsObject()) {
                 // Try to parse json like {"key":value, ...} into protobuf map
-                if (!JsonMapToProtoMap(*value_ptr, field, message, options, err)) {
+                if (!JsonMapToProtoMap(*value_ptr, f.field, message, options, codecs, err)) {
                     return false;
                 }
             } else {
-                if (!JsonValueToProtoField(*value_ptr, field, message, options, err)) {
+                if (!JsonValueToProtoField(*value_ptr, f.field, message, options, codecs, err)) {
                     return false;
                 }
             }
@@ -599,6 +573,319 @@ namespace json2pb {
         return true;
     }
 
+    // Converts json into messages directly from events of the reader without
+    // building the document. It's only used on messages which are empty at
+    // the beginning, and gives up on anything which might make the result
+    // different from converting the document: errors, extensions, values of
+    // one oneof. The message is cleared and converted again from the
+    // document in such cases, which also generates exactly the same errors.
+    class JsonToProtoHandler {
+    public:
+        JsonToProtoHandler(google::protobuf::Message *message,
+                           const Json2PbOptions &options,
+                           MessageCodecs *codecs)
+                : _root(message), _options(options), _codecs(codecs) {
+            _frames.reserve(16);
+        }
+
+        bool Null() { return OnValue(MUTIL_RAPIDJSON_NAMESPACE::Value()); }
+
+        bool Bool(bool b) { return OnValue(MUTIL_RAPIDJSON_NAMESPACE::Value(b)); }
+
+        bool AddInt(int i) { return OnValue(MUTIL_RAPIDJSON_NAMESPACE::Value(i)); }
+
+        bool AddUint(unsigned u) { return OnValue(MUTIL_RAPIDJSON_NAMESPACE::Value(u)); }
+
+        bool AddInt64(int64_t i) { return OnValue(MUTIL_RAPIDJSON_NAMESPACE::Value(i)); }
+
+        bool AddUint64(uint64_t u) { return OnValue(MUTIL_RAPIDJSON_NAMESPACE::Value(u)); }
+
+        bool Double(double d) { return OnValue(MUTIL_RAPIDJSON_NAMESPACE::Value(d)); }
+
+        bool String(const char *str, MUTIL_RAPIDJSON_NAMESPACE::SizeType length, bool) {
+            return OnValue(MUTIL_RAPIDJSON_NAMESPACE::Value(
+                    MUTIL_RAPIDJSON_NAMESPACE::StringRef(str, length)));
+        }
+
+        bool StartObject();
+
+        bool Key(const char *str, MUTIL_RAPIDJSON_NAMESPACE::SizeType length, bool);
+
+        bool EndObject(MUTIL_RAPIDJSON_NAMESPACE::SizeType);
+
+        bool StartArray();
+
+        bool EndArray(MUTIL_RAPIDJSON_NAMESPACE::SizeType) {
+            _frames.pop_back();
+            return true;
+        }
+
+    private:
+        enum FrameType {
+            FRAME_MESSAGE,   // Members of `message'
+            FRAME_MAP,       // Members of the map `field' of `message'
+            FRAME_REPEATED,  // Items of the repeated `field' of `message'
+            FRAME_SKIP,      // Object or array to be ignored
+        };
+
+        struct Frame {
+            FrameType type;
+            google::protobuf::Message *message;
+            const MessageCodec *codec;
+            const FieldCodec *field;
+            // The message and the field of the next value, the value is
+            // ignored if `value_field' is NULL.
+            google::protobuf::Message *value_message;
+            const FieldCodec *value_field;
+            // Offset of the fields and oneofs seen in _seen
+            size_t seen_offset;
+        };
+
+        bool OnValue(const MUTIL_RAPIDJSON_NAMESPACE::Value &value);
+
+        bool PushMessage(google::protobuf::Message *message);
+
+        void Push(FrameType type, google::protobuf::Message *message,
+                  const FieldCodec *field) {
+            Frame f = {type, message, NULL, field, NULL, NULL, 0};
+            if (type == FRAME_REPEATED) {
+                f.value_message = message;
+                f.value_field = field;
+            }
+            _frames.push_back(f);
+        }
+
+        // Returns true if the next value goes nowhere, clear it at the same
+        // time unless it's an item of a repeated field.
+        bool TakeValueTarget(google::protobuf::Message **message, const FieldCodec **field) {
+            Frame &top = _frames.back();
+            *message = top.value_message;
+            *field = top.value_field;
+            if (top.type != FRAME_REPEATED) {
+                top.value_field = NULL;
+            }
+            return top.type == FRAME_SKIP || *field == NULL;
+        }
+
+        google::protobuf::Message *_root;
+        const Json2PbOptions &_options;
+        MessageCodecs *_codecs;
+        std::vector<Frame> _frames;
+        std::vector<char> _seen;
+        // Tolerated errors are not reported, just to check if there's any.
+        std::string _error;
+    };
+
+    bool JsonToProtoHandler::OnValue(const MUTIL_RAPIDJSON_NAMESPACE::Value &value) {
+        if (_frames.empty()) {
+            // The document is not an object.
+            return false;
+        }
+        google::protobuf::Message *message = NULL;
+        const FieldCodec *f = NULL;
+        if (TakeValueTarget(&message, &f)) {
+            return true;
+        }
+        const google::protobuf::FieldDescriptor *field = f->field;
+        const bool repeated = (_frames.back().type == FRAME_REPEATED);
+        if (!repeated) {
+            if (value.IsNull()) {
+                return !field->is_required();
+            }
+            if (field->is_repeated()) {
+                return false;
+            }
+        }
+        if (field->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE) {
+            return false;
+        }
+        return JsonItemToProtoField(value, repeated, field, message,
+                                    message->GetReflection(), _options, &_error) &&
+               _error.empty();
+    }
+
+    bool JsonToProtoHandler::PushMessage(google::protobuf::Message *message) {
+        const MessageCodec *codec = _codecs->Get(message->GetDescriptor());
+        if (codec->has_extension_ranges()) {
+            return false;
+        }
+        Push(FRAME_MESSAGE, message, NULL);
+        Frame &top = _frames.back();
+        top.codec = codec;
+        top.seen_offset = _seen.size();
+        _seen.resize(_seen.size() + codec->fields().size() + codec->oneof_count(), 0);
+        return true;
+    }
+
+    bool JsonToProtoHandler::StartObject() {
+        if (_frames.empty()) {
+            return PushMessage(_root);
+        }
+        google::protobuf::Message *message = NULL;
+        const FieldCodec *f = NULL;
+        if (TakeValueTarget(&message, &f)) {
+            Push(FRAME_SKIP, NULL, NULL);
+            return true;
+        }
+        if (f->field->cpp_type() != google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE) {
+            return false;
+        }
+        if (_frames.back().type == FRAME_REPEATED) {
+            return PushMessage(message->GetReflection()->AddMessage(message, f->field));
+        }
+        if (f->is_map) {
+            if (_codecs->Get(f->field->message_type())->has_extension_ranges()) {
+                return false;
+            }
+            Push(FRAME_MAP, message, f);
+            return true;
+        }
+        if (f->field->is_repeated()) {
+            return false;
+        }
+        return PushMessage(message->GetReflection()->MutableMessage(message, f->field));
+    }
+
+    bool JsonToProtoHandler::Key(const char *str, MUTIL_RAPIDJSON_NAMESPACE::SizeType length, bool) {
+        Frame &top = _frames.back();
+        if (top.type == FRAME_SKIP) {
+            return true;
+        }
+        if (top.type == FRAME_MAP) {
+            const google::protobuf::Descriptor *entry_desc = top.field->field->message_type();
+            google::protobuf::Message *entry =
+                    top.message->GetReflection()->AddMessage(top.message, top.field->field);
+            entry->GetReflection()->SetString(
+                    entry, entry_desc->field(KEY_INDEX), std::string(str, length));
+            top.value_message = entry;
+            top.value_field = &_codecs->Get(entry_desc)->fields()[VALUE_INDEX];
+            return true;
+        }
+        const int index = top.codec->FindField(str, length);
+        if (index < 0 || _seen[top.seen_offset + index]) {
+            // Unknown member or duplicated name, ignore the value.
+            top.value_field = NULL;
+            return true;
+        }
+        _seen[top.seen_offset + index] = 1;
+        const FieldCodec &f = top.codec->fields()[index];
+        if (f.oneof_index >= 0) {
+            char &oneof_seen = _seen[top.seen_offset + top.codec->fields().size() + f.oneof_index];
+            if (oneof_seen) {
+                return false;
+            }
+            oneof_seen = 1;
+        }
+        top.value_message = top.message;
+        top.value_field = &f;
+        return true;
+    }
+
+    bool JsonToProtoHandler::EndObject(MUTIL_RAPIDJSON_NAMESPACE::SizeType) {
+        const Frame &top = _frames.back();
+        if (top.type == FRAME_MESSAGE) {
+            const std::vector<int> &required = top.codec->required_fields();
+            for (size_t i = 0; i < required.size(); ++i) {
+                if (!_seen[top.seen_offset + required[i]]) {
+                    return false;
+                }
+            }
+            _seen.resize(top.seen_offset);
+        }
+        _frames.pop_back();
+        return true;
+    }
+
+    bool JsonToProtoHandler::StartArray() {
+        if (_frames.empty()) {
+            if (!_options.array_to_single_repeated) {
+                return false;
+            }
+            const MessageCodec *codec = _codecs->Get(_root->GetDescriptor());
+            if (codec->has_extension_ranges() || codec->fields().size() != 1 ||
+                !codec->fields().front().field->is_repeated()) {
+                return false;
+            }
+            Push(FRAME_REPEATED, _root, &codec->fields().front());
+            return true;
+        }
+        google::protobuf::Message *message = NULL;
+        const FieldCodec *f = NULL;
+        if (TakeValueTarget(&message, &f)) {
+            Push(FRAME_SKIP, NULL, NULL);
+            return true;
+        }
+        if (_frames.back().type == FRAME_REPEATED || !f->field->is_repeated()) {
+            return false;
+        }
+        Push(FRAME_REPEATED, message, f);
+        return true;
+    }
+
+    // Streams longer than this are not copied into a string for the fast
+    // path, see JsonToProtoMessage(ZeroCopyStreamReader*, ...).
+    static const size_t FAST_PATH_MAX_JSON_SIZE = 64 * 1024;
+
+    // Reads `prefix' which was taken from `reader' and then the remaining
+    // bytes of `reader'.
+    class PrefixedStreamReader {
+    public:
+        typedef char Ch;
+
+        PrefixedStreamReader(const std::string &prefix, ZeroCopyStreamReader *reader)
+                : _prefix(prefix), _pos(0), _reader(reader) {
+        }
+
+        char Peek() {
+            return _pos < _prefix.size() ? _prefix[_pos] : _reader->Peek();
+        }
+
+        char Take() {
+            return _pos < _prefix.size() ? _prefix[_pos++] : _reader->Take();
+        }
+
+        const char *TakeWithAddr() {
+            return _pos < _prefix.size() ? &_prefix[_pos++] : _reader->TakeWithAddr();
+        }
+
+        // The prefix is a block, `_reader' has no bytes left in its current
+        // block after the prefix was taken.
+        bool ReadBlockTail() {
+            return _pos < _prefix.size() ? false : _reader->ReadBlockTail();
+        }
+
+        size_t Tell() { return _reader->Tell() - (_prefix.size() - _pos); }
+
+        void Put(char) {}
+
+        void Flush() {}
+
+        char *PutBegin() { return nullptr; }
+
+        size_t PutEnd(char *) { return 0; }
+
+    private:
+        const std::string &_prefix;
+        size_t _pos;
+        ZeroCopyStreamReader *_reader;
+    };
+
+    // Returns true if `json' was converted into the empty `message' by
+    // JsonToProtoHandler, otherwise `message' is left empty.
+    static bool FastJsonToProtoMessage(const std::string &json,
+                                       google::protobuf::Message *message,
+                                       const Json2PbOptions &options,
+                                       MessageCodecs *codecs) {
+        JsonToProtoHandler handler(message, options, codecs);
+        MUTIL_RAPIDJSON_NAMESPACE::Reader reader;
+        MUTIL_RAPIDJSON_NAMESPACE::StringStream stream(json.c_str());
+        if (reader.Parse<0>(stream, handler)) {
+            return true;
+        }
+        message->Clear();
+        return false;
+    }
+
     inline bool JsonToProtoMessageInline(const std::string &json_string,
                                          google::protobuf::Message *message,
                                          const Json2PbOptions &options,
@@ -607,6 +894,12 @@ namespace json2pb {
         if (error) {
             error->clear();
         }
+        MessageCodecs codecs;
+        if (!options.allow_remaining_bytes_after_parsing &&
+            message->ByteSizeLong() == 0 &&
+            FastJsonToProtoMessage(json_string, message, options, &codecs)) {
+            return true;
+        }
         MUTIL_RAPIDJSON_NAMESPACE::Document d;
         if (options.allow_remaining_bytes_after_parsing) {
             d.Parse<MUTIL_RAPIDJSON_NAMESPACE::kParseStopWhenDoneFlag>(json_string.c_str());
@@ -628,7 +921,7 @@ namespace json2pb {
                              MUTIL_RAPIDJSON_NAMESPACE::GetParseError_En(d.GetParseError()));
             return false;
         }
-        return JsonValueToProtoMessage(d, message, options, error, true);
+        return JsonValueToProtoMessage(d, message, options, &codecs, error, true);
     }
 
     bool JsonToProtoMessage(const std::string &json_string,
@@ -653,32 +946,50 @@ namespace json2pb {
                             const Json2PbOptions &options,
                             std::string *error,
                             size_t *parsed_offset) {
+        if (!options.allow_remaining_bytes_after_parsing) {
+            // The whole input is parsed. Small inputs are read into a string
+            // which can be parsed again when the fast path gives up, larger
+            // ones are parsed into the document from the stream rather than
+            // being copied entirely.
+            std::string json_string;
+            if (reader->ReadAll(&json_string, FAST_PATH_MAX_JSON_SIZE)) {
+                return JsonToProtoMessageInline(json_string, message, options, error, parsed_offset);
+            }
+            if (error) {
+                error->clear();
+            }
+            MessageCodecs codecs;
+            PrefixedStreamReader prefixed_reader(json_string, reader);
+            MUTIL_RAPIDJSON_NAMESPACE::Document d;
+            d.ParseStream<0, MUTIL_RAPIDJSON_NAMESPACE::UTF8<>>(prefixed_reader);
+            if (d.HasParseError()) {
+                J2PERROR_WITH_PB(message, error, "Invalid json: %s",
+                                 MUTIL_RAPIDJSON_NAMESPACE::GetParseError_En(d.GetParseError()));
+                return false;
+            }
+            return JsonValueToProtoMessage(d, message, options, &codecs, error, true);
+        }
         if (error) {
             error->clear();
         }
+        MessageCodecs codecs;
         MUTIL_RAPIDJSON_NAMESPACE::Document d;
-        if (options.allow_remaining_bytes_after_parsing) {
-            d.ParseStream<MUTIL_RAPIDJSON_NAMESPACE::kParseStopWhenDoneFlag, MUTIL_RAPIDJSON_NAMESPACE::UTF8<>>(
-                    *reader);
-            if (parsed_offset != nullptr) {
-                *parsed_offset = d.GetErrorOffset();
-            }
-        } else {
-            d.ParseStream<0, MUTIL_RAPIDJSON_NAMESPACE::UTF8<>>(*reader);
+        d.ParseStream<MUTIL_RAPIDJSON_NAMESPACE::kParseStopWhenDoneFlag, MUTIL_RAPIDJSON_NAMESPACE::UTF8<>>(
+                *reader);
+        if (parsed_offset != nullptr) {
+            *parsed_offset = d.GetErrorOffset();
         }
         if (d.HasParseError()) {
-            if (options.allow_remaining_bytes_after_parsing) {
-                if (d.GetParseError() == MUTIL_RAPIDJSON_NAMESPACE::kParseErrorDocumentEmpty) {
-                    // This is usual when parsing multiple jsons, don't waste time
-                    // on setting the `empty error'
-                    return false;
-                }
+            if (d.GetParseError() == MUTIL_RAPIDJSON_NAMESPACE::kParseErrorDocumentEmpty) {
+                // This is usual when parsing multiple jsons, don't waste time
+                // on setting the `empty error'
+                return false;
             }
             J2PERROR_WITH_PB(message, error, "Invalid json: %s",
                              MUTIL_RAPIDJSON_NAMESPACE::GetParseError_En(d.GetParseError()));
             return false;
         }
-        return JsonValueToProtoMessage(d, message, options, error, true);
+        return JsonValueToProtoMessage(d, message, options, &codecs, error, true);
     }
 
     bool JsonToProtoMessage(const std::string &json_string,
@@ -0,0 +1,109 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+//
+
+
+#include <string.h>
+#include <pthread.h>
+#include <unordered_map>
+#include <melon/json2pb/encode_decode.h>
+#include <melon/json2pb/protobuf_map.h>
+#include <melon/json2pb/message_codec.h>
+
+namespace json2pb {
+
+    MessageCodec::MessageCodec(const google::protobuf::Descriptor *descriptor)
+            : _descriptor(descriptor), _has_extension_ranges(descriptor->extension_range_count() > 0),
+              _slot_mask(0) {
+        const int field_count = descriptor->field_count();
+        _fields.resize(field_count);
+        std::string decoded;
+        for (int i = 0; i < field_count; ++i) {
+            const google::protobuf::FieldDescriptor *field = descriptor->field(i);
+            FieldCodec &f = _fields[i];
+            f.field = field;
+            f.name = (decode_name(field->name(), decoded) ? decoded : field->name());
+            f.hash = HashName(f.name.data(), f.name.size());
+            f.is_map = IsProtobufMap(field);
+            f.oneof_index = (field->containing_oneof() ?
+                             field->containing_oneof()->index() : -1);
+            if (field->is_required()) {
+                _required_fields.push_back(i);
+            }
+        }
+        // Keep the load factor under 0.5 so that probing ends quickly.
+        size_t nslot = 2;
+        while (nslot < (size_t) field_count * 2) {
+            nslot *= 2;
+        }
+        _slots.assign(nslot, -1);
+        _slot_mask = nslot - 1;
+        for (int i = 0; i < field_count; ++i) {
+            uint32_t s = _fields[i].hash & _slot_mask;
+            while (_slots[s] >= 0) {
+                s = (s + 1) & _slot_mask;
+            }
+            _slots[s] = i;
+        }
+    }
+
+    typedef std::unordered_map<const google::protobuf::Descriptor *,
+            const MessageCodec *> CodecMap;
+
+    static pthread_mutex_t s_codec_map_mutex = PTHREAD_MUTEX_INITIALIZER;
+    // Codecs are never deleted, just like descriptors of the generated pool.
+    static CodecMap *s_codec_map = NULL;
+
+    static const MessageCodec *GetGeneratedMessageCodec(
+            const google::protobuf::Descriptor *descriptor) {
+        // Lookups of the shared map are cached by each thread.
+        static thread_local CodecMap tls_codec_map;
+        CodecMap::const_iterator it = tls_codec_map.find(descriptor);
+        if (it != tls_codec_map.end()) {
+            return it->second;
+        }
+        const MessageCodec *codec = NULL;
+        pthread_mutex_lock(&s_codec_map_mutex);
+        if (s_codec_map == NULL) {
+            s_codec_map = new CodecMap;
+        }
+        const MessageCodec *&slot = (*s_codec_map)[descriptor];
+        if (slot == NULL) {
+            slot = new MessageCodec(descriptor);
+        }
+        codec = slot;
+        pthread_mutex_unlock(&s_codec_map_mutex);
+        tls_codec_map[descriptor] = codec;
+        return codec;
+    }
+
+    const MessageCodec *MessageCodecs::Get(const google::protobuf::Descriptor *descriptor) {
+        if (descriptor->file()->pool() ==
+            google::protobuf::DescriptorPool::generated_pool()) {
+            return GetGeneratedMessageCodec(descriptor);
+        }
+        for (size_t i = 0; i < _dynamic.size(); ++i) {
+            if (_dynamic[i]->descriptor() == descriptor) {
+                return _dynamic[i].get();
+            }
+        }
+        _dynamic.emplace_back(new MessageCodec(descriptor));
+        return _dynamic.back().get();
+    }
+
+} // namespace json2pb
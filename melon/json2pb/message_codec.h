@@ -0,0 +1,114 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+//
+
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <google/protobuf/descriptor.h>
+
+namespace json2pb {
+
+    struct FieldCodec {
+        const google::protobuf::FieldDescriptor *field;
+        // Name of the field in json, namely the decoded name.
+        std::string name;
+        uint32_t hash;
+        // IsProtobufMap(field)
+        bool is_map;
+        // Index of the containing oneof, -1 if the field is not in a oneof.
+        int oneof_index;
+    };
+
+    // What json2pb needs to know about fields of a message, which is compiled
+    // from the Descriptor once instead of being found by reflection and
+    // decode_name() for every converted message.
+    // Extensions are not included since they're registered at runtime.
+    class MessageCodec {
+    public:
+        explicit MessageCodec(const google::protobuf::Descriptor *descriptor);
+
+        const google::protobuf::Descriptor *descriptor() const { return _descriptor; }
+
+        bool has_extension_ranges() const { return _has_extension_ranges; }
+
+        // Fields in the order of the descriptor.
+        const std::vector<FieldCodec> &fields() const { return _fields; }
+
+        // Indexes of required fields.
+        const std::vector<int> &required_fields() const { return _required_fields; }
+
+        int oneof_count() const { return _descriptor->oneof_decl_count(); }
+
+        // Index of the field named `name' in json, -1 if not found.
+        int FindField(const char *name, size_t length) const;
+
+        static uint32_t HashName(const char *name, size_t length);
+
+    private:
+        const google::protobuf::Descriptor *_descriptor;
+        bool _has_extension_ranges;
+        std::vector<FieldCodec> _fields;
+        std::vector<int> _required_fields;
+        // Open-addressing table of indexes of _fields, -1 for empty slots.
+        std::vector<int> _slots;
+        uint32_t _slot_mask;
+    };
+
+    // Codecs of messages from the generated pool are compiled once and shared
+    // by all threads. Others are compiled per MessageCodecs since descriptors
+    // from other pools may be destroyed. Not thread-safe, create one for each
+    // conversion.
+    class MessageCodecs {
+    public:
+        const MessageCodec *Get(const google::protobuf::Descriptor *descriptor);
+
+    private:
+        std::vector<std::unique_ptr<MessageCodec> > _dynamic;
+    };
+
+    inline int MessageCodec::FindField(const char *name, size_t length) const {
+        const uint32_t hash = HashName(name, length);
+        for (uint32_t i = hash & _slot_mask;; i = (i + 1) & _slot_mask) {
+            const int index = _slots[i];
+            if (index < 0) {
+                return -1;
+            }
+            const FieldCodec &f = _fields[index];
+            if (f.hash == hash && f.name.size() == length &&
+                memcmp(f.name.data(), name, length) == 0) {
+                return index;
+            }
+        }
+    }
+
+    inline uint32_t MessageCodec::HashName(const char *name, size_t length) {
+        // FNV-1a
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < length; ++i) {
+            hash = (hash ^ (uint8_t) name[i]) * 16777619u;
+        }
+        return hash;
+    }
+
+} // namespace json2pb
@@ -26,8 +26,10 @@
 #include <google/protobuf/descriptor.h>
 #include <turbo/strings/escaping.h>
 #include <melon/json2pb/zero_copy_stream_writer.h>
+#include <melon/json2pb/iobuf_stream_writer.h>
 #include <melon/json2pb/encode_decode.h>
 #include <melon/json2pb/protobuf_map.h>
+#include <melon/json2pb/message_codec.h>
 #include <melon/json2pb/rapidjson.h>
 #include <melon/json2pb/pb_to_json.h>
 
@@ -39,7 +41,10 @@ namespace json2pb {
 
     class PbToJsonConverter {
     public:
-        explicit PbToJsonConverter(const Pb2JsonOptions &opt) : _option(opt) {}
+        // The conversion stops when `*output_failed' becomes true.
+        explicit PbToJsonConverter(const Pb2JsonOptions &opt,
+                                   const bool *output_failed = NULL)
+                : _option(opt), _output_failed(output_failed) {}
 
         template<typename Handler>
         bool Convert(const google::protobuf::Message &message, Handler &handler, bool root_msg = false);
@@ -47,6 +52,13 @@ namespace json2pb {
         const std::string &ErrorText() const { return _error; }
 
     private:
+        // Writes `field' of `message' named `name' unless it's not set.
+        template<typename Handler>
+        bool _NonMapFieldToJson(const google::protobuf::Message &message,
+                                const google::protobuf::FieldDescriptor *field,
+                                const std::string &name,
+                                Handler &handler);
+
         template<typename Handler>
         bool _PbFieldToJson(const google::protobuf::Message &message,
                             const google::protobuf::FieldDescriptor *field,
@@ -54,80 +66,80 @@ namespace json2pb {
 
         std::string _error;
         Pb2JsonOptions _option;
+        const bool *_output_failed;
+        MessageCodecs _codecs;
+        // Reused by encoding of bytes
+        std::string _base64_buf;
     };
 
     template<typename Handler>
     bool PbToJsonConverter::Convert(const google::protobuf::Message &message, Handler &handler, bool root_msg) {
+        if (_output_failed && *_output_failed) {
+            _error = "Fail to write json";
+            return false;
+        }
         const google::protobuf::Reflection *reflection = message.GetReflection();
         const google::protobuf::Descriptor *descriptor = message.GetDescriptor();
+        const MessageCodec *codec = _codecs.Get(descriptor);
+        const std::vector<FieldCodec> &field_codecs = codec->fields();
 
-        int ext_range_count = descriptor->extension_range_count();
-        int field_count = descriptor->field_count();
-        std::vector<const google::protobuf::FieldDescriptor *> fields;
-        fields.reserve(64);
-        for (int i = 0; i < ext_range_count; ++i) {
-            const google::protobuf::Descriptor::ExtensionRange *
-                    ext_range = descriptor->extension_range(i);
-            for (int tag_number = ext_range->start;
-                 tag_number < ext_range->end; ++tag_number) {
-                const google::protobuf::FieldDescriptor *field =
-                        reflection->FindKnownExtensionByNumber(tag_number);
-                if (field) {
-                    fields.push_back(field);
+        std::vector<const google::protobuf::FieldDescriptor *> ext_fields;
+        if (codec->has_extension_ranges()) {
+            int ext_range_count = descriptor->extension_range_count();
+            for (int i = 0; i < ext_range_count; ++i) {
+                const google::protobuf::Descriptor::ExtensionRange *
+                        ext_range = descriptor->extension_range(i);
+                for (int tag_number = ext_range->start;
+                     tag_number < ext_range->end; ++tag_number) {
+                    const google::protobuf::FieldDescriptor *field =
+                            reflection->FindKnownExtensionByNumber(tag_number);
+                    if (field) {
+                        ext_fields.push_back(field);
+                    }
                 }
             }
         }
-        std::vector<const google::protobuf::FieldDescriptor *> map_fields;
-        for (int i = 0; i < field_count; ++i) {
-            const google::protobuf::FieldDescriptor *field = descriptor->field(i);
-            if (_option.enable_protobuf_map && json2pb::IsProtobufMap(field)) {
-                map_fields.push_back(field);
-            } else {
-                fields.push_back(field);
-            }
-        }
 
         if (root_msg && _option.single_repeated_to_array) {
-            if (map_fields.empty() && fields.size() == 1 && fields.front()->is_repeated()) {
-                return _PbFieldToJson(message, fields.front(), handler);
+            if (ext_fields.empty() && field_codecs.size() == 1 &&
+                !(_option.enable_protobuf_map && field_codecs.front().is_map) &&
+                field_codecs.front().field->is_repeated()) {
+                return _PbFieldToJson(message, field_codecs.front().field, handler);
             }
         }
 
         handler.StartObject();
 
-        // Fill in non-map fields
+        // Fill in extensions, whose names are not in the codec.
         std::string field_name_str;
-        for (size_t i = 0; i < fields.size(); ++i) {
-            const google::protobuf::FieldDescriptor *field = fields[i];
-            if (!field->is_repeated() && !reflection->HasField(message, field)) {
-                // Field that has not been set
-                if (field->is_required()) {
-                    _error = "Missing required field: " + field->full_name();
-                    return false;
-                }
-                // Whether dumps default fields
-                if (!_option.always_print_primitive_fields) {
-                    continue;
-                }
-            } else if (field->is_repeated()
-                       && reflection->FieldSize(message, field) == 0
-                       && !_option.jsonify_empty_array) {
-                // Repeated field that has no entry
-                continue;
-            }
-
+        for (size_t i = 0; i < ext_fields.size(); ++i) {
+            const google::protobuf::FieldDescriptor *field = ext_fields[i];
             const std::string &orig_name = field->name();
             bool decoded = decode_name(orig_name, field_name_str);
             const std::string &name = decoded ? field_name_str : orig_name;
-            handler.Key(name.data(), name.size(), false);
-            if (!_PbFieldToJson(message, field, handler)) {
+            if (!_NonMapFieldToJson(message, field, name, handler)) {
+                return false;
+            }
+        }
+
+        // Fill in non-map fields
+        for (size_t i = 0; i < field_codecs.size(); ++i) {
+            const FieldCodec &f = field_codecs[i];
+            if (_option.enable_protobuf_map && f.is_map) {
+                continue;
+            }
+            if (!_NonMapFieldToJson(message, f.field, f.name, handler)) {
                 return false;
             }
         }
 
         // Fill in map fields
-        for (size_t i = 0; i < map_fields.size(); ++i) {
-            const google::protobuf::FieldDescriptor *map_desc = map_fields[i];
+        for (size_t i = 0; _option.enable_protobuf_map && i < field_codecs.size(); ++i) {
+            const FieldCodec &f = field_codecs[i];
+            if (!f.is_map) {
+                continue;
+            }
+            const google::protobuf::FieldDescriptor *map_desc = f.field;
             const google::protobuf::FieldDescriptor *key_desc =
                     map_desc->message_type()->field(json2pb::KEY_INDEX);
             const google::protobuf::FieldDescriptor *value_desc =
@@ -135,18 +147,15 @@ namespace json2pb {
 
             // Write a json object corresponding to hold protobuf map
             // such as {"key": value, ...}
-            const std::string &orig_name = map_desc->name();
-            bool decoded = decode_name(orig_name, field_name_str);
-            const std::string &name = decoded ? field_name_str : orig_name;
-            handler.Key(name.data(), name.size(), false);
+            handler.Key(f.name.data(), f.name.size(), false);
             handler.StartObject();
-            std::string entry_name;
+            std::string scratch;
             for (int j = 0; j < reflection->FieldSize(message, map_desc); ++j) {
                 const google::protobuf::Message &entry =
                         reflection->GetRepeatedMessage(message, map_desc, j);
                 const google::protobuf::Reflection *entry_reflection = entry.GetReflection();
-                entry_name = entry_reflection->GetStringReference(
-                        entry, key_desc, &entry_name);
+                const std::string &entry_name = entry_reflection->GetStringReference(
+                        entry, key_desc, &scratch);
                 handler.Key(entry_name.data(), entry_name.size(), false);
 
                 // Fill in entries into this json object
@@ -162,6 +171,33 @@ namespace json2pb {
         return true;
     }
 
+    template<typename Handler>
+    bool PbToJsonConverter::_NonMapFieldToJson(
+            const google::protobuf::Message &message,
+            const google::protobuf::FieldDescriptor *field,
+            const std::string &name,
+            Handler &handler) {
+        const google::protobuf::Reflection *reflection = message.GetReflection();
+        if (!field->is_repeated() && !reflection->HasField(message, field)) {
+            // Field that has not been set
+            if (field->is_required()) {
+                _error = "Missing required field: " + field->full_name();
+                return false;
+            }
+            // Whether dumps default fields
+            if (!_option.always_print_primitive_fields) {
+                return true;
+            }
+        } else if (field->is_repeated()
+                   && reflection->FieldSize(message, field) == 0
+                   && !_option.jsonify_empty_array) {
+            // Repeated field that has no entry
+            return true;
+        }
+        handler.Key(name.data(), name.size(), false);
+        return _PbFieldToJson(message, field, handler);
+    }
+
     template<typename Handler>
     bool PbToJsonConverter::_PbFieldToJson(
             const google::protobuf::Message &message,
@@ -207,9 +243,9 @@ namespace json2pb {
                                 message, field, index, &value);
                         if (field->type() == google::protobuf::FieldDescriptor::TYPE_BYTES
                             && _option.bytes_to_base64) {
-                            std::string value_decoded;
-                            turbo::base64_encode(value, &value_decoded);
-                            handler.String(value_decoded.data(), value_decoded.size(), false);
+                            _base64_buf.clear();
+                            turbo::base64_encode(value, &_base64_buf);
+                            handler.String(_base64_buf.data(), _base64_buf.size(), false);
                         } else {
                             handler.String(value.data(), value.size(), false);
                         }
@@ -220,9 +256,9 @@ namespace json2pb {
                     value = reflection->GetStringReference(message, field, &value);
                     if (field->type() == google::protobuf::FieldDescriptor::TYPE_BYTES
                         && _option.bytes_to_base64) {
-                        std::string value_decoded;
-                        turbo::base64_encode(value, &value_decoded);
-                        handler.String(value_decoded.data(), value_decoded.size(), false);
+                        _base64_buf.clear();
+                        turbo::base64_encode(value, &_base64_buf);
+                        handler.String(_base64_buf.data(), _base64_buf.size(), false);
                     } else {
                         handler.String(value.data(), value.size(), false);
                     }
@@ -286,8 +322,9 @@ namespace json2pb {
     template<typename OutputStream>
     bool ProtoMessageToJsonStream(const google::protobuf::Message &message,
                                   const Pb2JsonOptions &options,
-                                  OutputStream &os, std::string *error) {
-        PbToJsonConverter converter(options);
+                                  OutputStream &os, std::string *error,
+                                  const bool *output_failed = NULL) {
+        PbToJsonConverter converter(options, output_failed);
         bool succ = false;
         if (options.pretty_json) {
             MUTIL_RAPIDJSON_NAMESPACE::PrettyWriter<OutputStream> writer(os);
@@ -329,6 +366,35 @@ namespace json2pb {
         return json2pb::ProtoMessageToJsonStream(message, options, wrapper, error);
     }
 
+    bool ProtoMessageToJson(const google::protobuf::Message &message,
+                            mutil::IOBuf *json,
+                            const Pb2JsonOptions &options, std::string *error) {
+        IOBufStreamWriter wrapper;
+        if (!json2pb::ProtoMessageToJsonStream(message, options, wrapper, error)) {
+            return false;
+        }
+        wrapper.MoveTo(json);
+        return true;
+    }
+
+    bool ProtoMessageToJson(const google::protobuf::Message &message,
+                            JsonChunkWriter *writer,
+                            const Pb2JsonOptions &options, std::string *error) {
+        IOBufStreamWriter wrapper(writer);
+        if (!json2pb::ProtoMessageToJsonStream(message, options, wrapper, error,
+                                               &wrapper.failed())) {
+            return false;
+        }
+        wrapper.FlushChunk();
+        if (wrapper.failed()) {
+            if (error) {
+                *error = "Fail to write json";
+            }
+            return false;
+        }
+        return true;
+    }
+
     bool ProtoMessageToJson(const google::protobuf::Message &message,
                             google::protobuf::io::ZeroCopyOutputStream *stream,
                             std::string *error) {
@@ -23,6 +23,7 @@
 #include <string>
 #include <google/protobuf/message.h>
 #include <google/protobuf/io/zero_copy_stream.h> // ZeroCopyOutputStream
+#include <melon/utility/iobuf.h>
 
 namespace json2pb {
 
@@ -84,6 +85,39 @@ namespace json2pb {
                             const Pb2JsonOptions &options,
                             std::string *error = NULL);
 
+    // Append output to IOBuf instead of std::string.
+    bool ProtoMessageToJson(const google::protobuf::Message &message,
+                            mutil::IOBuf *json,
+                            const Pb2JsonOptions &options,
+                            std::string *error = NULL);
+
+    // Receives the json generated by ProtoMessageToJson chunk by chunk, so
+    // that json of any size can be generated and sent with bounded memory.
+    class JsonChunkWriter {
+    public:
+        explicit JsonChunkWriter(size_t chunk_size = 64 * 1024)
+                : _chunk_size(chunk_size) {}
+
+        virtual ~JsonChunkWriter() {}
+
+        // Chunks are (a little) larger than this size except the last one.
+        size_t chunk_size() const { return _chunk_size; }
+
+        // Write the next `chunk' of the json, which can be cut or swapped.
+        // Returns 0 on success, -1 to stop the conversion.
+        virtual int WriteChunk(mutil::IOBuf *chunk) = 0;
+
+    private:
+        size_t _chunk_size;
+    };
+
+    // Send output to `writer' in chunks. Chunks written before a failure are
+    // not revoked.
+    bool ProtoMessageToJson(const google::protobuf::Message &message,
+                            JsonChunkWriter *writer,
+                            const Pb2JsonOptions &options,
+                            std::string *error = NULL);
+
     // Using default Pb2JsonOptions.
     bool ProtoMessageToJson(const google::protobuf::Message &message,
                             std::string *json,
@@ -20,6 +20,7 @@
 
 #pragma once
 
+#include <string>
 #include <google/protobuf/io/zero_copy_stream.h> // ZeroCopyInputStream
 
 namespace json2pb {
@@ -78,6 +79,24 @@ namespace json2pb {
 
         size_t Tell() { return _nread; }
 
+        // Append the remaining bytes to `out' block by block.
+        // Returns true if all the bytes are appended, false if reading stops
+        // since `out' is longer than `max_size'.
+        bool ReadAll(std::string *out, size_t max_size = std::string::npos) {
+            do {
+                if (_data_size > 0) {
+                    out->append(_data, _data_size);
+                    _nread += _data_size;
+                    _data += _data_size;
+                    _data_size = 0;
+                    if (out->size() > max_size) {
+                        return false;
+                    }
+                }
+            } while (_stream->Next((const void **) &_data, &_data_size));
+            return true;
+        }
+
         void Put(char) {}
 
         void Flush() {}
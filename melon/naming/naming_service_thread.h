@@ -46,11 +46,13 @@ namespace melon {
 
     struct GetNamingServiceThreadOptions {
         GetNamingServiceThreadOptions()
-                : succeed_without_server(false), log_succeed_without_server(true), use_rdma(false) {}
+                : succeed_without_server(false), log_succeed_without_server(true), use_rdma(false),
+                  transport(NULL) {}
 
         bool succeed_without_server;
         bool log_succeed_without_server;
         bool use_rdma;
+        const Transport *transport;
         ChannelSignature channel_signature;
         std::shared_ptr<SocketSSLContext> ssl_ctx;
     };
@@ -20,6 +20,7 @@
 
 
 #include <inttypes.h>
+#include <algorithm>
 #include <gflags/gflags.h>
 #include <melon/utility/fd_guard.h>                 // fd_guard
 #include <melon/utility/fd_utility.h>               // make_close_on_exec
@@ -38,12 +39,14 @@ Acceptor::Acceptor(fiber_keytable_pool_t* pool)
     , _idle_timeout_sec(-1)
     , _close_idle_tid(INVALID_FIBER)
     , _listened_fd(-1)
-    , _acception_id(0)
+    , _nlistening(0)
     , _empty_cond(&_map_mutex)
     , _force_ssl(false)
     , _ssl_ctx(NULL) 
     , _use_rdma(false)
-    , _fiber_tag(FIBER_TAG_DEFAULT) {
+    , _transport(NULL)
+    , _fiber_tag(FIBER_TAG_DEFAULT)
+    , _edisp_index(-1) {
 }
 
 Acceptor::~Acceptor() {
@@ -95,18 +98,54 @@ int Acceptor::StartAccept(int listened_fd, int idle_timeout_sec,
     options.fd = listened_fd;
     options.user = this;
     options.fiber_tag = _fiber_tag;
+    options.event_dispatcher_index = _edisp_index;
     options.on_edge_triggered_events = OnNewConnections;
-    if (Socket::Create(options, &_acception_id) != 0) {
+    SocketId acception_id;
+    if (Socket::Create(options, &acception_id) != 0) {
         // Close-idle-socket thread will be stopped inside destructor
-        LOG(FATAL) << "Fail to create _acception_id";
+        LOG(FATAL) << "Fail to create acception_id";
         return -1;
     }
+    _acception_ids.clear();
+    _acception_ids.push_back(acception_id);
+    _nlistening = 1;
     
     _listened_fd = listened_fd;
     _status = RUNNING;
     return 0;
 }
 
+int Acceptor::AddListenedFd(int listened_fd, fiber_tag_t tag, int edisp_index) {
+    if (listened_fd < 0) {
+        LOG(ERROR) << "Invalid listened_fd=" << listened_fd;
+        return -1;
+    }
+    MELON_SCOPED_LOCK(_map_mutex);
+    if (_status != RUNNING) {
+        LOG(ERROR) << "Acceptor is not running: status=" << status();
+        return -1;
+    }
+    SocketOptions options;
+    options.fd = listened_fd;
+    options.user = this;
+    options.fiber_tag = tag;
+    options.event_dispatcher_index = edisp_index;
+    options.on_edge_triggered_events = OnNewConnections;
+    SocketId acception_id;
+    if (Socket::Create(options, &acception_id) != 0) {
+        LOG(ERROR) << "Fail to create acception_id";
+        return -1;
+    }
+    _acception_ids.push_back(acception_id);
+    ++_nlistening;
+    return 0;
+}
+
+size_t Acceptor::listened_fd_count() const {
+    MELON_SCOPED_LOCK(_map_mutex);
+    return _acception_ids.size();
+}
+
 void* Acceptor::CloseIdleConnections(void* arg) {
     Acceptor* am = static_cast<Acceptor*>(arg);
     std::vector<SocketId> checking_fds;
@@ -137,8 +176,15 @@ void Acceptor::StopAccept(int /*closewait_ms*/) {
         _status = STOPPING;
     }
 
-    // Don't set _acception_id to 0 because BeforeRecycle needs it.
-    Socket::SetFailed(_acception_id);
+    // Don't clear _acception_ids because BeforeRecycle needs them.
+    std::vector<SocketId> acception_ids;
+    {
+        MELON_SCOPED_LOCK(_map_mutex);
+        acception_ids = _acception_ids;
+    }
+    for (size_t i = 0; i < acception_ids.size(); ++i) {
+        Socket::SetFailed(acception_ids[i]);
+    }
 
     // SetFailed all existing connections. Connections added after this piece
     // of code will be SetFailed directly in OnNewConnectionsUntilEAGAIN
@@ -293,7 +339,11 @@ void Acceptor::OnNewConnectionsUntilEAGAIN(Socket* acception) {
         options.on_edge_triggered_events = InputMessenger::OnNewMessages;
 
         options.use_rdma = am->_use_rdma;
-        options.fiber_tag = am->_fiber_tag;
+        options.transport = am->_transport;
+        // Connections stay with the dispatcher of the listened fd, which
+        // the kernel selected with SO_REUSEPORT.
+        options.fiber_tag = acception->fiber_tag();
+        options.event_dispatcher_index = acception->event_dispatcher_index();
         if (Socket::Create(options, &socket_id) != 0) {
             LOG(ERROR) << "Fail to create Socket";
             continue;
@@ -345,12 +395,15 @@ void Acceptor::OnNewConnections(Socket* acception) {
 
 void Acceptor::BeforeRecycle(Socket* sock) {
     MELON_SCOPED_LOCK(_map_mutex);
-    if (sock->id() == _acception_id) {
-        // Set _listened_fd to -1 when acception socket has been recycled
-        // so that we are ensured no more events will arrive (and `Join'
-        // will return to its caller)
-        _listened_fd = -1;
-        _empty_cond.Broadcast();
+    if (std::find(_acception_ids.begin(), _acception_ids.end(), sock->id())
+        != _acception_ids.end()) {
+        // Set _listened_fd to -1 when all acception sockets have been
+        // recycled so that we are ensured no more events will arrive (and
+        // `Join' will return to its caller)
+        if (--_nlistening == 0) {
+            _listened_fd = -1;
+            _empty_cond.Broadcast();
+        }
         return;
     }
     // If a Socket could not be addressed shortly after its creation, it
@@ -59,6 +59,14 @@ public:
                     const std::shared_ptr<SocketSSLContext>& ssl_ctx,
                     bool force_ssl);
 
+    // [thread-safe] Accept connections from one more `listened_fd' after
+    // StartAccept() succeeded, typically another socket bound to the same
+    // port with SO_REUSEPORT. Events of the fd and connections accepted from
+    // it are handled by the `edisp_index'-th event dispatcher of `tag'.
+    // Ownership of `listened_fd' is transferred on success.
+    // Return 0 on success, -1 otherwise.
+    int AddListenedFd(int listened_fd, fiber_tag_t tag, int edisp_index);
+
     // [thread-safe] Stop accepting connections.
     // `closewait_ms' is not used anymore.
     void StopAccept(int /*closewait_ms*/);
@@ -69,6 +77,9 @@ public:
     // The parameter to StartAccept. Negative when acceptor is stopped.
     int listened_fd() const { return _listened_fd; }
 
+    // Number of fds accepted from, including the one passed to StartAccept.
+    size_t listened_fd_count() const;
+
     // Get number of existing connections.
     size_t ConnectionCount() const;
 
@@ -99,10 +110,13 @@ private:
     fiber_t _close_idle_tid;
 
     int _listened_fd;
-    // The Socket tso accept connections.
-    SocketId _acception_id;
+    // The Sockets to accept connections, the first one is created by
+    // StartAccept and others by AddListenedFd.
+    std::vector<SocketId> _acception_ids;
+    // Number of sockets in `_acception_ids' not recycled yet.
+    size_t _nlistening;
 
-    mutil::Mutex _map_mutex;
+    mutable mutil::Mutex _map_mutex;
     mutil::ConditionVariable _empty_cond;
     
     // The map containing all the accepted sockets
@@ -114,8 +128,16 @@ private:
     // Whether to use rdma or not
     bool _use_rdma;
 
+    // Prototype of the Transport of accepted connections, NULL to read and
+    // write the sockets directly
+    const Transport* _transport;
+
     // Acceptor belongs to this tag
     fiber_tag_t _fiber_tag;
+
+    // Index of the event dispatcher handling the fd passed to StartAccept
+    // and connections accepted from it, negative to hash by fd.
+    int _edisp_index;
 };
 
 } // namespace melon
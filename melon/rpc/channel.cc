@@ -36,6 +36,7 @@
 #include <melon/rpc/controller.h>
 #include <melon/rpc/channel.h>
 #include <melon/rpc/details/usercode_backup_pool.h>       // TooManyUserCode
+#include <melon/rpc/transport.h>                       // TransportExtension
 
 namespace melon {
 
@@ -53,9 +54,13 @@ ChannelOptions::ChannelOptions()
     , succeed_without_server(true)
     , log_succeed_without_server(true)
     , use_rdma(false)
+    , use_shm(false)
     , auth(nullptr)
     , retry_policy(nullptr)
     , ns_filter(nullptr)
+    , batch_max_calls(0)
+    , batch_window_us(200)
+    , min_pooled_connections(0)
 {}
 
 ChannelSSLOptions* ChannelOptions::mutable_ssl_options() {
@@ -65,9 +70,14 @@ ChannelSSLOptions* ChannelOptions::mutable_ssl_options() {
     return _ssl_options.get();
 }
 
+static const Transport* FindTransport(const std::string& name) {
+    return name.empty() ? nullptr : TransportExtension()->Find(name.c_str());
+}
+
 static ChannelSignature ComputeChannelSignature(const ChannelOptions& opt) {
     if (opt.auth == nullptr &&
         !opt.has_ssl_options() &&
+        opt.transport.empty() &&
         opt.connection_group.empty()) {
         // Returning zeroized result by default is more intuitive for users.
         return ChannelSignature();
@@ -107,6 +117,10 @@ static ChannelSignature ComputeChannelSignature(const ChannelOptions& opt) {
         if (opt.use_rdma) {
             buf.append("|rdma");
         }
+        if (!opt.transport.empty()) {
+            buf.append("|transport=");
+            buf.append(opt.transport);
+        }
         mutil::MurmurHash3_x64_128_Update(&mm_ctx, buf.data(), buf.size());
         buf.clear();
     
@@ -161,6 +175,20 @@ int Channel::InitChannelOptions(const ChannelOptions* options) {
         LOG(WARNING) << "Cannot use rdma since melon does not compile with rdma";
         return -1;
     }
+    if (_options.use_shm) {
+        _options.transport = "shm";
+    }
+    if (!_options.transport.empty()) {
+        if (TransportExtension()->Find(_options.transport.c_str()) == nullptr) {
+            LOG(ERROR) << "Unknown transport=" << _options.transport;
+            return -1;
+        }
+        if (_options.has_ssl_options()) {
+            LOG(ERROR) << "Cannot use transport=" << _options.transport
+                       << " with SSL";
+            return -1;
+        }
+    }
 
     _serialize_request = protocol->serialize_request;
     _pack_request = protocol->pack_request;
@@ -319,10 +347,18 @@ int Channel::InitSingle(const mutil::EndPoint& server_addr_and_port,
         return -1;
     }
     if (SocketMapInsert(SocketMapKey(server_addr_and_port, sig),
-                        &_server_id, ssl_ctx, _options.use_rdma) != 0) {
+                        &_server_id, ssl_ctx, _options.use_rdma,
+                        FindTransport(_options.transport)) != 0) {
         LOG(ERROR) << "Fail to insert into SocketMap";
         return -1;
     }
+    if (_options.connection_type == CONNECTION_TYPE_POOLED &&
+        _options.min_pooled_connections > 0) {
+        SocketUniquePtr ptr;
+        if (Socket::Address(_server_id, &ptr) == 0) {
+            ptr->WarmupPooledSockets(_options.min_pooled_connections);
+        }
+    }
     return 0;
 }
 
@@ -353,10 +389,14 @@ int Channel::Init(const char* ns_url,
         LOG(FATAL) << "Fail to new LoadBalancerWithNaming";
         return -1;        
     }
+    if (_options.connection_type == CONNECTION_TYPE_POOLED) {
+        lb->set_min_pooled_connections(_options.min_pooled_connections);
+    }
     GetNamingServiceThreadOptions ns_opt;
     ns_opt.succeed_without_server = _options.succeed_without_server;
     ns_opt.log_succeed_without_server = _options.log_succeed_without_server;
     ns_opt.use_rdma = _options.use_rdma;
+    ns_opt.transport = FindTransport(_options.transport);
     ns_opt.channel_signature = ComputeChannelSignature(_options);
     if (CreateSocketSSLContext(_options, &ns_opt.ssl_ctx) != 0) {
         return -1;
@@ -466,6 +506,8 @@ void Channel::CallMethod(const google::protobuf::MethodDescriptor* method,
     // overriding connect_timeout_ms does not make sense, just use the
     // one in ChannelOptions
     cntl->_connect_timeout_ms = _options.connect_timeout_ms;
+    cntl->_batch_max_calls = _options.batch_max_calls;
+    cntl->_batch_window_us = _options.batch_window_us;
     if (cntl->backup_request_ms() == UNSET_MAGIC_NUM) {
         cntl->set_backup_request_ms(_options.backup_request_ms);
     }
@@ -503,7 +545,8 @@ void Channel::CallMethod(const google::protobuf::MethodDescriptor* method,
         return cntl->HandleSendFailed();
     }
 
-    if (cntl->_request_stream != INVALID_STREAM_ID) {
+    if (cntl->_request_stream != INVALID_STREAM_ID ||
+        cntl->_grpc_stream != INVALID_GRPC_STREAM_ID) {
         // Currently we cannot handle retry and backup request correctly
         cntl->set_max_retry(0);
         cntl->set_backup_request_ms(-1);
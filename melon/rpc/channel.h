@@ -105,6 +105,18 @@ namespace melon {
         // Default: false
         bool use_rdma;
 
+        // Exchange data with servers on the same host through shared memory.
+        // Servers must be addressed by unix sockets (e.g. "unix:/path/x.sock")
+        // and started with ServerOptions.use_shm. Not compatible with SSL.
+        // Default: false
+        bool use_shm;
+
+        // Name of the Transport registered in TransportExtension() which
+        // moves bytes of connections instead of reading and writing the
+        // sockets directly. use_shm is same as "shm". Not compatible with SSL.
+        // Default: ""
+        std::string transport;
+
         // Turn on authentication for this channel if `auth' is not NULL.
         // Note `auth' will not be deleted by channel and must remain valid when
         // the channel is being used.
@@ -132,6 +144,27 @@ namespace melon {
         // Default: ""
         std::string connection_group;
 
+        // Coalesce melon_std requests to the same server over a "single"
+        // connection into one frame carrying up to so many calls. Each call
+        // keeps its own Controller, timeout and response; the server
+        // dispatches the calls of a batch concurrently. Not applied to
+        // requests with authentication or streams. <= 1 means no batching.
+        // Default: 0
+        int batch_max_calls;
+
+        // A batch is written after waiting so many microseconds for more
+        // calls even if it's not full. Only meaningful when batch_max_calls > 1.
+        // Default: 200
+        int32_t batch_window_us;
+
+        // Keep at least so many pooled connections to each server, connected
+        // in background when the channel is created or the naming service
+        // adds servers, reconnected after being broken and never closed as
+        // idle. Only meaningful for CONNECTION_TYPE_POOLED, capped by
+        // -max_connection_pool_size.
+        // Default: 0
+        int min_pooled_connections;
+
     private:
         // SSLOptions is large and not often used, allocate it on heap to
         // prevent ChannelOptions from being bloated in most cases.
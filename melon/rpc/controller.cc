@@ -22,6 +22,7 @@
 #include <signal.h>
 #include <openssl/md5.h>
 #include <google/protobuf/descriptor.h>
+#include <google/protobuf/arena.h>
 #include <gflags/gflags.h>
 #include <melon/fiber/fiber.h>
 #include <melon/utility/build_config.h>    // OS_MACOSX
@@ -44,7 +45,9 @@
 #include <melon/rpc/simple_data_pool.h>
 #include <melon/rpc/retry_policy.h>
 #include <melon/rpc/stream_impl.h>
+#include <melon/rpc/grpc/grpc_stream_impl.h>
 #include <melon/rpc/policy/streaming_rpc_protocol.h> // FIXME
+#include <melon/rpc/policy/melon_rpc_protocol.h>    // WriteMStdRequestInBatch
 #include <melon/rpc/dump/rpc_dump.h>
 #include <melon/rpc/details/usercode_backup_pool.h>  // RunUserCode
 #include <melon/rpc/mongo/mongo_service_adaptor.h>
@@ -237,6 +240,8 @@ namespace melon {
         delete _remote_stream_settings;
         _thrift_method_name.clear();
         _after_rpc_resp_fn = nullptr;
+        // Destroys request and response of the server-side call as well.
+        delete _arena;
 
         CHECK(_unfinished_call == NULL);
     }
@@ -272,6 +277,8 @@ namespace melon {
         _response_compress_type = COMPRESS_TYPE_NONE;
         _fail_limit = UNSET_MAGIC_NUM;
         _pipelined_count = 0;
+        _batch_max_calls = 0;
+        _batch_window_us = 0;
         _inheritable.Reset();
         _pchan_sub_count = 0;
         _response = NULL;
@@ -293,6 +300,8 @@ namespace melon {
         _response_user_fields = NULL;
         _request_stream = INVALID_STREAM_ID;
         _response_stream = INVALID_STREAM_ID;
+        _grpc_stream = INVALID_GRPC_STREAM_ID;
+        _arena = NULL;
         _remote_stream_settings = NULL;
         _auth_flags = 0;
     }
@@ -1209,6 +1218,14 @@ namespace melon {
                 packet_size = user_packet_guard->EstimatedByteSize();
             }
             rc = _current_call.sending_sock->Write(user_packet_guard, &wopt);
+        } else if (_batch_max_calls > 1 && using_auth == NULL &&
+                   _request_protocol == PROTOCOL_MELON_STD &&
+                   _connection_type == CONNECTION_TYPE_SINGLE &&
+                   _request_stream == INVALID_STREAM_ID) {
+            packet_size = packet.size();
+            rc = policy::WriteMStdRequestInBatch(
+                    _current_call.sending_sock.get(), &packet, wopt,
+                    _batch_max_calls, _batch_window_us);
         } else {
             packet_size = packet.size();
             rc = _current_call.sending_sock->Write(&packet, &wopt);
@@ -1372,6 +1389,10 @@ namespace melon {
     }
 
     void Controller::HandleStreamConnection(Socket *host_socket) {
+        if (_grpc_stream != INVALID_GRPC_STREAM_ID && FailedInline()) {
+            // Succeeded streams were bound when the response headers arrived.
+            GrpcStream::SetFailed(_grpc_stream, _error_code, ErrorText(), true);
+        }
         if (_request_stream == INVALID_STREAM_ID) {
             CHECK(!has_remote_stream());
             return;
@@ -43,6 +43,7 @@
 #include <melon/rpc/progressive_attachment.h>       // ProgressiveAttachment
 #include <melon/rpc/progressive_reader.h>           // ProgressiveReader
 #include <melon/rpc/grpc/grpc.h>
+#include <melon/rpc/grpc/grpc_stream.h>               // GrpcStreamId
 #include <melon/rpc/kvmap.h>
 #include <melon/utility/time.h>
 
@@ -124,6 +125,8 @@ namespace melon {
 
         friend class ParallelChannelDone;
 
+        friend class RedisClusterChannel;
+
         friend class ControllerPrivateAccessor;
 
         friend class ServerPrivateAccessor;
@@ -519,6 +522,14 @@ namespace melon {
         // Always NULL at client-side.
         const Server *server() const { return _server; }
 
+        // The arena where request and response of this RPC are allocated when
+        // ServerOptions.use_arena is on, NULL otherwise. The arena and all
+        // messages on it are destroyed along with the controller, so the
+        // messages can't be deleted or used after done->Run(). User may
+        // allocate other messages of the session on it as well.
+        // Always NULL at client-side.
+        google::protobuf::Arena *arena() const { return _arena; }
+
         // Get the data attached to current RPC session. The data is created by
         // ServerOptions.session_local_data_factory and reused between different
         // RPC. If factory is NULL, this method returns NULL.
@@ -859,6 +870,10 @@ namespace melon {
 
         uint32_t _pipelined_count;
 
+        // Copied from ChannelOptions, see batch_max_calls.
+        int _batch_max_calls;
+        int32_t _batch_window_us;
+
         // [Timeout related]
         int32_t _timeout_ms;
         int32_t _connect_timeout_ms;
@@ -929,6 +944,11 @@ namespace melon {
         StreamId _response_stream;
         // Defined at both sides
         StreamSettings *_remote_stream_settings;
+        // Messages of streaming gRPC calls, defined at both sides
+        GrpcStreamId _grpc_stream;
+
+        // Defined at server side, see arena()
+        google::protobuf::Arena *_arena;
 
         // Thrift method name, only used when thrift protocol enabled
         std::string _thrift_method_name;
@@ -123,6 +123,12 @@ public:
     StreamId request_stream() { return _cntl->_request_stream; }
     StreamId response_stream() { return _cntl->_response_stream; }
 
+    GrpcStreamId grpc_stream() const { return _cntl->_grpc_stream; }
+    void set_grpc_stream(GrpcStreamId id) { _cntl->_grpc_stream = id; }
+
+    // The arena is owned by the controller.
+    void set_arena(google::protobuf::Arena* arena) { _cntl->_arena = arena; }
+
     void set_method(const google::protobuf::MethodDescriptor* method) 
     { _cntl->_method = method; }
 
@@ -0,0 +1,270 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+//
+
+
+#include <melon/rpc/details/io_uring.h>
+
+#if defined(MELON_HAS_IO_URING)
+
+#include <errno.h>
+#include <algorithm>                               // std::max
+#include <stdlib.h>                                // posix_memalign
+#include <string.h>                                // memset
+#include <sys/mman.h>                              // mmap
+#include <sys/syscall.h>                           // __NR_io_uring_*
+#include <unistd.h>
+#include <turbo/log/logging.h>
+#include <melon/utility/fd_utility.h>              // make_close_on_exec
+#include <melon/utility/scoped_lock.h>
+
+namespace melon {
+
+    static int sys_io_uring_setup(unsigned entries, io_uring_params *p) {
+        return (int) syscall(__NR_io_uring_setup, entries, p);
+    }
+
+    static int sys_io_uring_enter(int fd, unsigned to_submit,
+                                  unsigned min_complete, unsigned flags) {
+        return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                             flags, NULL, 0);
+    }
+
+    static int sys_io_uring_register(int fd, unsigned opcode, void *arg,
+                                     unsigned nr_args) {
+        return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+    }
+
+    IOUring::IOUring()
+            : _ring_fd(-1), _sq_entries(0), _sqe_tail(0), _sqe_submitted(0), _sq_head(NULL), _sq_tail(NULL),
+              _sq_mask(NULL), _sq_array(NULL), _sqes(NULL), _cq_head(NULL), _cq_tail(NULL), _cq_mask(NULL),
+              _cqes(NULL), _sq_ptr(NULL), _sq_ptr_size(0), _cq_ptr(NULL), _cq_ptr_size(0), _sqes_size(0) {
+    }
+
+    IOUring::~IOUring() {
+        if (_sqes) {
+            munmap(_sqes, _sqes_size);
+        }
+        if (_cq_ptr && _cq_ptr != _sq_ptr) {
+            munmap(_cq_ptr, _cq_ptr_size);
+        }
+        if (_sq_ptr) {
+            munmap(_sq_ptr, _sq_ptr_size);
+        }
+        if (_ring_fd >= 0) {
+            close(_ring_fd);
+        }
+    }
+
+    int IOUring::Init(unsigned entries) {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        // Multishot operations post many CQEs per SQE, make CQ larger.
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = entries * 4;
+        const int fd = sys_io_uring_setup(entries, &p);
+        if (fd < 0) {
+            return errno;
+        }
+        _ring_fd = fd;
+        mutil::make_close_on_exec(_ring_fd);
+        if (!(p.features & IORING_FEAT_NODROP)) {
+            // Without NODROP, overflowed CQEs of multishot operations are
+            // lost silently which breaks edge-triggered semantics.
+            LOG(WARNING) << "io_uring does not support IORING_FEAT_NODROP";
+            return ENOTSUP;
+        }
+        _sq_ptr_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        _cq_ptr_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        const bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP);
+        if (single_mmap) {
+            _sq_ptr_size = std::max(_sq_ptr_size, _cq_ptr_size);
+            _cq_ptr_size = _sq_ptr_size;
+        }
+        void *sq_ptr = mmap(NULL, _sq_ptr_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQ_RING);
+        if (sq_ptr == MAP_FAILED) {
+            return errno;
+        }
+        _sq_ptr = sq_ptr;
+        if (single_mmap) {
+            _cq_ptr = _sq_ptr;
+        } else {
+            void *cq_ptr = mmap(NULL, _cq_ptr_size, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_CQ_RING);
+            if (cq_ptr == MAP_FAILED) {
+                return errno;
+            }
+            _cq_ptr = cq_ptr;
+        }
+        _sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+        void *sqes = mmap(NULL, _sqes_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) {
+            return errno;
+        }
+        _sqes = (io_uring_sqe *) sqes;
+
+        char *sq = (char *) _sq_ptr;
+        _sq_head = (unsigned *) (sq + p.sq_off.head);
+        _sq_tail = (unsigned *) (sq + p.sq_off.tail);
+        _sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+        _sq_array = (unsigned *) (sq + p.sq_off.array);
+        _sq_entries = p.sq_entries;
+        _sqe_tail = *_sq_tail;
+        _sqe_submitted = _sqe_tail;
+
+        char *cq = (char *) _cq_ptr;
+        _cq_head = (unsigned *) (cq + p.cq_off.head);
+        _cq_tail = (unsigned *) (cq + p.cq_off.tail);
+        _cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+        _cqes = (io_uring_cqe *) (cq + p.cq_off.cqes);
+        return 0;
+    }
+
+    io_uring_sqe *IOUring::GetSqe() {
+        const unsigned head = __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+        if (_sqe_tail - head >= _sq_entries) {
+            return NULL;
+        }
+        const unsigned idx = _sqe_tail & *_sq_mask;
+        io_uring_sqe *sqe = &_sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        _sq_array[idx] = idx;
+        ++_sqe_tail;
+        return sqe;
+    }
+
+    int IOUring::Submit() {
+        const unsigned to_submit = _sqe_tail - _sqe_submitted;
+        if (to_submit == 0) {
+            return 0;
+        }
+        __atomic_store_n(_sq_tail, _sqe_tail, __ATOMIC_RELEASE);
+        int rc;
+        do {
+            rc = sys_io_uring_enter(_ring_fd, to_submit, 0, 0);
+        } while (rc < 0 && errno == EINTR);
+        if (rc < 0) {
+            return -1;
+        }
+        _sqe_submitted += rc;
+        return rc;
+    }
+
+    int IOUring::WaitCqe() {
+        if (__atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE) != *_cq_head) {
+            return 0;
+        }
+        if (sys_io_uring_enter(_ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0) {
+            return -1;
+        }
+        return 0;
+    }
+
+    int IOUring::RegisterBufRing(io_uring_buf_ring *br, unsigned entries, int bgid) {
+        io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = (uint64_t) br;
+        reg.ring_entries = entries;
+        reg.bgid = bgid;
+        if (sys_io_uring_register(_ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            return errno;
+        }
+        return 0;
+    }
+
+    IOUringBufferPool::IOUringBufferPool()
+            : _bgid(-1), _nbuf(0), _buf_size(0), _bufs(NULL), _br(NULL), _br_size(0), _br_tail(0),
+              _noutstanding(0) {
+        pthread_mutex_init(&_mutex, NULL);
+    }
+
+    IOUringBufferPool::~IOUringBufferPool() {
+        if (_br) {
+            munmap(_br, _br_size);
+        }
+        free(_bufs);
+        pthread_mutex_destroy(&_mutex);
+    }
+
+    int IOUringBufferPool::Init(IOUring *ring, unsigned nbuf, unsigned buf_size, int bgid) {
+        if (nbuf == 0 || (nbuf & (nbuf - 1)) != 0 || nbuf > 32768) {
+            LOG(ERROR) << "Invalid number of buffers=" << nbuf;
+            return EINVAL;
+        }
+        // The ring must be page-aligned.
+        _br_size = nbuf * sizeof(io_uring_buf);
+        void *br = mmap(NULL, _br_size, PROT_READ | PROT_WRITE,
+                        MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        if (br == MAP_FAILED) {
+            return errno;
+        }
+        _br = (io_uring_buf_ring *) br;
+        void *bufs = NULL;
+        const int rc = posix_memalign(&bufs, 4096, (size_t) nbuf * buf_size);
+        if (rc != 0) {
+            return rc;
+        }
+        _bufs = (char *) bufs;
+        _nbuf = nbuf;
+        _buf_size = buf_size;
+        for (unsigned i = 0; i < nbuf; ++i) {
+            io_uring_buf *b = &_br->bufs[i];
+            b->addr = (uint64_t) (_bufs + (size_t) i * buf_size);
+            b->len = buf_size;
+            b->bid = i;
+        }
+        _br_tail = nbuf;
+        __atomic_store_n(&_br->tail, (uint16_t) _br_tail, __ATOMIC_RELEASE);
+        const int rc2 = ring->RegisterBufRing(_br, nbuf, bgid);
+        if (rc2 != 0) {
+            return rc2;
+        }
+        _bgid = bgid;
+        return 0;
+    }
+
+    void IOUringBufferPool::Recycle(unsigned bid) {
+        MELON_SCOPED_LOCK(_mutex);
+        io_uring_buf *b = &_br->bufs[_br_tail & (_nbuf - 1)];
+        b->addr = (uint64_t) (_bufs + (size_t) bid * _buf_size);
+        b->len = _buf_size;
+        b->bid = bid;
+        ++_br_tail;
+        __atomic_store_n(&_br->tail, (uint16_t) _br_tail, __ATOMIC_RELEASE);
+        _noutstanding.fetch_sub(1, mutil::memory_order_relaxed);
+    }
+
+    int IOUringBufferPool::AppendTo(unsigned bid, size_t len, mutil::IOBuf *out) {
+        if (bid >= _nbuf || len > _buf_size) {
+            LOG(ERROR) << "Invalid bid=" << bid << " len=" << len;
+            return -1;
+        }
+        _noutstanding.fetch_add(1, mutil::memory_order_relaxed);
+        if (out->append_user_data(_bufs + (size_t) bid * _buf_size, len,
+                                  [this, bid](void *) { Recycle(bid); }) != 0) {
+            Recycle(bid);
+            return -1;
+        }
+        return 0;
+    }
+
+} // namespace melon
+
+#endif  // MELON_HAS_IO_URING
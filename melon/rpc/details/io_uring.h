@@ -0,0 +1,167 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+//
+
+
+#pragma once
+
+#include <melon/utility/build_config.h>
+
+#if defined(OS_LINUX) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+// Multishot recv and provided buffer rings are declared by headers of
+// linux 6.0+, io_uring is not built with older headers and EventDispatcher
+// always runs on epoll.
+#if defined(IORING_RECV_MULTISHOT)
+#define MELON_HAS_IO_URING 1
+#endif
+
+#if defined(MELON_HAS_IO_URING)
+
+#include <pthread.h>
+#include <melon/utility/atomicops.h>
+#include <melon/utility/iobuf.h>
+#include <melon/utility/macros.h>
+
+namespace melon {
+
+    // A minimal io_uring built on raw syscalls so that melon does not depend
+    // on liburing. Submissions may come from any thread as long as they are
+    // serialized by the caller, completions must be reaped by one thread.
+    class IOUring {
+    public:
+        IOUring();
+
+        ~IOUring();
+
+        // Create the ring with at least `entries' submission entries.
+        // Returns 0 on success, errno otherwise (ENOSYS or EPERM when io_uring
+        // is not available).
+        int Init(unsigned entries);
+
+        int fd() const { return _ring_fd; }
+
+        // Get an empty SQE which will be submitted by next Submit(), NULL
+        // when the submission queue is full.
+        io_uring_sqe *GetSqe();
+
+        // Hand all SQEs got so far to the kernel.
+        // Returns number of submitted SQEs, -1 otherwise and errno is set.
+        int Submit();
+
+        // Block until at least one CQE is ready.
+        // Returns 0 on success, -1 otherwise and errno is set.
+        int WaitCqe();
+
+        // Call `fn(cqe, arg)' on ready CQEs in order and mark them as seen.
+        // Returns number of consumed CQEs.
+        template<typename Fn>
+        unsigned ForEachCqe(const Fn &fn);
+
+        // Register a ring of provided buffers as buffer group `bgid'.
+        // Returns 0 on success, errno otherwise.
+        int RegisterBufRing(io_uring_buf_ring *br, unsigned entries, int bgid);
+
+    private:
+        DISALLOW_COPY_AND_ASSIGN(IOUring);
+
+        int _ring_fd;
+        unsigned _sq_entries;
+        unsigned _sqe_tail;         // local tail, published by Submit()
+        unsigned _sqe_submitted;
+        unsigned *_sq_head;
+        unsigned *_sq_tail;
+        unsigned *_sq_mask;
+        unsigned *_sq_array;
+        io_uring_sqe *_sqes;
+        unsigned *_cq_head;
+        unsigned *_cq_tail;
+        unsigned *_cq_mask;
+        io_uring_cqe *_cqes;
+        void *_sq_ptr;
+        size_t _sq_ptr_size;
+        void *_cq_ptr;
+        size_t _cq_ptr_size;
+        size_t _sqes_size;
+    };
+
+    // Buffers provided to the kernel (IORING_REGISTER_PBUF_RING) so that
+    // multishot recv picks one per completion. Received data is wrapped
+    // into IOBuf without copying and the buffer goes back to the ring when
+    // the last IOBuf referencing it is destroyed.
+    class IOUringBufferPool {
+    public:
+        IOUringBufferPool();
+
+        ~IOUringBufferPool();
+
+        // Allocate `nbuf'(power of 2) buffers of `buf_size' bytes each and
+        // register them into `ring' as group `bgid'.
+        // Returns 0 on success, errno otherwise.
+        int Init(IOUring *ring, unsigned nbuf, unsigned buf_size, int bgid);
+
+        int bgid() const { return _bgid; }
+
+        unsigned nbuf() const { return _nbuf; }
+
+        // Append first `len' bytes of buffer `bid' to `out'. The buffer is
+        // returned to the kernel after `out' and its copies are released.
+        // Returns 0 on success, -1 otherwise.
+        int AppendTo(unsigned bid, size_t len, mutil::IOBuf *out);
+
+        // Number of buffers referenced by IOBufs right now.
+        int outstanding() const {
+            return _noutstanding.load(mutil::memory_order_relaxed);
+        }
+
+    private:
+        DISALLOW_COPY_AND_ASSIGN(IOUringBufferPool);
+
+        // Give buffer `bid' back to the kernel. Can be called in any thread.
+        void Recycle(unsigned bid);
+
+        int _bgid;
+        unsigned _nbuf;
+        unsigned _buf_size;
+        char *_bufs;
+        io_uring_buf_ring *_br;
+        size_t _br_size;
+        unsigned _br_tail;
+        pthread_mutex_t _mutex;     // protects _br_tail
+        mutil::atomic<int> _noutstanding;
+    };
+
+    template<typename Fn>
+    unsigned IOUring::ForEachCqe(const Fn &fn) {
+        unsigned head = *_cq_head;
+        const unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+        const unsigned n = tail - head;
+        for (; head != tail; ++head) {
+            fn(&_cqes[head & *_cq_mask]);
+        }
+        __atomic_store_n(_cq_head, tail, __ATOMIC_RELEASE);
+        return n;
+    }
+
+} // namespace melon
+
+#endif  // MELON_HAS_IO_URING
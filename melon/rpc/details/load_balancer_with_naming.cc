@@ -50,6 +50,14 @@ int LoadBalancerWithNaming::Init(const char* ns_url, const char* lb_name,
 void LoadBalancerWithNaming::OnAddedServers(
     const std::vector<ServerId>& servers) {
     AddServersInBatch(servers);
+    if (_min_pooled_connections > 0) {
+        for (size_t i = 0; i < servers.size(); ++i) {
+            SocketUniquePtr ptr;
+            if (Socket::Address(servers[i].id, &ptr) == 0) {
+                ptr->WarmupPooledSockets(_min_pooled_connections);
+            }
+        }
+    }
 }
 
 void LoadBalancerWithNaming::OnRemovedServers(
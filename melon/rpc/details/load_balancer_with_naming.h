@@ -31,9 +31,13 @@ namespace melon {
 class LoadBalancerWithNaming : public SharedLoadBalancer,
                                public NamingServiceWatcher {
 public:
-    LoadBalancerWithNaming() {}
+    LoadBalancerWithNaming() : _min_pooled_connections(0) {}
     ~LoadBalancerWithNaming();
 
+    // Connect so many pooled connections to each added server in background.
+    // Must be called before Init().
+    void set_min_pooled_connections(int n) { _min_pooled_connections = n; }
+
     int Init(const char* ns_url, const char* lb_name,
              const NamingServiceFilter* filter,
              const GetNamingServiceThreadOptions* options);
@@ -45,6 +49,7 @@ public:
 
 private:
     mutil::intrusive_ptr<NamingServiceThread> _nsthread_ptr;
+    int _min_pooled_connections;
 };
 
 } // namespace melon
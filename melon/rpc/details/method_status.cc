@@ -20,6 +20,7 @@
 
 
 #include <limits>
+#include <google/protobuf/arena.h>
 #include <melon/utility/macros.h>
 #include <melon/rpc/controller.h>
 #include <melon/rpc/details/server_private_accessor.h>
@@ -41,6 +42,7 @@ static int cast_cl(void* arg) {
 
 MethodStatus::MethodStatus()
     : _nconcurrency(0)
+    , _arena_space_used(0)
     , _nconcurrency_var(cast_int, &_nconcurrency)
     , _eps_var(&_nerror_var)
     , _max_concurrency_var(cast_cl, &_cl)
@@ -154,6 +156,9 @@ void MethodStatus::SetConcurrencyLimiter(ConcurrencyLimiter* cl) {
 
 ConcurrencyRemover::~ConcurrencyRemover() {
     if (_status) {
+        if (_c->arena()) {
+            _status->OnArenaUsed(_c->arena()->SpaceUsed());
+        }
         _status->OnResponded(_c->ErrorCode(), mutil::cpuwide_time_us() - _received_us);
         _status = NULL;
     }
@@ -18,6 +18,7 @@
 //
 #pragma once
 
+#include <algorithm>                          // std::min
 #include <melon/utility/macros.h>                  // DISALLOW_COPY_AND_ASSIGN
 #include <melon/var/var.h>                    // vars
 #include <melon/rpc/describable.h>
@@ -28,6 +29,10 @@ namespace melon {
 
 class Controller;
 class Server;
+
+// Arenas of calls with huge messages don't start with huge blocks.
+static const size_t MAX_ARENA_START_BLOCK_SIZE = 1024 * 1024;
+
 // Record accessing stats of a method.
 class MethodStatus : public Describable {
 public:
@@ -57,6 +62,15 @@ public:
     // Current max_concurrency of the method.
     int MaxConcurrency() const { return _cl ? _cl->MaxConcurrency() : 0; }
 
+    // Size of the first block of arenas where messages of the method are
+    // allocated(ServerOptions.use_arena), following space used by arenas of
+    // recent calls.
+    size_t arena_start_block_size() const;
+
+    // Call this with space used by the arena of a call before the arena
+    // is destroyed.
+    void OnArenaUsed(size_t space_used);
+
 private:
 friend class Server;
     DISALLOW_COPY_AND_ASSIGN(MethodStatus);
@@ -67,6 +81,8 @@ friend class Server;
 
     std::unique_ptr<ConcurrencyLimiter> _cl;
     mutil::atomic<int> _nconcurrency;
+    // Moving average of space used by arenas of calls.
+    mutil::atomic<size_t> _arena_space_used;
     melon::var::Adder<int64_t>  _nerror_var;
     melon::var::LatencyRecorder _latency_rec;
     melon::var::PassiveStatus<int>  _nconcurrency_var;
@@ -111,4 +127,19 @@ inline void MethodStatus::OnResponded(int error_code, int64_t latency) {
     }
 }
 
+inline size_t MethodStatus::arena_start_block_size() const {
+    const size_t used = _arena_space_used.load(mutil::memory_order_relaxed);
+    // Leave room for headers of the arena and the block.
+    return std::min(used + used / 8 + 64, MAX_ARENA_START_BLOCK_SIZE);
+}
+
+inline void MethodStatus::OnArenaUsed(size_t space_used) {
+    // Not a strict average: concurrent updates may lose a sample, which
+    // does no harm to a size hint.
+    const size_t avg = _arena_space_used.load(mutil::memory_order_relaxed);
+    const size_t new_avg = (avg == 0 ? space_used :
+                            avg - avg / 8 + space_used / 8);
+    _arena_space_used.store(new_avg, mutil::memory_order_relaxed);
+}
+
 } // namespace melon
@@ -0,0 +1,479 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+//
+
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <melon/utility/build_config.h>
+#if defined(OS_LINUX)
+#include <sys/eventfd.h>
+#endif
+#include <algorithm>
+#include <atomic>
+#include <gflags/gflags.h>
+#include <turbo/log/logging.h>
+#include <melon/utility/fd_guard.h>
+#include <melon/utility/endpoint.h>
+#include <melon/rpc/socket.h>
+#include <melon/rpc/reloadable_flags.h>
+#include <melon/rpc/details/shm_transport.h>
+
+namespace melon {
+
+    DEFINE_int32(shm_ring_size, 4 * 1024 * 1024,
+                 "Bytes of each direction of shared-memory connections, must be "
+                 "a power of 2");
+
+    static bool ValidateShmRingSize(const char *, int32_t val) {
+        return val >= 4096 && (val & (val - 1)) == 0;
+    }
+
+    MELON_VALIDATE_GFLAG(shm_ring_size, ValidateShmRingSize);
+
+    static const char SHM_HELLO_MAGIC[4] = {'M', 'S', 'H', 'M'};
+    static const uint32_t SHM_VERSION = 1;
+    static const size_t SHM_HELLO_SIZE = 16;
+    static const size_t SHM_MAX_RING_SIZE = 1024 * 1024 * 1024;
+    static const int SHM_NFDS = 3;
+#if defined(OS_LINUX)
+    static const int SHM_REQUIRED_SEALS = F_SEAL_SHRINK | F_SEAL_GROW;
+#endif
+
+    // Positions only increase, the offset in data is `pos & (ring_size - 1)'.
+    // Fields written by different sides are on different cachelines.
+    struct ShmRing {
+        alignas(64) std::atomic<uint64_t> head;   // written by the writer
+        alignas(64) std::atomic<uint64_t> tail;   // written by the reader
+        alignas(64) std::atomic<int> reader_waiting;
+        std::atomic<int> writer_waiting;
+    };
+
+    // [ShmRegion][data of rings[0]][data of rings[1]]
+    // rings[0] carries bytes from client to server, rings[1] reversely.
+    struct ShmRegion {
+        ShmRing rings[2];
+    };
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                  "Atomics in shared memory must be lock-free");
+
+    ShmTransport::ShmTransport()
+            : _socket(NULL), _server_side(false), _state(SHM_OFF)
+            , _region(NULL), _region_size(0), _ring_size(0)
+            , _in(NULL), _out(NULL), _in_data(NULL), _out_data(NULL)
+            , _self_efd(-1), _peer_efd(-1), _nring(0), _nwaitwritable(0) {
+    }
+
+    ShmTransport::ShmTransport(Socket *s, bool server_side)
+            : _socket(s), _server_side(server_side)
+            , _state(server_side ? SHM_PENDING : SHM_OFF)
+            , _region(NULL), _region_size(0), _ring_size(0)
+            , _in(NULL), _out(NULL), _in_data(NULL), _out_data(NULL)
+            , _self_efd(-1), _peer_efd(-1), _nring(0), _nwaitwritable(0) {
+    }
+
+    ShmTransport::~ShmTransport() {
+        Reset();
+    }
+
+    void ShmTransport::Reset() {
+        if (_self_efd >= 0) {
+            RemoveInputFd(_socket, _self_efd);
+            close(_self_efd);
+            _self_efd = -1;
+        }
+        if (_peer_efd >= 0) {
+            close(_peer_efd);
+            _peer_efd = -1;
+        }
+        if (_region != NULL) {
+            munmap(_region, _region_size);
+            _region = NULL;
+        }
+        _in = NULL;
+        _out = NULL;
+        _in_data = NULL;
+        _out_data = NULL;
+        // Server sockets are never reconnected.
+        _state = SHM_OFF;
+    }
+
+    int ShmTransport::MapRegion(int memfd, size_t ring_size, bool server_side) {
+        const size_t region_size = sizeof(ShmRegion) + 2 * ring_size;
+        struct stat st;
+        if (fstat(memfd, &st) != 0) {
+            return -1;
+        }
+        if ((size_t) st.st_size < region_size) {
+            errno = EPROTO;
+            return -1;
+        }
+        void *mem = mmap(NULL, region_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+        if (mem == MAP_FAILED) {
+            return -1;
+        }
+        _region = mem;
+        _region_size = region_size;
+        _ring_size = ring_size;
+        ShmRegion *r = static_cast<ShmRegion *>(mem);
+        char *data0 = static_cast<char *>(mem) + sizeof(ShmRegion);
+        char *data1 = data0 + ring_size;
+        if (server_side) {
+            _in = &r->rings[0];
+            _in_data = data0;
+            _out = &r->rings[1];
+            _out_data = data1;
+        } else {
+            _out = &r->rings[0];
+            _out_data = data0;
+            _in = &r->rings[1];
+            _in_data = data1;
+        }
+        return 0;
+    }
+
+    Transport *ShmTransport::New(Socket *socket, bool server_side) const {
+        return new ShmTransport(socket, server_side);
+    }
+
+    int ShmTransport::StartClient(int fd) {
+#if defined(OS_LINUX)
+        Reset();
+        const size_t ring_size = FLAGS_shm_ring_size;
+        mutil::fd_guard memfd(memfd_create("melon_shm", MFD_CLOEXEC | MFD_ALLOW_SEALING));
+        if (memfd < 0) {
+            return -1;
+        }
+        if (ftruncate(memfd, sizeof(ShmRegion) + 2 * ring_size) != 0) {
+            return -1;
+        }
+        // The size is fixed so that the peer can't SIGBUS us by truncating.
+        if (fcntl(memfd, F_ADD_SEALS, SHM_REQUIRED_SEALS) != 0) {
+            return -1;
+        }
+        if (MapRegion(memfd, ring_size, false) != 0) {
+            return -1;
+        }
+        // Readers start sleeping so that the first bytes ring the doorbell
+        // even if the peer has not started watching it.
+        ShmRegion *r = static_cast<ShmRegion *>(_region);
+        for (int i = 0; i < 2; ++i) {
+            r->rings[i].head.store(0, std::memory_order_relaxed);
+            r->rings[i].tail.store(0, std::memory_order_relaxed);
+            r->rings[i].reader_waiting.store(1, std::memory_order_relaxed);
+            r->rings[i].writer_waiting.store(0, std::memory_order_relaxed);
+        }
+        mutil::fd_guard server_efd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+        mutil::fd_guard client_efd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+        if (server_efd < 0 || client_efd < 0) {
+            return -1;
+        }
+
+        char hello[SHM_HELLO_SIZE];
+        memcpy(hello, SHM_HELLO_MAGIC, sizeof(SHM_HELLO_MAGIC));
+        const uint32_t version = SHM_VERSION;
+        const uint64_t size64 = ring_size;
+        memcpy(hello + 4, &version, sizeof(version));
+        memcpy(hello + 8, &size64, sizeof(size64));
+        iovec iov = {hello, sizeof(hello)};
+        char control[CMSG_SPACE(sizeof(int) * SHM_NFDS)];
+        memset(control, 0, sizeof(control));
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * SHM_NFDS);
+        const int fds[SHM_NFDS] = {memfd, server_efd, client_efd};
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+        // The socket buffer of a just connected unix socket always has room
+        // for the hello.
+        const ssize_t nw = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (nw != (ssize_t) sizeof(hello)) {
+            if (nw >= 0) {
+                errno = EPROTO;
+            }
+            return -1;
+        }
+        if (AddInputFd(_socket, client_efd) != 0) {
+            return -1;
+        }
+        _self_efd = client_efd.release();
+        _peer_efd = server_efd.release();
+        _state = SHM_ON;
+        return 0;
+#else
+        (void) fd;
+        errno = ENOTSUP;
+        return -1;
+#endif
+    }
+
+    ssize_t ShmTransport::AcceptHello(int fd) {
+        char hello[SHM_HELLO_SIZE];
+        ssize_t nr = recv(fd, hello, sizeof(SHM_HELLO_MAGIC), MSG_PEEK);
+        if (nr <= 0) {
+            return nr;
+        }
+        if (memcmp(hello, SHM_HELLO_MAGIC, nr) != 0) {
+            // Not from a shm client, read it as a plain connection.
+            _state = SHM_OFF;
+            return 1;
+        }
+        if (nr < (ssize_t) sizeof(SHM_HELLO_MAGIC)) {
+            errno = EAGAIN;
+            return -1;
+        }
+        iovec iov = {hello, sizeof(hello)};
+        char control[CMSG_SPACE(sizeof(int) * SHM_NFDS)];
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        nr = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+        if (nr <= 0) {
+            return nr;
+        }
+        int fds[SHM_NFDS] = {-1, -1, -1};
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SCM_RIGHTS &&
+            cmsg->cmsg_len == CMSG_LEN(sizeof(fds))) {
+            memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+        }
+        mutil::fd_guard memfd(fds[0]);
+        mutil::fd_guard server_efd(fds[1]);
+        mutil::fd_guard client_efd(fds[2]);
+        uint32_t version = 0;
+        uint64_t ring_size = 0;
+        memcpy(&version, hello + 4, sizeof(version));
+        memcpy(&ring_size, hello + 8, sizeof(ring_size));
+        if (nr != (ssize_t) sizeof(hello) || (msg.msg_flags & MSG_CTRUNC) ||
+            memfd < 0 || server_efd < 0 || client_efd < 0 ||
+            version != SHM_VERSION || ring_size < 4096 ||
+            ring_size > SHM_MAX_RING_SIZE || (ring_size & (ring_size - 1)) != 0) {
+            LOG(WARNING) << "Invalid shm hello from " << _socket->remote_side();
+            errno = EPROTO;
+            return -1;
+        }
+#if defined(OS_LINUX)
+        // The region is accessed without checking its size again, it must
+        // not be resizable by the peer.
+        const int seals = fcntl(memfd, F_GET_SEALS);
+        if (seals < 0 || (seals & SHM_REQUIRED_SEALS) != SHM_REQUIRED_SEALS) {
+            LOG(WARNING) << "Unsealed shm region from " << _socket->remote_side();
+            errno = EPROTO;
+            return -1;
+        }
+#endif
+        if (MapRegion(memfd, ring_size, true) != 0 ||
+            AddInputFd(_socket, server_efd) != 0) {
+            const int saved_errno = errno;
+            PLOG(WARNING) << "Fail to set up shm connection from "
+                          << _socket->remote_side();
+            Reset();
+            errno = saved_errno;
+            return -1;
+        }
+        _self_efd = server_efd.release();
+        _peer_efd = client_efd.release();
+        _state = SHM_ON;
+        return 1;
+    }
+
+    void ShmTransport::RingPeer() {
+        const uint64_t one = 1;
+        ++_nring;
+        // Fails only when the counter overflows, which means that the peer
+        // has been waken up already.
+        ssize_t rc = write(_peer_efd, &one, sizeof(one));
+        (void) rc;
+    }
+
+    ssize_t ShmTransport::CutMultipleIntoRing(mutil::IOBuf **pieces, size_t count) {
+        if (_socket->Failed()) {
+            errno = EPIPE;
+            return -1;
+        }
+        const uint64_t mask = _ring_size - 1;
+        const uint64_t head = _out->head.load(std::memory_order_relaxed);
+        uint64_t tail = _out->tail.load(std::memory_order_acquire);
+        if (head - tail == _ring_size) {
+            // Ask the reader to ring us after consuming, and check again in
+            // case it consumed before seeing the flag.
+            _out->writer_waiting.store(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            tail = _out->tail.load(std::memory_order_acquire);
+            if (head - tail == _ring_size) {
+                errno = EAGAIN;
+                return -1;
+            }
+        }
+        if (head - tail > _ring_size) {
+            // `tail' is written by the peer, never trust it.
+            LOG(WARNING) << "Invalid shm tail=" << tail << " head=" << head
+                         << " from " << _socket->remote_side();
+            errno = EPROTO;
+            return -1;
+        }
+        size_t space = _ring_size - (head - tail);
+        uint64_t pos = head;
+        for (size_t i = 0; i < count && space > 0; ++i) {
+            mutil::IOBuf *buf = pieces[i];
+            size_t ncut = 0;
+            for (size_t j = 0; j < buf->backing_block_num() && space > 0; ++j) {
+                const mutil::StringPiece blk = buf->backing_block(j);
+                const size_t len = std::min(blk.size(), space);
+                const size_t off = pos & mask;
+                const size_t first = std::min(len, (size_t) (_ring_size - off));
+                memcpy(_out_data + off, blk.data(), first);
+                memcpy(_out_data, blk.data() + first, len - first);
+                pos += len;
+                space -= len;
+                ncut += len;
+            }
+            buf->pop_front(ncut);
+        }
+        _out->head.store(pos, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_out->reader_waiting.load(std::memory_order_relaxed) &&
+            _out->reader_waiting.exchange(0, std::memory_order_relaxed)) {
+            RingPeer();
+        }
+        return pos - head;
+    }
+
+    ssize_t ShmTransport::AppendFromRing(mutil::IOBuf *buf, size_t size_hint) {
+        uint64_t counter = 0;
+        if (read(_self_efd, &counter, sizeof(counter)) > 0) {
+            // The peer may ring for space in the ring we write.
+            SignalWritable(_socket);
+        }
+        const uint64_t tail = _in->tail.load(std::memory_order_relaxed);
+        uint64_t head = _in->head.load(std::memory_order_acquire);
+        if (head == tail) {
+            _in->reader_waiting.store(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            head = _in->head.load(std::memory_order_acquire);
+            if (head == tail) {
+                // Nothing to read, the unix socket tells if the peer closed.
+                char c;
+                const ssize_t nr = recv(_socket->fd(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+                if (nr > 0) {
+                    errno = EPROTO;
+                    return -1;
+                }
+                return nr;
+            }
+        }
+        if (head - tail > _ring_size) {
+            // `head' is written by the peer, never trust it.
+            LOG(WARNING) << "Invalid shm head=" << head << " tail=" << tail
+                         << " from " << _socket->remote_side();
+            errno = EPROTO;
+            return -1;
+        }
+        const uint64_t mask = _ring_size - 1;
+        const size_t len = std::min((size_t) (head - tail), size_hint);
+        const size_t off = tail & mask;
+        const size_t first = std::min(len, (size_t) (_ring_size - off));
+        buf->append(_in_data + off, first);
+        if (len > first) {
+            buf->append(_in_data, len - first);
+        }
+        _in->tail.store(tail + len, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_in->writer_waiting.load(std::memory_order_relaxed) &&
+            _in->writer_waiting.exchange(0, std::memory_order_relaxed)) {
+            RingPeer();
+        }
+        return len;
+    }
+
+    ssize_t ShmTransport::Read(size_t size_hint) {
+        if (_state == SHM_PENDING) {
+            const ssize_t nr = AcceptHello(_socket->fd());
+            if (nr <= 0) {
+                return nr;
+            }
+        }
+        if (_state == SHM_ON) {
+            MarkPlain(_socket);
+            return AppendFromRing(read_buf(_socket), size_hint);
+        }
+        return ReadFromFd(_socket, size_hint);
+    }
+
+    ssize_t ShmTransport::Write(mutil::IOBuf **pieces, size_t count) {
+        if (_state == SHM_ON) {
+            return CutMultipleIntoRing(pieces, count);
+        }
+        return WriteToFd(_socket, pieces, count);
+    }
+
+    int ShmTransport::WaitWritable(const timespec *abstime) {
+        if (_state != SHM_ON) {
+            return WaitFdWritable(_socket, abstime);
+        }
+        ++_nwaitwritable;
+        const int expected_version = WritableVersion(_socket);
+        const uint64_t head = _out->head.load(std::memory_order_relaxed);
+        if (head - _out->tail.load(std::memory_order_acquire) < _ring_size) {
+            return 0;
+        }
+        return WaitWritableSignal(_socket, expected_version, abstime);
+    }
+
+    void ShmTransport::Describe(std::ostream &os) const {
+        os << "state=" << (_state == SHM_ON ? "on" : (_state == SHM_PENDING ? "pending" : "off"));
+        if (_state == SHM_ON) {
+            os << " ring_size=" << _ring_size
+               << " out_bytes=" << (_out->head.load(std::memory_order_relaxed)
+                                    - _out->tail.load(std::memory_order_relaxed))
+               << " in_bytes=" << (_in->head.load(std::memory_order_relaxed)
+                                   - _in->tail.load(std::memory_order_relaxed))
+               << " nring=" << _nring
+               << " nwaitwritable=" << _nwaitwritable;
+        }
+    }
+
+    void ShmTransport::StartConnect(void (*done)(int err, void *data), void *data) {
+        if (mutil::get_endpoint_type(_socket->remote_side()) != AF_UNIX) {
+            LOG(ERROR) << "Shm connections must be made by unix sockets, "
+                       << _socket->remote_side() << " is not";
+            done(EPROTONOSUPPORT, data);
+            return;
+        }
+        const int rc = StartClient(_socket->fd());
+        done(rc == 0 ? 0 : (errno ? errno : EPROTO), data);
+    }
+
+} // namespace melon
@@ -0,0 +1,125 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+//
+
+
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+#include <ostream>
+#include <melon/utility/iobuf.h>
+#include <melon/utility/macros.h>
+#include <melon/rpc/transport.h>
+
+namespace melon {
+
+    struct ShmRing;
+
+    // Transport of a connection between two processes on the same host,
+    // registered as "shm". Bytes are exchanged through a pair of ring
+    // buffers in a memfd mapped by both sides, so that a write or read costs
+    // one memcpy and no syscalls while the peer is busy. An eventfd per side
+    // is rung only when the reader of a ring sleeps or the writer waits for
+    // space.
+    // The unix socket which establishes the connection passes the memfd and
+    // the eventfds (SCM_RIGHTS) in a hello message, then only detects close
+    // of the peer. Accepted connections without the hello are read and
+    // written as plain connections.
+    class ShmTransport : public Transport {
+    public:
+        // The prototype.
+        ShmTransport();
+
+        // `server_side' transports wait for the hello from the client.
+        ShmTransport(Socket *s, bool server_side);
+
+        ~ShmTransport();
+
+        Transport *New(Socket *socket, bool server_side) const override;
+
+        void StartConnect(void (*done)(int err, void *data), void *data) override;
+
+        ssize_t Read(size_t size_hint) override;
+
+        ssize_t Write(mutil::IOBuf **pieces, size_t count) override;
+
+        int WaitWritable(const timespec *abstime) override;
+
+        void Reset() override;
+
+        void Describe(std::ostream &os) const override;
+
+        // True if data of the socket go through shared memory.
+        bool active() const { return _state == SHM_ON; }
+
+        // True if the server side is waiting for the hello message.
+        bool pending() const { return _state == SHM_PENDING; }
+
+    private:
+        DISALLOW_COPY_AND_ASSIGN(ShmTransport);
+
+        enum ShmState {
+            SHM_OFF,
+            SHM_PENDING,
+            SHM_ON
+        };
+
+        // Create the shared memory and doorbells of a new connection and send
+        // them to the server through the connected unix socket `fd'.
+        // Returns 0 on success, -1 otherwise and errno is set.
+        int StartClient(int fd);
+
+        // Receive the hello message from `fd'. Connections not starting with
+        // the hello are left untouched and read as plain connections.
+        // Returns 1 when the type of the connection is known, 0 on EOF, -1
+        // otherwise and errno is set (EAGAIN if more data is needed).
+        ssize_t AcceptHello(int fd);
+
+        // Move bytes from `pieces' into the outgoing ring.
+        // Returns bytes written, -1 otherwise and errno is set (EAGAIN when
+        // the ring is full).
+        ssize_t CutMultipleIntoRing(mutil::IOBuf **pieces, size_t count);
+
+        // Append at most `size_hint' bytes of the incoming ring into `buf'.
+        // Returns bytes read, 0 on EOF, -1 otherwise and errno is set.
+        ssize_t AppendFromRing(mutil::IOBuf *buf, size_t size_hint);
+
+        int MapRegion(int memfd, size_t ring_size, bool server_side);
+
+        void RingPeer();
+
+        Socket *_socket;
+        bool _server_side;
+        ShmState _state;
+        void *_region;
+        size_t _region_size;
+        size_t _ring_size;
+        ShmRing *_in;
+        ShmRing *_out;
+        char *_in_data;
+        char *_out_data;
+        // Readable when the peer rings us.
+        int _self_efd;
+        // Written to wake up the peer.
+        int _peer_efd;
+        int64_t _nring;
+        int64_t _nwaitwritable;
+    };
+
+} // namespace melon
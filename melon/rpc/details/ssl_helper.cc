@@ -600,18 +600,59 @@ SSL* CreateSSLSession(SSL_CTX* ctx, SocketId id, int fd, bool server_mode) {
     return ssl;
 }
 
+static BIO* NewBufferedFdBIO(int fd, int bufsize) {
+    BIO* bio = BIO_new(BIO_f_buffer());
+    BIO_set_buffer_size(bio, bufsize);
+    BIO* fdbio = BIO_new(BIO_s_fd());
+    BIO_set_fd(fdbio, fd, 0);
+    return BIO_push(bio, fdbio);
+}
+
 void AddBIOBuffer(SSL* ssl, int fd, int bufsize) {
-    BIO *rbio = BIO_new(BIO_f_buffer());
-    BIO_set_buffer_size(rbio, bufsize);
-    BIO *wbio = BIO_new(BIO_f_buffer());
-    BIO_set_buffer_size(wbio, bufsize);
-    BIO* rfd = BIO_new(BIO_s_fd());
-    BIO_set_fd(rfd, fd, 0);
-    rbio  = BIO_push(rbio, rfd);
-    BIO* wfd = BIO_new(BIO_s_fd());
-    BIO_set_fd(wfd, fd, 0);
-    wbio = BIO_push(wbio, wfd);
-    SSL_set_bio(ssl, rbio, wbio);
+#ifdef SSL_OP_ENABLE_KTLS
+    const bool ktls_recv = IsKTLSRecvEnabled(ssl);
+    const bool ktls_send = IsKTLSSendEnabled(ssl);
+    if (ktls_recv || ktls_send) {
+        if (!ktls_recv) {
+            SSL_set0_rbio(ssl, NewBufferedFdBIO(fd, bufsize));
+        }
+        if (!ktls_send) {
+            SSL_set0_wbio(ssl, NewBufferedFdBIO(fd, bufsize));
+        }
+        return;
+    }
+#endif
+    SSL_set_bio(ssl, NewBufferedFdBIO(fd, bufsize), NewBufferedFdBIO(fd, bufsize));
+}
+
+bool EnableKTLS(SSL* ssl) {
+#ifdef SSL_OP_ENABLE_KTLS
+    SSL_set_options(ssl, SSL_OP_ENABLE_KTLS);
+    return true;
+#else
+    (void)ssl;
+    return false;
+#endif
+}
+
+bool IsKTLSSendEnabled(SSL* ssl) {
+#ifdef SSL_OP_ENABLE_KTLS
+    BIO* wbio = SSL_get_wbio(ssl);
+    return wbio != NULL && BIO_get_ktls_send(wbio);
+#else
+    (void)ssl;
+    return false;
+#endif
+}
+
+bool IsKTLSRecvEnabled(SSL* ssl) {
+#ifdef SSL_OP_ENABLE_KTLS
+    BIO* rbio = SSL_get_rbio(ssl);
+    return rbio != NULL && BIO_get_ktls_recv(rbio);
+#else
+    (void)ssl;
+    return false;
+#endif
 }
 
 SSLState DetectSSLState(int fd, int* error_code) {
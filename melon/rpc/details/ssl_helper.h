@@ -96,9 +96,21 @@ SSL_CTX* CreateServerSSLContext(const std::string& certificate_file,
 SSL* CreateSSLSession(SSL_CTX* ctx, SocketId id, int fd, bool server_mode);
 
 // Add a buffer layer of BIO in front of the socket fd layer,
-// which can reduce the total number of calls to system read/write
+// which can reduce the total number of calls to system read/write.
+// Directions offloaded to kTLS keep the socket BIO which OpenSSL needs.
 void AddBIOBuffer(SSL* ssl, int fd, int bufsize);
 
+// Let OpenSSL push keys into kernel TLS (kTLS) when the handshake of `ssl'
+// completes, it falls back to user-space TLS silently if the kernel refuses.
+// Returns false if OpenSSL is built without kTLS.
+bool EnableKTLS(SSL* ssl);
+
+// True if records sent(received) by `ssl' are encrypted(decrypted) by the
+// kernel, in which case application data can be written(read) with plain
+// writev(readv) on the fd.
+bool IsKTLSSendEnabled(SSL* ssl);
+bool IsKTLSRecvEnabled(SSL* ssl);
+
 // Judge whether the underlying channel of `fd' is using SSL
 // If the return value is SSL_UNKNOWN, `error_code' will be
 // set to indicate the reason (0 for EOF)
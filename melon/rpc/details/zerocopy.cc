@@ -0,0 +1,267 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+//
+
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <melon/utility/build_config.h>
+#if defined(OS_LINUX)
+#include <linux/errqueue.h>
+#endif
+#include <turbo/log/logging.h>
+#include <melon/utility/time.h>
+#include <melon/fiber/fiber.h>
+#include <melon/rpc/details/zerocopy.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+namespace melon {
+
+    // Same as the limit of IOBuf::cut_multiple_into_file_descriptor.
+    static const size_t ZEROCOPY_IOV_MAX = 256;
+
+    // Pending sends of a recycled socket are given up after so long, which
+    // is far beyond the time for the kernel to drain a socket buffer.
+    static const int64_t ZEROCOPY_DRAIN_TIMEOUT_US = 10 * 1000000L;
+
+    ZerocopyWriter::ZerocopyWriter()
+            : _next_seq(0), _pending_bytes(0), _copied(false), _nsend(0), _send_bytes(0), _ncopied(0), _nfallback(0) {
+    }
+
+    ZerocopyWriter::~ZerocopyWriter() {
+        LOG_IF(WARNING, !_pending.empty())
+                        << "Release " << _pending.size() << " zerocopy sends before completion";
+    }
+
+    int ZerocopyWriter::EnableOnFd(int fd) {
+#if defined(OS_LINUX)
+        const int on = 1;
+        return setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on));
+#else
+        (void) fd;
+        errno = ENOPROTOOPT;
+        return -1;
+#endif
+    }
+
+    ssize_t ZerocopyWriter::CutMultipleIntoFileDescriptor(
+            int fd, mutil::IOBuf *const *pieces, size_t count) {
+#if defined(OS_LINUX)
+        if (pending_bytes() > 0) {
+            ReapCompletions(fd);
+        }
+        if (_copied.load(mutil::memory_order_relaxed)) {
+            // The kernel copies data of this socket anyway, pinning pages
+            // and reaping notifications are pure overhead.
+            return mutil::IOBuf::cut_multiple_into_file_descriptor(fd, pieces, count);
+        }
+        struct iovec vec[ZEROCOPY_IOV_MAX];
+        size_t nvec = 0;
+        for (size_t i = 0; i < count && nvec < ZEROCOPY_IOV_MAX; ++i) {
+            const mutil::IOBuf *p = pieces[i];
+            const size_t nref = p->backing_block_num();
+            for (size_t j = 0; j < nref && nvec < ZEROCOPY_IOV_MAX; ++j, ++nvec) {
+                const mutil::StringPiece blk = p->backing_block(j);
+                vec[nvec].iov_base = const_cast<char *>(blk.data());
+                vec[nvec].iov_len = blk.size();
+            }
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = vec;
+        msg.msg_iovlen = nvec;
+        ssize_t nw = 0;
+        int saved_errno = 0;
+        {
+            // The completion may be reaped by another thread right after
+            // sendmsg returns, enqueue the send with its sequence number
+            // before sending so that the notification always finds it.
+            MELON_SCOPED_LOCK(_mutex);
+            _pending.push_back(PendingSend());
+            PendingSend &ps = _pending.back();
+            ps.seq = _next_seq;
+            ps.done = false;
+            nw = sendmsg(fd, &msg, MSG_ZEROCOPY | MSG_NOSIGNAL);
+            if (nw > 0) {
+                // The kernel references pages of written bytes until the
+                // send is notified, hold the blocks till then.
+                size_t left = nw;
+                for (size_t i = 0; i < count && left > 0; ++i) {
+                    const size_t n = std::min(left, pieces[i]->size());
+                    pieces[i]->cutn(&ps.data, n);
+                    left -= n;
+                }
+                ++_next_seq;
+                _pending_bytes.fetch_add(nw, mutil::memory_order_relaxed);
+                ++_nsend;
+                _send_bytes += nw;
+                return nw;
+            }
+            // Nothing was sent and no notification will come, roll back.
+            saved_errno = errno;
+            _pending.pop_back();
+            if (nw < 0 && saved_errno == ENOBUFS) {
+                ++_nfallback;
+            }
+        }
+        if (nw < 0 && saved_errno == ENOBUFS) {
+            // Too many notifications are outstanding (limited by
+            // net.core.optmem_max), copy this time.
+            return mutil::IOBuf::cut_multiple_into_file_descriptor(fd, pieces, count);
+        }
+        errno = saved_errno;
+        return nw;
+#else
+        return mutil::IOBuf::cut_multiple_into_file_descriptor(fd, pieces, count);
+#endif
+    }
+
+    int ZerocopyWriter::ReapCompletions(int fd) {
+        int nreaped = 0;
+#if defined(OS_LINUX)
+        while (true) {
+            char control[128];
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+                // EAGAIN when the error queue is empty.
+                break;
+            }
+            for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != NULL;
+                 cm = CMSG_NXTHDR(&msg, cm)) {
+                if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+                    !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+                    continue;
+                }
+                const struct sock_extended_err *serr =
+                        (const struct sock_extended_err *) CMSG_DATA(cm);
+                if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                    continue;
+                }
+                // Sends numbered in [ee_info, ee_data] are completed.
+                OnCompleted(serr->ee_info, serr->ee_data,
+                            (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED));
+                ++nreaped;
+            }
+        }
+#else
+        (void) fd;
+#endif
+        return nreaped;
+    }
+
+    void ZerocopyWriter::OnCompleted(uint32_t lo, uint32_t hi, bool copied) {
+        // Destroy blocks outside the lock.
+        mutil::IOBuf released;
+        {
+            MELON_SCOPED_LOCK(_mutex);
+            if (copied) {
+                // The kernel copied the data anyway, e.g. loopback or NIC
+                // without scatter-gather, zerocopy is a waste for the socket.
+                _ncopied += (uint32_t) (hi - lo) + 1;
+                _copied.store(true, mutil::memory_order_relaxed);
+            }
+            for (size_t i = 0; i < _pending.size(); ++i) {
+                PendingSend &ps = _pending[i];
+                // Sequence numbers wrap around.
+                if ((int32_t) (ps.seq - hi) > 0) {
+                    break;
+                }
+                if (!ps.done && (uint32_t) (ps.seq - lo) <= (uint32_t) (hi - lo)) {
+                    ps.done = true;
+                    _pending_bytes.fetch_sub(ps.data.size(), mutil::memory_order_relaxed);
+                    released.append(mutil::IOBuf::Movable(ps.data));
+                }
+            }
+            while (!_pending.empty() && _pending.front().done) {
+                _pending.pop_front();
+            }
+        }
+    }
+
+    void ZerocopyWriter::Describe(std::ostream &os) const {
+        MELON_SCOPED_LOCK(_mutex);
+        os << "\nzerocopy_nsend=" << _nsend
+           << "\nzerocopy_send_bytes=" << _send_bytes
+           << "\nzerocopy_ncopied=" << _ncopied
+           << "\nzerocopy_nfallback=" << _nfallback
+           << "\nzerocopy_copied=" << _copied.load(mutil::memory_order_relaxed)
+           << "\nzerocopy_npending=" << _pending.size()
+           << "\nzerocopy_pending_bytes=" << pending_bytes();
+    }
+
+    struct ZerocopyDrainArg {
+        ZerocopyWriter *writer;
+        int fd;
+    };
+
+    static void *DrainZerocopyWriter(void *arg) {
+        ZerocopyDrainArg *a = static_cast<ZerocopyDrainArg *>(arg);
+        const int64_t deadline_us = mutil::gettimeofday_us() + ZEROCOPY_DRAIN_TIMEOUT_US;
+        while (true) {
+            a->writer->ReapCompletions(a->fd);
+            if (a->writer->pending_bytes() == 0) {
+                break;
+            }
+            if (mutil::gettimeofday_us() >= deadline_us) {
+                LOG(WARNING) << "Fail to drain zerocopy sends of fd=" << a->fd
+                             << ", pending_bytes=" << a->writer->pending_bytes();
+                // Reset the connection so that the kernel drops queued data
+                // before the blocks are reused.
+                struct linger lg = {1, 0};
+                setsockopt(a->fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+                break;
+            }
+            fiber_usleep(1000);
+        }
+        close(a->fd);
+        delete a->writer;
+        delete a;
+        return NULL;
+    }
+
+    void ZerocopyWriter::DrainAndDestroy(ZerocopyWriter *w, int fd) {
+        ZerocopyDrainArg *arg = new ZerocopyDrainArg;
+        arg->writer = w;
+        arg->fd = fd;
+        fiber_t th;
+        if (fiber_start_background(&th, NULL, DrainZerocopyWriter, arg) != 0) {
+            PLOG(ERROR) << "Fail to start fiber";
+            DrainZerocopyWriter(arg);
+        }
+    }
+
+} // namespace melon
@@ -0,0 +1,97 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+//
+
+
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+#include <ostream>
+#include <melon/utility/atomicops.h>
+#include <melon/utility/iobuf.h>
+#include <melon/utility/macros.h>
+#include <melon/utility/synchronization/lock.h>
+
+namespace melon {
+
+    // Write IOBuf into sockets with MSG_ZEROCOPY. The kernel pins pages of
+    // the sent data instead of copying them, so blocks referenced by each
+    // send are held until the completion notification arrives from the
+    // error queue of the socket.
+    // Writes must be serialized by the caller (as Socket does), reaping may
+    // run concurrently with writing.
+    class ZerocopyWriter {
+    public:
+        ZerocopyWriter();
+
+        ~ZerocopyWriter();
+
+        // Turn on SO_ZEROCOPY of `fd'. Returns 0 on success, -1 otherwise
+        // (the kernel or the type of socket does not support it).
+        static int EnableOnFd(int fd);
+
+        // Write `pieces' into `fd' like IOBuf::cut_multiple_into_file_descriptor
+        // with MSG_ZEROCOPY. Falls back to copying when the kernel runs out
+        // of memory for tracking notifications, and stops using MSG_ZEROCOPY
+        // once the kernel reports that it copied the data of a send.
+        // Returns bytes written on success, -1 otherwise and errno is set.
+        ssize_t CutMultipleIntoFileDescriptor(int fd, mutil::IOBuf *const *pieces,
+                                              size_t count);
+
+        // Read notifications from the error queue of `fd' and release blocks
+        // of completed sends. Returns number of notifications read.
+        int ReapCompletions(int fd);
+
+        // Bytes sent but not notified by the kernel yet.
+        int64_t pending_bytes() const {
+            return _pending_bytes.load(mutil::memory_order_relaxed);
+        }
+
+        void Describe(std::ostream &os) const;
+
+        // Keep `w' until all pending sends on `fd' complete (or timeout),
+        // then close `fd' and delete `w'. Takes ownership of both.
+        static void DrainAndDestroy(ZerocopyWriter *w, int fd);
+
+    private:
+        DISALLOW_COPY_AND_ASSIGN(ZerocopyWriter);
+
+        struct PendingSend {
+            uint32_t seq;
+            bool done;
+            mutil::IOBuf data;
+        };
+
+        void OnCompleted(uint32_t lo, uint32_t hi, bool copied);
+
+        mutable mutil::Mutex _mutex;
+        std::deque<PendingSend> _pending;
+        // Sequence number of next zerocopy send, matching the counter
+        // maintained by the kernel for each socket.
+        uint32_t _next_seq;
+        mutil::atomic<int64_t> _pending_bytes;
+        // A send was notified as copied by the kernel.
+        mutil::atomic<bool> _copied;
+        int64_t _nsend;
+        int64_t _send_bytes;
+        int64_t _ncopied;
+        int64_t _nfallback;
+    };
+
+} // namespace melon
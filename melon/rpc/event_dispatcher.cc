@@ -65,12 +65,16 @@ namespace melon {
         CHECK_EQ(0, atexit(StopAndJoinGlobalDispatchers));
     }
 
-    EventDispatcher &GetGlobalEventDispatcher(int fd, fiber_tag_t tag) {
+    EventDispatcher &GetGlobalEventDispatcher(int fd, fiber_tag_t tag, int index) {
         pthread_once(&g_edisp_once, InitializeGlobalDispatchers);
         if (fiber::FLAGS_task_group_ntags == 1 && FLAGS_event_dispatcher_num == 1) {
             return g_edisp[0];
         }
-        int index = mutil::fmix32(fd) % FLAGS_event_dispatcher_num;
+        if (index < 0) {
+            index = mutil::fmix32(fd) % FLAGS_event_dispatcher_num;
+        } else {
+            index %= FLAGS_event_dispatcher_num;
+        }
         return g_edisp[tag * FLAGS_event_dispatcher_num + index];
     }
 
@@ -78,6 +82,7 @@ namespace melon {
 
 #if defined(OS_LINUX)
 
+#include <melon/rpc/event_dispatcher_io_uring.cc>
 #include <melon/rpc/event_dispatcher_epoll.cc>
 
 #elif defined(OS_MACOSX)
@@ -28,6 +28,10 @@
 
 namespace melon {
 
+    struct IOUringContext;
+
+    class Transport;
+
 // Dispatch edge-triggered events of file descriptors to consumers
 // running in separate fibers.
     class EventDispatcher {
@@ -35,6 +39,8 @@ namespace melon {
 
         friend class rdma::RdmaEndpoint;
 
+        friend class Transport;
+
     public:
         EventDispatcher();
 
@@ -60,8 +66,17 @@ namespace melon {
         // Notice that this function also transfers ownership of `socket_id',
         // When the file descriptor is removed from internal epoll, the Socket
         // will be dereferenced once additionally.
+        // If `recv' is true and RecvInDispatcher() is true, data of `fd' is
+        // received by this dispatcher and handed to the Socket which must
+        // not read `fd' by itself. `recv_generation' is passed back with
+        // the data so that the Socket drops data of its previous fds.
         // Returns 0 on success, -1 otherwise.
-        int AddConsumer(SocketId socket_id, int fd);
+        int AddConsumer(SocketId socket_id, int fd, bool recv = false,
+                        uint32_t recv_generation = 0);
+
+        // True if this dispatcher runs on io_uring and receives data with
+        // multishot recv into provided buffers.
+        bool RecvInDispatcher() const;
 
         // Watch EPOLLOUT event on `fd' into epoll device. If `pollin' is
         // true, EPOLLIN event will also be included and EPOLL_CTL_MOD will
@@ -87,6 +102,13 @@ namespace melon {
         // Remove the file descriptor `fd' from epoll.
         int RemoveConsumer(int fd);
 
+        // Receive data of `fd' in this dispatcher again after the Socket
+        // read it by itself since StartInputEventWithData(stop_recv=true).
+        // The Socket must have drained `fd' and stop reading it on success.
+        // Returns 0 on success, 1 if the Socket should try again later,
+        // -1 if the dispatcher never receives for the Socket again.
+        int ResumeRecv(SocketId socket_id, int fd, uint32_t recv_generation);
+
         // The epoll to watch events.
         int _epfd;
 
@@ -101,9 +123,34 @@ namespace melon {
 
         // Pipe fds to wakeup EventDispatcher from `epoll_wait' in order to quit
         int _wakeup_fds[2];
+
+        // io_uring based backend replacing `_epfd', NULL unless
+        // -event_dispatcher_use_io_uring is on and io_uring is available.
+        IOUringContext *_uring;
+
+        // Implementations of public methods on io_uring.
+        int InitIOUring();
+
+        void RunIOUring();
+
+        void StopIOUring();
+
+        int AddConsumerIOUring(SocketId socket_id, int fd, bool recv,
+                               uint32_t recv_generation);
+
+        int RemoveConsumerIOUring(int fd);
+
+        int AddEpollOutIOUring(SocketId socket_id, int fd, bool pollin);
+
+        int RemoveEpollOutIOUring(int fd);
+
+        int ResumeRecvIOUring(SocketId socket_id, int fd, uint32_t recv_generation);
     };
 
-    EventDispatcher &GetGlobalEventDispatcher(int fd, fiber_tag_t tag);
+    // Get the dispatcher of `fd' among -event_dispatcher_num ones of `tag'.
+    // The `index'-th one (modulo the number) is returned if `index' is not
+    // negative, otherwise the one is picked by hashing `fd'.
+    EventDispatcher &GetGlobalEventDispatcher(int fd, fiber_tag_t tag, int index = -1);
 
 } // namespace melon
 
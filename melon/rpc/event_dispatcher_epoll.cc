@@ -26,7 +26,16 @@
 namespace melon {
 
     EventDispatcher::EventDispatcher()
-            : _epfd(-1), _stop(false), _tid(0), _consumer_thread_attr(FIBER_ATTR_NORMAL) {
+            : _epfd(-1), _stop(false), _tid(0), _consumer_thread_attr(FIBER_ATTR_NORMAL)
+            , _uring(NULL) {
+        if (FLAGS_event_dispatcher_use_io_uring) {
+            const int rc = InitIOUring();
+            if (rc == 0) {
+                return;
+            }
+            LOG(WARNING) << "Fail to init io_uring: " << berror(rc)
+                         << ", use epoll instead";
+        }
         _epfd = epoll_create(1024 * 1024);
         if (_epfd < 0) {
             PLOG(FATAL) << "Fail to create epoll";
@@ -45,6 +54,8 @@ namespace melon {
     EventDispatcher::~EventDispatcher() {
         Stop();
         Join();
+        delete _uring;
+        _uring = NULL;
         if (_epfd >= 0) {
             close(_epfd);
             _epfd = -1;
@@ -56,7 +67,7 @@ namespace melon {
     }
 
     int EventDispatcher::Start(const fiber_attr_t *consumer_thread_attr) {
-        if (_epfd < 0) {
+        if (_epfd < 0 && _uring == NULL) {
             LOG(FATAL) << "epoll was not created";
             return -1;
         }
@@ -91,13 +102,15 @@ namespace melon {
     }
 
     bool EventDispatcher::Running() const {
-        return !_stop && _epfd >= 0 && _tid != 0;
+        return !_stop && (_epfd >= 0 || _uring != NULL) && _tid != 0;
     }
 
     void EventDispatcher::Stop() {
         _stop = true;
 
-        if (_epfd >= 0) {
+        if (_uring != NULL) {
+            StopIOUring();
+        } else if (_epfd >= 0) {
             epoll_event evt = {EPOLLOUT, {NULL}};
             epoll_ctl(_epfd, EPOLL_CTL_ADD, _wakeup_fds[1], &evt);
         }
@@ -111,6 +124,9 @@ namespace melon {
     }
 
     int EventDispatcher::AddEpollOut(SocketId socket_id, int fd, bool pollin) {
+        if (_uring != NULL) {
+            return AddEpollOutIOUring(socket_id, fd, pollin);
+        }
         if (_epfd < 0) {
             errno = EINVAL;
             return -1;
@@ -139,6 +155,9 @@ namespace melon {
 
     int EventDispatcher::RemoveEpollOut(SocketId socket_id,
                                         int fd, bool pollin) {
+        if (_uring != NULL) {
+            return RemoveEpollOutIOUring(fd);
+        }
         if (pollin) {
             epoll_event evt;
             evt.data.u64 = socket_id;
@@ -153,7 +172,11 @@ namespace melon {
         return -1;
     }
 
-    int EventDispatcher::AddConsumer(SocketId socket_id, int fd) {
+    int EventDispatcher::AddConsumer(SocketId socket_id, int fd, bool recv,
+                                     uint32_t recv_generation) {
+        if (_uring != NULL) {
+            return AddConsumerIOUring(socket_id, fd, recv, recv_generation);
+        }
         if (_epfd < 0) {
             errno = EINVAL;
             return -1;
@@ -168,10 +191,20 @@ namespace melon {
         return -1;
     }
 
+    int EventDispatcher::ResumeRecv(SocketId socket_id, int fd, uint32_t recv_generation) {
+        if (_uring != NULL) {
+            return ResumeRecvIOUring(socket_id, fd, recv_generation);
+        }
+        return -1;
+    }
+
     int EventDispatcher::RemoveConsumer(int fd) {
         if (fd < 0) {
             return -1;
         }
+        if (_uring != NULL) {
+            return RemoveConsumerIOUring(fd);
+        }
         // Removing the consumer from dispatcher before closing the fd because
         // if process was forked and the fd is not marked as close-on-exec,
         // closing does not set reference count of the fd to 0, thus does not
@@ -192,6 +225,9 @@ namespace melon {
     }
 
     void EventDispatcher::Run() {
+        if (_uring != NULL) {
+            return RunIOUring();
+        }
         while (!_stop) {
             epoll_event e[32];
             const int n = epoll_wait(_epfd, e, ARRAY_SIZE(e), -1);
@@ -0,0 +1,628 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+//
+
+
+// io_uring backend of EventDispatcher. Included by event_dispatcher.cc on
+// Linux, methods of EventDispatcher delegate to the functions below when
+// `_uring' is not NULL.
+
+#include <poll.h>                                  // POLLIN
+#include <sys/socket.h>                            // socketpair
+#include <unordered_map>
+#include <melon/utility/scoped_lock.h>
+#include <melon/var/reducer.h>
+#include <melon/rpc/details/io_uring.h>
+
+namespace melon {
+
+    DEFINE_bool(event_dispatcher_use_io_uring, false,
+                "Run event dispatchers on io_uring instead of epoll, fall back "
+                "to epoll if io_uring is not available");
+    DEFINE_int32(io_uring_entries, 1024,
+                 "Number of submission entries of io_uring of each event dispatcher");
+    DEFINE_bool(io_uring_recv_multishot, true,
+                "Receive data of sockets with multishot recv into provided "
+                "buffers when event dispatchers run on io_uring");
+    DEFINE_int32(io_uring_recv_buffer_num, 4096,
+                 "Number of provided buffers of each event dispatcher, must be "
+                 "power of 2 and not greater than 32768");
+    DEFINE_int32(io_uring_recv_buffer_size, 8192,
+                 "Size of each provided buffer of io_uring");
+
+#if defined(MELON_HAS_IO_URING)
+
+    static const int IOURING_BUFFER_GROUP = 0;
+
+    static mutil::static_atomic<int> g_nuring = MUTIL_STATIC_ATOMIC_INIT(0);
+
+    static melon::var::Adder<int64_t> *g_recv_fallback = NULL;
+    static melon::var::Adder<int64_t> *g_recv_resume = NULL;
+    static pthread_once_t g_recv_fallback_once = PTHREAD_ONCE_INIT;
+
+    static void InitRecvFallbackVar() {
+        g_recv_fallback = new melon::var::Adder<int64_t>(
+                "rpc_io_uring_recv_fallback_count");
+        g_recv_resume = new melon::var::Adder<int64_t>(
+                "rpc_io_uring_recv_resume_count");
+    }
+
+    enum IOUringOpType {
+        IOURING_OP_POLL_IN = 0,     // multishot poll of input events
+        IOURING_OP_RECV = 1,        // multishot recv into provided buffers
+        IOURING_OP_POLL_OUT = 2,    // oneshot poll of output events
+    };
+
+    // A submitted operation, pointed by user_data of its SQE and deleted
+    // after its last CQE is reaped.
+    struct IOUringOp {
+        SocketId socket_id;
+        int fd;
+        uint32_t recv_generation;
+        IOUringOpType type;
+        bool armed;         // owned by the kernel right now
+        bool canceled;      // removed by user, never re-armed
+        bool pausing;       // recv is being canceled to let the socket catch up
+    };
+
+    struct IOUringContext {
+        IOUring ring;
+        IOUringBufferPool *pool;    // NULL if multishot recv is off
+        // Multishot recv failed with EINVAL/EOPNOTSUPP, never resumed.
+        bool recv_unsupported;
+        // Serializes submissions and protects ops in the maps. Never call
+        // into Socket with this mutex locked, the callee may start a fiber
+        // urgently and remove consumers.
+        pthread_mutex_t mutex;
+        std::unordered_map<int, IOUringOp *> consumers;
+        std::unordered_map<int, IOUringOp *> epollouts;
+
+        IOUringContext() : pool(NULL), recv_unsupported(false) {
+            pthread_mutex_init(&mutex, NULL);
+        }
+
+        ~IOUringContext() {
+            for (auto &kv: consumers) {
+                delete kv.second;
+            }
+            for (auto &kv: epollouts) {
+                delete kv.second;
+            }
+            if (pool && pool->outstanding() != 0) {
+                // IOBufs still reference the buffers, leak them.
+                LOG(WARNING) << pool->outstanding()
+                             << " io_uring buffers are still referenced";
+            } else {
+                delete pool;
+            }
+            pthread_mutex_destroy(&mutex);
+        }
+
+        // Get a SQE, submitting pending ones when the queue is full.
+        // Must be called with `mutex' locked.
+        io_uring_sqe *GetSqe() {
+            io_uring_sqe *sqe = ring.GetSqe();
+            if (sqe == NULL) {
+                if (ring.Submit() < 0) {
+                    return NULL;
+                }
+                sqe = ring.GetSqe();
+                if (sqe == NULL) {
+                    errno = EAGAIN;
+                }
+            }
+            return sqe;
+        }
+
+        // Queue `op' into the ring. Must be called with `mutex' locked.
+        // Returns 0 on success, -1 otherwise.
+        int Arm(IOUringOp *op) {
+            io_uring_sqe *sqe = GetSqe();
+            if (sqe == NULL) {
+                return -1;
+            }
+            sqe->fd = op->fd;
+            sqe->user_data = (uint64_t) op;
+            switch (op->type) {
+                case IOURING_OP_POLL_IN:
+                    sqe->opcode = IORING_OP_POLL_ADD;
+                    sqe->poll32_events = POLLIN;
+                    sqe->len = IORING_POLL_ADD_MULTI;
+                    break;
+                case IOURING_OP_RECV:
+                    sqe->opcode = IORING_OP_RECV;
+                    sqe->ioprio = IORING_RECV_MULTISHOT;
+                    sqe->flags = IOSQE_BUFFER_SELECT;
+                    sqe->buf_group = pool->bgid();
+                    break;
+                case IOURING_OP_POLL_OUT:
+                    sqe->opcode = IORING_OP_POLL_ADD;
+                    sqe->poll32_events = POLLOUT;
+                    break;
+            }
+            op->armed = true;
+            return 0;
+        }
+
+        // Cancel `op' or delete it directly if the kernel does not own it.
+        // Must be called with `mutex' locked.
+        void Cancel(IOUringOp *op) {
+            if (!op->armed) {
+                delete op;
+                return;
+            }
+            op->canceled = true;
+            CancelInKernel(op);
+        }
+
+        // Stop the multishot recv `op' of a socket consuming slower than
+        // receiving. The socket reads the fd by itself after the last CQE.
+        // Must be called with `mutex' locked.
+        void Pause(IOUringOp *op) {
+            if (!op->armed || op->canceled || op->pausing) {
+                return;
+            }
+            op->pausing = true;
+            CancelInKernel(op);
+            ring.Submit();
+        }
+
+        // Terminate `op' in the kernel, its last CQE comes later.
+        // Must be called with `mutex' locked.
+        void CancelInKernel(IOUringOp *op) {
+            io_uring_sqe *sqe = GetSqe();
+            if (sqe == NULL) {
+                PLOG(ERROR) << "Fail to cancel io_uring op of fd=" << op->fd;
+                return;
+            }
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            sqe->addr = (uint64_t) op;
+            sqe->user_data = 0;
+        }
+    };
+
+    // Some kernels accept IORING_REGISTER_PBUF_RING but fail every recv
+    // selecting buffers from the ring with ENOBUFS. Receive one byte through
+    // a socketpair before the dispatcher runs to make sure it works.
+    static bool CanRecvIntoProvidedBuffers(IOUringContext *ctx) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+            return false;
+        }
+        bool ok = false;
+        io_uring_sqe *sqe = ctx->ring.GetSqe();
+        if (sqe != NULL && write(fds[1], "x", 1) == 1) {
+            sqe->opcode = IORING_OP_RECV;
+            sqe->fd = fds[0];
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = ctx->pool->bgid();
+            sqe->user_data = 0;
+            if (ctx->ring.Submit() == 1 && ctx->ring.WaitCqe() == 0) {
+                ctx->ring.ForEachCqe([&](const io_uring_cqe *cqe) {
+                    if (cqe->res == 1 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+                        // Recycled after `buf' is destructed.
+                        mutil::IOBuf buf;
+                        ok = (ctx->pool->AppendTo(cqe->flags >> IORING_CQE_BUFFER_SHIFT,
+                                                  1, &buf) == 0);
+                    }
+                });
+            }
+        }
+        close(fds[0]);
+        close(fds[1]);
+        return ok;
+    }
+
+    int EventDispatcher::InitIOUring() {
+        IOUringContext *ctx = new(std::nothrow) IOUringContext;
+        if (ctx == NULL) {
+            return ENOMEM;
+        }
+        int rc = ctx->ring.Init(FLAGS_io_uring_entries);
+        if (rc != 0) {
+            delete ctx;
+            return rc;
+        }
+        if (FLAGS_io_uring_recv_multishot) {
+            IOUringBufferPool *pool = new(std::nothrow) IOUringBufferPool;
+            if (pool != NULL &&
+                pool->Init(&ctx->ring, FLAGS_io_uring_recv_buffer_num,
+                           FLAGS_io_uring_recv_buffer_size, IOURING_BUFFER_GROUP) == 0) {
+                ctx->pool = pool;
+                if (!CanRecvIntoProvidedBuffers(ctx)) {
+                    LOG(WARNING) << "io_uring can't receive into provided buffers, "
+                                    "receive data by Socket instead";
+                    ctx->pool = NULL;
+                    if (pool->outstanding() == 0) {
+                        delete pool;
+                    }
+                }
+            } else {
+                // Kernels before 5.19 don't have provided buffer rings.
+                LOG(WARNING) << "Fail to provide buffers to io_uring, "
+                                "receive data by Socket instead";
+                delete pool;
+            }
+        }
+        pthread_once(&g_recv_fallback_once, InitRecvFallbackVar);
+        _uring = ctx;
+        if (g_nuring.fetch_add(1, mutil::memory_order_relaxed) == 0) {
+            LOG(INFO) << "EventDispatcher runs on io_uring, multishot recv is "
+                      << (ctx->pool ? "on" : "off");
+        }
+        return 0;
+    }
+
+    bool EventDispatcher::RecvInDispatcher() const {
+        return _uring != NULL && _uring->pool != NULL;
+    }
+
+    void EventDispatcher::StopIOUring() {
+        MELON_SCOPED_LOCK(_uring->mutex);
+        // A NOP wakes up the dispatcher which checks _stop then.
+        io_uring_sqe *sqe = _uring->GetSqe();
+        if (sqe == NULL) {
+            PLOG(ERROR) << "Fail to wake up io_uring fd=" << _uring->ring.fd();
+            return;
+        }
+        sqe->opcode = IORING_OP_NOP;
+        sqe->user_data = 0;
+        _uring->ring.Submit();
+    }
+
+    int EventDispatcher::AddConsumerIOUring(SocketId socket_id, int fd, bool recv,
+                                            uint32_t recv_generation) {
+        IOUringOp *op = new(std::nothrow) IOUringOp;
+        if (op == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        op->socket_id = socket_id;
+        op->fd = fd;
+        op->recv_generation = recv_generation;
+        op->type = (recv && _uring->pool) ? IOURING_OP_RECV : IOURING_OP_POLL_IN;
+        op->armed = false;
+        op->canceled = false;
+        op->pausing = false;
+        MELON_SCOPED_LOCK(_uring->mutex);
+        if (_uring->consumers.find(fd) != _uring->consumers.end()) {
+            delete op;
+            errno = EEXIST;
+            return -1;
+        }
+        if (_uring->Arm(op) != 0 || _uring->ring.Submit() < 0) {
+            const int saved_errno = errno;
+            // The SQE may be submitted later, keep `op' alive and forget it.
+            if (!op->armed) {
+                delete op;
+            } else {
+                op->canceled = true;
+            }
+            errno = saved_errno;
+            return -1;
+        }
+        _uring->consumers[fd] = op;
+        return 0;
+    }
+
+    int EventDispatcher::RemoveConsumerIOUring(int fd) {
+        MELON_SCOPED_LOCK(_uring->mutex);
+        auto it = _uring->consumers.find(fd);
+        if (it == _uring->consumers.end()) {
+            errno = ENOENT;
+            return -1;
+        }
+        _uring->Cancel(it->second);
+        _uring->consumers.erase(it);
+        // Same as EPOLL_CTL_DEL, output events are not watched any more.
+        it = _uring->epollouts.find(fd);
+        if (it != _uring->epollouts.end()) {
+            _uring->Cancel(it->second);
+            _uring->epollouts.erase(it);
+        }
+        // Submit cancellations before the caller closes `fd'.
+        if (_uring->ring.Submit() < 0) {
+            PLOG(WARNING) << "Fail to remove fd=" << fd << " from io_uring";
+            return -1;
+        }
+        return 0;
+    }
+
+    int EventDispatcher::AddEpollOutIOUring(SocketId socket_id, int fd, bool pollin) {
+        IOUringOp *op = new(std::nothrow) IOUringOp;
+        if (op == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        op->socket_id = socket_id;
+        op->fd = fd;
+        op->recv_generation = 0;
+        op->type = IOURING_OP_POLL_OUT;
+        op->armed = false;
+        op->canceled = false;
+        op->pausing = false;
+        MELON_SCOPED_LOCK(_uring->mutex);
+        if (pollin && _uring->consumers.find(fd) == _uring->consumers.end()) {
+            // Same as EPOLL_CTL_MOD, `fd' was removed via `RemoveConsumer'.
+            delete op;
+            errno = ENOENT;
+            return -1;
+        }
+        auto it = _uring->epollouts.find(fd);
+        if (it != _uring->epollouts.end()) {
+            _uring->Cancel(it->second);
+            _uring->epollouts.erase(it);
+        }
+        if (_uring->Arm(op) != 0 || _uring->ring.Submit() < 0) {
+            const int saved_errno = errno;
+            if (!op->armed) {
+                delete op;
+            } else {
+                op->canceled = true;
+            }
+            errno = saved_errno;
+            return -1;
+        }
+        _uring->epollouts[fd] = op;
+        return 0;
+    }
+
+    int EventDispatcher::RemoveEpollOutIOUring(int fd) {
+        MELON_SCOPED_LOCK(_uring->mutex);
+        auto it = _uring->epollouts.find(fd);
+        if (it == _uring->epollouts.end()) {
+            // Already triggered.
+            return 0;
+        }
+        _uring->Cancel(it->second);
+        _uring->epollouts.erase(it);
+        return _uring->ring.Submit() < 0 ? -1 : 0;
+    }
+
+    int EventDispatcher::ResumeRecvIOUring(SocketId socket_id, int fd,
+                                           uint32_t recv_generation) {
+        IOUringBufferPool *pool = _uring->pool;
+        if (pool == NULL) {
+            return -1;
+        }
+        if (pool->outstanding() > (int) (pool->nbuf() / 2)) {
+            // Most buffers are still referenced, receiving now is likely to
+            // run out of buffers again.
+            return 1;
+        }
+        IOUringOp *op = new(std::nothrow) IOUringOp;
+        if (op == NULL) {
+            return 1;
+        }
+        op->socket_id = socket_id;
+        op->fd = fd;
+        op->recv_generation = recv_generation;
+        op->type = IOURING_OP_RECV;
+        op->armed = false;
+        op->canceled = false;
+        op->pausing = false;
+        MELON_SCOPED_LOCK(_uring->mutex);
+        if (_uring->recv_unsupported) {
+            delete op;
+            return -1;
+        }
+        auto it = _uring->consumers.find(fd);
+        if (it == _uring->consumers.end() || it->second->socket_id != socket_id ||
+            it->second->recv_generation != recv_generation ||
+            it->second->type != IOURING_OP_POLL_IN) {
+            // Removed or added again.
+            delete op;
+            return -1;
+        }
+        if (_uring->Arm(op) != 0) {
+            delete op;
+            return 1;
+        }
+        // Queued after the recv, no readiness is missed in between.
+        _uring->Cancel(it->second);
+        it->second = op;
+        if (_uring->ring.Submit() < 0) {
+            // Submitted by the next Submit().
+            PLOG(WARNING) << "Fail to submit io_uring recv of fd=" << fd;
+        }
+        *g_recv_resume << 1;
+        return 0;
+    }
+
+    void EventDispatcher::RunIOUring() {
+        IOUringContext *const ctx = _uring;
+        // Multishot operations to be re-armed after reaping the CQEs.
+        std::vector<IOUringOp *> rearm;
+        // Sockets(and generations) reading by themselves from now on.
+        std::vector<std::pair<SocketId, uint32_t> > fallback;
+        while (!_stop) {
+            if (ctx->ring.WaitCqe() != 0) {
+                if (EINTR == errno) {
+                    continue;
+                }
+                PLOG(FATAL) << "Fail to wait io_uring fd=" << ctx->ring.fd();
+                break;
+            }
+            if (_stop) {
+                break;
+            }
+            ctx->ring.ForEachCqe([&](const io_uring_cqe *cqe) {
+                IOUringOp *op = (IOUringOp *) cqe->user_data;
+                if (op == NULL) {
+                    // NOP or cancellation.
+                    return;
+                }
+                const int res = cqe->res;
+                const bool more = (cqe->flags & IORING_CQE_F_MORE);
+                // The socket has too much data not consumed.
+                bool socket_full = false;
+                switch (op->type) {
+                    case IOURING_OP_POLL_IN:
+                        if (res != -ECANCELED) {
+                            // We don't care about the return value.
+                            Socket::StartInputEvent(op->socket_id, EPOLLIN,
+                                                    _consumer_thread_attr);
+                        }
+                        break;
+                    case IOURING_OP_RECV:
+                        if (res > 0) {
+                            mutil::IOBuf data;
+                            if (cqe->flags & IORING_CQE_F_BUFFER) {
+                                ctx->pool->AppendTo(cqe->flags >> IORING_CQE_BUFFER_SHIFT,
+                                                    res, &data);
+                            }
+                            socket_full = (Socket::StartInputEventWithData(
+                                    op->socket_id, op->recv_generation, &data, 0,
+                                    _consumer_thread_attr) > 0);
+                            if (socket_full && more) {
+                                // Stop receiving so that the peer is slowed
+                                // down by TCP flow control.
+                                MELON_SCOPED_LOCK(ctx->mutex);
+                                ctx->Pause(op);
+                            }
+                        } else if (res == 0) {
+                            Socket::StartInputEventWithData(
+                                    op->socket_id, op->recv_generation, NULL, -1,
+                                    _consumer_thread_attr);
+                        } else if (res != -ECANCELED && res != -ENOBUFS &&
+                                   res != -EINVAL && res != -EOPNOTSUPP) {
+                            Socket::StartInputEventWithData(
+                                    op->socket_id, op->recv_generation, NULL, -res,
+                                    _consumer_thread_attr);
+                        }
+                        break;
+                    case IOURING_OP_POLL_OUT:
+                        break;
+                }
+                if (more) {
+                    return;
+                }
+                // Last CQE of `op'.
+                bool run_epollout = false;
+                {
+                    MELON_SCOPED_LOCK(ctx->mutex);
+                    op->armed = false;
+                    if (op->type == IOURING_OP_POLL_OUT) {
+                        auto it = ctx->epollouts.find(op->fd);
+                        if (it != ctx->epollouts.end() && it->second == op) {
+                            ctx->epollouts.erase(it);
+                        }
+                        run_epollout = !op->canceled;
+                    } else if (op->canceled) {
+                        delete op;
+                        return;
+                    } else if (op->type == IOURING_OP_RECV) {
+                        if (res == -EINVAL || res == -EOPNOTSUPP) {
+                            ctx->recv_unsupported = true;
+                        }
+                        if (op->pausing || socket_full || res == -ENOBUFS ||
+                            res == -EINVAL || res == -EOPNOTSUPP) {
+                            // Paused, out of provided buffers or multishot
+                            // recv is not supported, let the socket read by
+                            // itself until it calls ResumeRecv().
+                            op->type = IOURING_OP_POLL_IN;
+                            op->pausing = false;
+                            rearm.push_back(op);
+                            fallback.push_back(std::make_pair(op->socket_id,
+                                                              op->recv_generation));
+                        } else if (res > 0) {
+                            // Multishot recv was terminated by the kernel.
+                            rearm.push_back(op);
+                        }
+                    } else if (res >= 0) {
+                        // Multishot poll was terminated by the kernel.
+                        rearm.push_back(op);
+                    }
+                }
+                if (op->type == IOURING_OP_POLL_OUT) {
+                    if (run_epollout) {
+                        // We don't care about the return value.
+                        Socket::HandleEpollOut(op->socket_id);
+                    }
+                    delete op;
+                }
+            });
+            if (!rearm.empty()) {
+                MELON_SCOPED_LOCK(ctx->mutex);
+                for (size_t i = 0; i < rearm.size(); ++i) {
+                    if (rearm[i]->canceled) {
+                        delete rearm[i];
+                    } else if (ctx->Arm(rearm[i]) != 0) {
+                        PLOG(ERROR) << "Fail to re-arm io_uring op of fd=" << rearm[i]->fd;
+                    }
+                }
+                ctx->ring.Submit();
+                rearm.clear();
+            }
+            for (size_t i = 0; i < fallback.size(); ++i) {
+                *g_recv_fallback << 1;
+                Socket::StartInputEventWithData(fallback[i].first, fallback[i].second,
+                                                NULL, 0, _consumer_thread_attr, true);
+            }
+            fallback.clear();
+        }
+    }
+
+#else  // MELON_HAS_IO_URING
+
+    // Built with headers without io_uring, dispatchers always run on epoll.
+    struct IOUringContext {
+    };
+
+    int EventDispatcher::InitIOUring() {
+        return ENOSYS;
+    }
+
+    bool EventDispatcher::RecvInDispatcher() const {
+        return false;
+    }
+
+    void EventDispatcher::StopIOUring() {
+    }
+
+    int EventDispatcher::AddConsumerIOUring(SocketId, int, bool, uint32_t) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    int EventDispatcher::RemoveConsumerIOUring(int) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    int EventDispatcher::AddEpollOutIOUring(SocketId, int, bool) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    int EventDispatcher::RemoveEpollOutIOUring(int) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    int EventDispatcher::ResumeRecvIOUring(SocketId, int, uint32_t) {
+        return -1;
+    }
+
+    void EventDispatcher::RunIOUring() {
+    }
+
+#endif  // MELON_HAS_IO_URING
+
+} // namespace melon
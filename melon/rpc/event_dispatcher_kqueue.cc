@@ -30,6 +30,7 @@ EventDispatcher::EventDispatcher()
     , _stop(false)
     , _tid(0)
     , _consumer_thread_attr(FIBER_ATTR_NORMAL)
+    , _uring(NULL)
 {
     _epfd = kqueue();
     if (_epfd < 0) {
@@ -94,6 +95,14 @@ int EventDispatcher::Start(const fiber_attr_t* consumer_thread_attr) {
     return 0;
 }
 
+bool EventDispatcher::RecvInDispatcher() const {
+    return false;
+}
+
+int EventDispatcher::ResumeRecv(SocketId, int, uint32_t) {
+    return -1;
+}
+
 bool EventDispatcher::Running() const {
     return !_stop  && _epfd >= 0 && _tid != 0;
 }
@@ -154,7 +163,7 @@ int EventDispatcher::RemoveEpollOut(SocketId socket_id,
     return 0;
 }
 
-int EventDispatcher::AddConsumer(SocketId socket_id, int fd) {
+int EventDispatcher::AddConsumer(SocketId socket_id, int fd, bool, uint32_t) {
     if (_epfd < 0) {
         errno = EINVAL;
         return -1;
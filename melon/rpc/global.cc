@@ -69,6 +69,10 @@
 #include <melon/rpc/policy/constant_concurrency_limiter.h>
 #include <melon/rpc/policy/timeout_concurrency_limiter.h>
 
+// Transports
+#include <melon/rpc/transport.h>
+#include <melon/rpc/details/shm_transport.h>
+
 #include <melon/rpc/input_messenger.h>     // get_or_new_client_side_messenger
 #include <melon/rpc/socket_map.h>          // SocketMapList
 #include <melon/rpc/server.h>
@@ -137,6 +141,8 @@ namespace melon {
         AutoConcurrencyLimiter auto_cl;
         ConstantConcurrencyLimiter constant_cl;
         TimeoutConcurrencyLimiter timeout_cl;
+
+        ShmTransport shm_transport;
     };
 
     static pthread_once_t register_extensions_once = PTHREAD_ONCE_INIT;
@@ -443,7 +449,7 @@ namespace melon {
         Protocol mc_binary_protocol = {ParseMemcacheMessage,
                                        SerializeMemcacheRequest,
                                        PackMemcacheRequest,
-                                       nullptr, ProcessMemcacheResponse,
+                                       ProcessMemcacheRequest, ProcessMemcacheResponse,
                                        nullptr, nullptr, GetMemcacheMethodName,
                                        CONNECTION_TYPE_ALL, "memcache"};
         if (RegisterProtocol(PROTOCOL_MEMCACHE, mc_binary_protocol) != 0) {
@@ -503,6 +509,9 @@ namespace melon {
         ConcurrencyLimiterExtension()->RegisterOrDie("constant", &g_ext->constant_cl);
         ConcurrencyLimiterExtension()->RegisterOrDie("timeout", &g_ext->timeout_cl);
 
+        // Transports
+        TransportExtension()->RegisterOrDie("shm", &g_ext->shm_transport);
+
         if (FLAGS_usercode_in_pthread) {
             // Optional. If channel/server are initialized before main(), this
             // flag may be false at here even if it will be set to true after
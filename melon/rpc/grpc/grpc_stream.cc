@@ -0,0 +1,621 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+//
+
+
+#include <melon/rpc/grpc/grpc_stream_impl.h>
+
+#include <inttypes.h>
+#include <gflags/gflags.h>
+#include <melon/utility/sys_byteorder.h>
+#include <melon/utility/string_printf.h>
+#include <melon/fiber/unstable.h>
+#include <melon/rpc/log.h>
+#include <melon/rpc/controller.h>
+#include <melon/rpc/details/controller_private_accessor.h>
+#include <melon/rpc/policy/http2_rpc_protocol.h>
+#include <melon/proto/rpc/errno.pb.h>
+
+namespace melon {
+
+    DECLARE_bool(usercode_in_pthread);
+    DECLARE_uint64(max_body_size);
+
+    GrpcStream::GrpcStream()
+            : _host_socket(NULL), _fake_socket_weak_ref(NULL), _id(INVALID_GRPC_STREAM_ID),
+              _server_side(false), _h2_stream_id(0), _accepted(false), _headers_sent(false),
+              _local_closed(false), _end_sent(false), _remote_closed(false), _failed(false),
+              _close_error_code(0), _remote_error_code(0), _remote_window_left(0),
+              _unacked_window(0), _window_update_threshold(0), _partial_returned(0) {
+        CHECK_EQ(0, fiber_mutex_init(&_mutex, NULL));
+        CHECK_EQ(0, fiber_cond_init(&_writable_cond, NULL));
+    }
+
+    GrpcStream::~GrpcStream() {
+        CHECK(_host_socket == NULL);
+        for (size_t i = 0; i < _unaccepted_tasks.size(); ++i) {
+            delete _unaccepted_tasks[i].message;
+        }
+        fiber_cond_destroy(&_writable_cond);
+        fiber_mutex_destroy(&_mutex);
+    }
+
+    int GrpcStream::Create(const GrpcStreamOptions *options, bool server_side,
+                           GrpcStreamId *id) {
+        GrpcStream *s = new GrpcStream;
+        s->_server_side = server_side;
+        if (options != NULL) {
+            s->_options = *options;
+            s->_accepted = true;
+        }
+        if (s->_options.messages_in_batch == 0) {
+            s->_options.messages_in_batch = 1;
+        }
+        fiber::ExecutionQueueOptions q_opt;
+        q_opt.fiber_attr
+                = FLAGS_usercode_in_pthread ? FIBER_ATTR_PTHREAD : FIBER_ATTR_NORMAL;
+        if (fiber::execution_queue_start(&s->_consumer_queue, &q_opt, Consume, s) != 0) {
+            LOG(FATAL) << "Fail to create ExecutionQueue";
+            delete s;
+            return -1;
+        }
+        SocketOptions sock_opt;
+        sock_opt.conn = s;
+        SocketId fake_sock_id;
+        if (Socket::Create(sock_opt, &fake_sock_id) != 0) {
+            s->BeforeRecycle(NULL);
+            return -1;
+        }
+        SocketUniquePtr ptr;
+        CHECK_EQ(0, Socket::Address(fake_sock_id, &ptr));
+        s->_fake_socket_weak_ref = ptr.get();
+        s->_id = fake_sock_id;
+        *id = s->id();
+        return 0;
+    }
+
+    GrpcStream *GrpcStream::Address(GrpcStreamId id, SocketUniquePtr *ptr) {
+        if (Socket::Address(id, ptr) != 0) {
+            return NULL;
+        }
+        return dynamic_cast<GrpcStream *>((*ptr)->conn());
+    }
+
+    int GrpcStream::Connect(Socket *, const timespec *,
+                            int (*)(int, int, void *), void *) {
+        CHECK(false) << "GrpcStream is never connected";
+        errno = EINVAL;
+        return -1;
+    }
+
+    ssize_t GrpcStream::CutMessageIntoFileDescriptor(int, mutil::IOBuf **, size_t) {
+        CHECK(false) << "GrpcStream is written into the host socket";
+        errno = EINVAL;
+        return -1;
+    }
+
+    ssize_t GrpcStream::CutMessageIntoSSLChannel(SSL *, mutil::IOBuf **, size_t) {
+        CHECK(false) << "GrpcStream is written into the host socket";
+        errno = EINVAL;
+        return -1;
+    }
+
+    void GrpcStream::BeforeRecycle(Socket *) {
+        // No one holds reference now, so we don't need lock here
+        if (_host_socket) {
+            policy::UnbindGrpcStream(_host_socket, _h2_stream_id);
+            _host_socket->RemoveStream(id());
+        }
+        // The instance is to be deleted in the consumer thread
+        fiber::execution_queue_stop(_consumer_queue);
+    }
+
+    int GrpcStream::Accept(const GrpcStreamOptions &options) {
+        std::unique_lock<fiber_mutex_t> mu(_mutex);
+        if (_accepted) {
+            return -1;
+        }
+        _options = options;
+        if (_options.messages_in_batch == 0) {
+            _options.messages_in_batch = 1;
+        }
+        _accepted = true;
+        for (size_t i = 0; i < _unaccepted_tasks.size(); ++i) {
+            PushTask(_unaccepted_tasks[i]);
+        }
+        _unaccepted_tasks.clear();
+        return 0;
+    }
+
+    bool GrpcStream::accepted() {
+        std::unique_lock<fiber_mutex_t> mu(_mutex);
+        return _accepted;
+    }
+
+    void GrpcStream::PushTask(const GrpcStreamTask &task) {
+        if (!_accepted) {
+            _unaccepted_tasks.push_back(task);
+            return;
+        }
+        if (fiber::execution_queue_execute(_consumer_queue, task) != 0) {
+            delete task.message;
+        }
+    }
+
+    int GrpcStream::Bind(Socket *host_socket, int h2_stream_id, int64_t remote_window,
+                         int64_t window_update_threshold, bool local_closed) {
+        SocketUniquePtr ptr;
+        host_socket->ReAddress(&ptr);
+        if (ptr->AddStream(id()) != 0) {
+            return -1;
+        }
+        std::unique_lock<fiber_mutex_t> mu(_mutex);
+        if (_host_socket != NULL) {
+            mu.unlock();
+            CHECK(false) << "Bind has already been called";
+            ptr->RemoveStream(id());
+            return -1;
+        }
+        if (_failed) {
+            mu.unlock();
+            ptr->RemoveStream(id());
+            return -1;
+        }
+        _host_socket = ptr.release();
+        _h2_stream_id = h2_stream_id;
+        _remote_window_left = remote_window;
+        _window_update_threshold = window_update_threshold;
+        if (local_closed) {
+            _local_closed = true;
+            _end_sent = true;
+            _unsent.clear();
+        }
+        return 0;
+    }
+
+    void GrpcStream::OnHeadersSent() {
+        {
+            std::unique_lock<fiber_mutex_t> mu(_mutex);
+            _headers_sent = true;
+        }
+        Flush();
+        // Window consumed before binding
+        ReturnWindow(0);
+    }
+
+    int GrpcStream::Write(const mutil::IOBuf &message) {
+        char prefix[5];
+        prefix[0] = 0;  // not compressed
+        *(uint32_t *) (prefix + 1) = mutil::HostToNet32(message.size());
+        {
+            std::unique_lock<fiber_mutex_t> mu(_mutex);
+            if (_local_closed || _failed) {
+                return EINVAL;
+            }
+            if (full()) {
+                return EAGAIN;
+            }
+            _unsent.append(prefix, sizeof(prefix));
+            _unsent.append(message);
+        }
+        Flush();
+        return 0;
+    }
+
+    int GrpcStream::Wait(const timespec *due_time) {
+        std::unique_lock<fiber_mutex_t> mu(_mutex);
+        while (!_local_closed && !_failed && full()) {
+            const int rc = (due_time != NULL ?
+                            fiber_cond_timedwait(&_writable_cond, &_mutex, due_time) :
+                            fiber_cond_wait(&_writable_cond, &_mutex));
+            if (rc == ETIMEDOUT) {
+                return ETIMEDOUT;
+            }
+        }
+        return (_local_closed || _failed) ? EINVAL : 0;
+    }
+
+    void GrpcStream::Flush() {
+        bool finished = false;
+        std::unique_lock<fiber_mutex_t> mu(_mutex);
+        if (_host_socket == NULL || !_headers_sent || _end_sent) {
+            return;
+        }
+        // Frames are written with the lock held to keep them in order.
+        const bool was_full = full();
+        const bool end_stream = _local_closed && !_server_side;
+        const int64_t n = std::min((int64_t) _unsent.size(), _remote_window_left);
+        if (n > 0 || (end_stream && _unsent.empty())) {
+            const int64_t nw = policy::WriteH2Data(
+                    _host_socket, _h2_stream_id, &_unsent, std::max(n, (int64_t) 0), end_stream);
+            if (nw < 0) {
+                mu.unlock();
+                return Fail(EFAILEDSOCKET, "Fail to write into the host socket", false);
+            }
+            _remote_window_left -= nw;
+        }
+        if (_local_closed && _unsent.empty()) {
+            _end_sent = true;
+            if (_server_side &&
+                policy::WriteGrpcTrailers(_host_socket, _h2_stream_id,
+                                          _close_error_code, _close_error_text) != 0) {
+                mu.unlock();
+                return Fail(EFAILEDSOCKET, "Fail to write into the host socket", false);
+            }
+            if (_server_side && !_remote_closed) {
+                // The call is over once the status is sent, following
+                // messages from the client are dropped.
+                _remote_closed = true;
+                GrpcStreamTask task = {NULL, 0};
+                PushTask(task);
+            }
+            finished = _remote_closed;
+        }
+        if (was_full && !full()) {
+            fiber_cond_broadcast(&_writable_cond);
+        }
+        mu.unlock();
+        if (finished) {
+            _fake_socket_weak_ref->SetFailed();
+        }
+    }
+
+    void GrpcStream::Close(int error_code, const std::string &error_text) {
+        {
+            std::unique_lock<fiber_mutex_t> mu(_mutex);
+            if (_local_closed || _failed) {
+                return;
+            }
+            if (error_code != 0 && !_server_side) {
+                // Cancel the call.
+                mu.unlock();
+                return Fail(ECANCELED, error_text, true);
+            }
+            _local_closed = true;
+            _close_error_code = error_code;
+            _close_error_text = error_text;
+            fiber_cond_broadcast(&_writable_cond);
+        }
+        Flush();
+    }
+
+    void GrpcStream::Fail(int error_code, const std::string &error_text,
+                          bool reset_remote) {
+        std::unique_lock<fiber_mutex_t> mu(_mutex);
+        if (_failed) {
+            return;
+        }
+        _failed = true;
+        if (reset_remote && _host_socket != NULL && _headers_sent &&
+            !(_end_sent && _remote_closed)) {
+            policy::WriteH2ResetStream(_host_socket, _h2_stream_id, H2_CANCEL);
+        }
+        _local_closed = true;
+        _end_sent = true;
+        _unsent.clear();
+        if (!_remote_closed) {
+            _remote_closed = true;
+            _remote_error_code = error_code;
+            _remote_error_text = error_text;
+            GrpcStreamTask task = {NULL, 0};
+            PushTask(task);
+        }
+        fiber_cond_broadcast(&_writable_cond);
+        mu.unlock();
+        _fake_socket_weak_ref->SetFailed();
+    }
+
+    int GrpcStream::SetFailed(GrpcStreamId id, int error_code,
+                              const std::string &error_text, bool reset_remote) {
+        SocketUniquePtr ptr;
+        if (Socket::AddressFailedAsWell(id, &ptr) == -1) {
+            // Don't care recycled stream
+            return 0;
+        }
+        GrpcStream *s = dynamic_cast<GrpcStream *>(ptr->conn());
+        if (s == NULL) {
+            return -1;
+        }
+        s->Fail(error_code, error_text, reset_remote);
+        return 0;
+    }
+
+    int GrpcStream::OnData(mutil::IOBuf *data, int64_t flow_size) {
+        // Padding is not given to the handler
+        int64_t returned = flow_size - (int64_t) data->size();
+        _partial.append(mutil::IOBuf::Movable(*data));
+        while (_partial.size() >= 5) {
+            char prefix[5];
+            _partial.copy_to(prefix, sizeof(prefix));
+            if (prefix[0] != 0) {
+                Fail(EREQUEST, "Compressed gRPC message is not supported", true);
+                return -1;
+            }
+            const uint64_t payload_size = mutil::NetToHost32(*(uint32_t *) (prefix + 1));
+            if (payload_size > FLAGS_max_body_size) {
+                RejectMessage(ELIMIT, mutil::string_printf(
+                        "gRPC message of %" PRIu64 " bytes is larger than "
+                        "max_body_size=%" PRIu64, payload_size,
+                        (uint64_t) FLAGS_max_body_size));
+                return -1;
+            }
+            const int64_t message_size = (int64_t) payload_size + 5;
+            if ((int64_t) _partial.size() < message_size) {
+                break;
+            }
+            GrpcStreamTask task;
+            task.message = new mutil::IOBuf;
+            _partial.pop_front(5);
+            _partial.cutn(task.message, message_size - 5);
+            task.window = message_size - std::min(_partial_returned, message_size);
+            _partial_returned -= message_size - task.window;
+            std::unique_lock<fiber_mutex_t> mu(_mutex);
+            if (_remote_closed) {
+                delete task.message;
+                return -1;
+            }
+            PushTask(task);
+        }
+        // The incomplete message is not able to be consumed until more data
+        // arrives, give its window back at once, otherwise messages larger
+        // than the window would never complete. The window is only given
+        // for the announced size of the message, which is capped by
+        // -max_body_size above, so _partial never grows beyond that.
+        returned += (int64_t) _partial.size() - _partial_returned;
+        _partial_returned = _partial.size();
+        ReturnWindow(returned);
+        return 0;
+    }
+
+    void GrpcStream::RejectMessage(int error_code, const std::string &error_text) {
+        std::unique_lock<fiber_mutex_t> mu(_mutex);
+        if (!_server_side || !_headers_sent || _end_sent || _failed) {
+            mu.unlock();
+            return Fail(error_code, error_text, true);
+        }
+        // Respond with the status at once, unsent messages are dropped.
+        _unsent.clear();
+        _local_closed = true;
+        _close_error_code = error_code;
+        _close_error_text = error_text;
+        if (!_remote_closed) {
+            _remote_closed = true;
+            _remote_error_code = error_code;
+            _remote_error_text = error_text;
+            GrpcStreamTask task = {NULL, 0};
+            PushTask(task);
+        }
+        fiber_cond_broadcast(&_writable_cond);
+        mu.unlock();
+        Flush();
+    }
+
+    void GrpcStream::OnWindowUpdate(int64_t increment) {
+        {
+            std::unique_lock<fiber_mutex_t> mu(_mutex);
+            _remote_window_left += increment;
+        }
+        Flush();
+    }
+
+    void GrpcStream::OnRemoteClosed(int error_code, const std::string &error_text) {
+        bool finished = false;
+        {
+            std::unique_lock<fiber_mutex_t> mu(_mutex);
+            if (_remote_closed) {
+                return;
+            }
+            _remote_closed = true;
+            _remote_error_code = error_code;
+            _remote_error_text = error_text;
+            GrpcStreamTask task = {NULL, 0};
+            PushTask(task);
+            if (!_server_side) {
+                // The call is over once the server finishes.
+                _local_closed = true;
+                _end_sent = true;
+                _unsent.clear();
+                fiber_cond_broadcast(&_writable_cond);
+            }
+            finished = _end_sent;
+        }
+        if (finished) {
+            _fake_socket_weak_ref->SetFailed();
+        }
+    }
+
+    void GrpcStream::ReturnWindow(int64_t size) {
+        std::unique_lock<fiber_mutex_t> mu(_mutex);
+        _unacked_window += size;
+        if (_host_socket == NULL || !_headers_sent || _remote_closed ||
+            _unacked_window < _window_update_threshold || _unacked_window <= 0) {
+            return;
+        }
+        const int64_t wu = _unacked_window;
+        _unacked_window = 0;
+        policy::ReturnGrpcStreamWindow(_host_socket, _h2_stream_id, wu);
+    }
+
+    int GrpcStream::Consume(void *meta, fiber::TaskIterator<GrpcStreamTask> &iter) {
+        GrpcStream *s = (GrpcStream *) meta;
+        if (iter.is_queue_stopped()) {
+            // indicating the queue was closed
+            if (s->_host_socket) {
+                DereferenceSocket(s->_host_socket);
+                s->_host_socket = NULL;
+            }
+            delete s;
+            return 0;
+        }
+        GrpcStreamInputHandler *const handler = s->_options.handler;
+        const size_t cap = s->_options.messages_in_batch;
+        DEFINE_SMALL_ARRAY(mutil::IOBuf*, buf_list, cap, 256);
+        size_t size = 0;
+        int64_t window = 0;
+        bool closed = false;
+        for (; iter; ++iter) {
+            const GrpcStreamTask &t = *iter;
+            if (t.message == NULL) {
+                closed = true;
+                continue;
+            }
+            buf_list[size++] = t.message;
+            window += t.window;
+            if (size == cap) {
+                if (handler != NULL) {
+                    handler->on_received_messages(s->id(), buf_list, size);
+                }
+                for (size_t i = 0; i < size; ++i) {
+                    delete buf_list[i];
+                }
+                size = 0;
+            }
+        }
+        if (size > 0) {
+            if (handler != NULL) {
+                handler->on_received_messages(s->id(), buf_list, size);
+            }
+            for (size_t i = 0; i < size; ++i) {
+                delete buf_list[i];
+            }
+        }
+        s->ReturnWindow(window);
+        if (closed && handler != NULL) {
+            // _remote_error_* are not modified after the task was pushed
+            handler->on_closed(s->id(), s->_remote_error_code, s->_remote_error_text);
+        }
+        return 0;
+    }
+
+    int GrpcStreamCreate(GrpcStreamId *stream, Controller &cntl,
+                         const GrpcStreamOptions *options) {
+        ControllerPrivateAccessor accessor(&cntl);
+        if (accessor.grpc_stream() != INVALID_GRPC_STREAM_ID) {
+            LOG(ERROR) << "Can't create grpc stream more than once";
+            return -1;
+        }
+        if (stream == NULL) {
+            LOG(ERROR) << "stream is NULL";
+            return -1;
+        }
+        GrpcStreamOptions opt;
+        if (options != NULL) {
+            opt = *options;
+        }
+        GrpcStreamId stream_id;
+        if (GrpcStream::Create(&opt, false, &stream_id) != 0) {
+            LOG(ERROR) << "Fail to create grpc stream";
+            return -1;
+        }
+        accessor.set_grpc_stream(stream_id);
+        *stream = stream_id;
+        return 0;
+    }
+
+    int GrpcStreamAccept(GrpcStreamId *stream, Controller &cntl,
+                         const GrpcStreamOptions *options) {
+        if (stream == NULL) {
+            LOG(ERROR) << "stream is NULL";
+            return -1;
+        }
+        GrpcStreamOptions opt;
+        if (options != NULL) {
+            opt = *options;
+        }
+        ControllerPrivateAccessor accessor(&cntl);
+        GrpcStreamId stream_id = accessor.grpc_stream();
+        if (stream_id != INVALID_GRPC_STREAM_ID) {
+            // Created along with a request with streaming messages.
+            SocketUniquePtr ptr;
+            GrpcStream *s = GrpcStream::Address(stream_id, &ptr);
+            if (s == NULL) {
+                LOG(ERROR) << "The grpc stream was closed";
+                return -1;
+            }
+            if (s->Accept(opt) != 0) {
+                LOG(ERROR) << "Can't accept grpc stream more than once";
+                return -1;
+            }
+            *stream = stream_id;
+            return 0;
+        }
+        bool is_grpc_ct = false;
+        policy::ParseContentType(cntl.http_request().content_type(), &is_grpc_ct);
+        if (!cntl.http_request().is_http2() || !is_grpc_ct) {
+            LOG(ERROR) << "The request is not gRPC over http2";
+            return -1;
+        }
+        if (GrpcStream::Create(&opt, true, &stream_id) != 0) {
+            LOG(ERROR) << "Fail to create grpc stream";
+            return -1;
+        }
+        // The only request message was received along with END_STREAM.
+        SocketUniquePtr ptr;
+        GrpcStream *s = GrpcStream::Address(stream_id, &ptr);
+        CHECK(s != NULL);
+        s->OnRemoteClosed(0, std::string());
+        accessor.set_grpc_stream(stream_id);
+        *stream = stream_id;
+        return 0;
+    }
+
+    int GrpcStreamWrite(GrpcStreamId stream, const mutil::IOBuf &message) {
+        SocketUniquePtr ptr;
+        GrpcStream *s = GrpcStream::Address(stream, &ptr);
+        if (s == NULL) {
+            return EINVAL;
+        }
+        return s->Write(message);
+    }
+
+    int GrpcStreamWait(GrpcStreamId stream, const timespec *due_time) {
+        SocketUniquePtr ptr;
+        GrpcStream *s = GrpcStream::Address(stream, &ptr);
+        if (s == NULL) {
+            return EINVAL;
+        }
+        return s->Wait(due_time);
+    }
+
+    int GrpcStreamClose(GrpcStreamId stream) {
+        SocketUniquePtr ptr;
+        GrpcStream *s = GrpcStream::Address(stream, &ptr);
+        if (s != NULL) {
+            s->Close(0, std::string());
+        }
+        return 0;
+    }
+
+    int GrpcStreamClose(GrpcStreamId stream, int error_code,
+                        const char *reason_fmt, ...) {
+        std::string error_text;
+        if (reason_fmt) {
+            va_list ap;
+            va_start(ap, reason_fmt);
+            mutil::string_vappendf(&error_text, reason_fmt, ap);
+            va_end(ap);
+        }
+        SocketUniquePtr ptr;
+        GrpcStream *s = GrpcStream::Address(stream, &ptr);
+        if (s != NULL) {
+            s->Close(error_code, error_text);
+        }
+        return 0;
+    }
+
+} // namespace melon
@@ -0,0 +1,138 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+//
+
+
+#ifndef MELON_RPC_GRPC_GRPC_STREAM_H_
+#define MELON_RPC_GRPC_GRPC_STREAM_H_
+
+#include <string>
+#include <melon/utility/iobuf.h>
+#include <melon/rpc/socket_id.h>
+
+// Server-streaming, client-streaming and bidi-streaming gRPC over the http2
+// stream of a call, used in the way of melon::Stream:
+//
+//   Client                                   Server
+//   GrpcStreamCreate(&s, cntl, &opt);
+//   stub.Method(&cntl, &req, &res, NULL);    GrpcStreamAccept(&s, *cntl, &opt);
+//                                            done->Run();
+//   GrpcStreamWrite(s, msg) ...              GrpcStreamWrite(s, msg) ...
+//   GrpcStreamClose(s);                      GrpcStreamClose(s);
+//
+// The call completes once the server responds with headers, after which
+// messages flow in both directions. For methods with a streaming request,
+// `req' is not sent and all request messages are written into the stream;
+// for other methods `req' is the only request message. Responses of
+// accepted calls are empty, all response messages are written into the
+// stream. Messages are not serialized or copied: they're written and received
+// as IOBuf referencing the DATA frames.
+// Writing is throttled by the http2 flow-control windows of the remote side,
+// and the window of the local side is given back only after received
+// messages are consumed by the handler.
+
+namespace melon {
+
+    class Controller;
+
+    typedef SocketId GrpcStreamId;
+    const GrpcStreamId INVALID_GRPC_STREAM_ID = (GrpcStreamId) -1L;
+
+    class GrpcStreamInputHandler {
+    public:
+        virtual ~GrpcStreamInputHandler() = default;
+
+        // Payloads of received messages, the length-prefixes are removed.
+        virtual int on_received_messages(GrpcStreamId id,
+                                         mutil::IOBuf *const messages[],
+                                         size_t size) = 0;
+
+        // Called after all messages are received. |error_code| is 0 when the
+        // remote side finished normally: the client half-closed the stream or
+        // the server sent an OK grpc-status. Otherwise the stream is broken and
+        // can't be written either.
+        virtual void on_closed(GrpcStreamId id, int error_code,
+                               const std::string &error_text) = 0;
+    };
+
+    struct GrpcStreamOptions {
+        GrpcStreamOptions()
+                : max_buf_size(2 * 1024 * 1024), messages_in_batch(128), handler(NULL) {}
+
+        // Max bytes of written messages which are not sent yet because the
+        // flow-control windows of the remote side are exhausted.
+        // If |max_buf_size| <= 0, there's no limit of buf size
+        // default: 2097152 (2M)
+        int64_t max_buf_size;
+
+        // Maximum messages in batch passed to handler->on_received_messages
+        // default: 128
+        size_t messages_in_batch;
+
+        // Handle received messages. If handler is NULL, messages are dropped.
+        // default: NULL
+        GrpcStreamInputHandler *handler;
+    };
+
+    // [Called at the client side]
+    // Create a stream along with the gRPC call of |cntl|, which is opened when
+    // the server responds. If |options| is NULL, the stream will be created
+    // with default options.
+    // Return 0 on success, -1 otherwise
+    int GrpcStreamCreate(GrpcStreamId *stream, Controller &cntl,
+                         const GrpcStreamOptions *options);
+
+    // [Called at the server side]
+    // Accept the stream of the gRPC call of |cntl| before done->Run(), which
+    // is opened when the response headers are sent. Fails if the request is
+    // not gRPC over http2.
+    // Return 0 on success, -1 otherwise.
+    int GrpcStreamAccept(GrpcStreamId *stream, Controller &cntl,
+                         const GrpcStreamOptions *options);
+
+    // Write |message| into |stream|.
+    // Returns 0 on success, errno otherwise
+    // Errno:
+    //  - EAGAIN: unsent bytes exceed |max_buf_size|, call GrpcStreamWait.
+    //  - EINVAL: |stream| is invalid or has been closed
+    int GrpcStreamWrite(GrpcStreamId stream, const mutil::IOBuf &message);
+
+    // Wait until unsent bytes are less than |max_buf_size| or error occurs
+    // Returns 0 on success, errno otherwise
+    // Errno:
+    //  - ETIMEDOUT: when |due_time| is not NULL and time expired this
+    //  - EINVAL: the stream was closed during waiting
+    int GrpcStreamWait(GrpcStreamId stream, const timespec *due_time);
+
+    // Close |stream| after written messages are sent: the client half-closes
+    // the stream while the server sends trailers with OK grpc-status.
+    // Following GrpcStreamWrite fail, messages from the remote side are still
+    // received until the handler's on_closed is called.
+    // This function could be called multiple times without side-effects
+    int GrpcStreamClose(GrpcStreamId stream);
+
+    // Close |stream| with an error. The server sends grpc-status converted
+    // from |error_code| after written messages, the client cancels the
+    // stream immediately.
+    int GrpcStreamClose(GrpcStreamId stream, int error_code,
+                        const char *reason_fmt, ...)
+    __attribute__ ((__format__ (__printf__, 3, 4)));
+
+} // namespace melon
+
+#endif // MELON_RPC_GRPC_GRPC_STREAM_H_
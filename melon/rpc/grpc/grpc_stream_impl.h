@@ -0,0 +1,174 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+//
+
+
+#ifndef MELON_RPC_GRPC_GRPC_STREAM_IMPL_H_
+#define MELON_RPC_GRPC_GRPC_STREAM_IMPL_H_
+
+#include <vector>
+#include <melon/fiber/fiber.h>
+#include <melon/fiber/execution_queue.h>
+#include <melon/rpc/socket.h>
+#include <melon/rpc/grpc/grpc_stream.h>
+
+namespace melon {
+
+    struct GrpcStreamTask {
+        // NULL means the remote side finished.
+        mutil::IOBuf *message;
+        // Bytes of the stream-level window given back after consuming.
+        int64_t window;
+    };
+
+    // A gRPC stream is identified by a fake Socket like melon::Stream so that
+    // it's referenced and recycled safely. Nothing is written into the fake
+    // socket, frames are written into the http2 connection(host socket)
+    // directly.
+    class MELON_CACHELINE_ALIGNMENT GrpcStream : public SocketConnection {
+    public:
+        // |--------------------------------------------------|
+        // |----------- Implement SocketConnection -----------|
+        // |--------------------------------------------------|
+
+        int Connect(Socket *ptr, const timespec *due_time,
+                    int (*on_connect)(int, int, void *), void *data);
+
+        ssize_t CutMessageIntoFileDescriptor(int, mutil::IOBuf **data_list,
+                                             size_t size);
+
+        ssize_t CutMessageIntoSSLChannel(SSL *, mutil::IOBuf **, size_t);
+
+        void BeforeRecycle(Socket *);
+
+        // --------------------- SocketConnection --------------
+
+        // Create a stream at client side(server_side=false) or server side.
+        // A NULL |options| means the stream is created by the server for a
+        // request with streaming messages before the user accepts it, received
+        // messages are kept until Accept().
+        static int Create(const GrpcStreamOptions *options, bool server_side,
+                          GrpcStreamId *id);
+
+        // Returns the stream addressed by |id| in |ptr|, NULL if the stream is
+        // recycled or |id| is not a GrpcStream.
+        static GrpcStream *Address(GrpcStreamId id, SocketUniquePtr *ptr);
+
+        GrpcStreamId id() const { return _id; }
+
+        int Accept(const GrpcStreamOptions &options);
+
+        bool accepted();
+
+        // Attach to the http2 stream |h2_stream_id| of |host_socket| whose
+        // stream-level window at the remote side is |remote_window|.
+        // |local_closed| is true if END_STREAM was already sent, namely the
+        // request of a call without streaming request. Messages are not sent
+        // until OnHeadersSent() is called.
+        int Bind(Socket *host_socket, int h2_stream_id, int64_t remote_window,
+                 int64_t window_update_threshold, bool local_closed);
+
+        // Headers of the http2 stream were written, start sending messages.
+        void OnHeadersSent();
+
+        int Write(const mutil::IOBuf &message);
+
+        int Wait(const timespec *due_time);
+
+        // Finish the local side with |error_code|, see GrpcStreamClose.
+        void Close(int error_code, const std::string &error_text);
+
+        // Called by H2Context in the parsing fiber.
+        // Cut messages from DATA frames. |flow_size| is the size of frames
+        // counted by flow control.
+        int OnData(mutil::IOBuf *data, int64_t flow_size);
+
+        void OnWindowUpdate(int64_t increment);
+
+        // The remote side sent END_STREAM.
+        void OnRemoteClosed(int error_code, const std::string &error_text);
+
+        // Break the stream in both directions, RST_STREAM is sent if
+        // |reset_remote| is true and the stream was opened.
+        void Fail(int error_code, const std::string &error_text, bool reset_remote);
+
+        // Stop receiving because of an invalid message. The server responds
+        // with the status of |error_code|, the client cancels the stream.
+        void RejectMessage(int error_code, const std::string &error_text);
+
+        // Send messages as the windows allow.
+        void Flush();
+
+        static int SetFailed(GrpcStreamId id, int error_code,
+                             const std::string &error_text, bool reset_remote);
+
+    private:
+        GrpcStream();
+
+        ~GrpcStream();
+
+        // Give |size| bytes of the stream-level window back to the remote side.
+        void ReturnWindow(int64_t size);
+
+        // Schedule |task| to the handler, _mutex must be held.
+        void PushTask(const GrpcStreamTask &task);
+
+        bool full() const {
+            return _options.max_buf_size > 0 &&
+                   (int64_t) _unsent.size() >= _options.max_buf_size;
+        }
+
+        static int Consume(void *meta, fiber::TaskIterator<GrpcStreamTask> &iter);
+
+        Socket *_host_socket;  // Holding a reference once bound
+        Socket *_fake_socket_weak_ref;  // Not holding reference
+        GrpcStreamId _id;
+        GrpcStreamOptions _options;
+        bool _server_side;
+        int _h2_stream_id;
+        fiber::ExecutionQueueId<GrpcStreamTask> _consumer_queue;
+
+        fiber_mutex_t _mutex;
+        fiber_cond_t _writable_cond;
+        // Following fields are protected by _mutex
+        bool _accepted;
+        bool _headers_sent;
+        bool _local_closed;  // No more Write()
+        bool _end_sent;  // END_STREAM was sent or will never be sent
+        bool _remote_closed;  // on_closed was scheduled
+        bool _failed;
+        int _close_error_code;
+        std::string _close_error_text;
+        int _remote_error_code;
+        std::string _remote_error_text;
+        // Length-prefixed messages waiting for the windows
+        mutil::IOBuf _unsent;
+        int64_t _remote_window_left;
+        int64_t _unacked_window;
+        int64_t _window_update_threshold;
+        std::vector<GrpcStreamTask> _unaccepted_tasks;
+
+        // Only accessed in the parsing fiber.
+        mutil::IOBuf _partial;
+        // Bytes at the front of _partial which were given back already.
+        int64_t _partial_returned;
+    };
+
+} // namespace melon
+
+#endif // MELON_RPC_GRPC_GRPC_STREAM_IMPL_H_
@@ -323,6 +323,8 @@ namespace melon {
             node(cur).value = value;
         }
 
+        size_t node_count() const { return _node_memory.size(); }
+
         const HuffmanNode *node(NodeId id) const {
             if (id == 0u) {
                 return NULL;
@@ -350,118 +352,174 @@ namespace melon {
 
     };
 
+    // Accumulates codes in a 64-bit integer and flushes 4 bytes at a time.
+    template<typename Output>
     class HuffmanEncoder {
         DISALLOW_COPY_AND_ASSIGN(HuffmanEncoder);
 
     public:
-        HuffmanEncoder(mutil::IOBufAppender *out, const HuffmanCode *table)
-                : _out(out), _table(table), _partial_byte(0), _remain_bit(8), _out_bytes(0) {}
+        HuffmanEncoder(Output *out, const HuffmanCode *table)
+                : _out(out), _table(table), _acc(0), _nbits(0), _out_bytes(0) {}
 
         void Encode(unsigned char byte) {
             const HuffmanCode code = _table[byte];
-            uint16_t bits_left = code.bit_len;
-            while (bits_left) {
-                const uint16_t adding_bits_len = std::min(_remain_bit, bits_left);
-                const uint8_t adding_bits = static_cast<uint8_t>(
-                        (code.code & ((1u << bits_left) - 1))   // clear leading bits
-                                >> (bits_left - adding_bits_len));  // align to LSB
-                _partial_byte |= adding_bits << (_remain_bit - adding_bits_len);
-                _remain_bit -= adding_bits_len;
-                bits_left -= adding_bits_len;
-                if (!_remain_bit) {
-                    ++_out_bytes;
-                    _out->push_back(_partial_byte);
-                    _remain_bit = 8;
-                    _partial_byte = 0;
-                }
+            // _nbits < 32 and codes are at most 30 bits, no overflow.
+            _acc = (_acc << code.bit_len) | code.code;
+            _nbits += code.bit_len;
+            if (_nbits >= 32) {
+                _nbits -= 32;
+                const uint32_t v = static_cast<uint32_t>(_acc >> _nbits);
+                const char buf[4] = {
+                        static_cast<char>(v >> 24), static_cast<char>(v >> 16),
+                        static_cast<char>(v >> 8), static_cast<char>(v)};
+                _out->append(buf, 4);
+                _out_bytes += 4;
             }
         }
 
         void EndStream() {
-            if (_remain_bit == 8u) {
-                return;
+            while (_nbits >= 8) {
+                _nbits -= 8;
+                _out->push_back(static_cast<char>(_acc >> _nbits));
+                ++_out_bytes;
             }
-            DCHECK_LT(_remain_bit, 8u);
-            // Add padding `1's to lsb to make _out aligned
-            _partial_byte |= (1 << _remain_bit) - 1;
-            // TODO: push_back is probably costly since it acquires tls everytime it
-            // is invoked.
-            _out->push_back(_partial_byte);
-            _partial_byte = 0;
-            _remain_bit = 0;
+            if (_nbits > 0) {
+                // Add padding `1's to lsb to make _out aligned
+                const uint32_t npad = 8 - _nbits;
+                _out->push_back(static_cast<char>((_acc << npad) | ((1u << npad) - 1)));
+                ++_out_bytes;
+            }
+            _nbits = 0;
             _out = NULL;
-            ++_out_bytes;
         }
 
         uint32_t out_bytes() const { return _out_bytes; }
 
     private:
-        mutil::IOBufAppender *_out;
+        Output *_out;
         const HuffmanCode *_table;
-        uint8_t _partial_byte;
-        uint16_t _remain_bit;
+        uint64_t _acc;
+        uint32_t _nbits;
         uint32_t _out_bytes;
     };
 
-    class HuffmanDecoder {
-        DISALLOW_COPY_AND_ASSIGN(HuffmanDecoder);
+    struct HuffmanTransition {
+        uint8_t state;
+        uint8_t flags;
+        uint8_t symbol;
+    };
 
-    public:
-        HuffmanDecoder(std::string *out, const HuffmanTree *tree)
-        // FIXME: resizing of out is costly
-                : _out(out), _tree(tree), _cur_node(tree->node(HuffmanTree::ROOT_NODE)),
-                  _cur_depth(0)  // Depth of root node is 0
-                , _padding(true) {}
+    // State machine decoding 4 bits at a time instead of walking HuffmanTree
+    // bit by bit. Each internal node of the tree is a state, the transition
+    // from a state with 4 bits tells the next state and the decoded symbol
+    // if any. Codes are at least 5 bits long so that there's at most one.
+    class MELON_CACHELINE_ALIGNMENT HuffmanDecodeTable {
+        DISALLOW_COPY_AND_ASSIGN(HuffmanDecodeTable);
 
-        int Decode(uint8_t byte) {
-            for (int i = 7; i >= 0; --i) {
-                if (byte & (1u << i)) {
-                    _cur_node = _tree->node(_cur_node->right_child);
-                    if (MELON_UNLIKELY(!_cur_node)) {
-                        LOG(ERROR) << "Decoder stream reaches NULL_NODE";
-                        return -1;
-                    }
-                    if (_cur_node->value != HuffmanTree::INVALID_VALUE) {
-                        if (MELON_UNLIKELY(_cur_node->value == HPACK_HUFFMAN_EOS)) {
-                            LOG(ERROR) << "Decoder stream reaches EOS";
-                            return -1;
+    public:
+        enum Flag {
+            // A symbol is decoded.
+            EMIT = 1,
+            // The bits reach EOS, which is a decoding error.
+            FAIL = 2,
+            // The stream may end at the next state: it's the root or all bits
+            // since the last symbol are less than 8 `1's, namely a valid
+            // padding according to https://tools.ietf.org/html/rfc7541#section-5.2
+            ACCEPTED = 4
+        };
+        static const int ROOT_STATE = 0;
+
+        explicit HuffmanDecodeTable(const HuffmanTree &tree) {
+            // Number internal nodes as states, root first.
+            std::vector<int> state_of(tree.node_count() + 1, -1);
+            std::vector<HuffmanTree::NodeId> node_of;
+            state_of[HuffmanTree::ROOT_NODE] = ROOT_STATE;
+            node_of.push_back(HuffmanTree::ROOT_NODE);
+            for (size_t id = HuffmanTree::ROOT_NODE + 1; id <= tree.node_count(); ++id) {
+                if (tree.node(id)->value == HuffmanTree::INVALID_VALUE) {
+                    state_of[id] = node_of.size();
+                    node_of.push_back(id);
+                }
+            }
+            CHECK_EQ(256u, node_of.size());
+            std::vector<bool> accepted(tree.node_count() + 1, false);
+            HuffmanTree::NodeId id = HuffmanTree::ROOT_NODE;
+            for (int depth = 0; depth < 8 && id != HuffmanTree::NULL_NODE &&
+                                tree.node(id)->value == HuffmanTree::INVALID_VALUE; ++depth) {
+                accepted[id] = true;
+                id = tree.node(id)->right_child;
+            }
+            for (size_t state = 0; state < node_of.size(); ++state) {
+                for (int bits = 0; bits < 16; ++bits) {
+                    HuffmanTransition &t = _table[state][bits];
+                    t.flags = 0;
+                    t.symbol = 0;
+                    HuffmanTree::NodeId cur = node_of[state];
+                    for (int i = 3; i >= 0; --i) {
+                        const HuffmanNode *n = tree.node(cur);
+                        cur = (bits & (1 << i)) ? n->right_child : n->left_child;
+                        const HuffmanNode *child = tree.node(cur);
+                        if (child == NULL || child->value == HPACK_HUFFMAN_EOS) {
+                            t.flags = FAIL;
+                            break;
                         }
-                        _out->push_back(static_cast<uint8_t>(_cur_node->value));
-                        _cur_node = _tree->node(HuffmanTree::ROOT_NODE);
-                        _cur_depth = 0;
-                        _padding = true;
-                        continue;
-                    }
-                    _padding &= 1;
-                } else {
-                    _cur_node = _tree->node(_cur_node->left_child);
-                    if (MELON_UNLIKELY(!_cur_node)) {
-                        LOG(ERROR) << "Decoder stream reaches NULL_NODE";
-                        return -1;
-                    }
-                    if (_cur_node->value != HuffmanTree::INVALID_VALUE) {
-                        if (MELON_UNLIKELY(_cur_node->value == HPACK_HUFFMAN_EOS)) {
-                            LOG(ERROR) << "Decoder stream reaches EOS";
-                            return -1;
+                        if (child->value != HuffmanTree::INVALID_VALUE) {
+                            t.flags |= EMIT;
+                            t.symbol = static_cast<uint8_t>(child->value);
+                            cur = HuffmanTree::ROOT_NODE;
                         }
-                        _out->push_back(static_cast<uint8_t>(_cur_node->value));
-                        _cur_node = _tree->node(HuffmanTree::ROOT_NODE);
-                        _cur_depth = 0;
-                        _padding = true;
+                    }
+                    if (t.flags & FAIL) {
+                        t.state = ROOT_STATE;
                         continue;
                     }
-                    _padding &= 0;
+                    t.state = static_cast<uint8_t>(state_of[cur]);
+                    if (accepted[cur]) {
+                        t.flags |= ACCEPTED;
+                    }
                 }
-                ++_cur_depth;
             }
+        }
+
+        const HuffmanTransition &next(uint8_t state, uint8_t bits) const {
+            return _table[state][bits];
+        }
+
+    private:
+        HuffmanTransition _table[256][16];
+    };
+
+    class HuffmanDecoder {
+        DISALLOW_COPY_AND_ASSIGN(HuffmanDecoder);
+
+    public:
+        HuffmanDecoder(std::string *out, const HuffmanDecodeTable *table)
+                : _out(out), _table(table), _state(HuffmanDecodeTable::ROOT_STATE), _accepted(true) {}
+
+        int Decode(uint8_t byte) {
+            const HuffmanTransition &t1 = _table->next(_state, byte >> 4);
+            if (MELON_UNLIKELY(t1.flags & HuffmanDecodeTable::FAIL)) {
+                LOG(ERROR) << "Decoder stream reaches EOS";
+                return -1;
+            }
+            if (t1.flags & HuffmanDecodeTable::EMIT) {
+                _out->push_back(static_cast<char>(t1.symbol));
+            }
+            const HuffmanTransition &t2 = _table->next(t1.state, byte & 0xF);
+            if (MELON_UNLIKELY(t2.flags & HuffmanDecodeTable::FAIL)) {
+                LOG(ERROR) << "Decoder stream reaches EOS";
+                return -1;
+            }
+            if (t2.flags & HuffmanDecodeTable::EMIT) {
+                _out->push_back(static_cast<char>(t2.symbol));
+            }
+            _state = t2.state;
+            _accepted = (t2.flags & HuffmanDecodeTable::ACCEPTED);
             return 0;
         }
 
         int EndStream() {
-            if (_cur_depth == 0) {
-                return 0;
-            }
-            if (_cur_depth <= 7 && _padding) {
+            if (_accepted) {
                 return 0;
             }
             // Invalid stream, the padding is not corresponding to MSB of EOS
@@ -471,16 +529,16 @@ namespace melon {
 
     private:
         std::string *_out;
-        const HuffmanTree *_tree;
-        const HuffmanNode *_cur_node;
-        uint16_t _cur_depth;
-        bool _padding;
+        const HuffmanDecodeTable *_table;
+        uint8_t _state;
+        bool _accepted;
     };
 
 // Primitive Type Representations
 
 // Encode variant intger and return the size
-    inline void EncodeInteger(mutil::IOBufAppender *out, uint8_t msb,
+    template<typename Output>
+    inline void EncodeInteger(Output *out, uint8_t msb,
                               uint8_t prefix_size, uint32_t value) {
         uint8_t max_prefix_value = (1 << prefix_size) - 1;
         if (value < max_prefix_value) {
@@ -500,15 +558,16 @@ namespace melon {
     }
 
 // Static variables
-    static HuffmanTree *s_huffman_tree = NULL;
+    static HuffmanDecodeTable *s_huffman_decode_table = NULL;
     static IndexTable *s_static_table = NULL;
     static pthread_once_t s_create_once = PTHREAD_ONCE_INIT;
 
     static void CreateStaticTableOrDie() {
-        s_huffman_tree = new HuffmanTree;
+        HuffmanTree huffman_tree;
         for (size_t i = 0; i < ARRAY_SIZE(s_huffman_table); ++i) {
-            s_huffman_tree->AddLeafNode(i, s_huffman_table[i]);
+            huffman_tree.AddLeafNode(i, s_huffman_table[i]);
         }
+        s_huffman_decode_table = new HuffmanDecodeTable(huffman_tree);
         IndexTableOptions options;
         options.max_size = UINT_MAX;
         options.static_table = s_static_headers;
@@ -568,9 +627,9 @@ namespace melon {
         return in_bytes;
     }
 
-    template<bool LOWERCASE>
+    template<bool LOWERCASE, typename Output>
     // use template to remove dead branches.
-    inline void EncodeString(mutil::IOBufAppender *out, const std::string &s,
+    inline void EncodeString(Output *out, const std::string &s,
                              bool huffman_encoding) {
         if (!huffman_encoding) {
             EncodeInteger(out, 0x00, 7, s.size());
@@ -595,7 +654,7 @@ namespace melon {
             }
         }
         EncodeInteger(out, 0x80, 7, (bit_len >> 3) + !!(bit_len & 7));
-        HuffmanEncoder e(out, s_huffman_table);
+        HuffmanEncoder<Output> e(out, s_huffman_table);
         if (LOWERCASE) {
             for (size_t i = 0; i < s.size(); ++i) {
                 e.Encode(mutil::ascii_tolower(s[i]));
@@ -627,7 +686,9 @@ namespace melon {
             iter.copy_and_forward(out, length);
             return in_bytes;
         }
-        HuffmanDecoder d(out, s_huffman_tree);
+        // Codes are at least 5 bits long.
+        out->reserve(length * 8 / 5);
+        HuffmanDecoder d(out, s_huffman_decode_table);
         for (; iter != NULL && length; ++iter, --length) {
             if (d.Decode(*iter) != 0) {
                 return -1;
@@ -639,8 +700,93 @@ namespace melon {
         return in_bytes;
     }
 
+    // Literal header fields not added into the dynamic table are encoded
+    // again and again, which is costly when huffman encoding is on. Remember
+    // encoded bytes of recent ones in a direct-mapped cache, keyed by the
+    // header and everything else changing the bytes.
+    class LiteralCache {
+        DISALLOW_COPY_AND_ASSIGN(LiteralCache);
+
+        typedef HPacker::Header Header;
+    public:
+        static const size_t NSLOT = 32;
+        // Don't cache large headers to bound memory of each connection.
+        static const size_t MAX_HEADER_SIZE = 1024;
+
+        LiteralCache() {}
+
+        // Append the encoded bytes of `h' into `out' and return true if it
+        // was cached, false otherwise.
+        bool Find(mutil::IOBufAppender *out, const Header &h, size_t hash_code,
+                  const HPackOptions &options, int name_index) const {
+            const Entry &e = _slots[hash_code % NSLOT];
+            if (e.encoded.empty() || e.hash_code != hash_code ||
+                e.name_index != name_index ||
+                e.index_policy != options.index_policy ||
+                e.encode_name != options.encode_name ||
+                e.encode_value != options.encode_value ||
+                e.header.value != h.value || e.header.name != h.name) {
+                return false;
+            }
+            out->append(e.encoded);
+            return true;
+        }
+
+        // Returns the place to store encoded bytes of `h', NULL if `h' should
+        // not be cached.
+        std::string *Add(const Header &h, size_t hash_code,
+                         const HPackOptions &options, int name_index) {
+            if (h.name.size() + h.value.size() > MAX_HEADER_SIZE) {
+                return NULL;
+            }
+            Entry &e = _slots[hash_code % NSLOT];
+            e.hash_code = hash_code;
+            e.name_index = name_index;
+            e.index_policy = options.index_policy;
+            e.encode_name = options.encode_name;
+            e.encode_value = options.encode_value;
+            e.header = h;
+            e.encoded.clear();
+            return &e.encoded;
+        }
+
+    private:
+        struct Entry {
+            size_t hash_code;
+            int name_index;
+            HeaderIndexPolicy index_policy;
+            bool encode_name;
+            bool encode_value;
+            Header header;
+            // Empty if the slot is not used.
+            std::string encoded;
+        };
+
+        Entry _slots[NSLOT];
+    };
+
+    template<typename Output>
+    static void EncodeLiteral(Output *out, const HPacker::Header &header,
+                              const HPackOptions &options, int name_index) {
+        switch (options.index_policy) {
+            case HPACK_INDEX_HEADER:
+                EncodeInteger(out, 0x40, 6, name_index);
+                break;
+            case HPACK_NOT_INDEX_HEADER:
+                EncodeInteger(out, 0x00, 4, name_index);
+                break;
+            case HPACK_NEVER_INDEX_HEADER:
+                EncodeInteger(out, 0x10, 4, name_index);
+                break;
+        }
+        if (name_index == 0) {
+            EncodeString<true>(out, header.name, options.encode_name);
+        }
+        EncodeString<false>(out, header.value, options.encode_value);
+    }
+
     HPacker::HPacker()
-            : _encode_table(NULL), _decode_table(NULL) {
+            : _encode_table(NULL), _decode_table(NULL), _literal_cache(NULL) {
         CreateStaticTableOnceOrDie();
     }
 
@@ -653,6 +799,10 @@ namespace melon {
             delete _decode_table;
             _decode_table = NULL;
         }
+        if (_literal_cache) {
+            delete _literal_cache;
+            _literal_cache = NULL;
+        }
     }
 
     int HPacker::Init(size_t max_table_size) {
@@ -676,12 +826,13 @@ namespace melon {
             LOG(ERROR) << "Fail to init decode table";
             return -1;
         }
+        _literal_cache = new LiteralCache;
         return 0;
     }
 
-    inline int HPacker::FindHeaderFromIndexTable(const Header &h) const {
+    inline int HPacker::FindHeaderFromIndexTable(const Header &h, size_t hash_code) const {
         // saves a hash (which is a hotspot) for ones missing s_static_table
-        const HeaderAndHashCode hhc = {HeaderHasher()(h), &h};
+        const HeaderAndHashCode hhc = {hash_code, &h};
         int index = s_static_table->GetIndexOfHeader(hhc);
         if (index > 0) {
             return index;
@@ -699,8 +850,10 @@ namespace melon {
 
     void HPacker::Encode(mutil::IOBufAppender *out, const Header &header,
                          const HPackOptions &options) {
+        size_t hash_code = 0;
         if (options.index_policy != HPACK_NEVER_INDEX_HEADER) {
-            const int index = FindHeaderFromIndexTable(header);
+            hash_code = HeaderHasher()(header);
+            const int index = FindHeaderFromIndexTable(header, hash_code);
             if (index > 0) {
                 // This header is already in the index table
                 return EncodeInteger(out, 0x80, 7, index);
@@ -711,22 +864,24 @@ namespace melon {
         if (options.index_policy == HPACK_INDEX_HEADER) {
             // TODO: Add Options that indexes name independently
             _encode_table->AddHeader(header);
+            return EncodeLiteral(out, header, options, name_index);
         }
-        switch (options.index_policy) {
-            case HPACK_INDEX_HEADER:
-                EncodeInteger(out, 0x40, 6, name_index);
-                break;
-            case HPACK_NOT_INDEX_HEADER:
-                EncodeInteger(out, 0x00, 4, name_index);
-                break;
-            case HPACK_NEVER_INDEX_HEADER:
-                EncodeInteger(out, 0x10, 4, name_index);
-                break;
+        if (!options.encode_value && !(name_index == 0 && options.encode_name)) {
+            // Copying is as fast as looking up the cache.
+            return EncodeLiteral(out, header, options, name_index);
         }
-        if (name_index == 0) {
-            EncodeString<true>(out, header.name, options.encode_name);
+        if (options.index_policy == HPACK_NEVER_INDEX_HEADER) {
+            hash_code = HeaderHasher()(header);
         }
-        EncodeString<false>(out, header.value, options.encode_value);
+        if (_literal_cache->Find(out, header, hash_code, options, name_index)) {
+            return;
+        }
+        std::string *encoded = _literal_cache->Add(header, hash_code, options, name_index);
+        if (encoded == NULL) {
+            return EncodeLiteral(out, header, options, name_index);
+        }
+        EncodeLiteral(encoded, header, options, name_index);
+        out->append(*encoded);
     }
 
     inline const HPacker::Header *HPacker::HeaderAt(int index) const {
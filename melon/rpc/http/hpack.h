@@ -71,6 +71,8 @@ namespace melon {
 
     class IndexTable;
 
+    class LiteralCache;
+
     // HPACK - Header compression algorithm for http2 (rfc7541)
     // http://httpwg.org/specs/rfc7541.html
     // Note: Name of header is assumed to be in *lowercase* acoording to
@@ -128,7 +130,7 @@ namespace melon {
     private:
         DISALLOW_COPY_AND_ASSIGN(HPacker);
 
-        int FindHeaderFromIndexTable(const Header &h) const;
+        int FindHeaderFromIndexTable(const Header &h, size_t hash_code) const;
 
         int FindNameFromIndexTable(const std::string &name) const;
 
@@ -139,6 +141,8 @@ namespace melon {
 
         IndexTable *_encode_table;
         IndexTable *_decode_table;
+        // Encoded huffman literals which are not added into _encode_table.
+        LiteralCache *_literal_cache;
     };
 
 // Lowercase the input string, a fast implementation.
@@ -22,6 +22,7 @@
  * IN THE SOFTWARE.
  */
 #include <melon/rpc/http/http_parser.h>
+#include <melon/rpc/http/http_scan.h>
 #include <assert.h>
 #include <stddef.h>
 #include <ctype.h>
@@ -117,6 +118,22 @@ do {                                                                 \
 } while (0)
 
 
+/* Skip bytes after the current one until SCANNER finds a byte changing the
+ * state, the skipped bytes are counted into the header size as if they were
+ * parsed one by one. */
+#define SKIP_HEADER_BYTES(SCANNER)                                   \
+do {                                                                 \
+  const char *scan_end = data + len;                                 \
+  const size_t room = (MELON_HTTP_MAX_HEADER_SIZE) - parser->nread;  \
+  if ((size_t)(scan_end - p - 1) > room) {                           \
+    scan_end = p + 1 + room;                                         \
+  }                                                                  \
+  const char *next = SCANNER(p + 1, scan_end);                       \
+  parser->nread += next - p - 1;                                     \
+  p = next - 1;                                                      \
+} while (0)
+
+
 #define PROXY_CONNECTION "proxy-connection"
 #define CONNECTION "connection"
 #define CONTENT_LENGTH "content-length"
@@ -1398,6 +1415,7 @@ size_t http_parser_execute (http_parser *parser,
         if (c) {
           switch (parser->header_state) {
             case h_general:
+              SKIP_HEADER_BYTES(http_find_non_name_char);
               break;
 
             case h_C:
@@ -1595,6 +1613,7 @@ size_t http_parser_execute (http_parser *parser,
 
         switch (parser->header_state) {
           case h_general:
+            SKIP_HEADER_BYTES(http_find_crlf);
             break;
 
           case h_connection:
@@ -0,0 +1,128 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+//
+
+
+
+#ifndef  MELON_RPC_HTTP_HTTP_SCAN_H_
+#define  MELON_RPC_HTTP_HTTP_SCAN_H_
+
+#include <stddef.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+// Scanners used by http_parser to skip runs of bytes which don't change the
+// state of the parser, in the spirit of picohttpparser. Bytes are compared
+// 32 at a time with AVX2 or 16 at a time with SSE4.2, the tail and builds
+// without them are scanned byte by byte.
+// All scanners return `end' if no such byte is found in [p, end).
+
+namespace melon {
+
+    // Find the first CR or LF.
+    inline const char *http_find_crlf(const char *p, const char *end) {
+#if defined(__AVX2__)
+        const __m256i cr = _mm256_set1_epi8('\r');
+        const __m256i lf = _mm256_set1_epi8('\n');
+        for (; end - p >= 32; p += 32) {
+            const __m256i v = _mm256_loadu_si256((const __m256i *) p);
+            const unsigned mask = (unsigned) _mm256_movemask_epi8(
+                    _mm256_or_si256(_mm256_cmpeq_epi8(v, cr),
+                                    _mm256_cmpeq_epi8(v, lf)));
+            if (mask) {
+                return p + __builtin_ctz(mask);
+            }
+        }
+#elif defined(__SSE4_2__)
+        const __m128i crlf = _mm_setr_epi8('\r', '\n', 0, 0, 0, 0, 0, 0,
+                                           0, 0, 0, 0, 0, 0, 0, 0);
+        for (; end - p >= 16; p += 16) {
+            const __m128i v = _mm_loadu_si128((const __m128i *) p);
+            const int i = _mm_cmpestri(crlf, 2, v, 16,
+                                       _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY |
+                                       _SIDD_LEAST_SIGNIFICANT);
+            if (i != 16) {
+                return p + i;
+            }
+        }
+#endif
+        for (; p != end; ++p) {
+            if (*p == '\r' || *p == '\n') {
+                return p;
+            }
+        }
+        return end;
+    }
+
+    // Find the first byte which is not alphanumeric or '-', namely not one
+    // of the bytes forming almost all header names.
+    inline const char *http_find_non_name_char(const char *p, const char *end) {
+#if defined(__AVX2__)
+        const __m256i to_lower = _mm256_set1_epi8(0x20);
+        const __m256i a = _mm256_set1_epi8('a');
+        const __m256i zero = _mm256_set1_epi8('0');
+        const __m256i dash = _mm256_set1_epi8('-');
+        const __m256i nalpha = _mm256_set1_epi8(25);
+        const __m256i ndigit = _mm256_set1_epi8(9);
+        for (; end - p >= 32; p += 32) {
+            const __m256i v = _mm256_loadu_si256((const __m256i *) p);
+            // Letters and digits are mapped to [0, 25] and [0, 9] resp.,
+            // others to larger unsigned bytes.
+            const __m256i alpha = _mm256_sub_epi8(_mm256_or_si256(v, to_lower), a);
+            const __m256i digit = _mm256_sub_epi8(v, zero);
+            const __m256i ok = _mm256_or_si256(
+                    _mm256_or_si256(
+                            _mm256_cmpeq_epi8(_mm256_min_epu8(alpha, nalpha), alpha),
+                            _mm256_cmpeq_epi8(_mm256_min_epu8(digit, ndigit), digit)),
+                    _mm256_cmpeq_epi8(v, dash));
+            const unsigned mask = ~(unsigned) _mm256_movemask_epi8(ok);
+            if (mask) {
+                return p + __builtin_ctz(mask);
+            }
+        }
+#elif defined(__SSE4_2__)
+        // Inclusive ranges of accepted bytes.
+        const __m128i ranges = _mm_setr_epi8('0', '9', 'A', 'Z', 'a', 'z', '-', '-',
+                                             0, 0, 0, 0, 0, 0, 0, 0);
+        for (; end - p >= 16; p += 16) {
+            const __m128i v = _mm_loadu_si128((const __m128i *) p);
+            const int i = _mm_cmpestri(ranges, 8, v, 16,
+                                       _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES |
+                                       _SIDD_NEGATIVE_POLARITY |
+                                       _SIDD_LEAST_SIGNIFICANT);
+            if (i != 16) {
+                return p + i;
+            }
+        }
+#endif
+        for (; p != end; ++p) {
+            const char c = *p;
+            if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                  (c >= '0' && c <= '9') || c == '-')) {
+                return p;
+            }
+        }
+        return end;
+    }
+
+}  // namespace melon
+
+#endif  // MELON_RPC_HTTP_HTTP_SCAN_H_
@@ -52,6 +52,7 @@ public:
     int64_t base_real_us() const { return _base_real_us; }
 
 protected:
+    InputMessageBase() : _cut_size(0), _next_in_batch(NULL) {}
     virtual ~InputMessageBase();
 
 private:
@@ -63,6 +64,10 @@ friend class Stream;
     SocketUniquePtr _socket;
     void (*_process)(InputMessageBase* msg);
     const void* _arg;
+    // Bytes cut from the socket for this message.
+    size_t _cut_size;
+    // Next message processed in the same fiber, see InputMessenger.
+    InputMessageBase* _next_in_batch;
 };
 
 } // namespace melon
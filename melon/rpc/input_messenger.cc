@@ -67,6 +67,18 @@ DEFINE_int32(socket_keepalive_interval_s, -1,
 DEFINE_int32(socket_keepalive_count, -1,
              "Set number of keepalives of sockets before close if this value is positive");
 
+DEFINE_int32(max_messages_per_fiber, 1,
+             "Process at most so many consecutive small messages(namely "
+             "pipelined requests) from a socket one after another in a single "
+             "fiber instead of in one fiber each. Notice that a message "
+             "blocking in user code delays the following ones in the fiber");
+MELON_VALIDATE_GFLAG(max_messages_per_fiber, PositiveInteger);
+
+DEFINE_int32(small_message_size, 1024,
+             "Messages with at most so many bytes are small ones which may be "
+             "processed in one fiber, see -max_messages_per_fiber");
+MELON_VALIDATE_GFLAG(small_message_size, NonNegativeInteger);
+
 DECLARE_bool(usercode_in_pthread);
 DECLARE_bool(usercode_in_coroutine);
 DECLARE_uint64(max_body_size);
@@ -74,6 +86,31 @@ DECLARE_uint64(max_body_size);
 const size_t MSG_SIZE_WINDOW = 10;  // Take last so many message into stat.
 const size_t MIN_ONCE_READ = 4096;
 const size_t MAX_ONCE_READ = 524288;
+
+size_t InputMessenger::GetOnceReadSize(const Socket* m) {
+    // Read enough for several average messages at least.
+    size_t once_read = m->_avg_msg_size * 16;
+    if (once_read < m->_read_size_hint) {
+        once_read = m->_read_size_hint;
+    }
+    if (once_read < MIN_ONCE_READ) {
+        once_read = MIN_ONCE_READ;
+    } else if (once_read > MAX_ONCE_READ) {
+        once_read = MAX_ONCE_READ;
+    }
+    return once_read;
+}
+
+void InputMessenger::UpdateReadSizeHint(Socket* m, size_t once_read, size_t nr) {
+    if (nr >= once_read) {
+        // The buffer is filled, more data is probably pending in the
+        // socket, read twice as much next time to save syscalls.
+        m->_read_size_hint = std::min(once_read * 2, MAX_ONCE_READ);
+    } else if (nr <= once_read / 4) {
+        // Shrink slowly, a short read may be the tail of a burst.
+        m->_read_size_hint /= 2;
+    }
+}
 const size_t PROTO_DUMMY_LEN = 4;
 
 ParseResult InputMessenger::CutInputMessage(
@@ -172,7 +209,13 @@ ParseResult InputMessenger::CutInputMessage(
 
 void* ProcessInputMessage(void* void_arg) {
     InputMessageBase* msg = static_cast<InputMessageBase*>(void_arg);
-    msg->_process(msg);
+    do {
+        // `msg' may be destroyed in _process.
+        InputMessageBase* next = msg->_next_in_batch;
+        msg->_next_in_batch = NULL;
+        msg->_process(msg);
+        msg = next;
+    } while (msg);
     return NULL;
 }
 
@@ -206,6 +249,59 @@ static void QueueMessage(InputMessageBase* to_run_msg,
     }
 }
 
+class InputMessenger::MessageBatch {
+public:
+    MessageBatch(int* num_fiber_created, fiber_keytable_pool_t* keytable_pool)
+        : _head(NULL), _tail(NULL), _size(0)
+        , _max_size(FLAGS_max_messages_per_fiber)
+        , _num_fiber_created(num_fiber_created)
+        , _keytable_pool(keytable_pool) {}
+
+    ~MessageBatch() { Flush(); }
+
+    // Run `msg' in a new fiber, or together with other small messages.
+    void Queue(InputMessageBase* msg) {
+        if (msg == NULL) {
+            return;
+        }
+        if (_max_size <= 1 ||
+            msg->_cut_size > (size_t)FLAGS_small_message_size) {
+            // Keep the order of starting fibers.
+            Flush();
+            QueueMessage(msg, _num_fiber_created, _keytable_pool);
+            return;
+        }
+        if (_tail) {
+            _tail->_next_in_batch = msg;
+        } else {
+            _head = msg;
+        }
+        _tail = msg;
+        if (++_size >= _max_size) {
+            Flush();
+        }
+    }
+
+    void Flush() {
+        if (_head) {
+            QueueMessage(_head, _num_fiber_created, _keytable_pool);
+            _head = NULL;
+            _tail = NULL;
+            _size = 0;
+        }
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(MessageBatch);
+
+    InputMessageBase* _head;
+    InputMessageBase* _tail;
+    int _size;
+    const int _max_size;
+    int* _num_fiber_created;
+    fiber_keytable_pool_t* _keytable_pool;
+};
+
 InputMessenger::InputMessageClosure::~InputMessageClosure() noexcept(false) {
     if (_msg) {
         ProcessInputMessage(_msg);
@@ -230,6 +326,7 @@ int InputMessenger::ProcessNewMessage(
     
     size_t last_size = m->_read_buf.length();
     int num_fiber_created = 0;
+    MessageBatch batch(&num_fiber_created, m->_keytable_pool);
     while (1) {
         size_t index = 8888;
         ParseResult pr = CutInputMessage(m, &index, read_eof);
@@ -267,6 +364,7 @@ int InputMessenger::ProcessNewMessage(
         }
         m->_last_msg_size += (last_size - cur_size);
         last_size = cur_size;
+        const size_t cut_size = m->_last_msg_size;
         const size_t old_avg = m->_avg_msg_size;
         if (old_avg != 0) {
             m->_avg_msg_size = (old_avg * (MSG_SIZE_WINDOW - 1) + m->_last_msg_size)
@@ -281,12 +379,12 @@ int InputMessenger::ProcessNewMessage(
         }
         pr.message()->_received_us = received_us;
         pr.message()->_base_real_us = base_realtime;
+        pr.message()->_cut_size = cut_size;
                     
         // This unique_ptr prevents msg to be lost before transfering
         // ownership to last_msg
         DestroyingPtr<InputMessageBase> msg(pr.message());
-        QueueMessage(last_msg.release(), &num_fiber_created,
-                            m->_keytable_pool);
+        batch.Queue(last_msg.release());
         if (_handlers[index].process == NULL) {
             LOG(ERROR) << "process of index=" << index << " is NULL";
             continue;
@@ -319,12 +417,14 @@ int InputMessenger::ProcessNewMessage(
             // Transfer ownership to last_msg
             last_msg.reset(msg.release());
         } else {
+            batch.Flush();
             QueueMessage(msg.release(), &num_fiber_created,
                                 m->_keytable_pool);
             fiber_flush();
             num_fiber_created = 0;
         }
     }
+    batch.Flush();
     if (num_fiber_created) {
         fiber_flush();
     }
@@ -355,16 +455,13 @@ void InputMessenger::OnNewMessages(Socket* m) {
         const int64_t base_realtime = mutil::gettimeofday_us() - received_us;
 
         // Calculate bytes to be read.
-        size_t once_read = m->_avg_msg_size * 16;
-        if (once_read < MIN_ONCE_READ) {
-            once_read = MIN_ONCE_READ;
-        } else if (once_read > MAX_ONCE_READ) {
-            once_read = MAX_ONCE_READ;
-        }
+        const size_t once_read = GetOnceReadSize(m);
 
         // Read.
         const ssize_t nr = m->DoRead(once_read);
-        if (nr <= 0) {
+        if (nr > 0) {
+            UpdateReadSizeHint(m, once_read, nr);
+        } else {
             if (0 == nr) {
                 // Set `read_eof' flag and proceed to feed EOF into `Protocol'
                 // (implied by m->_read_buf.empty), which may produce a new
@@ -77,6 +77,7 @@ struct InputMessageHandler {
 // `Message' corresponds to a client's request or a server's response.
 class InputMessenger : public SocketUser {
 friend class rdma::RdmaEndpoint;
+friend class Socket;
 public:
     explicit InputMessenger(size_t capacity = 128);
     ~InputMessenger();
@@ -131,6 +132,15 @@ private:
         InputMessageBase* _msg;
     };
 
+    // Chains consecutive small messages to be processed one after another
+    // in a single fiber, see -max_messages_per_fiber.
+    class MessageBatch;
+
+    // Decide bytes to read next time from the read history of `m'.
+    static size_t GetOnceReadSize(const Socket* m);
+    // Update the history with a read of `nr' bytes out of `once_read'.
+    static void UpdateReadSizeHint(Socket* m, size_t once_read, size_t nr);
+
     // Find a valid scissor from `handlers' to cut off `header' and `payload'
     // from m->read_buf, save index of the scissor into `index'.
     ParseResult CutInputMessage(Socket* m, size_t* index, bool read_eof);
@@ -0,0 +1,186 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+//
+
+
+#include <string.h>
+#include <turbo/log/logging.h>
+#include <melon/utility/sys_byteorder.h>
+#include <melon/rpc/policy/memcache_binary_header.h>
+#include <melon/rpc/memcache/memcache_service.h>
+
+namespace melon {
+
+const size_t MemcacheResponseWriter::MIN_REFERENCED_SIZE;
+
+bool MemcacheCommand::quiet() const {
+    switch (command) {
+    case policy::MC_BINARY_GETQ:
+    case policy::MC_BINARY_GETKQ:
+    case policy::MC_BINARY_SETQ:
+    case policy::MC_BINARY_ADDQ:
+    case policy::MC_BINARY_REPLACEQ:
+    case policy::MC_BINARY_DELETEQ:
+    case policy::MC_BINARY_INCREMENTQ:
+    case policy::MC_BINARY_DECREMENTQ:
+    case policy::MC_BINARY_QUITQ:
+    case policy::MC_BINARY_FLUSHQ:
+    case policy::MC_BINARY_APPENDQ:
+    case policy::MC_BINARY_PREPENDQ:
+    case policy::MC_BINARY_GATQ:
+    case policy::MC_BINARY_GATKQ:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Commands of get which carry the key in responses.
+static bool IsGetWithKey(uint8_t command) {
+    return command == policy::MC_BINARY_GETK ||
+        command == policy::MC_BINARY_GETKQ ||
+        command == policy::MC_BINARY_GATK ||
+        command == policy::MC_BINARY_GATKQ;
+}
+
+static bool IsGet(uint8_t command) {
+    return command == policy::MC_BINARY_GET ||
+        command == policy::MC_BINARY_GETQ ||
+        command == policy::MC_BINARY_GAT ||
+        command == policy::MC_BINARY_GATQ ||
+        IsGetWithKey(command);
+}
+
+void MemcacheResponseWriter::AppendHeader(
+    const MemcacheCommand& cmd, uint16_t status, size_t extras_length,
+    size_t key_length, size_t value_length, uint64_t cas_value) {
+    const policy::MemcacheResponseHeader header = {
+        policy::MC_MAGIC_RESPONSE,
+        cmd.command,
+        mutil::HostToNet16(key_length),
+        (uint8_t)extras_length,
+        policy::MC_BINARY_RAW_BYTES,
+        mutil::HostToNet16(status),
+        mutil::HostToNet32(extras_length + key_length + value_length),
+        mutil::HostToNet32(cmd.opaque),
+        mutil::HostToNet64(cas_value)
+    };
+    _appender.append(&header, sizeof(header));
+}
+
+// MUST have extras.
+// MAY have key.
+// MAY have value.
+void MemcacheResponseWriter::AppendGetHeader(
+    const MemcacheCommand& cmd, uint32_t flags, size_t value_length,
+    uint64_t cas_value) {
+    ++_nhandled;
+    const mutil::StringPiece key =
+        IsGetWithKey(cmd.command) ? cmd.key : mutil::StringPiece();
+    AppendHeader(cmd, MemcacheResponse::STATUS_SUCCESS, sizeof(flags),
+                 key.size(), value_length, cas_value);
+    const uint32_t raw_flags = mutil::HostToNet32(flags);
+    _appender.append(&raw_flags, sizeof(raw_flags));
+    _appender.append(key);
+}
+
+void MemcacheResponseWriter::AppendGet(
+    const MemcacheCommand& cmd, uint32_t flags,
+    const mutil::StringPiece& value, uint64_t cas_value) {
+    AppendGetHeader(cmd, flags, value.size(), cas_value);
+    _appender.append(value);
+}
+
+void MemcacheResponseWriter::AppendGet(
+    const MemcacheCommand& cmd, uint32_t flags,
+    const mutil::IOBuf& value, uint64_t cas_value) {
+    AppendGetHeader(cmd, flags, value.size(), cas_value);
+    if (value.size() < MIN_REFERENCED_SIZE) {
+        char buf[MIN_REFERENCED_SIZE];
+        _appender.append(value.fetch(buf, value.size()), value.size());
+    } else {
+        // Data in _appender must be placed before the referenced blocks.
+        mutil::IOBuf written;
+        _appender.move_to(written);
+        _buf.append(mutil::IOBuf::Movable(written));
+        _buf.append(value);
+    }
+}
+
+void MemcacheResponseWriter::AppendStatus(
+    const MemcacheCommand& cmd, MemcacheResponse::Status status, uint64_t cas_value) {
+    ++_nhandled;
+    if (cmd.quiet() && (status == MemcacheResponse::STATUS_SUCCESS ||
+                        (status == MemcacheResponse::STATUS_KEY_ENOENT &&
+                         IsGet(cmd.command)))) {
+        return;
+    }
+    const mutil::StringPiece key =
+        IsGetWithKey(cmd.command) ? cmd.key : mutil::StringPiece();
+    mutil::StringPiece message;
+    if (status != MemcacheResponse::STATUS_SUCCESS) {
+        message = MemcacheResponse::status_str(status);
+    }
+    AppendHeader(cmd, status, 0, key.size(), message.size(), cas_value);
+    _appender.append(key);
+    _appender.append(message);
+}
+
+// MUST NOT have extras.
+// MUST NOT have key.
+// MUST have value.
+void MemcacheResponseWriter::AppendCounter(
+    const MemcacheCommand& cmd, uint64_t value, uint64_t cas_value) {
+    ++_nhandled;
+    if (cmd.quiet()) {
+        return;
+    }
+    AppendHeader(cmd, MemcacheResponse::STATUS_SUCCESS, 0, 0, sizeof(value), cas_value);
+    const uint64_t raw_value = mutil::HostToNet64(value);
+    _appender.append(&raw_value, sizeof(raw_value));
+}
+
+void MemcacheResponseWriter::AppendVersion(
+    const MemcacheCommand& cmd, const mutil::StringPiece& version) {
+    ++_nhandled;
+    AppendHeader(cmd, MemcacheResponse::STATUS_SUCCESS, 0, 0, version.size(), 0);
+    _appender.append(version);
+}
+
+void MemcacheResponseWriter::MoveTo(mutil::IOBuf* out) {
+    mutil::IOBuf written;
+    _appender.move_to(written);
+    _buf.append(mutil::IOBuf::Movable(written));
+    out->append(mutil::IOBuf::Movable(_buf));
+}
+
+MemcacheService::MemcacheService() {
+    memset(_handlers, 0, sizeof(_handlers));
+}
+
+bool MemcacheService::AddCommandHandler(uint8_t command,
+                                        MemcacheCommandHandler* handler) {
+    if (_handlers[command] != NULL) {
+        LOG(ERROR) << "memcache command=" << (int)command << " exist";
+        return false;
+    }
+    _handlers[command] = handler;
+    return true;
+}
+
+} // namespace melon
@@ -0,0 +1,144 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+//
+
+
+#pragma once
+
+#include <stdint.h>
+#include <melon/utility/macros.h>
+#include <melon/utility/iobuf.h>
+#include <melon/utility/strings/string_piece.h>
+#include <melon/rpc/memcache/memcache.h>        // MemcacheResponse::Status
+
+namespace melon {
+
+// A command of memcache binary protocol received by the server.
+// The pieces reference data read from the connection and are only valid
+// inside MemcacheCommandHandler::Run().
+struct MemcacheCommand {
+    // Opcode of the command(policy::MC_BINARY_XXX), quiet ones included.
+    uint8_t command;
+    uint16_t vbucket_id;
+    uint32_t opaque;
+    uint64_t cas_value;
+    mutil::StringPiece extras;
+    mutil::StringPiece key;
+    mutil::StringPiece value;
+
+    // True if the command is a quiet one(GETQ, GETKQ, SETQ ...), whose
+    // response is not sent unless it's an error or a hit of get.
+    bool quiet() const;
+};
+
+// Write responses of memcache binary protocol directly into an IOBuf.
+// Values given as IOBuf are appended by reference unless they're short,
+// so values kept in IOBuf are sent without being copied.
+// Responses to quiet commands that should not be sent are dropped.
+class MemcacheResponseWriter {
+public:
+    MemcacheResponseWriter() : _nhandled(0) {}
+
+    // Respond to GET/GETQ/GETK/GETKQ with the value found. The key is
+    // included for GETK and GETKQ.
+    void AppendGet(const MemcacheCommand& cmd, uint32_t flags,
+                   const mutil::StringPiece& value, uint64_t cas_value);
+    void AppendGet(const MemcacheCommand& cmd, uint32_t flags,
+                   const mutil::IOBuf& value, uint64_t cas_value);
+
+    // Respond with `status' and no value. Error messages of failed statuses
+    // are filled as the protocol requires, e.g. STATUS_KEY_ENOENT for a miss
+    // of get. Suitable for SET/ADD/DELETE/TOUCH/FLUSH/NOOP... and errors of
+    // all commands.
+    void AppendStatus(const MemcacheCommand& cmd, MemcacheResponse::Status status,
+                      uint64_t cas_value = 0);
+
+    // Respond to INCREMENT/DECREMENT with the value after the operation.
+    void AppendCounter(const MemcacheCommand& cmd, uint64_t value, uint64_t cas_value);
+
+    // Respond to VERSION.
+    void AppendVersion(const MemcacheCommand& cmd, const mutil::StringPiece& version);
+
+    // Number of commands responded, including the dropped responses of
+    // quiet commands.
+    size_t handled_count() const { return _nhandled; }
+
+    // Move all written into `out'.
+    void MoveTo(mutil::IOBuf* out);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(MemcacheResponseWriter);
+
+    void AppendHeader(const MemcacheCommand& cmd, uint16_t status,
+                      size_t extras_length, size_t key_length,
+                      size_t value_length, uint64_t cas_value);
+
+    // Write the response of get before the value.
+    void AppendGetHeader(const MemcacheCommand& cmd, uint32_t flags,
+                         size_t value_length, uint64_t cas_value);
+
+    // Values longer than this are appended by reference.
+    static const size_t MIN_REFERENCED_SIZE = 512;
+
+    mutil::IOBufAppender _appender;
+    // Written before the data in _appender.
+    mutil::IOBuf _buf;
+    size_t _nhandled;
+};
+
+// The handler of memcache commands. A handler gets all consecutive commands
+// registered to it in the data read from the connection at once, e.g. a
+// multi-get sent as GETKQ...GETKQ NOOP, so that storages can look up the
+// keys together.
+class MemcacheCommandHandler {
+public:
+    virtual ~MemcacheCommandHandler() {}
+
+    // `commands[0]' ... `commands[count-1]' are the commands in the order
+    // they arrive. Call exactly one AppendXXX of `output' for each command
+    // in the same order, including the quiet ones.
+    // Returns 0 on success, -1 otherwise and the connection is closed.
+    virtual int Run(const MemcacheCommand* commands, size_t count,
+                    MemcacheResponseWriter* output) = 0;
+};
+
+// Container of MemcacheCommandHandlers.
+// Assign an instance to ServerOptions.memcache_service to enable memcache
+// binary protocol at server side.
+// NOOP is responded by the server unless a handler is registered, other
+// commands without handlers are responded with STATUS_UNKNOWN_COMMAND.
+class MemcacheService {
+public:
+    MemcacheService();
+    virtual ~MemcacheService() {}
+
+    // Register `handler' to handle `command'(policy::MC_BINARY_XXX). Quiet
+    // commands must be registered separately, say GETKQ is not handled by
+    // the handler of GETK. `handler' is not owned by the service.
+    bool AddCommandHandler(uint8_t command, MemcacheCommandHandler* handler);
+
+    // This function should not be touched by user and used by melon developer only.
+    MemcacheCommandHandler* FindCommandHandler(uint8_t command) const {
+        return _handlers[command];
+    }
+
+private:
+    MemcacheCommandHandler* _handlers[256];
+};
+
+} // namespace melon
@@ -150,11 +150,16 @@ static void SendBRPCResponse(int64_t correlation_id,
     }
     Socket* sock = accessor.get_sending_socket();
 
-    std::unique_ptr<const google::protobuf::Message> recycle_req(req);
-    std::unique_ptr<const google::protobuf::Message> recycle_res(res);
-
+    // Messages may be allocated on the arena of `cntl', delete them
+    // before `cntl'.
     std::unique_ptr<Controller, LogErrorTextAndDelete> recycle_cntl(cntl);
     ConcurrencyRemover concurrency_remover(method_status, cntl, received_us);
+    std::unique_ptr<const google::protobuf::Message,
+                    DeleteMessageUnlessOnArena> recycle_req(
+                    req, DeleteMessageUnlessOnArena(cntl->arena()));
+    std::unique_ptr<const google::protobuf::Message,
+                    DeleteMessageUnlessOnArena> recycle_res(
+                    res, DeleteMessageUnlessOnArena(cntl->arena()));
 
     ClosureGuard guard(melon::NewCallback(cntl, &Controller::CallAfterRpcResp, req, res));
     
@@ -358,8 +363,8 @@ void ProcessBRPCRequest(InputMessageBase* msg_base) {
         LOG(WARNING) << "Fail to new Controller";
         return;
     }
-    std::unique_ptr<google::protobuf::Message> req;
-    std::unique_ptr<google::protobuf::Message> res;
+    std::unique_ptr<google::protobuf::Message, DeleteMessageUnlessOnArena> req;
+    std::unique_ptr<google::protobuf::Message, DeleteMessageUnlessOnArena> res;
 
     ServerPrivateAccessor server_accessor(server);
     ControllerPrivateAccessor accessor(cntl.get());
@@ -509,7 +514,11 @@ void ProcessBRPCRequest(InputMessageBase* msg_base) {
         }
 
         CompressType req_cmp_type = (CompressType)meta.compress_type();
-        req.reset(svc->GetRequestPrototype(method).New());
+        google::protobuf::Arena* arena =
+            CreateServerCallArena(cntl.get(), method_status);
+        req.get_deleter() = DeleteMessageUnlessOnArena(arena);
+        res.get_deleter() = DeleteMessageUnlessOnArena(arena);
+        req.reset(svc->GetRequestPrototype(method).New(arena));
         if (!ParseFromCompressedData(*req_buf_ptr, req.get(), req_cmp_type)) {
             cntl->SetFailed(EREQUEST, "Fail to parse request message, "
                             "CompressType=%s, request_size=%d", 
@@ -517,7 +526,7 @@ void ProcessBRPCRequest(InputMessageBase* msg_base) {
             break;
         }
         
-        res.reset(svc->GetResponsePrototype(method).New());
+        res.reset(svc->GetResponsePrototype(method).New(arena));
         // `socket' will be held until response has been sent
         google::protobuf::Closure* done = ::melon::NewCallback<
             int64_t, Controller*, const google::protobuf::Message*,
@@ -22,8 +22,10 @@
 #include <melon/rpc/policy/http2_rpc_protocol.h>
 #include <melon/rpc/details/controller_private_accessor.h>
 #include <melon/rpc/server.h>
+#include <melon/rpc/grpc/grpc_stream_impl.h>
 #include <turbo/strings/escaping.h>
 #include <melon/rpc/log.h>
+#include <melon/utility/time.h>
 #include <cinttypes>
 
 namespace melon {
@@ -35,6 +37,10 @@ namespace melon {
 
     namespace policy {
 
+        const Server::MethodProperty *
+        FindMethodPropertyByURI(const std::string &uri_path, const Server *server,
+                                std::string *unresolved_path);
+
         DEFINE_int32(h2_client_header_table_size,
                      H2Settings::DEFAULT_HEADER_TABLE_SIZE,
                      "maximum size of compression tables for decoding headers");
@@ -46,6 +52,12 @@ namespace melon {
                      H2Settings::DEFAULT_MAX_FRAME_SIZE,
                      "Size of the largest frame payload that client is willing to receive");
 
+        DEFINE_bool(h2_bdp_probe, true,
+                    "Estimate bandwidth-delay product of http2 connections by "
+                    "PING and grow the flow-control windows accordingly");
+        DEFINE_int32(h2_bdp_max_window_size, 16 * 1024 * 1024,
+                     "Max stream-level window size that h2_bdp_probe grows to");
+
         DEFINE_bool(h2_hpack_encode_name, false,
                     "Encode name in HTTP2 headers with huffman encoding");
         DEFINE_bool(h2_hpack_encode_value, false,
@@ -63,6 +75,16 @@ namespace melon {
 
         MELON_VALIDATE_GFLAG(h2_client_connection_window_size, CheckConnWindowSize);
 
+        static bool CheckMaxWindowSize(const char *, int32_t val) {
+            return val >= 0 && (uint32_t) val <= H2Settings::MAX_WINDOW_SIZE;
+        }
+
+        MELON_VALIDATE_GFLAG(h2_bdp_max_window_size, CheckMaxWindowSize);
+
+        // Intervals between BDP pings once the estimation stops growing.
+        static const int64_t MIN_BDP_PING_INTERVAL_US = 100000;
+        static const int64_t MAX_BDP_PING_INTERVAL_US = 10000000;
+
         const char *H2StreamState2Str(H2StreamState s) {
             switch (s) {
                 case H2_STREAM_IDLE:
@@ -355,7 +377,11 @@ namespace melon {
                 // receving the remote settings.
                 , _remote_window_left(H2Settings::MAX_WINDOW_SIZE), _conn_state(H2_CONNECTION_UNINITIALIZED),
                   _last_received_stream_id(-1), _last_sent_stream_id(1), _goaway_stream_id(-1),
-                  _remote_settings_received(false), _deferred_window_update(0) {
+                  _remote_settings_received(false), _deferred_window_update(0), _server(server),
+                  _bdp_ping_id(0), _bdp_ping_start_us(0), _bdp_next_ping_us(0),
+                  _bdp_ping_interval_us(MIN_BDP_PING_INTERVAL_US), _bdp_bytes(0),
+                  _bdp_estimate(0), _bdp_bw(0), _bdp_rtt_us(0), _bdp_ping_count(0),
+                  _window_grow_count(0) {
             // Stop printing the field which is useless for remote settings.
             _remote_settings.connection_window_size = 0;
             // Maximize the window size to make sending big request possible before
@@ -369,6 +395,7 @@ namespace melon {
                 _unack_local_settings.max_frame_size = FLAGS_h2_client_max_frame_size;
                 _unack_local_settings.connection_window_size = FLAGS_h2_client_connection_window_size;
             }
+            _bdp_estimate = _unack_local_settings.stream_window_size;
 #if defined(UNIT_TEST)
             // In ut, we hope _last_sent_stream_id run out quickly to test the correctness
             // of creating new h2 socket. This value is 10,000 less than 0x7FFFFFFF.
@@ -389,6 +416,10 @@ namespace melon {
                 LOG(ERROR) << "Fail to init _pending_streams";
                 return -1;
             }
+            if (_grpc_streams.init(8, 70) != 0) {
+                LOG(ERROR) << "Fail to init _grpc_streams";
+                return -1;
+            }
             if (_hpacker.Init(_unack_local_settings.header_table_size) != 0) {
                 LOG(ERROR) << "Fail to init _hpacker";
                 return -1;
@@ -448,6 +479,83 @@ namespace melon {
             return NULL;
         }
 
+        GrpcStreamId H2Context::FindGrpcStream(int stream_id) {
+            std::unique_lock<mutil::Mutex> mu(_stream_mutex);
+            GrpcStreamId *pid = _grpc_streams.seek(stream_id);
+            if (pid) {
+                return *pid;
+            }
+            return INVALID_GRPC_STREAM_ID;
+        }
+
+        int64_t H2Context::RegisterGrpcStream(int stream_id, GrpcStreamId id) {
+            std::unique_lock<mutil::Mutex> mu(_stream_mutex);
+            _grpc_streams[stream_id] = id;
+            // Following WINDOW_UPDATE go to the GrpcStream, increments
+            // received before are in the stream context if it's not removed.
+            H2StreamContext **psctx = _pending_streams.seek(stream_id);
+            if (psctx) {
+                return (*psctx)->_remote_window_left.load(mutil::memory_order_relaxed);
+            }
+            return _remote_settings.stream_window_size;
+        }
+
+        void H2Context::UnregisterGrpcStream(int stream_id) {
+            std::unique_lock<mutil::Mutex> mu(_stream_mutex);
+            _grpc_streams.erase(stream_id);
+        }
+
+        void H2Context::OnGrpcStreamWindowReturned(int stream_id, int64_t size) {
+            // Contexts are deleted after being removed with the lock held.
+            std::unique_lock<mutil::Mutex> mu(_stream_mutex);
+            H2StreamContext **psctx = _pending_streams.seek(stream_id);
+            if (psctx) {
+                (*psctx)->_grpc_unreturned_window.fetch_sub(
+                        size, mutil::memory_order_relaxed);
+            }
+        }
+
+        void H2Context::UpdateGrpcStreamWindows(int64_t stream_window_diff) {
+            std::vector<GrpcStreamId> ids;
+            {
+                std::unique_lock<mutil::Mutex> mu(_stream_mutex);
+                if (_grpc_streams.empty()) {
+                    return;
+                }
+                ids.reserve(_grpc_streams.size());
+                for (GrpcStreamMap::const_iterator it = _grpc_streams.begin();
+                     it != _grpc_streams.end(); ++it) {
+                    ids.push_back(it->second);
+                }
+            }
+            for (size_t i = 0; i < ids.size(); ++i) {
+                SocketUniquePtr ptr;
+                GrpcStream *s = GrpcStream::Address(ids[i], &ptr);
+                if (s == NULL) {
+                    continue;
+                }
+                if (stream_window_diff != 0) {
+                    s->OnWindowUpdate(stream_window_diff);
+                } else {
+                    s->Flush();
+                }
+            }
+        }
+
+        int64_t H2Context::ConsumeRemoteWindowUpTo(int64_t size) {
+            int64_t left = _remote_window_left.load(mutil::memory_order_relaxed);
+            while (true) {
+                const int64_t n = std::min(left, size);
+                if (n <= 0) {
+                    return 0;
+                }
+                if (_remote_window_left.compare_exchange_weak(
+                        left, left - n, mutil::memory_order_relaxed)) {
+                    return n;
+                }
+            }
+        }
+
         int H2Context::TryToInsertStream(int stream_id, H2StreamContext *ctx) {
             std::unique_lock<mutil::Mutex> mu(_stream_mutex);
             if (_goaway_stream_id >= 0 && stream_id > _goaway_stream_id) {
@@ -542,7 +650,8 @@ namespace melon {
                     }
                     H2StreamContext *sctx = RemoveStreamAndDeferWU(h2_res.stream_id());
                     if (sctx) {
-                        if (is_server_side()) {
+                        if (sctx->AbortGrpcStream(ECANCELED, h2_res.error_str()) ||
+                            is_server_side()) {
                             delete sctx;
                             return MakeMessage(NULL);
                         } else {
@@ -668,7 +777,7 @@ namespace melon {
                 if (frame_head.flags & H2_FLAGS_END_STREAM) {
                     return OnEndStream();
                 }
-                return MakeH2Message(NULL);
+                return OnGrpcStreamHeaders();
             } else {
                 if (frame_head.flags & H2_FLAGS_END_STREAM) {
                     // Delay calling OnEndStream() in OnContinuation()
@@ -718,10 +827,59 @@ namespace melon {
                 if (_stream_ended) {
                     return OnEndStream();
                 }
+                return OnGrpcStreamHeaders();
             }
             return MakeH2Message(NULL);
         }
 
+        H2ParseResult H2StreamContext::OnGrpcStreamHeaders() {
+            if (_grpc_headers_dispatched) {
+                return MakeH2Message(NULL);
+            }
+            if (_conn_ctx->is_server_side()) {
+                // Requests of client-streaming methods are not ended by the
+                // first message, create the stream to receive them.
+                const Server *server = _conn_ctx->_server;
+                bool is_grpc_ct = false;
+                ParseContentType(header().content_type(), &is_grpc_ct);
+                if (server == NULL || !is_grpc_ct) {
+                    return MakeH2Message(NULL);
+                }
+                const Server::MethodProperty *mp =
+                        FindMethodPropertyByURI(header().uri().path(), server, NULL);
+                if (mp == NULL || mp->method == NULL ||
+                    !mp->method->client_streaming()) {
+                    return MakeH2Message(NULL);
+                }
+                if (GrpcStream::Create(NULL, true, &_grpc_stream) != 0) {
+                    LOG(ERROR) << "Fail to create grpc stream, stream_id=" << stream_id();
+                    return MakeH2Error(H2_INTERNAL_ERROR, stream_id());
+                }
+            } else if (_grpc_stream == INVALID_GRPC_STREAM_ID) {
+                return MakeH2Message(NULL);
+            }
+            // This context keeps receiving DATA frames, dispatch headers in
+            // another one.
+            H2StreamContext *head = new H2StreamContext(false);
+            head->Init(_conn_ctx, stream_id());
+            head->header().Swap(header());
+            head->set_correlation_id(_correlation_id);
+            head->_grpc_stream = _grpc_stream;
+            head->_grpc_headers_dispatched = true;
+            head->_parsed_length = _parsed_length;
+            head->OnMessageComplete();
+            _grpc_headers_dispatched = true;
+            return MakeH2Message(head);
+        }
+
+        bool H2StreamContext::AbortGrpcStream(int error_code, const char *error_text) {
+            if (_grpc_stream == INVALID_GRPC_STREAM_ID) {
+                return false;
+            }
+            GrpcStream::SetFailed(_grpc_stream, error_code, error_text, false);
+            return _grpc_headers_dispatched;
+        }
+
         H2ParseResult H2Context::OnData(
                 mutil::IOBufBytesIterator &it, const H2FrameHead &frame_head) {
             uint32_t frag_size = frame_head.payload_size;
@@ -735,6 +893,7 @@ namespace melon {
                 return MakeH2Error(H2_FRAME_SIZE_ERROR);
             }
             frag_size -= pad_length;
+            OnBdpData(frame_head.payload_size);
             H2StreamContext *sctx = FindStream(frame_head.stream_id);
             if (sctx == NULL) {
                 // If a DATA frame is received whose stream is not in "open" or "half-closed (local)" state,
@@ -758,6 +917,28 @@ namespace melon {
             mutil::IOBuf data;
             it.append_and_forward(&data, frag_size);
             it.forward(pad_length);
+            if (_grpc_headers_dispatched) {
+                // The connection-level window is given back at once while the
+                // stream-level one is given back by the GrpcStream after the
+                // messages are consumed.
+                _conn_ctx->DeferWindowUpdate(frame_head.payload_size);
+                const int64_t unreturned = _grpc_unreturned_window.fetch_add(
+                        frame_head.payload_size, mutil::memory_order_relaxed)
+                        + frame_head.payload_size;
+                if (unreturned > _conn_ctx->max_local_stream_window_size()) {
+                    LOG(ERROR) << "Fail to satisfy the stream-level flow control policy";
+                    return MakeH2Error(H2_FLOW_CONTROL_ERROR, frame_head.stream_id);
+                }
+                SocketUniquePtr ptr;
+                GrpcStream *s = GrpcStream::Address(_grpc_stream, &ptr);
+                if (s == NULL || s->OnData(&data, frame_head.payload_size) != 0) {
+                    return MakeH2Error(H2_CANCEL, frame_head.stream_id);
+                }
+                if (frame_head.flags & H2_FLAGS_END_STREAM) {
+                    return OnEndStream();
+                }
+                return MakeH2Message(NULL);
+            }
             for (size_t i = 0; i < data.backing_block_num(); ++i) {
                 const mutil::StringPiece blk = data.backing_block(i);
                 if (OnBody(blk.data(), blk.size()) != 0) {
@@ -769,7 +950,7 @@ namespace melon {
             const int64_t acc = _deferred_window_update.fetch_add(frag_size, mutil::memory_order_relaxed) + frag_size;
             // Allocate the quota of the window to each stream.
             if (acc >= _conn_ctx->local_settings().stream_window_size / (_conn_ctx->VolatilePendingStreamSize() + 1)) {
-                if (acc > _conn_ctx->local_settings().stream_window_size) {
+                if (acc > _conn_ctx->max_local_stream_window_size()) {
                     LOG(ERROR) << "Fail to satisfy the stream-level flow control policy";
                     return MakeH2Error(H2_FLOW_CONTROL_ERROR, frame_head.stream_id);
                 }
@@ -809,6 +990,13 @@ namespace melon {
             const H2Error h2_error = static_cast<H2Error>(LoadUint32(it));
             H2StreamContext *sctx = FindStream(frame_head.stream_id);
             if (sctx == NULL) {
+                // The remote side may cancel a gRPC stream after ending its side.
+                const GrpcStreamId grpc_stream = FindGrpcStream(frame_head.stream_id);
+                if (grpc_stream != INVALID_GRPC_STREAM_ID) {
+                    GrpcStream::SetFailed(grpc_stream, ECANCELED,
+                                          H2ErrorToString(h2_error), false);
+                    return MakeH2Message(NULL);
+                }
                 RPC_VLOG << "Fail to find stream_id=" << frame_head.stream_id;
                 return MakeH2Message(NULL);
             }
@@ -834,6 +1022,10 @@ namespace melon {
                 LOG(ERROR) << "Fail to find stream_id=" << stream_id();
                 return MakeH2Error(H2_PROTOCOL_ERROR);
             }
+            if (sctx->AbortGrpcStream(ECANCELED, H2ErrorToString(h2_error))) {
+                delete sctx;
+                return MakeH2Message(NULL);
+            }
             if (_conn_ctx->is_client_side()) {
                 sctx->header().set_status_code(H2ErrorToStatusCode(h2_error));
                 return MakeH2Message(sctx);
@@ -863,6 +1055,44 @@ namespace melon {
             }
             CHECK_EQ(sctx, this);
 
+            if (_grpc_stream != INVALID_GRPC_STREAM_ID) {
+                SocketUniquePtr ptr;
+                GrpcStream *s = GrpcStream::Address(_grpc_stream, &ptr);
+                if (_grpc_headers_dispatched) {
+                    int error_code = 0;
+                    std::string error_text;
+                    if (_conn_ctx->is_client_side()) {
+                        // Status of the call is in the trailers.
+                        const std::string *grpc_status = header().GetHeader("grpc-status");
+                        if (grpc_status == NULL) {
+                            error_code = ERESPONSE;
+                            error_text = "Fail to find grpc-status in trailers";
+                        } else {
+                            const GrpcStatus status =
+                                    (GrpcStatus) strtol(grpc_status->c_str(), NULL, 10);
+                            if (status != GRPC_OK) {
+                                error_code = GrpcStatusToErrorCode(status);
+                                const std::string *grpc_message =
+                                        header().GetHeader("grpc-message");
+                                if (grpc_message) {
+                                    PercentDecode(*grpc_message, &error_text);
+                                } else {
+                                    error_text = GrpcStatusToString(status);
+                                }
+                            }
+                        }
+                    }
+                    if (s != NULL) {
+                        s->OnRemoteClosed(error_code, error_text);
+                    }
+                    delete sctx;
+                    return MakeH2Message(NULL);
+                }
+                if (s != NULL && _conn_ctx->is_client_side()) {
+                    // The whole response was sent, the stream is never opened.
+                    s->OnRemoteClosed(EREQUEST, "The server didn't accept the stream");
+                }
+            }
             OnMessageComplete();
             return MakeH2Message(sctx);
         }
@@ -919,13 +1149,16 @@ namespace melon {
                 // be changed using WINDOW_UPDATE frames.
                 // https://tools.ietf.org/html/rfc7540#section-6.9.2
                 // TODO(gejun): Has race conditions with AppendAndDestroySelf
-                std::unique_lock<mutil::Mutex> mu(_stream_mutex);
-                for (StreamMap::const_iterator it = _pending_streams.begin();
-                     it != _pending_streams.end(); ++it) {
-                    if (!AddWindowSize(&it->second->_remote_window_left, window_diff)) {
-                        return MakeH2Error(H2_FLOW_CONTROL_ERROR);
+                {
+                    std::unique_lock<mutil::Mutex> mu(_stream_mutex);
+                    for (StreamMap::const_iterator it = _pending_streams.begin();
+                         it != _pending_streams.end(); ++it) {
+                        if (!AddWindowSize(&it->second->_remote_window_left, window_diff)) {
+                            return MakeH2Error(H2_FLOW_CONTROL_ERROR);
+                        }
                     }
                 }
+                UpdateGrpcStreamWindows(window_diff);
             }
             // Respond with ack
             char headbuf[FRAME_HEAD_SIZE];
@@ -960,6 +1193,9 @@ namespace melon {
                 return MakeH2Error(H2_PROTOCOL_ERROR);
             }
             if (frame_head.flags & H2_FLAGS_ACK) {
+                const uint64_t hi = LoadUint32(it);
+                const uint64_t lo = LoadUint32(it);
+                OnBdpPingAck((hi << 32) | lo);
                 return MakeH2Message(NULL);
             }
 
@@ -973,6 +1209,94 @@ namespace melon {
             return MakeH2Message(NULL);
         }
 
+        void H2Context::OnBdpData(uint32_t size) {
+            if (_bdp_ping_id != 0) {
+                _bdp_bytes += size;
+                return;
+            }
+            if (!FLAGS_h2_bdp_probe ||
+                _bdp_estimate >= FLAGS_h2_bdp_max_window_size) {
+                return;
+            }
+            const int64_t now_us = mutil::cpuwide_time_us();
+            if (now_us < _bdp_next_ping_us) {
+                return;
+            }
+            const uint64_t ping_id = ++_bdp_ping_count;
+            char pingbuf[FRAME_HEAD_SIZE + 8];
+            SerializeFrameHead(pingbuf, 8, H2_FRAME_PING, 0, 0);
+            SaveUint32(pingbuf + FRAME_HEAD_SIZE, ping_id >> 32);
+            SaveUint32(pingbuf + FRAME_HEAD_SIZE + 4, ping_id & 0xFFFFFFFF);
+            if (WriteAck(_socket, pingbuf, sizeof(pingbuf)) != 0) {
+                LOG(WARNING) << "Fail to send PING to " << *_socket;
+                return;
+            }
+            _bdp_ping_id = ping_id;
+            _bdp_ping_start_us = now_us;
+            _bdp_bytes = 0;
+        }
+
+        void H2Context::OnBdpPingAck(uint64_t ping_id) {
+            if (_bdp_ping_id == 0 || ping_id != _bdp_ping_id) {
+                // Not sent by OnBdpData.
+                return;
+            }
+            _bdp_ping_id = 0;
+            const int64_t now_us = mutil::cpuwide_time_us();
+            _bdp_rtt_us = std::max(now_us - _bdp_ping_start_us, (int64_t) 1);
+            // Bytes received during a round trip are limited by either the
+            // bandwidth or the windows. The latter is the case if the sample
+            // is close to the estimation and the bandwidth still grows, the
+            // same rule as gRPC.
+            const int64_t bw = _bdp_bytes * 1000000L / _bdp_rtt_us;
+            if (_bdp_bytes > 2 * _bdp_estimate / 3 && bw > _bdp_bw) {
+                _bdp_estimate = std::max(_bdp_bytes, 2 * _bdp_estimate);
+                _bdp_bw = bw;
+                // Probe again with the next DATA.
+                _bdp_ping_interval_us = MIN_BDP_PING_INTERVAL_US;
+                _bdp_next_ping_us = now_us;
+                GrowLocalWindows(_bdp_estimate);
+            } else {
+                _bdp_next_ping_us = now_us + _bdp_ping_interval_us;
+                _bdp_ping_interval_us = std::min(_bdp_ping_interval_us * 2,
+                                                 MAX_BDP_PING_INTERVAL_US);
+            }
+        }
+
+        void H2Context::GrowLocalWindows(int64_t window_size) {
+            window_size = std::min(window_size, (int64_t) FLAGS_h2_bdp_max_window_size);
+            if (window_size <= _unack_local_settings.stream_window_size) {
+                return;
+            }
+            // Keep the ratio between default connection-level and stream-level
+            // windows so that concurrent streams are not starved.
+            const int64_t old_conn_window = _unack_local_settings.connection_window_size;
+            const int64_t conn_window = std::max(old_conn_window, std::min(
+                    4 * window_size, (int64_t) H2Settings::MAX_WINDOW_SIZE));
+            _unack_local_settings.stream_window_size = window_size;
+            _unack_local_settings.connection_window_size = conn_window;
+
+            // The new INITIAL_WINDOW_SIZE also enlarges windows of existing
+            // streams, while the connection-level window can only be enlarged
+            // by WINDOW_UPDATE.
+            char buf[FRAME_HEAD_SIZE + H2_SETTINGS_MAX_BYTE_SIZE +
+                     FRAME_HEAD_SIZE + 4/*for WU*/];
+            const size_t nb = SerializeH2Settings(_unack_local_settings,
+                                                  buf + FRAME_HEAD_SIZE);
+            SerializeFrameHead(buf, nb, H2_FRAME_SETTINGS, 0, 0);
+            char *p = buf + FRAME_HEAD_SIZE + nb;
+            if (conn_window > old_conn_window) {
+                SerializeFrameHead(p, 4, H2_FRAME_WINDOW_UPDATE, 0, 0);
+                SaveUint32(p + FRAME_HEAD_SIZE, conn_window - old_conn_window);
+                p += FRAME_HEAD_SIZE + 4;
+            }
+            if (WriteAck(_socket, buf, p - buf) != 0) {
+                LOG(WARNING) << "Fail to send SETTINGS to " << *_socket;
+                return;
+            }
+            ++_window_grow_count;
+        }
+
         static void *ProcessHttpResponseWrapper(void *void_arg) {
             ProcessHttpResponse(static_cast<InputMessageBase *>(void_arg));
             return NULL;
@@ -1007,9 +1331,19 @@ namespace melon {
                 if (goaway_streams.empty()) {
                     return MakeH2Message(NULL);
                 }
+                size_t n = 0;
                 for (size_t i = 0; i < goaway_streams.size(); ++i) {
                     H2StreamContext *sctx = goaway_streams[i];
+                    if (sctx->AbortGrpcStream(ELOGOFF, "The server is going away")) {
+                        delete sctx;
+                        continue;
+                    }
                     sctx->header().set_status_code(HTTP_STATUS_SERVICE_UNAVAILABLE);
+                    goaway_streams[n++] = sctx;
+                }
+                goaway_streams.resize(n);
+                if (goaway_streams.empty()) {
+                    return MakeH2Message(NULL);
                 }
                 for (size_t i = 1; i < goaway_streams.size(); ++i) {
                     fiber_t th;
@@ -1043,8 +1377,18 @@ namespace melon {
                     LOG(ERROR) << "Invalid connection-level window_size_increment=" << inc;
                     return MakeH2Error(H2_FLOW_CONTROL_ERROR);
                 }
+                UpdateGrpcStreamWindows(0);
                 return MakeH2Message(NULL);
             } else {
+                const GrpcStreamId grpc_stream = FindGrpcStream(frame_head.stream_id);
+                if (grpc_stream != INVALID_GRPC_STREAM_ID) {
+                    SocketUniquePtr ptr;
+                    GrpcStream *s = GrpcStream::Address(grpc_stream, &ptr);
+                    if (s != NULL) {
+                        s->OnWindowUpdate(inc);
+                    }
+                    return MakeH2Message(NULL);
+                }
                 H2StreamContext *sctx = FindStream(frame_head.stream_id);
                 if (sctx == NULL) {
                     RPC_VLOG << "Fail to find stream_id=" << frame_head.stream_id;
@@ -1075,6 +1419,11 @@ namespace melon {
                << sep << "remote_settings=" << _remote_settings
                << sep << "remote_settings_received=" << _remote_settings_received
                << sep << "local_settings=" << _local_settings
+               << sep << "bdp_estimate=" << _bdp_estimate
+               << sep << "bdp_bandwidth=" << _bdp_bw
+               << sep << "bdp_rtt_us=" << _bdp_rtt_us
+               << sep << "bdp_ping_count=" << _bdp_ping_count
+               << sep << "window_grow_count=" << _window_grow_count
                << sep << "hpacker={";
             IndentingOStream os2(os, 2);
             _hpacker.Describe(os2, opt);
@@ -1185,7 +1534,8 @@ namespace melon {
                 , _state(H2_STREAM_IDLE)
 #endif
                 , _stream_id(0), _stream_ended(false), _remote_window_left(0), _deferred_window_update(0),
-                  _correlation_id(INVALID_FIBER_ID.value) {
+                  _correlation_id(INVALID_FIBER_ID.value), _grpc_stream(INVALID_GRPC_STREAM_ID),
+                  _grpc_headers_dispatched(false), _grpc_unreturned_window(0) {
             header().set_version(2, 0);
 #ifndef NDEBUG
             get_h2_vars()->h2_stream_context_count << 1;
@@ -1331,12 +1681,13 @@ namespace melon {
                                   mutil::IOBuf &trailer_headers,
                                   const mutil::IOBuf &data,
                                   int stream_id,
-                                  H2Context *conn_ctx) {
+                                  H2Context *conn_ctx,
+                                  bool end_stream) {
             const H2Settings &remote_settings = conn_ctx->remote_settings();
             char headbuf[FRAME_HEAD_SIZE];
             H2FrameHead headers_head = {
                     (uint32_t) headers.size(), H2_FRAME_HEADERS, 0, stream_id};
-            if (data.empty() && trailer_headers.empty()) {
+            if (end_stream && data.empty() && trailer_headers.empty()) {
                 headers_head.flags |= H2_FLAGS_END_STREAM;
             }
             if (headers_head.payload_size <= remote_settings.max_frame_size) {
@@ -1369,7 +1720,7 @@ namespace melon {
                 while (it.bytes_left()) {
                     if (it.bytes_left() <= remote_settings.max_frame_size) {
                         data_head.payload_size = it.bytes_left();
-                        if (trailer_headers.empty()) {
+                        if (end_stream && trailer_headers.empty()) {
                             data_head.flags |= H2_FLAGS_END_STREAM;
                         }
                     } else {
@@ -1570,9 +1921,19 @@ namespace melon {
             }
 
             _sctx->Init(ctx, id);
+            // Messages of client-streaming methods are all sent by the
+            // GrpcStream, the request is left unsent.
+            const GrpcStreamId grpc_stream = ControllerPrivateAccessor(_cntl).grpc_stream();
+            const bool request_streaming = (grpc_stream != INVALID_GRPC_STREAM_ID &&
+                                            _cntl->method() != NULL &&
+                                            _cntl->method()->client_streaming());
+            const mutil::IOBuf empty_data;
+            const mutil::IOBuf &data =
+                    (request_streaming ? empty_data : _cntl->request_attachment());
+            _sctx->_grpc_stream = grpc_stream;
             // check flow control restriction
-            if (!_cntl->request_attachment().empty()) {
-                const int64_t data_size = _cntl->request_attachment().size();
+            if (!data.empty()) {
+                const int64_t data_size = data.size();
                 if (!_sctx->ConsumeWindowSize(data_size)) {
                     return mutil::Status(ELIMIT, "remote_window_left is not enough, data_size=%" PRId64, data_size);
                 }
@@ -1587,6 +1948,10 @@ namespace melon {
             _stream_id = _sctx->stream_id();
             // After calling TryToInsertStream, the ownership of _sctx is transferred to ctx
             _sctx.release();
+            if (grpc_stream != INVALID_GRPC_STREAM_ID &&
+                BindGrpcStream(socket, _stream_id, grpc_stream, !request_streaming) != 0) {
+                return mutil::Status(ECANCELED, "The grpc stream was closed");
+            }
 
             HPacker &hpacker = ctx->hpacker();
             mutil::IOBufAppender appender;
@@ -1611,7 +1976,16 @@ namespace melon {
             mutil::IOBuf frag;
             appender.move_to(frag);
             mutil::IOBuf dummy_buf;
-            PackH2Message(out, frag, dummy_buf, _cntl->request_attachment(), _stream_id, ctx);
+            PackH2Message(out, frag, dummy_buf, data, _stream_id, ctx, !request_streaming);
+            if (grpc_stream != INVALID_GRPC_STREAM_ID) {
+                // Messages written into the socket from now on are queued
+                // after the headers.
+                SocketUniquePtr ptr;
+                GrpcStream *s = GrpcStream::Address(grpc_stream, &ptr);
+                if (s != NULL) {
+                    s->OnHeadersSent();
+                }
+            }
             return mutil::Status::OK();
         }
 
@@ -1659,16 +2033,19 @@ namespace melon {
 
         }
 
-        H2UnsentResponse::H2UnsentResponse(Controller *c, int stream_id, bool is_grpc)
-                : _size(0), _stream_id(stream_id), _http_response(c->release_http_response()), _is_grpc(is_grpc) {
+        H2UnsentResponse::H2UnsentResponse(Controller *c, int stream_id, bool is_grpc,
+                                           bool end_stream)
+                : _size(0), _stream_id(stream_id), _http_response(c->release_http_response()), _is_grpc(is_grpc),
+                  _end_stream(end_stream) {
             _data.swap(c->response_attachment());
-            if (is_grpc) {
+            if (is_grpc && end_stream) {
                 _grpc_status = ErrorCodeToGrpcStatus(c->ErrorCode());
                 PercentEncode(c->ErrorText(), &_grpc_message);
             }
         }
 
-        H2UnsentResponse *H2UnsentResponse::New(Controller *c, int stream_id, bool is_grpc) {
+        H2UnsentResponse *H2UnsentResponse::New(Controller *c, int stream_id, bool is_grpc,
+                                                bool end_stream) {
             const HttpHeader *const h = &c->http_response();
             const CommonStrings *const common = get_common_strings();
             const bool need_content_type = !h->content_type().empty();
@@ -1676,7 +2053,7 @@ namespace melon {
                                    + (size_t) need_content_type;
             const size_t memsize = offsetof(H2UnsentResponse, _list) +
                                    sizeof(HPacker::Header) * maxsize;
-            H2UnsentResponse *msg = new(malloc(memsize)) H2UnsentResponse(c, stream_id, is_grpc);
+            H2UnsentResponse *msg = new(malloc(memsize)) H2UnsentResponse(c, stream_id, is_grpc, end_stream);
             // :status
             if (h->status_code() == 200) {
                 msg->push(common->H2_STATUS, common->STATUS_200);
@@ -1753,7 +2130,7 @@ namespace melon {
             appender.move_to(frag);
 
             mutil::IOBuf trailer_frag;
-            if (_is_grpc) {
+            if (_is_grpc && _end_stream) {
                 HPacker::Header status_header("grpc-status",
                                               mutil::string_printf("%d", _grpc_status));
                 hpacker.Encode(&appender, status_header, options);
@@ -1764,7 +2141,7 @@ namespace melon {
                 appender.move_to(trailer_frag);
             }
 
-            PackH2Message(out, frag, trailer_frag, _data, _stream_id, ctx);
+            PackH2Message(out, frag, trailer_frag, _data, _stream_id, ctx, _end_stream);
             return mutil::Status::OK();
         }
 
@@ -1829,6 +2206,149 @@ namespace melon {
             }
         }
 
+        int BindGrpcStream(Socket *socket, int stream_id, GrpcStreamId id, bool local_closed) {
+            H2Context *ctx = static_cast<H2Context *>(socket->parsing_context());
+            SocketUniquePtr ptr;
+            GrpcStream *s = GrpcStream::Address(id, &ptr);
+            if (ctx == NULL || s == NULL) {
+                return -1;
+            }
+            const int64_t remote_window = ctx->RegisterGrpcStream(stream_id, id);
+            // Give back the stream-level window when half of it is consumed,
+            // the same as DeferWindowUpdate() does to the connection.
+            if (s->Bind(socket, stream_id, remote_window,
+                        ctx->local_settings().stream_window_size / 2, local_closed) != 0) {
+                ctx->UnregisterGrpcStream(stream_id);
+                return -1;
+            }
+            return 0;
+        }
+
+        void UnbindGrpcStream(Socket *socket, int stream_id) {
+            H2Context *ctx = static_cast<H2Context *>(socket->parsing_context());
+            if (ctx == NULL) {
+                return;
+            }
+            ctx->UnregisterGrpcStream(stream_id);
+            ctx->AddAbandonedStream(stream_id);
+        }
+
+        int64_t WriteH2Data(Socket *socket, int stream_id, mutil::IOBuf *data,
+                            int64_t max_size, bool end_stream) {
+            H2Context *ctx = static_cast<H2Context *>(socket->parsing_context());
+            if (ctx == NULL) {
+                errno = EINVAL;
+                return -1;
+            }
+            const int64_t n = ctx->ConsumeRemoteWindowUpTo(
+                    std::min((int64_t) data->size(), max_size));
+            const bool end = (end_stream && (size_t) n == data->size());
+            if (n == 0 && !end) {
+                return 0;
+            }
+            const uint32_t max_frame_size = ctx->remote_settings().max_frame_size;
+            mutil::IOBuf buf;
+            char headbuf[FRAME_HEAD_SIZE];
+            H2FrameHead data_head = {0, H2_FRAME_DATA, 0, stream_id};
+            int64_t left = n;
+            do {
+                data_head.payload_size = (uint32_t) std::min(left, (int64_t) max_frame_size);
+                left -= data_head.payload_size;
+                if (left == 0 && end) {
+                    data_head.flags |= H2_FLAGS_END_STREAM;
+                }
+                SerializeFrameHead(headbuf, data_head);
+                buf.append(headbuf, sizeof(headbuf));
+                data->cutn(&buf, data_head.payload_size);
+            } while (left > 0);
+            Socket::WriteOptions wopt;
+            wopt.ignore_eovercrowded = true;
+            if (socket->Write(&buf, &wopt) != 0) {
+                return -1;
+            }
+            return n;
+        }
+
+        // Trailers are encoded when being written to keep the HPACK tables
+        // of both sides in sync.
+        class H2GrpcTrailers : public SocketMessage {
+        public:
+            H2GrpcTrailers(int stream_id, int error_code, const std::string &error_text)
+                    : _stream_id(stream_id), _grpc_status(ErrorCodeToGrpcStatus(error_code)) {
+                if (error_code != 0) {
+                    PercentEncode(error_text, &_grpc_message);
+                }
+            }
+
+            mutil::Status AppendAndDestroySelf(mutil::IOBuf *out, Socket *socket) override {
+                std::unique_ptr<H2GrpcTrailers> delete_self(this);
+                if (socket == NULL) {
+                    return mutil::Status::OK();
+                }
+                H2Context *ctx = static_cast<H2Context *>(socket->parsing_context());
+                HPackOptions options;
+                options.encode_name = FLAGS_h2_hpack_encode_name;
+                options.encode_value = FLAGS_h2_hpack_encode_value;
+                if (ctx->remote_settings().header_table_size == 0) {
+                    options.index_policy = HPACK_NEVER_INDEX_HEADER;
+                }
+                mutil::IOBufAppender appender;
+                HPacker::Header status_header("grpc-status",
+                                              mutil::string_printf("%d", _grpc_status));
+                ctx->hpacker().Encode(&appender, status_header, options);
+                if (!_grpc_message.empty()) {
+                    HPacker::Header msg_header("grpc-message", _grpc_message);
+                    ctx->hpacker().Encode(&appender, msg_header, options);
+                }
+                mutil::IOBuf frag;
+                appender.move_to(frag);
+                char headbuf[FRAME_HEAD_SIZE];
+                // Trailers are tiny, no CONTINUATION.
+                SerializeFrameHead(headbuf, frag.size(), H2_FRAME_HEADERS,
+                                   H2_FLAGS_END_STREAM | H2_FLAGS_END_HEADERS, _stream_id);
+                out->append(headbuf, sizeof(headbuf));
+                out->append(mutil::IOBuf::Movable(frag));
+                return mutil::Status::OK();
+            }
+
+        private:
+            int _stream_id;
+            GrpcStatus _grpc_status;
+            std::string _grpc_message;
+        };
+
+        int WriteGrpcTrailers(Socket *socket, int stream_id, int error_code,
+                              const std::string &error_text) {
+            SocketMessagePtr<H2GrpcTrailers> trailers(
+                    new H2GrpcTrailers(stream_id, error_code, error_text));
+            Socket::WriteOptions wopt;
+            wopt.ignore_eovercrowded = true;
+            return socket->Write(trailers, &wopt);
+        }
+
+        int WriteH2ResetStream(Socket *socket, int stream_id, H2Error h2_error) {
+            char rstbuf[FRAME_HEAD_SIZE + 4];
+            SerializeFrameHead(rstbuf, 4, H2_FRAME_RST_STREAM, 0, stream_id);
+            SaveUint32(rstbuf + FRAME_HEAD_SIZE, h2_error);
+            return WriteAck(socket, rstbuf, sizeof(rstbuf));
+        }
+
+        int WriteH2WindowUpdate(Socket *socket, int stream_id, int64_t increment) {
+            char winbuf[FRAME_HEAD_SIZE + 4];
+            SerializeFrameHead(winbuf, 4, H2_FRAME_WINDOW_UPDATE, 0, stream_id);
+            SaveUint32(winbuf + FRAME_HEAD_SIZE, increment);
+            return WriteAck(socket, winbuf, sizeof(winbuf));
+        }
+
+        int ReturnGrpcStreamWindow(Socket *socket, int stream_id, int64_t increment) {
+            H2Context *ctx = static_cast<H2Context *>(socket->parsing_context());
+            if (ctx != NULL) {
+                // Before sending, the remote side may use the window at once.
+                ctx->OnGrpcStreamWindowReturned(stream_id, increment);
+            }
+            return WriteH2WindowUpdate(socket, stream_id, increment);
+        }
+
         static bool IsH2SocketValid(Socket *s) {
             H2Context *c = static_cast<H2Context *>(s->parsing_context());
             return (c == NULL || !c->RunOutStreams());
@@ -28,6 +28,7 @@
 #include <melon/rpc/http/hpack.h>
 #include <melon/rpc/stream_creator.h>
 #include <melon/rpc/controller.h>
+#include <melon/rpc/grpc/grpc_stream.h>
 
 #ifndef NDEBUG
 #include <melon/var/var.h>
@@ -198,7 +199,10 @@ private:
 
 class H2UnsentResponse : public SocketMessage {
 public:
-    static H2UnsentResponse* New(Controller* c, int stream_id, bool is_grpc);
+    // If |end_stream| is false, only headers are sent and the stream is left
+    // open for messages of a gRPC stream.
+    static H2UnsentResponse* New(Controller* c, int stream_id, bool is_grpc,
+                                 bool end_stream = true);
     void Destroy();
     void Print(std::ostream& os) const;
     // @SocketMessage
@@ -212,7 +216,7 @@ private:
     void push(const std::string& name, const std::string& value)
     { new (&_list[_size++]) HPacker::Header(name, value); }
 
-    H2UnsentResponse(Controller* c, int stream_id, bool is_grpc);
+    H2UnsentResponse(Controller* c, int stream_id, bool is_grpc, bool end_stream);
     ~H2UnsentResponse() {}
     H2UnsentResponse(const H2UnsentResponse&);
     void operator=(const H2UnsentResponse&);
@@ -223,6 +227,7 @@ private:
     std::unique_ptr<HttpHeader> _http_response;
     mutil::IOBuf _data;
     bool _is_grpc;
+    bool _end_stream;
     GrpcStatus _grpc_status;
     std::string _grpc_message;
     HPacker::Header _list[0];
@@ -247,12 +252,20 @@ public:
                           uint32_t frag_size, uint8_t pad_length);
     H2ParseResult OnContinuation(mutil::IOBufBytesIterator&, const H2FrameHead&);
     H2ParseResult OnResetStream(H2Error h2_error, const H2FrameHead&);
+
+    // Dispatch headers of a gRPC stream before END_STREAM, messages in
+    // following DATA frames go to the GrpcStream.
+    H2ParseResult OnGrpcStreamHeaders();
+    // Fail the GrpcStream when the stream is reset or abandoned. Returns
+    // true if this context should be deleted instead of being dispatched.
+    bool AbortGrpcStream(int error_code, const char* error_text);
     
     uint64_t correlation_id() const { return _correlation_id; }
     void set_correlation_id(uint64_t cid) { _correlation_id = cid; }
     
     size_t parsed_length() const { return this->_parsed_length; }
     int stream_id() const { return _stream_id; }
+    GrpcStreamId grpc_stream() const { return _grpc_stream; }
 
     int64_t ReleaseDeferredWindowUpdate() {
         if (_deferred_window_update.load(mutil::memory_order_relaxed) == 0) {
@@ -279,6 +292,11 @@ friend class H2Context;
     mutil::atomic<int64_t> _deferred_window_update;
     uint64_t _correlation_id;
     mutil::IOBuf _remaining_header_fragment;
+    GrpcStreamId _grpc_stream;
+    bool _grpc_headers_dispatched;
+    // Bytes of DATA given to the GrpcStream and not given back to the
+    // remote side, which must be within the stream-level window.
+    mutil::atomic<int64_t> _grpc_unreturned_window;
 };
 
 StreamCreator* get_h2_global_stream_creator();
@@ -345,6 +363,11 @@ public:
     HPacker& hpacker() { return _hpacker; }
     const H2Settings& remote_settings() const { return _remote_settings; }
     const H2Settings& local_settings() const { return _local_settings; }
+    // Windows only grow, the remote side may use the unacknowledged one.
+    uint32_t max_local_stream_window_size() const {
+        return std::max(_local_settings.stream_window_size,
+                        _unack_local_settings.stream_window_size);
+    }
 
     bool is_client_side() const { return _socket->CreatedByConnect(); }
     bool is_server_side() const { return !is_client_side(); }
@@ -354,6 +377,18 @@ public:
     void DeferWindowUpdate(int64_t);
     int64_t ReleaseDeferredWindowUpdate();
 
+    // Take at most |size| bytes from the connection-level window of the
+    // remote side. Returns bytes taken.
+    int64_t ConsumeRemoteWindowUpTo(int64_t size);
+
+    // Route WINDOW_UPDATE and SETTINGS of |stream_id| to the gRPC stream |id|.
+    // Returns the stream-level window of the remote side.
+    int64_t RegisterGrpcStream(int stream_id, GrpcStreamId id);
+    void UnregisterGrpcStream(int stream_id);
+    // The gRPC stream of |stream_id| gives |size| bytes of the stream-level
+    // window back to the remote side.
+    void OnGrpcStreamWindowReturned(int stream_id, int64_t size);
+
 private:
 friend class H2StreamContext;
 friend class H2UnsentRequest;
@@ -373,10 +408,20 @@ friend void InitFrameHandlers();
     H2ParseResult OnWindowUpdate(mutil::IOBufBytesIterator&, const H2FrameHead&);
     H2ParseResult OnContinuation(mutil::IOBufBytesIterator&, const H2FrameHead&);
 
+    // Estimate bandwidth-delay product with bytes of DATA received during
+    // round trips of PINGs, and grow local windows to the estimation.
+    void OnBdpData(uint32_t size);
+    void OnBdpPingAck(uint64_t ping_id);
+    void GrowLocalWindows(int64_t window_size);
+
     H2StreamContext* RemoveStreamAndDeferWU(int stream_id);
     void RemoveGoAwayStreams(int goaway_stream_id, std::vector<H2StreamContext*>* out_streams);
 
     H2StreamContext* FindStream(int stream_id);
+    GrpcStreamId FindGrpcStream(int stream_id);
+    // Apply |stream_window_diff| to registered gRPC streams and let them
+    // send messages blocked by the windows.
+    void UpdateGrpcStreamWindows(int64_t stream_window_diff);
 
     // True if the connection is established by client, otherwise it's
     // accepted by server.
@@ -396,9 +441,46 @@ friend void InitFrameHandlers();
     typedef mutil::FlatMap<int, H2StreamContext*> StreamMap;
     mutable mutil::Mutex _stream_mutex;
     StreamMap _pending_streams;
+    // gRPC streams being written, protected by _stream_mutex as well. Entries
+    // outlive H2StreamContext when the remote side ended first.
+    typedef mutil::FlatMap<int, GrpcStreamId> GrpcStreamMap;
+    GrpcStreamMap _grpc_streams;
     mutil::atomic<int64_t> _deferred_window_update;
+    const Server* _server;
+
+    // Fields of BDP probing, only modified by the parsing fiber.
+    uint64_t _bdp_ping_id;
+    int64_t _bdp_ping_start_us;
+    int64_t _bdp_next_ping_us;
+    int64_t _bdp_ping_interval_us;
+    int64_t _bdp_bytes;
+    int64_t _bdp_estimate;
+    int64_t _bdp_bw;
+    int64_t _bdp_rtt_us;
+    int64_t _bdp_ping_count;
+    int64_t _window_grow_count;
 };
 
+// Write frames of the gRPC stream bound to |stream_id| of the http2
+// connection |socket|, used by GrpcStream.
+// Returns 0 on success, -1 otherwise.
+int BindGrpcStream(Socket* socket, int stream_id, GrpcStreamId id, bool local_closed);
+void UnbindGrpcStream(Socket* socket, int stream_id);
+
+// Cut DATA frames from |data| as many as the connection-level window allows
+// but no more than |max_size| bytes. END_STREAM is set on the last frame if
+// |end_stream| is true and |data| is drained.
+// Returns bytes cut from |data|, -1 on error.
+int64_t WriteH2Data(Socket* socket, int stream_id, mutil::IOBuf* data,
+                    int64_t max_size, bool end_stream);
+int WriteGrpcTrailers(Socket* socket, int stream_id, int error_code,
+                      const std::string& error_text);
+int WriteH2ResetStream(Socket* socket, int stream_id, H2Error h2_error);
+int WriteH2WindowUpdate(Socket* socket, int stream_id, int64_t increment);
+// Send the WINDOW_UPDATE of the gRPC stream bound to |stream_id| after the
+// received messages are consumed.
+int ReturnGrpcStreamWindow(Socket* socket, int stream_id, int64_t increment);
+
 inline int H2Context::AllocateClientStreamId() {
     if (RunOutStreams()) {
         LOG(WARNING) << "Fail to allocate new client stream, _last_sent_stream_id="
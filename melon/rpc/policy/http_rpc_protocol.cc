@@ -47,6 +47,7 @@
 #include <melon/rpc/policy/http2_rpc_protocol.h>
 #include <melon/rpc/details/usercode_backup_pool.h>
 #include <melon/rpc/grpc/grpc.h>
+#include <melon/rpc/grpc/grpc_stream_impl.h>
 #include <melon/fiber/key.h>
 #include <cinttypes>
 
@@ -403,6 +404,11 @@ namespace melon {
                     }
                     break;
                 }
+                if (is_grpc && res_body.empty() &&
+                    accessor.grpc_stream() != INVALID_GRPC_STREAM_ID) {
+                    // The stream was opened, responses are messages in it.
+                    break;
+                }
                 if (cntl->response() == NULL ||
                     cntl->response()->GetDescriptor()->field_count() == 0) {
                     // a http call, content is the "real response".
@@ -540,7 +546,7 @@ namespace melon {
                     opt.enum_option = (FLAGS_pb_enum_as_number
                                        ? json2pb::OUTPUT_ENUM_BY_NUMBER
                                        : json2pb::OUTPUT_ENUM_BY_NAME);
-                    if (!json2pb::ProtoMessageToJson(*pbreq, &wrapper, opt, &err)) {
+                    if (!json2pb::ProtoMessageToJson(*pbreq, &cntl->request_attachment(), opt, &err)) {
                         cntl->request_attachment().clear();
                         return cntl->SetFailed(
                                 EREQUEST, "Fail to convert request to json, %s", err.c_str());
@@ -704,9 +710,16 @@ namespace melon {
 
             ~HttpResponseSender();
 
-            void own_request(google::protobuf::Message *req) { _req.reset(req); }
+            // Messages are created by New(_cntl->arena()).
+            void own_request(google::protobuf::Message *req) {
+                _req.get_deleter() = DeleteMessageUnlessOnArena(_cntl->arena());
+                _req.reset(req);
+            }
 
-            void own_response(google::protobuf::Message *res) { _res.reset(res); }
+            void own_response(google::protobuf::Message *res) {
+                _res.get_deleter() = DeleteMessageUnlessOnArena(_cntl->arena());
+                _res.reset(res);
+            }
 
             void set_method_status(MethodStatus *ms) { _method_status = ms; }
 
@@ -715,9 +728,11 @@ namespace melon {
             void set_h2_stream_id(int id) { _h2_stream_id = id; }
 
         private:
+            // Messages may be allocated on the arena of _cntl, which must be
+            // declared before them.
             std::unique_ptr<Controller, LogErrorTextAndDelete> _cntl;
-            std::unique_ptr<google::protobuf::Message> _req;
-            std::unique_ptr<google::protobuf::Message> _res;
+            std::unique_ptr<google::protobuf::Message, DeleteMessageUnlessOnArena> _req;
+            std::unique_ptr<google::protobuf::Message, DeleteMessageUnlessOnArena> _res;
             MethodStatus *_method_status;
             int64_t _received_us;
             int _h2_stream_id;
@@ -751,6 +766,8 @@ namespace melon {
             const google::protobuf::Message *res = _res.get();
 
             if (cntl->IsCloseConnection()) {
+                GrpcStream::SetFailed(accessor.grpc_stream(), ECLOSE,
+                                      "The connection was closed", false);
                 socket->SetFailed();
                 return;
             }
@@ -774,10 +791,31 @@ namespace melon {
             const bool is_http2 = req_header->is_http2();
             const bool is_grpc = (is_http2 && is_grpc_ct);
 
+            // Messages of an accepted gRPC stream follow the response headers
+            // in the same http2 stream, otherwise the stream is closed.
+            const GrpcStreamId grpc_stream = accessor.grpc_stream();
+            bool grpc_stream_opened = false;
+            if (grpc_stream != INVALID_GRPC_STREAM_ID) {
+                SocketUniquePtr stream_ptr;
+                GrpcStream *s = GrpcStream::Address(grpc_stream, &stream_ptr);
+                if (s == NULL || !is_grpc || cntl->Failed() || !s->accepted()) {
+                    GrpcStream::SetFailed(grpc_stream, EREQUEST,
+                                          "The stream was not accepted", false);
+                } else if (BindGrpcStream(socket, _h2_stream_id, grpc_stream, false) != 0) {
+                    GrpcStream::SetFailed(grpc_stream, EFAILEDSOCKET,
+                                          "Fail to bind the stream", false);
+                    cntl->SetFailed(EFAILEDSOCKET, "Fail to bind grpc stream to %s",
+                                    socket->description().c_str());
+                } else {
+                    grpc_stream_opened = true;
+                    cntl->response_attachment().clear();
+                }
+            }
+
             // Convert response to json/proto if needed.
             // Notice: Not check res->IsInitialized() which should be checked in the
             // conversion function.
-            if (res != NULL &&
+            if (res != NULL && !grpc_stream_opened &&
                 cntl->response_attachment().empty() &&
                 // ^ user did not fill the body yet.
                 res->GetDescriptor()->field_count() > 0 &&
@@ -804,7 +842,7 @@ namespace melon {
                     opt.enum_option = (FLAGS_pb_enum_as_number
                                        ? json2pb::OUTPUT_ENUM_BY_NUMBER
                                        : json2pb::OUTPUT_ENUM_BY_NAME);
-                    if (!json2pb::ProtoMessageToJson(*res, &wrapper, opt, &err)) {
+                    if (!json2pb::ProtoMessageToJson(*res, &cntl->response_attachment(), opt, &err)) {
                         cntl->SetFailed(ERESPONSE, "Fail to convert response to json, %s", err.c_str());
                     }
                 }
@@ -912,12 +950,13 @@ namespace melon {
             Socket::WriteOptions wopt;
             wopt.ignore_eovercrowded = true;
             if (is_http2) {
-                if (is_grpc) {
+                if (is_grpc && !grpc_stream_opened) {
                     // Append compressed and length before body
                     AddGrpcPrefix(&cntl->response_attachment(), grpc_compressed);
                 }
                 SocketMessagePtr<H2UnsentResponse> h2_response(
-                        H2UnsentResponse::New(cntl, _h2_stream_id, is_grpc));
+                        H2UnsentResponse::New(cntl, _h2_stream_id, is_grpc,
+                                              !grpc_stream_opened));
                 if (h2_response == NULL) {
                     LOG(ERROR) << "Fail to make http2 response";
                     errno = EINVAL;
@@ -953,8 +992,18 @@ namespace melon {
                 const int errcode = errno;
                 PLOG_IF(WARNING, errcode != EPIPE) << "Fail to write into " << *socket;
                 cntl->SetFailed(errcode, "Fail to write into %s", socket->description().c_str());
+                if (grpc_stream_opened) {
+                    GrpcStream::SetFailed(grpc_stream, errcode, "Fail to write headers", false);
+                }
                 return;
             }
+            if (grpc_stream_opened) {
+                SocketUniquePtr stream_ptr;
+                GrpcStream *s = GrpcStream::Address(grpc_stream, &stream_ptr);
+                if (s != NULL) {
+                    s->OnHeadersSent();
+                }
+            }
             if (span) {
                 // TODO: this is not sent
                 span->set_sent_us(mutil::cpuwide_time_us());
@@ -1302,6 +1351,8 @@ namespace melon {
             if (is_http2) {
                 H2StreamContext *h2_sctx = static_cast<H2StreamContext *>(msg);
                 resp_sender.set_h2_stream_id(h2_sctx->stream_id());
+                // Created for request messages of a client-streaming method.
+                ControllerPrivateAccessor(cntl).set_grpc_stream(h2_sctx->grpc_stream());
             }
 
             ControllerPrivateAccessor accessor(cntl);
@@ -1473,9 +1524,10 @@ namespace melon {
             google::protobuf::Service *svc = sp->service;
             const google::protobuf::MethodDescriptor *method = sp->method;
             accessor.set_method(method);
-            google::protobuf::Message *req = svc->GetRequestPrototype(method).New();
+            google::protobuf::Arena *arena = CreateServerCallArena(cntl, method_status);
+            google::protobuf::Message *req = svc->GetRequestPrototype(method).New(arena);
             resp_sender.own_request(req);
-            google::protobuf::Message *res = svc->GetResponsePrototype(method).New();
+            google::protobuf::Message *res = svc->GetResponsePrototype(method).New(arena);
             resp_sender.own_response(res);
 
             if (__builtin_expect(!req || !res, 0)) {
@@ -1491,7 +1543,8 @@ namespace melon {
                 // service is always accessed with valid requests.
                 if (req_body.empty()) {
                     // Treat empty body specially since parsing it results in error
-                    if (!req->IsInitialized()) {
+                    if (!req->IsInitialized() &&
+                        accessor.grpc_stream() == INVALID_GRPC_STREAM_ID) {
                         cntl->SetFailed(EREQUEST, "%s needs to be created from a"
                                                   " non-empty json, it has required fields.",
                                         req->GetDescriptor()->full_name().c_str());
@@ -234,8 +234,12 @@ namespace melon {
             Socket *sock = accessor.get_sending_socket();
             std::unique_ptr<HuluController, LogErrorTextAndDelete> recycle_cntl(cntl);
             ConcurrencyRemover concurrency_remover(method_status, cntl, received_us);
-            std::unique_ptr<const google::protobuf::Message> recycle_req(req);
-            std::unique_ptr<const google::protobuf::Message> recycle_res(res);
+            std::unique_ptr<const google::protobuf::Message,
+                    DeleteMessageUnlessOnArena> recycle_req(
+                    req, DeleteMessageUnlessOnArena(cntl->arena()));
+            std::unique_ptr<const google::protobuf::Message,
+                    DeleteMessageUnlessOnArena> recycle_res(
+                    res, DeleteMessageUnlessOnArena(cntl->arena()));
 
             if (cntl->IsCloseConnection()) {
                 sock->SetFailed();
@@ -365,8 +369,8 @@ namespace melon {
                 LOG(WARNING) << "Fail to new Controller";
                 return;
             }
-            std::unique_ptr<google::protobuf::Message> req;
-            std::unique_ptr<google::protobuf::Message> res;
+            std::unique_ptr<google::protobuf::Message, DeleteMessageUnlessOnArena> req;
+            std::unique_ptr<google::protobuf::Message, DeleteMessageUnlessOnArena> res;
 
             ServerPrivateAccessor server_accessor(server);
             ControllerPrivateAccessor accessor(cntl.get());
@@ -486,7 +490,11 @@ namespace melon {
                     cntl->request_attachment().swap(msg->payload);
                 }
 
-                req.reset(svc->GetRequestPrototype(method).New());
+                google::protobuf::Arena *arena =
+                        CreateServerCallArena(cntl.get(), method_status);
+                req.get_deleter() = DeleteMessageUnlessOnArena(arena);
+                res.get_deleter() = DeleteMessageUnlessOnArena(arena);
+                req.reset(svc->GetRequestPrototype(method).New(arena));
                 if (!ParseFromCompressedData(*req_buf_ptr, req.get(), req_cmp_type)) {
                     cntl->SetFailed(EREQUEST, "Fail to parse request message, "
                                               "CompressType=%s, request_size=%d",
@@ -494,7 +502,7 @@ namespace melon {
                     break;
                 }
 
-                res.reset(svc->GetResponsePrototype(method).New());
+                res.reset(svc->GetResponsePrototype(method).New(arena));
                 // `socket' will be held until response has been sent
                 google::protobuf::Closure *done = ::melon::NewCallback<
                         int64_t, HuluController *, const google::protobuf::Message *,
@@ -19,6 +19,7 @@
 
 
 
+#include <unordered_map>
 #include <google/protobuf/descriptor.h>         // MethodDescriptor
 #include <google/protobuf/message.h>            // Message
 #include <google/protobuf/io/zero_copy_stream_impl_lite.h>
@@ -27,6 +28,7 @@
 #include <melon/utility/time.h>
 #include <melon/utility/iobuf.h>                         // mutil::IOBuf
 #include <melon/utility/raw_pack.h>                      // RawPacker RawUnpacker
+#include <melon/var/reducer.h>                           // melon::var::Adder
 #include <melon/rpc/controller.h>                    // Controller
 #include <melon/rpc/socket.h>                        // Socket
 #include <melon/rpc/server.h>                        // Server
@@ -42,6 +44,7 @@
 #include <melon/rpc/details/controller_private_accessor.h>
 #include <melon/rpc/details/server_private_accessor.h>
 #include <melon/fiber/key.h>
+#include <melon/fiber/unstable.h>                   // fiber_timer_add
 #include <cinttypes>
 
 namespace melon {
@@ -60,6 +63,8 @@ namespace melon {
         // 3. Use service->full_name() + method_name to specify the method to call
         // 4. `attachment_size' is set iff request/response has attachment
         // 5. Not supported: chunk_info
+        // 6. Requests may be coalesced into [MRPB][body_size][meta_size] frames
+        //    whose meta is a RpcBatchMeta, see ChannelOptions.batch_max_calls
 
         // Pack header into `buf'
         inline void PackMStdHeader(char *rpc_header, uint32_t meta_size, int payload_size) {
@@ -92,17 +97,73 @@ namespace melon {
             }
         }
 
+        // Batch frames and calls in them received by servers.
+        static melon::var::Adder<int64_t> &BatchFrameCount() {
+            static melon::var::Adder<int64_t> *c =
+                    new melon::var::Adder<int64_t>("rpc_melon_std_batch_frame_count");
+            return *c;
+        }
+
+        static melon::var::Adder<int64_t> &BatchedCallCount() {
+            static melon::var::Adder<int64_t> *c =
+                    new melon::var::Adder<int64_t>("rpc_melon_std_batched_call_count");
+            return *c;
+        }
+
+        // Replace the batch frame at the front of `source' (header already
+        // popped) with one ordinary frame per call so that each call is parsed
+        // and dispatched like a standalone request. Blocks are referenced rather
+        // than copied.
+        static int ExpandMStdBatch(mutil::IOBuf *source, uint32_t body_size,
+                                   uint32_t meta_size) {
+            mutil::IOBuf meta_buf;
+            source->cutn(&meta_buf, meta_size);
+            const uint32_t calls_size = body_size - meta_size;
+            RpcBatchMeta meta;
+            if (!ParsePbFromIOBuf(&meta, meta_buf) ||
+                meta.meta_sizes_size() != meta.payload_sizes_size() ||
+                meta.meta_sizes_size() == 0) {
+                source->pop_front(calls_size);
+                return -1;
+            }
+            uint64_t total = 0;
+            for (int i = 0; i < meta.meta_sizes_size(); ++i) {
+                total += (uint64_t) meta.meta_sizes(i) + meta.payload_sizes(i);
+            }
+            if (total != calls_size) {
+                source->pop_front(calls_size);
+                return -1;
+            }
+            mutil::IOBuf expanded;
+            for (int i = 0; i < meta.meta_sizes_size(); ++i) {
+                char header[12];
+                PackMStdHeader(header, meta.meta_sizes(i), meta.payload_sizes(i));
+                expanded.append(header, sizeof(header));
+                source->cutn(&expanded, meta.meta_sizes(i) + meta.payload_sizes(i));
+            }
+            expanded.append(*source);
+            source->swap(expanded);
+            BatchFrameCount() << 1;
+            BatchedCallCount() << meta.meta_sizes_size();
+            return 0;
+        }
+
         ParseResult ParseMStdMessage(mutil::IOBuf *source, Socket *socket,
                                      bool /*read_eof*/, const void *) {
             char header_buf[12];
             const size_t n = source->copy_to(header_buf, sizeof(header_buf));
+            bool is_batch = false;
             if (n >= 4) {
                 void *dummy = header_buf;
                 if (*(const uint32_t *) dummy != *(const uint32_t *) "MRPC") {
-                    return MakeParseError(PARSE_ERROR_TRY_OTHERS);
+                    if (*(const uint32_t *) dummy != *(const uint32_t *) "MRPB") {
+                        return MakeParseError(PARSE_ERROR_TRY_OTHERS);
+                    }
+                    is_batch = true;
                 }
             } else {
-                if (memcmp(header_buf, "MRPC", n) != 0) {
+                if (memcmp(header_buf, "MRPC", n) != 0 &&
+                    memcmp(header_buf, "MRPB", n) != 0) {
                     return MakeParseError(PARSE_ERROR_TRY_OTHERS);
                 }
             }
@@ -129,6 +190,15 @@ namespace melon {
                 return MakeParseError(PARSE_ERROR_TRY_OTHERS);
             }
             source->pop_front(sizeof(header_buf));
+            if (is_batch) {
+                if (ExpandMStdBatch(source, body_size, meta_size) != 0) {
+                    LOG(ERROR) << "Fail to expand batch frame from "
+                               << socket->remote_side();
+                    return MakeParseError(PARSE_ERROR_ABSOLUTELY_WRONG);
+                }
+                // `source' starts with the first call of the batch now.
+                return ParseMStdMessage(source, socket, false, NULL);
+            }
             MostCommonMessage *msg = MostCommonMessage::Get();
             source->cutn(&msg->meta, meta_size);
             source->cutn(&msg->payload, body_size - meta_size);
@@ -150,11 +220,16 @@ namespace melon {
             }
             Socket *sock = accessor.get_sending_socket();
 
-            std::unique_ptr<const google::protobuf::Message> recycle_req(req);
-            std::unique_ptr<const google::protobuf::Message> recycle_res(res);
-
+            // Messages may be allocated on the arena of `cntl', delete them
+            // before `cntl'.
             std::unique_ptr<Controller, LogErrorTextAndDelete> recycle_cntl(cntl);
             ConcurrencyRemover concurrency_remover(method_status, cntl, received_us);
+            std::unique_ptr<const google::protobuf::Message,
+                    DeleteMessageUnlessOnArena> recycle_req(
+                    req, DeleteMessageUnlessOnArena(cntl->arena()));
+            std::unique_ptr<const google::protobuf::Message,
+                    DeleteMessageUnlessOnArena> recycle_res(
+                    res, DeleteMessageUnlessOnArena(cntl->arena()));
 
             ClosureGuard guard(melon::NewCallback(cntl, &Controller::CallAfterRpcResp, req, res));
 
@@ -358,8 +433,8 @@ namespace melon {
                 LOG(WARNING) << "Fail to new Controller";
                 return;
             }
-            std::unique_ptr<google::protobuf::Message> req;
-            std::unique_ptr<google::protobuf::Message> res;
+            std::unique_ptr<google::protobuf::Message, DeleteMessageUnlessOnArena> req;
+            std::unique_ptr<google::protobuf::Message, DeleteMessageUnlessOnArena> res;
 
             ServerPrivateAccessor server_accessor(server);
             ControllerPrivateAccessor accessor(cntl.get());
@@ -509,7 +584,11 @@ namespace melon {
                 }
 
                 CompressType req_cmp_type = (CompressType) meta.compress_type();
-                req.reset(svc->GetRequestPrototype(method).New());
+                google::protobuf::Arena *arena =
+                        CreateServerCallArena(cntl.get(), method_status);
+                req.get_deleter() = DeleteMessageUnlessOnArena(arena);
+                res.get_deleter() = DeleteMessageUnlessOnArena(arena);
+                req.reset(svc->GetRequestPrototype(method).New(arena));
                 if (!ParseFromCompressedData(*req_buf_ptr, req.get(), req_cmp_type)) {
                     cntl->SetFailed(EREQUEST, "Fail to parse request message, "
                                               "CompressType=%s, request_size=%d",
@@ -517,7 +596,7 @@ namespace melon {
                     break;
                 }
 
-                res.reset(svc->GetResponsePrototype(method).New());
+                res.reset(svc->GetResponsePrototype(method).New(arena));
                 // `socket' will be held until response has been sent
                 google::protobuf::Closure *done = ::melon::NewCallback<
                         int64_t, Controller *, const google::protobuf::Message *,
@@ -751,5 +830,143 @@ namespace melon {
             }
         }
 
+        // Requests packed by PackMStdRequest and waiting to be written to one
+        // connection as a single batch frame.
+        struct MStdPendingBatch {
+            std::vector<mutil::IOBuf> packets;
+            std::vector<fiber_session_t> ids;
+            Socket::WriteOptions wopt;
+        };
+
+        struct MStdBatchShard {
+            mutil::Mutex mutex;
+            std::unordered_map<SocketId, MStdPendingBatch> batches;
+        };
+
+        static const size_t MSTD_BATCH_SHARDS = 32;
+        static MStdBatchShard g_batch_shards[MSTD_BATCH_SHARDS];
+
+        inline MStdBatchShard &GetBatchShard(SocketId id) {
+            return g_batch_shards[id % MSTD_BATCH_SHARDS];
+        }
+
+        static void WriteMStdBatch(SocketId socket_id, MStdPendingBatch *batch) {
+            SocketUniquePtr sock;
+            if (Socket::Address(socket_id, &sock) != 0) {
+                for (size_t i = 0; i < batch->ids.size(); ++i) {
+                    fiber_session_error(batch->ids[i], EFAILEDSOCKET);
+                }
+                return;
+            }
+            mutil::IOBuf frame;
+            if (batch->packets.size() == 1) {
+                frame.swap(batch->packets[0]);
+            } else {
+                RpcBatchMeta meta;
+                mutil::IOBuf calls;
+                for (size_t i = 0; i < batch->packets.size(); ++i) {
+                    mutil::IOBuf &packet = batch->packets[i];
+                    char header[12];
+                    packet.cutn(header, sizeof(header));
+                    uint32_t body_size;
+                    uint32_t meta_size;
+                    mutil::RawUnpacker(header + 4).unpack32(body_size).unpack32(meta_size);
+                    meta.add_meta_sizes(meta_size);
+                    meta.add_payload_sizes(body_size - meta_size);
+                    calls.append(packet);
+                }
+                const uint32_t meta_size = GetProtobufByteSize(meta);
+                char header[12];
+                uint32_t *dummy = (uint32_t *) header;  // suppress strict-alias warning
+                *dummy = *(uint32_t *) "MRPB";
+                mutil::RawPacker(header + 4)
+                        .pack32(meta_size + calls.size())
+                        .pack32(meta_size);
+                frame.append(header, sizeof(header));
+                mutil::IOBufAsZeroCopyOutputStream buf_stream(&frame);
+                CHECK(meta.SerializeToZeroCopyStream(&buf_stream));
+                frame.append(calls);
+            }
+            // Failures after the frame is queued make the socket SetFailed,
+            // which errors every call registered by NotifyOnFailed.
+            if (sock->Write(&frame, &batch->wopt) != 0) {
+                const int rc = errno;
+                for (size_t i = 0; i < batch->ids.size(); ++i) {
+                    fiber_session_error(batch->ids[i], rc);
+                }
+            }
+        }
+
+        static bool TakeMStdBatch(SocketId socket_id, MStdPendingBatch *out) {
+            MStdBatchShard &shard = GetBatchShard(socket_id);
+            MELON_SCOPED_LOCK(shard.mutex);
+            auto it = shard.batches.find(socket_id);
+            if (it == shard.batches.end()) {
+                return false;
+            }
+            out->packets.swap(it->second.packets);
+            out->ids.swap(it->second.ids);
+            out->wopt = it->second.wopt;
+            shard.batches.erase(it);
+            return true;
+        }
+
+        static void *FlushMStdBatch(void *arg) {
+            const SocketId socket_id = (SocketId) (uintptr_t) arg;
+            MStdPendingBatch batch;
+            if (TakeMStdBatch(socket_id, &batch)) {
+                WriteMStdBatch(socket_id, &batch);
+            }
+            return NULL;
+        }
+
+        static void OnMStdBatchTimer(void *arg) {
+            // Don't write in the timer thread.
+            fiber_t th;
+            if (fiber_start_background(&th, NULL, FlushMStdBatch, arg) != 0) {
+                FlushMStdBatch(arg);
+            }
+        }
+
+        int WriteMStdRequestInBatch(Socket *sock, mutil::IOBuf *packet,
+                                    const Socket::WriteOptions &wopt,
+                                    int max_calls, int32_t window_us) {
+            const SocketId socket_id = sock->id();
+            MStdBatchShard &shard = GetBatchShard(socket_id);
+            bool full = false;
+            bool first = false;
+            {
+                MELON_SCOPED_LOCK(shard.mutex);
+                MStdPendingBatch &batch = shard.batches[socket_id];
+                if (batch.ids.empty()) {
+                    first = true;
+                    batch.wopt = wopt;
+                    batch.wopt.id_wait = INVALID_FIBER_ID;
+                }
+                batch.packets.emplace_back();
+                batch.packets.back().swap(*packet);
+                batch.ids.push_back(wopt.id_wait);
+                full = (batch.ids.size() >= (size_t) max_calls);
+            }
+            // Responses are matched by correlation_id as usual, only failures
+            // of the connection have to be delivered to every batched call.
+            sock->NotifyOnFailed(wopt.id_wait);
+            if (full) {
+                MStdPendingBatch batch;
+                if (TakeMStdBatch(socket_id, &batch)) {
+                    WriteMStdBatch(socket_id, &batch);
+                }
+            } else if (first) {
+                fiber_timer_t timer;
+                if (fiber_timer_add(&timer, mutil::microseconds_from_now(window_us),
+                                    OnMStdBatchTimer,
+                                    (void *) (uintptr_t) socket_id) != 0) {
+                    LOG(ERROR) << "Fail to add timer for batching requests";
+                    FlushMStdBatch((void *) (uintptr_t) socket_id);
+                }
+            }
+            return 0;
+        }
+
     }  // namespace policy
 } // namespace melon
@@ -20,6 +20,7 @@
 #pragma once
 
 #include <melon/rpc/protocol.h>
+#include <melon/rpc/socket.h>
 
 namespace melon {
 namespace policy {
@@ -46,5 +47,13 @@ void PackMStdRequest(mutil::IOBuf* buf,
                     const mutil::IOBuf& request,
                     const Authenticator* auth);
 
+// Queue `packet' packed by PackMStdRequest to be written to `sock' along with
+// other requests in one batch frame. The batch is written when it has
+// `max_calls' requests or `window_us' microseconds after its first request.
+// Errors are delivered to `wopt.id_wait' as Socket::Write does.
+int WriteMStdRequestInBatch(Socket* sock, mutil::IOBuf* packet,
+                            const Socket::WriteOptions& wopt,
+                            int max_calls, int32_t window_us);
+
 }  // namespace policy
 } // namespace melon
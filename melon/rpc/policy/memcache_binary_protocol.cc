@@ -38,6 +38,9 @@
 #include <melon/rpc/memcache/memcache.h>
 #include <melon/rpc/policy/most_common_message.h>
 #include <melon/utility/containers/flat_map.h>
+#include <melon/utility/arena.h>
+#include <melon/rpc/destroyable.h>
+#include <melon/rpc/memcache/memcache_service.h>
 
 
 namespace melon {
@@ -76,8 +79,168 @@ inline bool IsSupportedCommand(uint8_t command) {
     return mutil::bit_array_get(supported_cmd_map, command);
 }
 
+// This class is as parsing_context of sockets at server side.
+class MemcacheConnContext : public Destroyable {
+public:
+    // @Destroyable
+    void Destroy() override {
+        delete this;
+    }
+
+    // Commands parsed from the data read at a time and the bodies referenced
+    // by them, reused to save allocations.
+    std::vector<MemcacheCommand> commands;
+    std::vector<mutil::IOBuf> bodies;
+    // Bodies not in one block are copied here to be referenced.
+    mutil::Arena arena;
+};
+
+// Cut a request from `source' into ctx->commands[index].
+static ParseError CutMemcacheCommand(mutil::IOBuf* source,
+                                     MemcacheConnContext* ctx, size_t index) {
+    char buf[24];
+    const MemcacheRequestHeader* header =
+        (const MemcacheRequestHeader*)source->fetch(buf, sizeof(buf));
+    if (header == NULL) {
+        return PARSE_ERROR_NOT_ENOUGH_DATA;
+    }
+    if (header->magic != (uint8_t)MC_MAGIC_REQUEST) {
+        return PARSE_ERROR_ABSOLUTELY_WRONG;
+    }
+    const uint32_t total_body_length = mutil::NetToHost32(header->total_body_length);
+    const uint16_t key_length = mutil::NetToHost16(header->key_length);
+    const uint8_t extras_length = header->extras_length;
+    if ((uint32_t)extras_length + key_length > total_body_length) {
+        return PARSE_ERROR_ABSOLUTELY_WRONG;
+    }
+    if (total_body_length > FLAGS_max_body_size) {
+        LOG(ERROR) << "body_size=" << total_body_length << " is too large";
+        return PARSE_ERROR_TOO_BIG_DATA;
+    }
+    if (source->size() < sizeof(*header) + total_body_length) {
+        return PARSE_ERROR_NOT_ENOUGH_DATA;
+    }
+    if (index == ctx->commands.size()) {
+        ctx->commands.resize(index + 1);
+        ctx->bodies.resize(index + 1);
+    }
+    MemcacheCommand* cmd = &ctx->commands[index];
+    cmd->command = header->command;
+    cmd->vbucket_id = mutil::NetToHost16(header->vbucket_id);
+    cmd->opaque = mutil::NetToHost32(header->opaque);
+    cmd->cas_value = mutil::NetToHost64(header->cas_value);
+    source->pop_front(sizeof(*header));
+
+    mutil::IOBuf& body = ctx->bodies[index];
+    body.clear();
+    source->cutn(&body, total_body_length);
+    const char* data = NULL;
+    if (body.backing_block_num() == 1) {
+        data = body.backing_block(0).data();
+    } else if (!body.empty()) {
+        char* copied = (char*)ctx->arena.allocate(total_body_length);
+        body.copy_to(copied, total_body_length);
+        data = copied;
+    }
+    cmd->extras.set(data, extras_length);
+    cmd->key.set(data + extras_length, key_length);
+    cmd->value.set(data + extras_length + key_length,
+                   total_body_length - extras_length - key_length);
+    return PARSE_OK;
+}
+
+// Run `commands' in order. Consecutive commands of one handler are given to
+// it at once.
+static int ConsumeMemcacheCommands(const MemcacheService* ms,
+                                   const MemcacheCommand* commands,
+                                   size_t ncommand,
+                                   MemcacheResponseWriter* writer) {
+    size_t i = 0;
+    while (i < ncommand) {
+        MemcacheCommandHandler* handler = ms->FindCommandHandler(commands[i].command);
+        if (handler == NULL) {
+            writer->AppendStatus(commands[i], commands[i].command == MC_BINARY_NOOP ?
+                                 MemcacheResponse::STATUS_SUCCESS :
+                                 MemcacheResponse::STATUS_UNKNOWN_COMMAND);
+            ++i;
+            continue;
+        }
+        size_t end = i + 1;
+        while (end < ncommand &&
+               ms->FindCommandHandler(commands[end].command) == handler) {
+            ++end;
+        }
+        const size_t nhandled = writer->handled_count();
+        if (handler->Run(commands + i, end - i, writer) != 0) {
+            LOG(ERROR) << "Fail to run " << end - i << " memcache commands";
+            return -1;
+        }
+        if (writer->handled_count() - nhandled != end - i) {
+            LOG(ERROR) << "response count can't be matched with commands, expected="
+                       << end - i << " actual=" << writer->handled_count() - nhandled;
+            return -1;
+        }
+        i = end;
+    }
+    return 0;
+}
+
+static ParseResult ParseMemcacheRequests(mutil::IOBuf* source, Socket* socket,
+                                         const MemcacheService* ms) {
+    const uint8_t* p_mcmagic = (const uint8_t*)source->fetch1();
+    if (NULL == p_mcmagic) {
+        return MakeParseError(PARSE_ERROR_NOT_ENOUGH_DATA);
+    }
+    if (*p_mcmagic != (uint8_t)MC_MAGIC_REQUEST) {
+        return MakeParseError(PARSE_ERROR_TRY_OTHERS);
+    }
+    MemcacheConnContext* ctx =
+        static_cast<MemcacheConnContext*>(socket->parsing_context());
+    if (ctx == NULL) {
+        ctx = new MemcacheConnContext;
+        socket->reset_parsing_context(ctx);
+    }
+    // Parse all intact requests so that batches like GETKQ...GETKQ NOOP are
+    // handled as a whole, and responses are sent with one write.
+    size_t ncommand = 0;
+    ParseError err = PARSE_OK;
+    while ((err = CutMemcacheCommand(source, ctx, ncommand)) == PARSE_OK) {
+        ++ncommand;
+    }
+    if (ncommand == 0) {
+        return MakeParseError(err);
+    }
+    MemcacheResponseWriter writer;
+    const int rc = ConsumeMemcacheCommands(ms, &ctx->commands[0], ncommand, &writer);
+    for (size_t i = 0; i < ncommand; ++i) {
+        ctx->bodies[i].clear();
+    }
+    ctx->arena.clear();
+    if (rc != 0) {
+        return MakeParseError(PARSE_ERROR_ABSOLUTELY_WRONG);
+    }
+    mutil::IOBuf sendbuf;
+    writer.MoveTo(&sendbuf);
+    // Nothing to send if all commands are quiet ones.
+    if (!sendbuf.empty()) {
+        Socket::WriteOptions wopt;
+        wopt.ignore_eovercrowded = true;
+        LOG_IF(WARNING, socket->Write(&sendbuf, &wopt) != 0)
+            << "Fail to send memcache response";
+    }
+    return MakeParseError(err);
+}
+
 ParseResult ParseMemcacheMessage(mutil::IOBuf* source,
-                                 Socket* socket, bool /*read_eof*/, const void */*arg*/) {
+                                 Socket* socket, bool /*read_eof*/, const void *arg) {
+    const Server* server = static_cast<const Server*>(arg);
+    if (server) {
+        const MemcacheService* const ms = server->options().memcache_service;
+        if (!ms) {
+            return MakeParseError(PARSE_ERROR_TRY_OTHERS);
+        }
+        return ParseMemcacheRequests(source, socket, ms);
+    }
     while (1) {
         const uint8_t* p_mcmagic = (const uint8_t*)source->fetch1();
         if (NULL == p_mcmagic) {
@@ -153,6 +316,9 @@ ParseResult ParseMemcacheMessage(mutil::IOBuf* source,
     }
 }
 
+// Requests are handled inside ParseMemcacheMessage.
+void ProcessMemcacheRequest(InputMessageBase* msg_base) { }
+
 void ProcessMemcacheResponse(InputMessageBase* msg_base) {
     const int64_t start_parse_us = mutil::cpuwide_time_us();
     DestroyingPtr<MostCommonMessage> msg(static_cast<MostCommonMessage*>(msg_base));
@@ -29,6 +29,9 @@ namespace policy {
 ParseResult ParseMemcacheMessage(mutil::IOBuf* source, Socket *socket, bool read_eof,
         const void *arg);
 
+// Actions to a memcache request, which is left unused.
+void ProcessMemcacheRequest(InputMessageBase* msg);
+
 // Actions to a memcache response.
 void ProcessMemcacheResponse(InputMessageBase* msg);
 
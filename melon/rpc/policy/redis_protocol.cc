@@ -77,12 +77,16 @@ public:
 
     RedisCommandParser parser;
     mutil::Arena arena;
+    // Commands parsed from the data read at a time and their batch
+    // handlers(NULL if not registered), reused to save allocations.
+    std::vector<std::vector<mutil::StringPiece> > commands;
+    std::vector<RedisBatchCommandHandler*> batch_handlers;
 };
 
 int ConsumeCommand(RedisConnContext* ctx,
                    const std::vector<mutil::StringPiece>& args,
                    bool flush_batched,
-                   mutil::IOBufAppender* appender) {
+                   RedisReplyWriter* writer) {
     RedisReply output(&ctx->arena);
     RedisCommandHandlerResult result = REDIS_CMD_HANDLED;
     if (ctx->transaction_handler) {
@@ -120,14 +124,14 @@ int ConsumeCommand(RedisConnContext* ctx,
                 return -1;
             }
             for (int i = 0; i < (int)output.size(); ++i) {
-                output[i].SerializeTo(appender);
+                writer->AppendReply(output[i]);
             }
             ctx->batched_size = 0;
         } else {
-            output.SerializeTo(appender);
+            writer->AppendReply(output);
         }
     } else if (result == REDIS_CMD_CONTINUE) {
-        output.SerializeTo(appender);
+        writer->AppendReply(output);
     } else if (result == REDIS_CMD_BATCHED) {
         // just do nothing and wait handler to return OK.
     } else {
@@ -147,6 +151,48 @@ void RedisConnContext::Destroy() {
 
 // ========== impl of RedisConnContext ==========
 
+// Run the first `ncommand' commands in ctx->commands in order. Consecutive
+// commands of one RedisBatchCommandHandler are given to it at once.
+static int ConsumeCommands(RedisConnContext* ctx, size_t ncommand,
+                           RedisReplyWriter* writer) {
+    const std::vector<mutil::StringPiece>* commands = &ctx->commands[0];
+    ctx->batch_handlers.resize(ncommand);
+    RedisBatchCommandHandler** handlers = &ctx->batch_handlers[0];
+    for (size_t i = 0; i < ncommand; ++i) {
+        handlers[i] = ctx->redis_service->FindBatchCommandHandler(commands[i][0]);
+    }
+    size_t i = 0;
+    while (i < ncommand) {
+        RedisBatchCommandHandler* bh = handlers[i];
+        if (bh == NULL || ctx->transaction_handler || ctx->batched_size != 0) {
+            // Commands batched by RedisCommandHandler must be flushed before
+            // the ones handled by a batch handler to keep the replies in order.
+            const bool flush_batched = (i + 1 == ncommand || handlers[i + 1] != NULL);
+            if (ConsumeCommand(ctx, commands[i], flush_batched, writer) != 0) {
+                return -1;
+            }
+            ++i;
+            continue;
+        }
+        size_t end = i + 1;
+        while (end < ncommand && handlers[end] == bh) {
+            ++end;
+        }
+        const size_t nreply = writer->reply_count();
+        if (bh->RunBatch(commands + i, end - i, writer) != 0) {
+            LOG(ERROR) << "Fail to run " << end - i << " batched commands";
+            return -1;
+        }
+        if (writer->reply_count() - nreply != end - i || writer->in_array()) {
+            LOG(ERROR) << "reply count can't be matched with batched commands, expected="
+                       << end - i << " actual=" << writer->reply_count() - nreply;
+            return -1;
+        }
+        i = end;
+    }
+    return 0;
+}
+
 ParseResult ParseRedisMessage(mutil::IOBuf* source, Socket* socket,
                               bool read_eof, const void* arg) {
     if (read_eof || source->empty()) {
@@ -163,31 +209,29 @@ ParseResult ParseRedisMessage(mutil::IOBuf* source, Socket* socket,
             ctx = new RedisConnContext(rs);
             socket->reset_parsing_context(ctx);
         }
-        std::vector<mutil::StringPiece> current_args;
-        mutil::IOBufAppender appender;
+        // Parse all intact commands so that the pipeline is handled as a
+        // whole, and replies are sent with one write.
+        size_t ncommand = 0;
         ParseError err = PARSE_OK;
-
-        err = ctx->parser.Consume(*source, &current_args, &ctx->arena);
-        if (err != PARSE_OK) {
-            return MakeParseError(err);
-        }
         while (true) {
-            std::vector<mutil::StringPiece> next_args;
-            err = ctx->parser.Consume(*source, &next_args, &ctx->arena);
+            if (ncommand == ctx->commands.size()) {
+                ctx->commands.resize(ncommand + 1);
+            }
+            err = ctx->parser.Consume(*source, &ctx->commands[ncommand], &ctx->arena);
             if (err != PARSE_OK) {
                 break;
             }
-            if (ConsumeCommand(ctx, current_args, false, &appender) != 0) {
-                return MakeParseError(PARSE_ERROR_ABSOLUTELY_WRONG);
-            }
-            current_args.swap(next_args);
+            ++ncommand;
+        }
+        if (ncommand == 0) {
+            return MakeParseError(err);
         }
-        if (ConsumeCommand(ctx, current_args,
-                    true /*must be the last message*/, &appender) != 0) {
+        RedisReplyWriter writer;
+        if (ConsumeCommands(ctx, ncommand, &writer) != 0) {
             return MakeParseError(PARSE_ERROR_ABSOLUTELY_WRONG);
         }
         mutil::IOBuf sendbuf;
-        appender.move_to(sendbuf);
+        writer.MoveTo(&sendbuf);
         CHECK(!sendbuf.empty());
         Socket::WriteOptions wopt;
         wopt.ignore_eovercrowded = true;
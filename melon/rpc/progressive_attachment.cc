@@ -241,6 +241,33 @@ static int RunOnFailed(fiber_session_t id, void* data, int) {
     return 0;
 }
 
+int ProgressiveJsonWriter::WriteChunk(mutil::IOBuf* chunk) {
+    if (_pa->Write(*chunk) == 0) {
+        return 0;
+    }
+    if (errno != EOVERCROWDED) {
+        return -1;
+    }
+    {
+        // Chunks written before the RPC is done are saved in the attachment
+        // until MarkRPCAsDone(), waiting for them to be written out would
+        // never end. Pausing by MarkRPCAsDone() ends soon.
+        std::unique_lock<mutil::Mutex> mu(_pa->_mutex);
+        if (_pa->_rpc_state.load(mutil::memory_order_relaxed) ==
+            ProgressiveAttachment::RPC_RUNNING &&
+            !_pa->_pause_from_mark_rpc_as_done) {
+            mu.unlock();
+            LOG_EVERY_N_SEC(ERROR, 1) << "Too much data is written by"
+                " ProgressiveJsonWriter before done->Run() of the RPC";
+            errno = EOVERCROWDED;
+            return -1;
+        }
+    }
+    // Write() fails with EOVERCROWDED when too much data is not written
+    // out yet, which bounds the memory.
+    return MELON_HANDLE_EOVERCROWDED(_pa->Write(*chunk)) < 0 ? -1 : 0;
+}
+
 void ProgressiveAttachment::NotifyOnStopped(google::protobuf::Closure* done) {
     if (done == NULL) {
         LOG(ERROR) << "Param[done] is NULL";
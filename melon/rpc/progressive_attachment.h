@@ -26,6 +26,8 @@
 #include <melon/utility/atomicops.h>
 #include <melon/utility/iobuf.h>
 #include <melon/utility/endpoint.h>       // mutil::EndPoint
+#include <melon/utility/intrusive_ptr.hpp> // mutil::intrusive_ptr
+#include <melon/json2pb/pb_to_json.h>     // json2pb::JsonChunkWriter
 #include <melon/fiber/types.h>        // fiber_session_t
 #include <melon/rpc/socket_id.h>       // SocketUniquePtr
 #include <melon/rpc/shared_object.h>   // SharedObject
@@ -34,6 +36,7 @@ namespace melon {
 
 class ProgressiveAttachment : public SharedObject {
 friend class Controller;
+friend class ProgressiveJsonWriter;
 public:
     // [Thread-safe]
     // Write `data' as one HTTP chunk to peer ASAP.
@@ -80,6 +83,33 @@ private:
     static const int RPC_FAILED;
 };
 
+// Write json converted by json2pb::ProtoMessageToJson into a
+// ProgressiveAttachment chunk by chunk. Writing sleeps while the connection
+// is overcrowded, so that json of any size is sent with bounded memory.
+// Before done->Run() of the RPC, chunks are buffered in the attachment and
+// nothing drains them, so WriteChunk() fails with EOVERCROWDED instead of
+// waiting forever once -socket_max_unwritten_bytes are buffered. Write
+// json of unknown size after done->Run().
+// Example:
+//   mutil::intrusive_ptr<melon::ProgressiveAttachment> pa =
+//       cntl->CreateProgressiveAttachment();
+//   done->Run();
+//   melon::ProgressiveJsonWriter writer(pa);
+//   // Better in another fiber since it blocks until all chunks are written.
+//   json2pb::ProtoMessageToJson(huge_message, &writer, options, &error);
+class ProgressiveJsonWriter : public json2pb::JsonChunkWriter {
+public:
+    explicit ProgressiveJsonWriter(
+        const mutil::intrusive_ptr<ProgressiveAttachment>& pa,
+        size_t chunk_size = 64 * 1024)
+        : json2pb::JsonChunkWriter(chunk_size), _pa(pa) {}
+
+    int WriteChunk(mutil::IOBuf* chunk) override;
+
+private:
+    mutil::intrusive_ptr<ProgressiveAttachment> _pa;
+};
+
 } // namespace melon
 
 
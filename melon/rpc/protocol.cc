@@ -22,6 +22,7 @@
 // Since kDefaultTotalBytesLimit is private, we need some hacks to get the limit.
 // Works for pb 2.4, 2.6, 3.0
 #define private public
+#include <google/protobuf/arena.h>
 #include <google/protobuf/io/coded_stream.h>
 const int PB_TOTAL_BYETS_LIMITS_RAW =
     google::protobuf::io::CodedInputStream::kDefaultTotalBytesLimit;
@@ -40,6 +41,9 @@ const uint64_t PB_TOTAL_BYETS_LIMITS =
 #include <melon/rpc/global.h>
 #include <melon/rpc/serialized_request.h>
 #include <melon/rpc/input_messenger.h>
+#include <melon/rpc/server.h>
+#include <melon/rpc/details/method_status.h>
+#include <melon/rpc/details/controller_private_accessor.h>
 
 
 namespace melon {
@@ -249,6 +253,35 @@ bool ParsePbFromString(google::protobuf::Message* msg, const std::string& str) {
     return ParsePbFromZeroCopyStreamInlined(msg, &stream);
 }
 
+google::protobuf::Arena* CreateServerCallArena(Controller* cntl,
+                                               const MethodStatus* status) {
+    const Server* server = cntl->server();
+    if (server == NULL || !server->options().use_arena) {
+        return NULL;
+    }
+    google::protobuf::ArenaOptions options;
+    if (status) {
+        // Messages of most calls fit in the first block.
+        const size_t hint = status->arena_start_block_size();
+        if (hint > options.start_block_size) {
+            options.start_block_size = hint;
+        }
+        if (options.start_block_size > options.max_block_size) {
+            options.max_block_size = options.start_block_size;
+        }
+    }
+    google::protobuf::Arena* arena = new google::protobuf::Arena(options);
+    ControllerPrivateAccessor(cntl).set_arena(arena);
+    return arena;
+}
+
+void DeleteMessageUnlessOnArena::operator()(
+    const google::protobuf::Message* msg) const {
+    if (msg != NULL && _arena == NULL && msg->GetArena() == NULL) {
+        delete msg;
+    }
+}
+
 void LogErrorTextAndDelete::operator()(Controller* c) const {
     if (!c) {
         return;
@@ -36,6 +36,8 @@ namespace google {
         class Message;
 
         class MethodDescriptor;
+
+        class Arena;
     }  // namespace protobuf
 }  // namespace google
 
@@ -55,6 +57,8 @@ namespace melon {
 
     class InputMessageBase;
 
+    class MethodStatus;
+
     DECLARE_uint64(max_body_size);
     DECLARE_bool(log_error_text);
 
@@ -238,6 +242,34 @@ namespace melon {
         bool _delete_cntl;
     };
 
+    // Create the arena of the server-side call of `cntl' where its request
+    // and response are allocated when ServerOptions.use_arena is on, the
+    // first block is sized by `status' from space used by recent calls.
+    // Returns NULL if the option is off.
+    // The arena is owned by `cntl', see Controller::arena().
+    google::protobuf::Arena *CreateServerCallArena(Controller *cntl,
+                                                   const MethodStatus *status);
+
+    // Deleter for unique_ptr of request and response messages which are not
+    // deleted when they're allocated on an arena: they're destroyed along
+    // with the arena.
+    // Messages created by New(arena) are never deleted even if GetArena()
+    // of them is NULL: types not supporting arenas are created on the heap
+    // and owned by the arena.
+    class DeleteMessageUnlessOnArena {
+    public:
+        DeleteMessageUnlessOnArena() : _arena(NULL) {}
+
+        // `arena' is the one passed to New() to create the message.
+        explicit DeleteMessageUnlessOnArena(google::protobuf::Arena *arena)
+                : _arena(arena) {}
+
+        void operator()(const google::protobuf::Message *msg) const;
+
+    private:
+        google::protobuf::Arena *_arena;
+    };
+
     // Utility to build a temporary array.
     // Example:
     //   TemporaryArrayBuilder<Foo, 5> b;
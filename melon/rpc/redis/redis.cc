@@ -461,10 +461,26 @@ namespace melon {
             LOG(ERROR) << "redis command name=" << name << " exist";
             return false;
         }
+        if (_batch_command_map.find(lcname) != _batch_command_map.end()) {
+            LOG(ERROR) << "redis command name=" << name << " exist";
+            return false;
+        }
         _command_map[lcname] = handler;
         return true;
     }
 
+    bool RedisService::AddBatchCommandHandler(const std::string &name,
+                                              RedisBatchCommandHandler *handler) {
+        std::string lcname = StringToLowerASCII(name);
+        if (_command_map.find(lcname) != _command_map.end() ||
+            _batch_command_map.find(lcname) != _batch_command_map.end()) {
+            LOG(ERROR) << "redis command name=" << name << " exist";
+            return false;
+        }
+        _batch_command_map[lcname] = handler;
+        return true;
+    }
+
     RedisCommandHandler *RedisService::FindCommandHandler(const mutil::StringPiece &name) const {
         auto it = _command_map.find(name.as_string());
         if (it != _command_map.end()) {
@@ -473,6 +489,18 @@ namespace melon {
         return NULL;
     }
 
+    RedisBatchCommandHandler *RedisService::FindBatchCommandHandler(
+            const mutil::StringPiece &name) const {
+        if (_batch_command_map.empty()) {
+            return NULL;
+        }
+        auto it = _batch_command_map.find(name.as_string());
+        if (it != _batch_command_map.end()) {
+            return it->second;
+        }
+        return NULL;
+    }
+
     RedisCommandHandler *RedisCommandHandler::NewTransactionHandler() {
         LOG(ERROR) << "NewTransactionHandler is not implemented";
         return NULL;
@@ -31,6 +31,7 @@
 #include <melon/utility/arena.h>
 #include <melon/proto/rpc/proto_base.pb.h>
 #include <melon/rpc/redis/redis_reply.h>
+#include <melon/rpc/redis/redis_reply_writer.h>
 #include <melon/rpc/parse_result.h>
 #include <melon/rpc/callback.h>
 #include <melon/rpc/socket.h>
@@ -267,6 +268,8 @@ namespace melon {
 
     class RedisCommandHandler;
 
+    class RedisBatchCommandHandler;
+
     // Container of CommandHandlers.
     // Assign an instance to ServerOption.redis_service to enable redis support.
     class RedisService {
@@ -276,12 +279,22 @@ namespace melon {
         // Call this function to register `handler` that can handle command `name`.
         bool AddCommandHandler(const std::string &name, RedisCommandHandler *handler);
 
+        // Call this function to register `handler' that handles consecutive
+        // commands named `name' of a pipeline as a whole, see
+        // RedisBatchCommandHandler. A name can't be registered to both kinds
+        // of handlers.
+        bool AddBatchCommandHandler(const std::string &name, RedisBatchCommandHandler *handler);
+
         // This function should not be touched by user and used by melon deverloper only.
         RedisCommandHandler *FindCommandHandler(const mutil::StringPiece &name) const;
 
+        RedisBatchCommandHandler *FindBatchCommandHandler(const mutil::StringPiece &name) const;
+
     private:
         typedef std::unordered_map<std::string, RedisCommandHandler *> CommandMap;
+        typedef std::unordered_map<std::string, RedisBatchCommandHandler *> BatchCommandMap;
         CommandMap _command_map;
+        BatchCommandMap _batch_command_map;
     };
 
     enum RedisCommandHandlerResult {
@@ -334,6 +347,26 @@ namespace melon {
         virtual RedisCommandHandler *NewTransactionHandler();
     };
 
+    // The handler for commands of a pipeline, which gets all consecutive
+    // commands registered to it in the data read from the connection at
+    // once, instead of one by one. Handlers of storages can look up or
+    // update keys of the commands together with one lock, and write values
+    // kept in IOBuf into the replies without copying.
+    // Commands in a transaction are still sent to the transaction handler.
+    class RedisBatchCommandHandler {
+    public:
+        virtual ~RedisBatchCommandHandler() {}
+
+        // `commands[0]' ... `commands[count-1]' are the consecutive commands in
+        // the order they arrive, each of which is like `args' of
+        // RedisCommandHandler::Run(). Write exactly one reply for each command
+        // into `output' in the same order.
+        // Returns 0 on success, -1 otherwise and the connection is closed.
+        virtual int RunBatch(const std::vector<mutil::StringPiece> *commands,
+                             size_t count,
+                             RedisReplyWriter *output) = 0;
+    };
+
 } // namespace melon
 
 #endif  // MELON_RPC_REDIS_REDIS_H_
@@ -0,0 +1,745 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+//
+
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <cinttypes>
+#include <turbo/log/logging.h>
+#include <melon/fiber/fiber.h>                  // fiber_session_xx
+#include <melon/fiber/unstable.h>               // fiber_timer_add
+#include <melon/utility/arena.h>
+#include <melon/utility/fast_rand.h>
+#include <melon/utility/scoped_lock.h>
+#include <melon/utility/string_printf.h>
+#include <melon/utility/string_splitter.h>
+#include <melon/utility/strings/string_number_conversions.h>
+#include <melon/utility/time.h>
+#include <melon/rpc/controller.h>
+#include <melon/rpc/redis/redis_command.h>
+#include <melon/rpc/redis/redis_cluster_channel.h>
+
+namespace melon {
+
+    DECLARE_bool(usercode_in_pthread);
+
+    struct RedisClusterChannel::SlotMap {
+        std::vector<std::string> nodes;
+        // Index of node in `nodes' serving each slot, -1 if unknown.
+        std::vector<int> slots;
+    };
+
+    namespace {
+
+    // A command of the call.
+    struct ClusterCommand {
+        ClusterCommand() : asking(false), redirects(0), replied(false) {}
+
+        std::vector<mutil::StringPiece> args;
+        // The node to send the command to.
+        std::string node;
+        // Send ASKING before the command.
+        bool asking;
+        int redirects;
+        bool replied;
+        // Serialized reply.
+        mutil::IOBuf reply;
+    };
+
+    } // namespace
+
+    // The state of a call, set as `_done' of the controller like
+    // ParallelChannelDone does. The call_id of the controller is errored with
+    // EPCHANFINISH after all commands are done, or with ECANCELED/ERPCTIMEDOUT
+    // by StartCancel() or the timer, which runs Run() and cancels the pending
+    // sub calls. The call ends when both the commands and Run() are done.
+    struct RedisClusterChannel::ClusterCall : public google::protobuf::Closure {
+        ClusterCall()
+                : channel(NULL), cntl(NULL), response(NULL), user_done(NULL), cid(INVALID_FIBER_ID),
+                  error_code(0), canceled(false), state(0) {}
+
+        // Called in EndRPC() of `cntl' with the call_id locked.
+        void Run() override;
+
+        // Called after RunCall() returns.
+        void OnCommandsDone();
+
+        // Set the result of commands, which is set to `cntl' in OnComplete().
+        void SetFailed(int ec, const char *fmt, ...);
+
+        // Add call_id of sub calls to be sent. Returns false if the call was
+        // canceled and the sub calls should not be sent.
+        bool AddSubCalls(const std::vector<CallId> &cids);
+
+        void RemoveSubCalls();
+
+        enum {
+            COMMANDS_DONE = 1,
+            RUN_CALLED = 2
+        };
+
+        RedisClusterChannel *channel;
+        Controller *cntl;
+        RedisResponse *response;
+        google::protobuf::Closure *user_done;
+        CallId cid;
+        // Memory of args of commands.
+        mutil::Arena arena;
+        std::vector<ClusterCommand> commands;
+        // Result of commands.
+        int error_code;
+        std::string error_text;
+        mutil::IOBuf replies;
+        mutil::EndPoint remote_side;
+        // Protect `sub_cids' and `canceled'.
+        mutil::Mutex mutex;
+        std::vector<CallId> sub_cids;
+        bool canceled;
+        // Bitwise-or of COMMANDS_DONE and RUN_CALLED.
+        mutil::atomic<int> state;
+
+    private:
+        // [ Rendezvous point ] Run by the last one of OnCommandsDone() and
+        // Run(), with the call_id locked. `this' is deleted.
+        void OnComplete();
+    };
+
+    namespace {
+
+    // The pipeline sent to one node in a round.
+    struct NodeCall {
+        std::shared_ptr<Channel> channel;
+        RedisRequest request;
+        RedisResponse response;
+        Controller cntl;
+        // Index of command for each reply, -1 for replies of ASKING.
+        std::vector<int> indexes;
+    };
+
+    // CRC16 in XMODEM, as required by redis cluster.
+    struct CRC16Table {
+        CRC16Table() {
+            for (int i = 0; i < 256; ++i) {
+                uint16_t crc = (uint16_t) (i << 8);
+                for (int j = 0; j < 8; ++j) {
+                    crc = (crc & 0x8000) ? (uint16_t) ((crc << 1) ^ 0x1021) : (uint16_t) (crc << 1);
+                }
+                table[i] = crc;
+            }
+        }
+
+        uint16_t table[256];
+    };
+
+    const CRC16Table s_crc16_table;
+
+    } // namespace
+
+    RedisClusterChannelOptions::RedisClusterChannelOptions()
+            : max_redirect(5) {}
+
+    void RedisClusterChannel::ClusterCall::SetFailed(int ec, const char *fmt, ...) {
+        error_code = ec;
+        error_text.clear();
+        va_list ap;
+        va_start(ap, fmt);
+        mutil::string_vappendf(&error_text, fmt, ap);
+        va_end(ap);
+    }
+
+    bool RedisClusterChannel::ClusterCall::AddSubCalls(const std::vector<CallId> &cids) {
+        MELON_SCOPED_LOCK(mutex);
+        if (canceled) {
+            return false;
+        }
+        sub_cids = cids;
+        return true;
+    }
+
+    void RedisClusterChannel::ClusterCall::RemoveSubCalls() {
+        MELON_SCOPED_LOCK(mutex);
+        sub_cids.clear();
+    }
+
+    void RedisClusterChannel::ClusterCall::Run() {
+        if (cntl->ErrorCode() == EPCHANFINISH) {
+            // All commands are done, the result is set in OnComplete().
+            cntl->_error_code = 0;
+            cntl->_error_text.clear();
+        } else {
+            // Canceled or timedout, stop sending commands and cancel the
+            // pending sub calls. RunCall() returns soon after.
+            std::vector<CallId> cids;
+            {
+                MELON_SCOPED_LOCK(mutex);
+                canceled = true;
+                cids.swap(sub_cids);
+            }
+            for (size_t i = 0; i < cids.size(); ++i) {
+                fiber_session_error(cids[i], ECANCELED);
+            }
+        }
+        // NOTE: Don't touch `this' after the fetch_or unless it's the last
+        // one, OnCommandsDone() may complete the call in another thread.
+        const int val = state.fetch_or(RUN_CALLED, mutil::memory_order_release);
+        if (!(val & COMMANDS_DONE)) {
+            return;
+        }
+        mutil::atomic_thread_fence(mutil::memory_order_acquire);
+        OnComplete();
+    }
+
+    void RedisClusterChannel::ClusterCall::OnCommandsDone() {
+        const CallId saved_cid = cid;
+        const int val = state.fetch_or(COMMANDS_DONE, mutil::memory_order_release);
+        if (!(val & RUN_CALLED)) {
+            // Stop the call_id by a special error which is cleared in Run().
+            // It's ignored if the call_id is destroyed or being destroyed by
+            // Run() concurrently.
+            fiber_session_error(saved_cid, EPCHANFINISH);
+            return;
+        }
+        mutil::atomic_thread_fence(mutil::memory_order_acquire);
+        OnComplete();
+    }
+
+    void RedisClusterChannel::ClusterCall::OnComplete() {
+        // If the controller was canceled or timedout, don't change it.
+        if (!cntl->FailedInline()) {
+            if (error_code != 0) {
+                cntl->SetFailed(error_code, "%s", error_text.c_str());
+            } else {
+                // Merge replies in the order of commands.
+                response->Clear();
+                if (!commands.empty() &&
+                    response->ConsumePartialIOBuf(replies, (int) commands.size()) != PARSE_OK) {
+                    cntl->SetFailed(ERESPONSE, "Fail to merge replies");
+                }
+            }
+        }
+        cntl->_remote_side = remote_side;
+        Controller *saved_cntl = cntl;
+        google::protobuf::Closure *saved_done = user_done;
+        const CallId saved_cid = cid;
+        saved_cntl->_done = NULL;
+        delete this;
+        if (saved_done) {
+            saved_cntl->OnRPCEnd(mutil::gettimeofday_us());
+            saved_done->Run();
+        }
+        CHECK_EQ(0, fiber_session_unlock_and_destroy(saved_cid));
+    }
+
+    static uint16_t CRC16(const char *buf, size_t len) {
+        uint16_t crc = 0;
+        for (size_t i = 0; i < len; ++i) {
+            crc = (uint16_t) ((crc << 8) ^ s_crc16_table.table[((crc >> 8) ^ (uint8_t) buf[i]) & 0xFF]);
+        }
+        return crc;
+    }
+
+    uint16_t RedisClusterChannel::GetSlot(const mutil::StringPiece &key) {
+        // Only the part inside the first {...} is hashed if it's not empty.
+        const size_t start = key.find('{');
+        if (start != mutil::StringPiece::npos) {
+            const size_t end = key.find('}', start + 1);
+            if (end != mutil::StringPiece::npos && end != start + 1) {
+                return CRC16(key.data() + start + 1, end - start - 1) & (SLOT_COUNT - 1);
+            }
+        }
+        return CRC16(key.data(), key.size()) & (SLOT_COUNT - 1);
+    }
+
+    // Set `key' to the key deciding the slot of command `args'. Returns false
+    // if the command has no key.
+    static bool GetCommandKey(const std::vector<mutil::StringPiece> &args,
+                              mutil::StringPiece *key) {
+        if (args.size() < 2) {
+            return false;
+        }
+        const mutil::StringPiece &name = args[0];
+        if (name == "eval" || name == "evalsha") {
+            // EVAL script numkeys key [key ...] arg [arg ...]
+            if (args.size() < 4 || args[2] == "0") {
+                return false;
+            }
+            *key = args[3];
+            return true;
+        }
+        static const char *const keyless_commands[] = {
+            "auth", "client", "cluster", "command", "config", "dbsize", "echo",
+            "info", "ping", "script", "select", "time"
+        };
+        for (size_t i = 0; i < arraysize(keyless_commands); ++i) {
+            if (name == keyless_commands[i]) {
+                return false;
+            }
+        }
+        *key = args[1];
+        return true;
+    }
+
+    // Parse `error' of MOVED or ASK, e.g. "MOVED 3999 127.0.0.1:6381".
+    // Returns false if it's not a redirection.
+    static bool ParseRedirection(const mutil::StringPiece &error, bool *moved,
+                                 uint16_t *slot, std::string *node) {
+        if (error.starts_with("MOVED ")) {
+            *moved = true;
+        } else if (error.starts_with("ASK ")) {
+            *moved = false;
+        } else {
+            return false;
+        }
+        mutil::StringPiece rest = error.substr(*moved ? 6 : 4);
+        const size_t space = rest.find(' ');
+        if (space == mutil::StringPiece::npos) {
+            return false;
+        }
+        int slot_value = 0;
+        if (!mutil::StringToInt(rest.substr(0, space), &slot_value) ||
+            slot_value < 0 || slot_value >= RedisClusterChannel::SLOT_COUNT) {
+            return false;
+        }
+        *slot = (uint16_t) slot_value;
+        rest.remove_prefix(space + 1);
+        if (rest.empty()) {
+            return false;
+        }
+        rest.CopyToString(node);
+        return true;
+    }
+
+    RedisClusterChannel::RedisClusterChannel()
+            : _slot_map(std::make_shared<SlotMap>()), _refreshing(false) {}
+
+    RedisClusterChannel::~RedisClusterChannel() {}
+
+    int RedisClusterChannel::Init(const char *seed_addresses,
+                                  const RedisClusterChannelOptions *options) {
+        if (options) {
+            _options = *options;
+        }
+        _options.channel_options.protocol = PROTOCOL_REDIS;
+        for (mutil::StringSplitter sp(seed_addresses, ','); sp; ++sp) {
+            std::string seed(sp.field(), sp.length());
+            if (!seed.empty()) {
+                _seeds.push_back(seed);
+            }
+        }
+        if (_seeds.empty()) {
+            LOG(ERROR) << "No seed in `" << seed_addresses << '\'';
+            return -1;
+        }
+        return RefreshSlots();
+    }
+
+    std::shared_ptr<Channel> RedisClusterChannel::GetNodeChannel(const std::string &node) {
+        MELON_SCOPED_LOCK(_mutex);
+        std::shared_ptr<Channel> &chan = _node_channels[node];
+        if (chan == NULL) {
+            std::shared_ptr<Channel> new_chan = std::make_shared<Channel>();
+            if (new_chan->Init(node.c_str(), &_options.channel_options) != 0) {
+                LOG(ERROR) << "Fail to init channel to redis node=" << node;
+                _node_channels.erase(node);
+                return NULL;
+            }
+            chan = new_chan;
+        }
+        return chan;
+    }
+
+    std::shared_ptr<const RedisClusterChannel::SlotMap> RedisClusterChannel::slot_map() const {
+        MELON_SCOPED_LOCK(_mutex);
+        return _slot_map;
+    }
+
+    void RedisClusterChannel::UpdateSlot(uint16_t slot, const std::string &node) {
+        MELON_SCOPED_LOCK(_mutex);
+        std::shared_ptr<SlotMap> new_map = std::make_shared<SlotMap>(*_slot_map);
+        size_t i = 0;
+        for (; i < new_map->nodes.size() && new_map->nodes[i] != node; ++i) {}
+        if (i == new_map->nodes.size()) {
+            new_map->nodes.push_back(node);
+        }
+        if (new_map->slots.empty()) {
+            new_map->slots.resize(SLOT_COUNT, -1);
+        }
+        new_map->slots[slot] = (int) i;
+        _slot_map = new_map;
+    }
+
+    int RedisClusterChannel::RefreshSlots() {
+        std::vector<std::string> candidates = slot_map()->nodes;
+        candidates.insert(candidates.end(), _seeds.begin(), _seeds.end());
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            const std::string &candidate = candidates[i];
+            std::shared_ptr<Channel> chan = GetNodeChannel(candidate);
+            if (chan == NULL) {
+                continue;
+            }
+            RedisRequest request;
+            RedisResponse response;
+            Controller cntl;
+            request.AddCommand("cluster slots");
+            chan->CallMethod(NULL, &cntl, &request, &response, NULL);
+            if (cntl.Failed() || response.reply_size() != 1 ||
+                !response.reply(0).is_array()) {
+                LOG(WARNING) << "Fail to get slots from redis node=" << candidate
+                             << ": " << (cntl.Failed() ? cntl.ErrorText() : "bad reply");
+                continue;
+            }
+            // Each element is [start, end, [ip, port, id], replicas...]
+            const RedisReply &reply = response.reply(0);
+            std::shared_ptr<SlotMap> new_map = std::make_shared<SlotMap>();
+            new_map->slots.resize(SLOT_COUNT, -1);
+            bool bad_reply = false;
+            for (size_t j = 0; j < reply.size() && !bad_reply; ++j) {
+                const RedisReply &range = reply[j];
+                if (!range.is_array() || range.size() < 3 ||
+                    !range[0].is_integer() || !range[1].is_integer() ||
+                    !range[2].is_array() || range[2].size() < 2 ||
+                    !range[2][0].is_string() || !range[2][1].is_integer()) {
+                    bad_reply = true;
+                    break;
+                }
+                const int64_t start = range[0].integer();
+                const int64_t end = range[1].integer();
+                if (start < 0 || end < start || end >= SLOT_COUNT) {
+                    bad_reply = true;
+                    break;
+                }
+                std::string ip = range[2][0].data().as_string();
+                if (ip.empty()) {
+                    // The node doesn't know its ip, which is the one we asked.
+                    ip = candidate.substr(0, candidate.rfind(':'));
+                }
+                const std::string node = ip + ':' + std::to_string(range[2][1].integer());
+                size_t index = 0;
+                for (; index < new_map->nodes.size() && new_map->nodes[index] != node; ++index) {}
+                if (index == new_map->nodes.size()) {
+                    new_map->nodes.push_back(node);
+                }
+                for (int64_t slot = start; slot <= end; ++slot) {
+                    new_map->slots[slot] = (int) index;
+                }
+            }
+            if (bad_reply) {
+                LOG(WARNING) << "Bad reply of CLUSTER SLOTS from redis node="
+                             << candidate << ": " << reply;
+                continue;
+            }
+            MELON_SCOPED_LOCK(_mutex);
+            _slot_map = new_map;
+            return 0;
+        }
+        LOG(ERROR) << "Fail to get slots of the redis cluster";
+        return -1;
+    }
+
+    static void HandleTimeout(void *arg) {
+        fiber_session_t correlation_id = {(uint64_t) arg};
+        fiber_session_error(correlation_id, ERPCTIMEDOUT);
+    }
+
+    void *RedisClusterChannel::RunDoneAndDestroy(void *arg) {
+        Controller *c = static_cast<Controller *>(arg);
+        // Move done out from the controller.
+        google::protobuf::Closure *done = c->_done;
+        c->_done = NULL;
+        // Save call_id from the controller which may be deleted after Run().
+        const fiber_session_t cid = c->call_id();
+        done->Run();
+        CHECK_EQ(0, fiber_session_unlock_and_destroy(cid));
+        return NULL;
+    }
+
+    void RedisClusterChannel::CallMethod(const google::protobuf::MethodDescriptor *,
+                                         google::protobuf::RpcController *controller,
+                                         const google::protobuf::Message *request,
+                                         google::protobuf::Message *response,
+                                         google::protobuf::Closure *done) {
+        Controller *cntl = static_cast<Controller *>(controller);
+        cntl->OnRPCBegin(mutil::gettimeofday_us());
+        const CallId cid = cntl->call_id();
+        const int rc = fiber_session_lock(cid, NULL);
+        if (rc != 0) {
+            CHECK_EQ(EINVAL, rc);
+            if (!cntl->FailedInline()) {
+                cntl->SetFailed(EINVAL, "Fail to lock call_id=%" PRId64, cid.value);
+            }
+            LOG_IF(ERROR, cntl->is_used_by_rpc())
+                << "Controller=" << cntl << " was used by another RPC before. "
+                "Did you forget to Reset() it before reuse?";
+            // Have to run done in-place.
+            // Read comment in CallMethod() in channel.cpp for details.
+            if (done) {
+                done->Run();
+            }
+            return;
+        }
+        cntl->set_used_by_rpc();
+
+        const RedisRequest *rr = static_cast<const RedisRequest *>(request);
+        std::unique_ptr<ClusterCall> call;
+        mutil::IOBuf raw;
+        RedisCommandParser parser;
+        ClusterCall *c = NULL;
+
+        if (cntl->FailedInline()) {
+            // The call_id is cancelled before RPC.
+            goto FAIL;
+        }
+        if (request == NULL || request->GetDescriptor() != RedisRequest::descriptor()) {
+            cntl->SetFailed(EREQUEST, "Must be RedisRequest");
+            goto FAIL;
+        }
+        if (response == NULL || response->GetDescriptor() != RedisResponse::descriptor()) {
+            cntl->SetFailed(ERESPONSE, "Must be RedisResponse");
+            goto FAIL;
+        }
+        if (rr->has_error()) {
+            cntl->SetFailed(EREQUEST, "Bad RedisRequest");
+            goto FAIL;
+        }
+        // Commands are parsed before returning so that `request' can be
+        // deleted after an asynchronous call.
+        call.reset(new ClusterCall);
+        call->channel = this;
+        call->cntl = cntl;
+        call->response = static_cast<RedisResponse *>(response);
+        call->user_done = done;
+        call->cid = cid;
+        if (!rr->SerializeTo(&raw)) {
+            cntl->SetFailed(EREQUEST, "Fail to serialize RedisRequest");
+            goto FAIL;
+        }
+        call->commands.resize(rr->command_size());
+        for (size_t i = 0; i < call->commands.size(); ++i) {
+            if (parser.Consume(raw, &call->commands[i].args, &call->arena) != PARSE_OK) {
+                cntl->SetFailed(EREQUEST, "Fail to parse command %d", (int) i);
+                goto FAIL;
+            }
+        }
+
+        if (cntl->timeout_ms() == UNSET_MAGIC_NUM) {
+            cntl->set_timeout_ms(_options.channel_options.timeout_ms);
+        }
+        if (cntl->timeout_ms() >= 0) {
+            cntl->_deadline_us = cntl->timeout_ms() * 1000L + cntl->_begin_time_us;
+            // Setup timer for RPC timetout
+            const int rc = fiber_timer_add(
+                    &cntl->_timeout_id,
+                    mutil::microseconds_to_timespec(cntl->_deadline_us),
+                    HandleTimeout, (void *) cid.value);
+            if (rc != 0) {
+                cntl->SetFailed(rc, "Fail to add timer");
+                goto FAIL;
+            }
+        } else {
+            cntl->_deadline_us = -1;
+        }
+        c = call.release();
+        cntl->_done = c;
+        cntl->add_flag(Controller::FLAGS_DESTROY_CID_IN_DONE);
+        CHECK_EQ(0, fiber_session_unlock(cid));
+        // Don't touch `cntl' and `c' again (for async RPC)
+
+        if (done == NULL) {
+            RunCall(c);
+            c->OnCommandsDone();
+            Join(cid);
+            cntl->OnRPCEnd(mutil::gettimeofday_us());
+            return;
+        }
+        {
+            fiber_t tid;
+            if (fiber_start_background(&tid, NULL, RunCallInBackground, c) != 0) {
+                LOG(ERROR) << "Fail to start fiber";
+                RunCallInBackground(c);
+            }
+        }
+        return;
+
+    FAIL:
+        // The RPC was failed after locking call_id and before sending commands.
+        if (done) {
+            if (!cntl->is_done_allowed_to_run_in_place()) {
+                fiber_t bh;
+                fiber_attr_t attr = (FLAGS_usercode_in_pthread ?
+                                     FIBER_ATTR_PTHREAD : FIBER_ATTR_NORMAL);
+                // Hack: save done in cntl->_done to remove a malloc of args.
+                cntl->_done = done;
+                if (fiber_start_background(&bh, &attr, RunDoneAndDestroy, cntl) == 0) {
+                    return;
+                }
+                cntl->_done = NULL;
+                LOG(FATAL) << "Fail to start fiber";
+            }
+            done->Run();
+        }
+        CHECK_EQ(0, fiber_session_unlock_and_destroy(cid));
+    }
+
+    void *RedisClusterChannel::RunCallInBackground(void *arg) {
+        ClusterCall *call = static_cast<ClusterCall *>(arg);
+        call->channel->RunCall(call);
+        call->OnCommandsDone();
+        return NULL;
+    }
+
+    void RedisClusterChannel::RunCall(ClusterCall *call) {
+        std::vector<ClusterCommand> &commands = call->commands;
+        std::shared_ptr<const SlotMap> map = slot_map();
+        for (size_t i = 0; i < commands.size(); ++i) {
+            ClusterCommand &cmd = commands[i];
+            mutil::StringPiece key;
+            int index = -1;
+            if (GetCommandKey(cmd.args, &key) && !map->slots.empty()) {
+                index = map->slots[GetSlot(key)];
+            }
+            if (index < 0 && !map->nodes.empty()) {
+                // No key or the slot is unknown, nodes redirect it if needed.
+                index = (int) mutil::fast_rand_less_than(map->nodes.size());
+            }
+            cmd.node = index >= 0 ? map->nodes[index] : _seeds[0];
+        }
+
+        size_t nreplied = 0;
+        bool refreshed = false;
+        while (nreplied < commands.size()) {
+            // Send pipelines to nodes in parallel.
+            std::map<std::string, std::unique_ptr<NodeCall> > node_calls;
+            for (size_t i = 0; i < commands.size(); ++i) {
+                ClusterCommand &cmd = commands[i];
+                if (cmd.replied) {
+                    continue;
+                }
+                std::unique_ptr<NodeCall> &nc = node_calls[cmd.node];
+                if (nc == NULL) {
+                    nc.reset(new NodeCall);
+                    nc->channel = GetNodeChannel(cmd.node);
+                    if (nc->channel == NULL) {
+                        return call->SetFailed(EHOSTDOWN, "Fail to connect redis node=%s",
+                                               cmd.node.c_str());
+                    }
+                    // The timer of the call cancels sub calls.
+                    nc->cntl.set_timeout_ms(-1);
+                }
+                if (cmd.asking) {
+                    nc->request.AddCommand("asking");
+                    nc->indexes.push_back(-1);
+                }
+                nc->request.AddCommandByComponents(&cmd.args[0], cmd.args.size());
+                nc->indexes.push_back((int) i);
+            }
+            std::vector<CallId> sub_cids;
+            for (auto it = node_calls.begin(); it != node_calls.end(); ++it) {
+                sub_cids.push_back(it->second->cntl.call_id());
+            }
+            if (!call->AddSubCalls(sub_cids)) {
+                // Canceled, the error is set to the controller already.
+                return;
+            }
+            for (auto it = node_calls.begin(); it != node_calls.end(); ++it) {
+                NodeCall *nc = it->second.get();
+                nc->channel->CallMethod(NULL, &nc->cntl, &nc->request, &nc->response,
+                                        DoNothing());
+            }
+            for (size_t i = 0; i < sub_cids.size(); ++i) {
+                Join(sub_cids[i]);
+            }
+            call->RemoveSubCalls();
+
+            // Keep replies and resend the redirected commands.
+            std::vector<std::pair<uint16_t, std::string> > moved_slots;
+            for (auto it = node_calls.begin(); it != node_calls.end(); ++it) {
+                NodeCall *nc = it->second.get();
+                if (nc->cntl.Failed()) {
+                    return call->SetFailed(nc->cntl.ErrorCode(), "Fail to access redis node=%s: %s",
+                                           it->first.c_str(), nc->cntl.ErrorText().c_str());
+                }
+                for (size_t j = 0; j < nc->indexes.size(); ++j) {
+                    if (nc->indexes[j] < 0) {
+                        continue;
+                    }
+                    if (nc->indexes[j] == 0) {
+                        call->remote_side = nc->cntl.remote_side();
+                    }
+                    ClusterCommand &cmd = commands[nc->indexes[j]];
+                    const RedisReply &reply = nc->response.reply(j);
+                    bool moved = false;
+                    uint16_t slot = 0;
+                    std::string node;
+                    if (reply.is_error() && cmd.redirects < _options.max_redirect &&
+                        ParseRedirection(reply.error_message(), &moved, &slot, &node)) {
+                        ++cmd.redirects;
+                        cmd.node = node;
+                        cmd.asking = !moved;
+                        if (moved) {
+                            moved_slots.push_back(std::make_pair(slot, node));
+                        }
+                        continue;
+                    }
+                    mutil::IOBufAppender appender;
+                    if (!reply.SerializeTo(&appender)) {
+                        return call->SetFailed(ERESPONSE, "Fail to serialize reply");
+                    }
+                    appender.move_to(cmd.reply);
+                    cmd.replied = true;
+                    ++nreplied;
+                }
+            }
+            if (!moved_slots.empty()) {
+                // Slots were migrated, refresh the slot map once per call.
+                // Calls meeting MOVED at the same time don't refresh again.
+                bool expected = false;
+                if (!refreshed &&
+                    _refreshing.compare_exchange_strong(expected, true)) {
+                    refreshed = true;
+                    RefreshSlots();
+                    _refreshing.store(false);
+                }
+                for (size_t i = 0; i < moved_slots.size(); ++i) {
+                    UpdateSlot(moved_slots[i].first, moved_slots[i].second);
+                }
+            }
+        }
+
+        for (size_t i = 0; i < commands.size(); ++i) {
+            call->replies.append(mutil::IOBuf::Movable(commands[i].reply));
+        }
+    }
+
+    int RedisClusterChannel::CheckHealth() {
+        return slot_map()->nodes.empty() ? -1 : 0;
+    }
+
+    void RedisClusterChannel::Describe(std::ostream &os, const DescribeOptions &) const {
+        std::shared_ptr<const SlotMap> map = slot_map();
+        os << "RedisClusterChannel[";
+        for (size_t i = 0; i < map->nodes.size(); ++i) {
+            if (i) {
+                os << ' ';
+            }
+            os << map->nodes[i];
+        }
+        os << ']';
+    }
+
+} // namespace melon
@@ -0,0 +1,142 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+//
+
+
+#ifndef MELON_RPC_REDIS_REDIS_CLUSTER_CHANNEL_H_
+#define MELON_RPC_REDIS_REDIS_CLUSTER_CHANNEL_H_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <melon/utility/atomicops.h>
+#include <melon/utility/synchronization/lock.h>
+#include <melon/utility/strings/string_piece.h>
+#include <melon/rpc/channel.h>
+#include <melon/rpc/redis/redis.h>
+
+namespace melon {
+
+    struct RedisClusterChannelOptions {
+        // Constructed with default options.
+        RedisClusterChannelOptions();
+
+        // Options of the channels to nodes of the cluster. `protocol' is
+        // always set to redis.
+        ChannelOptions channel_options;
+
+        // Max times that a command is redirected by MOVED or ASK. The reply
+        // of redirection is given to user when the limit is reached.
+        // Default: 5
+        int max_redirect;
+    };
+
+    // A channel to a redis cluster, aka "rcchan". Commands in a RedisRequest
+    // are routed to the nodes serving the slots of their keys. Commands to
+    // one node are sent as one pipeline, and pipelines to different nodes
+    // are sent in parallel, just like ParallelChannel does. Replies are put
+    // into RedisResponse in the same order as the commands.
+    // The slot map is fetched by CLUSTER SLOTS. Commands redirected by MOVED
+    // are resent to the new node and the slot map is refreshed, commands
+    // redirected by ASK are resent to the new node after ASKING.
+    // Like other channels, the call can be joined by cntl.call_id(), and is
+    // ended by timeout of the controller or StartCancel() which cancel the
+    // pending commands.
+    // Example:
+    //   RedisClusterChannel channel;
+    //   channel.Init("127.0.0.1:7000,127.0.0.1:7001", NULL);
+    //   RedisRequest request;
+    //   request.AddCommand("get key1");
+    //   request.AddCommand("get key2");
+    //   RedisResponse response;
+    //   channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+    // CAUTION:
+    //   * The key of a command is its first argument, or the first key of
+    //     EVAL/EVALSHA. Commands without keys(PING, INFO...) are sent to any
+    //     node. Keys of a multi-key command must be in one slot, use hash
+    //     tags like {user1}.name to make sure of it.
+    //   * Transactions(MULTI/EXEC) are not supported.
+    //   * The channel must outlive the asynchronous calls over it.
+    class RedisClusterChannel : public ChannelBase/*non-copyable*/ {
+    public:
+        RedisClusterChannel();
+
+        ~RedisClusterChannel();
+
+        // Initialize with nodes in `seed_addresses', which are separated by
+        // comma, e.g. "127.0.0.1:7000,127.0.0.1:7001". The slot map is fetched
+        // from the first seed answering CLUSTER SLOTS.
+        // If `options' is NULL, use default options.
+        // Returns 0 on success, -1 otherwise.
+        int Init(const char *seed_addresses, const RedisClusterChannelOptions *options);
+
+        // `request' must be RedisRequest and `response' must be RedisResponse.
+        void CallMethod(const google::protobuf::MethodDescriptor *method,
+                        google::protobuf::RpcController *controller,
+                        const google::protobuf::Message *request,
+                        google::protobuf::Message *response,
+                        google::protobuf::Closure *done) override;
+
+        // Fetch the slot map again from known nodes.
+        // Returns 0 on success, -1 otherwise.
+        int RefreshSlots();
+
+        // Slot of `key' in the cluster, namely CRC16 of the key(or the hash
+        // tag inside) modulo 16384.
+        static uint16_t GetSlot(const mutil::StringPiece &key);
+
+        void Describe(std::ostream &os, const DescribeOptions &options) const override;
+
+        static const int SLOT_COUNT = 16384;
+
+    private:
+        struct SlotMap;
+        struct ClusterCall;
+
+        int CheckHealth() override;
+
+        // Run `call' until all commands are replied or the RPC is canceled,
+        // and save the replies into `call'.
+        void RunCall(ClusterCall *call);
+
+        static void *RunCallInBackground(void *arg);
+
+        static void *RunDoneAndDestroy(void *arg);
+
+        // Get the shared channel to `node'("ip:port"), created if not exist.
+        std::shared_ptr<Channel> GetNodeChannel(const std::string &node);
+
+        std::shared_ptr<const SlotMap> slot_map() const;
+
+        // Set `slot' to be served by `node' according to MOVED.
+        void UpdateSlot(uint16_t slot, const std::string &node);
+
+        RedisClusterChannelOptions _options;
+        std::vector<std::string> _seeds;
+        mutable mutil::Mutex _mutex;
+        std::shared_ptr<const SlotMap> _slot_map;
+        std::map<std::string, std::shared_ptr<Channel> > _node_channels;
+        // True if RefreshSlots() is running after MOVED, other calls meeting
+        // MOVED don't refresh again.
+        mutil::atomic<bool> _refreshing;
+    };
+
+} // namespace melon
+
+#endif  // MELON_RPC_REDIS_REDIS_CLUSTER_CHANNEL_H_
@@ -41,7 +41,7 @@ const char* RedisReplyTypeToString(RedisReplyType type) {
     }
 }
 
-bool RedisReply::SerializeTo(mutil::IOBufAppender* appender) {
+bool RedisReply::SerializeTo(mutil::IOBufAppender* appender) const {
     switch (_type) {
         case REDIS_REPLY_ERROR:
             // fall through
@@ -131,7 +131,7 @@ namespace melon {
         ParseError ConsumePartialIOBuf(mutil::IOBuf &buf);
 
         // Serialize to iobuf appender using redis protocol
-        bool SerializeTo(mutil::IOBufAppender *appender);
+        bool SerializeTo(mutil::IOBufAppender *appender) const;
 
         // Swap internal fields with another reply.
         void Swap(RedisReply &other);
@@ -0,0 +1,60 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+//
+
+
+#include <melon/rpc/redis/redis_reply_writer.h>
+
+namespace melon {
+
+const size_t RedisReplyWriter::MIN_REFERENCED_SIZE;
+
+void RedisReplyWriter::AppendString(const mutil::IOBuf& str) {
+    _appender.push_back('$');
+    _appender.append_decimal(str.size());
+    _appender.append("\r\n", 2);
+    if (str.size() < MIN_REFERENCED_SIZE) {
+        char buf[MIN_REFERENCED_SIZE];
+        _appender.append(str.fetch(buf, str.size()), str.size());
+    } else {
+        // Data in _appender must be placed before the referenced blocks.
+        mutil::IOBuf written;
+        _appender.move_to(written);
+        _buf.append(mutil::IOBuf::Movable(written));
+        _buf.append(str);
+    }
+    _appender.append("\r\n", 2);
+    OnReplyWritten();
+}
+
+bool RedisReplyWriter::AppendReply(const RedisReply& reply) {
+    if (!reply.SerializeTo(&_appender)) {
+        return false;
+    }
+    OnReplyWritten();
+    return true;
+}
+
+void RedisReplyWriter::MoveTo(mutil::IOBuf* out) {
+    mutil::IOBuf written;
+    _appender.move_to(written);
+    _buf.append(mutil::IOBuf::Movable(written));
+    out->append(mutil::IOBuf::Movable(_buf));
+}
+
+} // namespace melon
@@ -0,0 +1,153 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+//
+
+
+#ifndef MELON_RPC_REDIS_REDIS_REPLY_WRITER_H_
+#define MELON_RPC_REDIS_REDIS_REPLY_WRITER_H_
+
+#include <vector>
+#include <melon/utility/iobuf.h>                  // mutil::IOBuf
+#include <melon/utility/strings/string_piece.h>   // mutil::StringPiece
+#include <melon/rpc/redis/redis_reply.h>
+
+namespace melon {
+
+    // Write replies in redis protocol directly into an IOBuf, without building
+    // RedisReply first. Payloads of bulk strings given as IOBuf are appended
+    // by reference, so values kept in IOBuf are sent without being copied.
+    // Elements of an array are written right after AppendArray().
+    // Example:
+    //   writer->AppendArray(2);
+    //   writer->AppendString("value1");
+    //   writer->AppendString(value2_in_iobuf);
+    class RedisReplyWriter {
+    public:
+        RedisReplyWriter() : _nreply(0) {}
+
+        void AppendStatus(const mutil::StringPiece &str);
+
+        void AppendError(const mutil::StringPiece &str);
+
+        void AppendInteger(int64_t value);
+
+        // Append a bulk string, which is copied.
+        void AppendString(const mutil::StringPiece &str);
+
+        // Append a bulk string, which is referenced unless it's short.
+        void AppendString(const mutil::IOBuf &str);
+
+        void AppendNullString();
+
+        // Following `size' replies are elements of the array.
+        void AppendArray(int size);
+
+        void AppendNullArray();
+
+        bool AppendReply(const RedisReply &reply);
+
+        // Number of intact replies at the top level.
+        size_t reply_count() const { return _nreply; }
+
+        // True if some array is still waiting for its elements.
+        bool in_array() const { return !_open_arrays.empty(); }
+
+        // Move all written into `out'.
+        void MoveTo(mutil::IOBuf *out);
+
+    private:
+        DISALLOW_COPY_AND_ASSIGN(RedisReplyWriter);
+
+        // A reply is written, which may complete the arrays containing it.
+        void OnReplyWritten();
+
+        // Payloads longer than this are appended by reference.
+        static const size_t MIN_REFERENCED_SIZE = 512;
+
+        mutil::IOBufAppender _appender;
+        // Written before the data in _appender.
+        mutil::IOBuf _buf;
+        // Elements left of arrays being written, the innermost one is at back.
+        std::vector<int> _open_arrays;
+        size_t _nreply;
+    };
+
+    inline void RedisReplyWriter::OnReplyWritten() {
+        while (!_open_arrays.empty()) {
+            if (--_open_arrays.back() > 0) {
+                return;
+            }
+            _open_arrays.pop_back();
+        }
+        ++_nreply;
+    }
+
+    inline void RedisReplyWriter::AppendStatus(const mutil::StringPiece &str) {
+        _appender.push_back('+');
+        _appender.append(str);
+        _appender.append("\r\n", 2);
+        OnReplyWritten();
+    }
+
+    inline void RedisReplyWriter::AppendError(const mutil::StringPiece &str) {
+        _appender.push_back('-');
+        _appender.append(str);
+        _appender.append("\r\n", 2);
+        OnReplyWritten();
+    }
+
+    inline void RedisReplyWriter::AppendInteger(int64_t value) {
+        _appender.push_back(':');
+        _appender.append_decimal(value);
+        _appender.append("\r\n", 2);
+        OnReplyWritten();
+    }
+
+    inline void RedisReplyWriter::AppendString(const mutil::StringPiece &str) {
+        _appender.push_back('$');
+        _appender.append_decimal(str.size());
+        _appender.append("\r\n", 2);
+        _appender.append(str);
+        _appender.append("\r\n", 2);
+        OnReplyWritten();
+    }
+
+    inline void RedisReplyWriter::AppendNullString() {
+        _appender.append("$-1\r\n", 5);
+        OnReplyWritten();
+    }
+
+    inline void RedisReplyWriter::AppendArray(int size) {
+        _appender.push_back('*');
+        _appender.append_decimal(size);
+        _appender.append("\r\n", 2);
+        if (size > 0) {
+            _open_arrays.push_back(size);
+        } else {
+            OnReplyWritten();
+        }
+    }
+
+    inline void RedisReplyWriter::AppendNullArray() {
+        _appender.append("*-1\r\n", 5);
+        OnReplyWritten();
+    }
+
+} // namespace melon
+
+#endif  // MELON_RPC_REDIS_REDIS_REPLY_WRITER_H_
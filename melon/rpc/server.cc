@@ -40,6 +40,7 @@
 #include <melon/rpc/acceptor.h>                     // Acceptor
 #include <melon/rpc/details/ssl_helper.h>           // CreateServerSSLContext
 #include <melon/rpc/protocol.h>                     // ListProtocols
+#include <melon/rpc/transport.h>                    // TransportExtension
 #include <melon/builtin/bad_method_service.h>   // BadMethodService
 #include <melon/builtin/get_favicon_service.h>
 #include <melon/builtin/get_js_service.h>
@@ -108,12 +109,20 @@ namespace melon {
 
     mutil::static_atomic<int> g_running_server_count = MUTIL_STATIC_ATOMIC_INIT(0);
 
+    // Close fds in `fds' from `begin' which are not owned by an acceptor.
+    static void CloseListenedFds(const std::vector<int> &fds, size_t begin) {
+        for (size_t i = begin; i < fds.size(); ++i) {
+            close(fds[i]);
+        }
+    }
+
     // Following services may have security issues and are disabled by default.
     DEFINE_bool(enable_dir_service, false, "Enable /dir");
     DEFINE_bool(enable_threads_service, false, "Enable /threads");
 
     DECLARE_int32(usercode_backup_threads);
     DECLARE_bool(usercode_in_pthread);
+    DECLARE_int32(event_dispatcher_num);
 
     const int INITIAL_SERVICE_CAP = 64;
     const int INITIAL_CERT_MAP = 64;
@@ -126,8 +135,10 @@ namespace melon {
               server_owns_interceptor(false), num_threads(8), max_concurrency(0), session_local_data_factory(NULL),
               reserved_session_local_data(0), thread_local_data_factory(NULL), reserved_thread_local_data(0),
               fiber_init_fn(NULL), fiber_init_args(NULL), fiber_init_count(0), internal_port(-1),
-              has_builtin_services(true), force_ssl(false), use_rdma(false), http_master_service(NULL),
-              health_reporter(NULL), rtmp_service(NULL), redis_service(NULL), fiber_tag(FIBER_TAG_DEFAULT) {
+              has_builtin_services(true), force_ssl(false), use_rdma(false), use_shm(false), http_master_service(NULL),
+              health_reporter(NULL), rtmp_service(NULL), redis_service(NULL), memcache_service(NULL),
+              fiber_tag(FIBER_TAG_DEFAULT),
+              num_acceptors(1), use_arena(false) {
         if (s_ncore > 0) {
             num_threads = s_ncore + 1;
         }
@@ -408,6 +419,9 @@ namespace melon {
 
         delete _options.redis_service;
         _options.redis_service = NULL;
+
+        delete _options.memcache_service;
+        _options.memcache_service = NULL;
     }
 
     int Server::AddBuiltinServices() {
@@ -752,6 +766,15 @@ namespace melon {
             return -1;
         }
 
+        if (_options.use_shm) {
+            _options.transport = "shm";
+        }
+        if (!_options.transport.empty() &&
+            TransportExtension()->Find(_options.transport.c_str()) == NULL) {
+            LOG(ERROR) << "Unknown transport=" << _options.transport;
+            return -1;
+        }
+
         if (_options.http_master_service) {
             // Check requirements for http_master_service:
             //  has "default_method" & request/response have no fields
@@ -971,10 +994,31 @@ namespace melon {
             LOG(ERROR) << "Only IPv4 address supports port range feature";
             return -1;
         }
+        const int num_acceptors = _options.num_acceptors;
+        if (num_acceptors < 1) {
+            LOG(ERROR) << "Invalid num_acceptors=" << num_acceptors;
+            return -1;
+        }
+        if (num_acceptors > 1 && mutil::get_endpoint_type(endpoint) == AF_UNIX) {
+            LOG(ERROR) << "num_acceptors > 1 is not supported by unix domain socket";
+            return -1;
+        }
+        for (size_t i = 0; i < _options.acceptor_fiber_tags.size(); ++i) {
+            const fiber_tag_t tag = _options.acceptor_fiber_tags[i];
+            if (tag < FIBER_TAG_DEFAULT || tag >= fiber::FLAGS_task_group_ntags) {
+                LOG(ERROR) << "Fail to set acceptor tag " << tag << ", tag range is ["
+                           << FIBER_TAG_DEFAULT << ":" << fiber::FLAGS_task_group_ntags << ")";
+                return -1;
+            }
+        }
+        LOG_IF(WARNING, num_acceptors > FLAGS_event_dispatcher_num)
+                << "num_acceptors=" << num_acceptors << " is larger than"
+                   " -event_dispatcher_num=" << FLAGS_event_dispatcher_num
+                << ", some acceptors share event dispatchers";
         _listen_addr = endpoint;
         for (int port = port_range.min_port; port <= port_range.max_port; ++port) {
             _listen_addr.port = port;
-            mutil::fd_guard sockfd(tcp_listen(_listen_addr));
+            mutil::fd_guard sockfd(tcp_listen(_listen_addr, num_acceptors > 1));
             if (sockfd < 0) {
                 if (port != port_range.max_port) { // not the last port, try next
                     continue;
@@ -1004,6 +1048,8 @@ namespace melon {
                     return -1;
                 }
                 _am->_use_rdma = _options.use_rdma;
+                _am->_transport = _options.transport.empty() ? NULL :
+                                  TransportExtension()->Find(_options.transport.c_str());
                 if (_options.fiber_tag < FIBER_TAG_DEFAULT ||
                     _options.fiber_tag >= fiber::FLAGS_task_group_ntags) {
                     LOG(ERROR) << "Fail to set tag " << _options.fiber_tag << ", tag range is ["
@@ -1012,6 +1058,24 @@ namespace melon {
                 }
                 _am->_fiber_tag = _options.fiber_tag;
             }
+            _am->_edisp_index = (num_acceptors > 1 ? 0 : -1);
+            if (!_options.acceptor_fiber_tags.empty()) {
+                _am->_fiber_tag = _options.acceptor_fiber_tags[0];
+            }
+            // Open the other sockets on the same port before accepting any
+            // connection, so that failing to listen leaves nothing to undo.
+            // Connections are spread over them by the kernel.
+            std::vector<int> extra_fds;
+            for (int i = 1; i < num_acceptors; ++i) {
+                const int extra_fd = tcp_listen(_listen_addr, true);
+                if (extra_fd < 0) {
+                    PLOG(ERROR) << "Fail to listen " << _listen_addr
+                                << " with SO_REUSEPORT";
+                    CloseListenedFds(extra_fds, 0);
+                    return -1;
+                }
+                extra_fds.push_back(extra_fd);
+            }
             // Set `_status' to RUNNING before accepting connections
             // to prevent requests being rejected as ELOGOFF
             _status = RUNNING;
@@ -1024,9 +1088,29 @@ namespace melon {
                                  _default_ssl_ctx,
                                  _options.force_ssl) != 0) {
                 LOG(ERROR) << "Fail to start acceptor";
+                CloseListenedFds(extra_fds, 0);
+                g_running_server_count.fetch_sub(1, mutil::memory_order_relaxed);
+                _status = READY;
                 return -1;
             }
             sockfd.release();
+            for (size_t i = 0; i < extra_fds.size(); ++i) {
+                const int index = i + 1;
+                const fiber_tag_t tag = _options.acceptor_fiber_tags.empty() ?
+                        _options.fiber_tag :
+                        _options.acceptor_fiber_tags[index % _options.acceptor_fiber_tags.size()];
+                if (_am->AddListenedFd(extra_fds[i], tag, index) != 0) {
+                    LOG(ERROR) << "Fail to add listened fd into acceptor";
+                    // Close what the acceptor does not own yet and stop
+                    // accepting on the sockets added so far.
+                    CloseListenedFds(extra_fds, i);
+                    _am->StopAccept(0);
+                    _am->Join();
+                    g_running_server_count.fetch_sub(1, mutil::memory_order_relaxed);
+                    _status = READY;
+                    return -1;
+                }
+            }
             break; // stop trying
         }
         if (_options.internal_port >= 0 && _options.has_builtin_services) {
@@ -1655,7 +1739,8 @@ namespace melon {
         if (!_version.empty()) {
             return;
         }
-        int extra_count = !!_options.rtmp_service + !!_options.redis_service;
+        int extra_count = !!_options.rtmp_service + !!_options.redis_service +
+                          !!_options.memcache_service;
         _version.reserve((extra_count + service_count()) * 20);
         for (ServiceMap::const_iterator it = _fullname_service_map.begin();
              it != _fullname_service_map.end(); ++it) {
@@ -1680,6 +1765,13 @@ namespace melon {
             }
             _version.append(mutil::class_name_str(*_options.redis_service));
         }
+
+        if (_options.memcache_service) {
+            if (!_version.empty()) {
+                _version.push_back('+');
+            }
+            _version.append(mutil::class_name_str(*_options.memcache_service));
+        }
     }
 
     void Server::PutPidFileIfNeeded() {
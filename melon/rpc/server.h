@@ -39,6 +39,7 @@
 #include <melon/rpc/adaptive_max_concurrency.h>
 #include <melon/rpc/http/http2.h>
 #include <melon/rpc/redis/redis.h>
+#include <melon/rpc/memcache/memcache_service.h>
 #include <melon/rpc/interceptor.h>
 
 namespace melon {
@@ -219,6 +220,18 @@ namespace melon {
         // Default: false
         bool use_rdma;
 
+        // Accept connections of ChannelOptions.use_shm which exchange data
+        // through shared memory. The server should listen on a unix socket,
+        // connections from other clients are served as usual.
+        // Default: false
+        bool use_shm;
+
+        // Name of the Transport registered in TransportExtension() for
+        // accepted connections, see ChannelOptions.transport. use_shm is
+        // same as "shm".
+        // Default: ""
+        std::string transport;
+
         // [CAUTION] This option is for implementing specialized http proxies,
         // most users don't need it. Don't change this option unless you fully
         // understand the description below.
@@ -253,6 +266,12 @@ namespace melon {
         // Default: NULL (disabled)
         RedisService *redis_service;
 
+        // For processing memcache connections in binary protocol. Read
+        // melon/rpc/memcache/memcache_service.h for details.
+        // Owned by Server and deleted in server's destructor.
+        // Default: NULL (disabled)
+        MemcacheService *memcache_service;
+
         // Optional info name for composing server var prefix. Read ServerPrefix() method for details;
         // Default: ""
         std::string server_info_name;
@@ -261,6 +280,28 @@ namespace melon {
         // Default: FIBER_TAG_DEFAULT
         fiber_tag_t fiber_tag;
 
+        // Number of sockets listening to the port with SO_REUSEPORT. The kernel
+        // balances new connections over them, each socket and connections
+        // accepted from it are handled by a different event dispatcher, so
+        // accepting and polling are spread over -event_dispatcher_num threads.
+        // Not available for unix domain sockets.
+        // Default: 1
+        int num_acceptors;
+
+        // If non-empty, the i-th listening socket and its connections run in
+        // fiber workers of acceptor_fiber_tags[i % size] instead of `fiber_tag'.
+        // Default: empty
+        std::vector<fiber_tag_t> acceptor_fiber_tags;
+
+        // Allocate request and response of each call to pb services on an
+        // arena owned by the controller, which saves allocations when parsing
+        // big nested messages. The first block of the arena is sized from
+        // recent calls of the method. Service implementations must not delete
+        // the messages or use them after done->Run(), see Controller::arena().
+        // Applied to baidu_std, melon_std, hulu_pbrpc and http/h2 protocols.
+        // Default: false
+        bool use_arena;
+
     private:
         // SSLOptions is large and not often used, allocate it on heap to
         // prevent ServerOptions from being bloated in most cases.
@@ -23,6 +23,7 @@
 #include <melon/utility/ssl_compat.h>                    // BIO_fd_non_fatal_error
 #include <openssl/ssl.h>
 #include <openssl/err.h>
+#include <algorithm>                             // std::find
 #include <netinet/tcp.h>                         // getsockopt
 #include <gflags/gflags.h>
 #include <melon/fiber/unstable.h>                    // fiber_timer_del
@@ -47,6 +48,8 @@
 #include <melon/rpc/policy/rtmp_protocol.h>  // FIXME
 #include <melon/rpc/periodic_task.h>
 #include <melon/rpc/details/health_check.h>
+#include <melon/rpc/details/zerocopy.h>
+#include <melon/rpc/transport.h>
 
 
 #if defined(OS_MACOSX)
@@ -80,10 +83,21 @@ namespace melon {
 
     DEFINE_int32(ssl_bio_buffer_size, 16 * 1024, "Set buffer size for SSL read/write");
 
+    DEFINE_bool(ssl_use_ktls, false,
+                "Offload TLS records of SSL connections to the kernel (kTLS) after "
+                "handshaking, requires OpenSSL 3 built with kTLS and the `tls'"
+                " kernel module. Connections use user-space TLS if not available");
+    MELON_VALIDATE_GFLAG(ssl_use_ktls, PassValidate);
+
     DEFINE_int64(socket_max_unwritten_bytes, 64 * 1024 * 1024,
                  "Max unwritten bytes in each socket, if the limit is reached,"
                  " Socket.Write fails with EOVERCROWDED");
 
+    DEFINE_int64(socket_max_unconsumed_recv_bytes, 4 * 1024 * 1024,
+                 "Max bytes received by EventDispatcher for a socket but not "
+                 "consumed by the socket yet, the dispatcher stops receiving "
+                 "for the socket beyond this until the socket catches up");
+
     DEFINE_int64(socket_max_streams_unconsumed_bytes, 0,
                  "Max stream receivers' unconsumed bytes in one socket,"
                  " it used in stream for receiver buffer control.");
@@ -97,6 +111,23 @@ namespace melon {
                  "times *continuously*, the error is changed to ENETUNREACH which "
                  "fails the main socket as well when this socket is pooled.");
 
+    DEFINE_int32(socket_zerocopy_min_size, 0,
+                 "Write with MSG_ZEROCOPY when a write to a plain tcp connection "
+                 "has at least so many bytes, 0 disables zerocopy. Notice that "
+                 "the notification of each send costs as much as copying ~10KB");
+    MELON_VALIDATE_GFLAG(socket_zerocopy_min_size, NonNegativeInteger);
+
+    DEFINE_int32(socket_cork_us, 0,
+                 "A write smaller than -socket_cork_bytes waits for at most so "
+                 "many microseconds for concurrent writes to the same socket so "
+                 "that they're written by one syscall, 0 disables corking. "
+                 "Overridden by SocketOptions.cork_us");
+    MELON_VALIDATE_GFLAG(socket_cork_us, NonNegativeInteger);
+
+    DEFINE_int32(socket_cork_bytes, 16 * 1024,
+                 "Corked writes are written as soon as so many bytes are queued");
+    MELON_VALIDATE_GFLAG(socket_cork_bytes, NonNegativeInteger);
+
     DECLARE_int32(health_check_timeout_ms);
     DECLARE_bool(usercode_in_coroutine);
 
@@ -128,7 +159,19 @@ namespace melon {
         // Get all pooled sockets inside.
         void ListSockets(std::vector<SocketId> *list, size_t max_count);
 
+        // Raise the minimum size of the pool to `min_size' and connect
+        // missing sockets in background.
+        void Warmup(int min_size);
+
+        // Remove failed sockets from the pool, connect missing or extra
+        // sockets in background and return how many free sockets should be
+        // kept even if they're idle.
+        int Maintain();
+
     private:
+        // Connect `n' sockets in background and put them into the pool.
+        void Preconnect(int n);
+
         // options used to create this instance
         SocketOptions _options;
         mutil::Mutex _mutex;
@@ -136,6 +179,12 @@ namespace melon {
         mutil::EndPoint _remote_side;
         mutil::atomic<int> _numfree; // #free sockets in all sub pools.
         mutil::atomic<int> _numinflight; // #inflight sockets in all sub pools.
+        mutil::atomic<int> _min_size;
+        mutil::atomic<int64_t> _nhit;
+        mutil::atomic<int64_t> _nmiss;
+        mutil::atomic<int64_t> _npreconnect;
+        // _nmiss at last Maintain(), only used in Maintain().
+        int64_t _last_nmiss;
     };
 
 // NOTE: sizeof of this class is 1200 bytes. If we have 10K sockets, total
@@ -424,23 +473,29 @@ namespace melon {
     // must be even because Address() relies on evenness of version
             : _versioned_ref(0), _shared_part(NULL), _nevent(0), _keytable_pool(NULL), _fd(-1), _tos(0),
               _reset_fd_real_us(-1), _on_edge_triggered_events(NULL), _user(NULL), _conn(NULL), _this_id(0),
-              _preferred_index(-1), _hc_count(0), _last_msg_size(0), _avg_msg_size(0), _last_readtime_us(0),
+              _preferred_index(-1), _hc_count(0), _last_msg_size(0), _avg_msg_size(0), _read_size_hint(0),
+              _recv_in_dispatcher(false), _recv_error(0), _recv_fallback(false),
+              _recv_generation(0),
+              _zerocopy(NULL), _zerocopy_unsupported(false), _last_readtime_us(0),
               _parsing_context(NULL), _correlation_id(0), _health_check_interval_s(-1), _is_hc_related_ref_held(false),
               _hc_started(false), _ninprocess(1), _auth_flag_error(0), _auth_id(INVALID_FIBER_ID), _auth_context(NULL),
-              _ssl_state(SSL_UNKNOWN), _ssl_session(NULL), _rdma_ep(NULL), _rdma_state(RDMA_OFF),
+              _ssl_state(SSL_UNKNOWN), _ssl_session(NULL), _ktls_send(false), _ktls_recv(false), _rdma_ep(NULL), _rdma_state(RDMA_OFF), _transport(NULL), _transport_proto(NULL),
               _connection_type_for_progressive_read(CONNECTION_TYPE_UNKNOWN), _controller_released_socket(false),
               _overcrowded(false), _fail_me_at_server_stop(false), _logoff_flag(false),
               _additional_ref_status(REF_USING), _error_code(0), _pipeline_q(NULL), _last_writetime_us(0),
-              _unwritten_bytes(0), _epollout_butex(NULL), _write_head(NULL), _stream_set(NULL),
+              _unwritten_bytes(0), _epollout_butex(NULL), _write_head(NULL),
+              _cork_us(-1), _cork_bytes(-1), _corking(false), _corked_bytes(0), _cork_butex(NULL), _stream_set(NULL),
               _total_streams_unconsumed_size(0), _ninflight_app_health_check(0), _http_request_method(HTTP_METHOD_GET) {
         CreateVarsOnce();
         pthread_mutex_init(&_id_wait_list_mutex, NULL);
         _epollout_butex = fiber::butex_create_checked<mutil::atomic<int> >();
+        _cork_butex = fiber::butex_create_checked<mutil::atomic<int> >();
     }
 
     Socket::~Socket() {
         pthread_mutex_destroy(&_id_wait_list_mutex);
         fiber::butex_destroy(_epollout_butex);
+        fiber::butex_destroy(_cork_butex);
     }
 
     void Socket::ReturnSuccessfulWriteRequest(Socket::WriteRequest *p) {
@@ -498,10 +553,12 @@ namespace melon {
         // Reset message sizes when fd is changed.
         _last_msg_size = 0;
         _avg_msg_size = 0;
+        _read_size_hint = 0;
         // MUST store `_fd' before adding itself into epoll device to avoid
         // race conditions with the callback function inside epoll
         _fd.store(fd, mutil::memory_order_release);
         _reset_fd_real_us = mutil::gettimeofday_us();
+        _zerocopy_unsupported = false;
         if (!ValidFileDescriptor(fd)) {
             return 0;
         }
@@ -547,7 +604,23 @@ namespace melon {
         EnableKeepaliveIfNeeded(fd);
 
         if (_on_edge_triggered_events) {
-            if (GetGlobalEventDispatcher(fd, _fiber_tag).AddConsumer(id(), fd) != 0) {
+            EventDispatcher &edisp = GetGlobalEventDispatcher(fd, _fiber_tag, _edisp_index);
+            // Let the dispatcher receive data only for plain connections
+            // whose data are consumed by InputMessenger.
+            const bool recv = edisp.RecvInDispatcher() && _ssl_ctx == NULL &&
+                              !_force_ssl && _conn == NULL && _rdma_state == RDMA_OFF &&
+                              _transport == NULL &&
+                              _on_edge_triggered_events == InputMessenger::OnNewMessages;
+            uint32_t recv_generation = 0;
+            {
+                MELON_SCOPED_LOCK(_recv_mutex);
+                _recv_buf.clear();
+                _recv_error = 0;
+                _recv_fallback = false;
+                recv_generation = ++_recv_generation;
+            }
+            _recv_in_dispatcher.store(recv, mutil::memory_order_release);
+            if (edisp.AddConsumer(id(), fd, recv, recv_generation) != 0) {
                 PLOG(ERROR) << "Fail to add SocketId=" << id()
                             << " into EventDispatcher";
                 _fd.store(-1, mutil::memory_order_release);
@@ -640,6 +713,11 @@ namespace melon {
         m->_user = options.user;
         m->_conn = options.conn;
         m->_app_connect = options.app_connect;
+        CHECK(m->_transport == NULL);
+        m->_transport_proto = options.transport;
+        if (options.transport) {
+            m->_transport = options.transport->New(m, options.fd >= 0);
+        }
         // nref can be non-zero due to concurrent AddressSocket().
         // _this_id will only be used in destructor/Destroy of referenced
         // slots, which is safe and properly fenced. Although it's better
@@ -693,7 +771,11 @@ namespace melon {
         m->_unwritten_bytes.store(0, mutil::memory_order_relaxed);
         m->_keepalive_options = options.keepalive_options;
         m->_fiber_tag = options.fiber_tag;
+        m->_edisp_index = options.event_dispatcher_index;
         CHECK(NULL == m->_write_head.load(mutil::memory_order_relaxed));
+        m->_cork_us = options.cork_us;
+        m->_cork_bytes = options.cork_bytes;
+        m->_corking.store(false, mutil::memory_order_relaxed);
         // Must be last one! Internal fields of this Socket may be access
         // just after calling ResetFileDescriptor.
         if (m->ResetFileDescriptor(options.fd) != 0) {
@@ -743,9 +825,13 @@ namespace melon {
 
         // It's safe to close previous fd (provided expected_nref is correct).
         const int prev_fd = _fd.exchange(-1, mutil::memory_order_relaxed);
+        ReleaseZerocopyWriter(prev_fd);
+        if (_transport) {
+            _transport->Reset();
+        }
         if (ValidFileDescriptor(prev_fd)) {
             if (_on_edge_triggered_events != NULL) {
-                GetGlobalEventDispatcher(prev_fd, _fiber_tag).RemoveConsumer(prev_fd);
+                GetGlobalEventDispatcher(prev_fd, _fiber_tag, _edisp_index).RemoveConsumer(prev_fd);
             }
             close(prev_fd);
             if (CreatedByConnect()) {
@@ -766,6 +852,10 @@ namespace melon {
         // Must clear _read_buf otehrwise even if the connections is recovered,
         // the kept old data is likely to make parsing fail.
         _read_buf.clear();
+        {
+            MELON_SCOPED_LOCK(_recv_mutex);
+            _recv_buf.clear();
+        }
         _ninprocess.store(1, mutil::memory_order_relaxed);
         _auth_flag_error.store(0, mutil::memory_order_relaxed);
         fiber_session_error(_auth_id, 0);
@@ -1044,9 +1134,13 @@ namespace melon {
             sp->RemoveRefManually();
         }
         const int prev_fd = _fd.exchange(-1, mutil::memory_order_relaxed);
+        ReleaseZerocopyWriter(prev_fd);
+        if (_transport) {
+            _transport->Reset();
+        }
         if (ValidFileDescriptor(prev_fd)) {
             if (_on_edge_triggered_events != NULL) {
-                GetGlobalEventDispatcher(prev_fd, _fiber_tag).RemoveConsumer(prev_fd);
+                GetGlobalEventDispatcher(prev_fd, _fiber_tag, _edisp_index).RemoveConsumer(prev_fd);
             }
             close(prev_fd);
             if (create_by_connect) {
@@ -1054,8 +1148,16 @@ namespace melon {
             }
         }
 
+        delete _transport;
+        _transport = NULL;
+        _transport_proto = NULL;
+
         reset_parsing_context(NULL);
         _read_buf.clear();
+        {
+            MELON_SCOPED_LOCK(_recv_mutex);
+            _recv_buf.clear();
+        }
 
         _auth_flag_error.store(0, mutil::memory_order_relaxed);
         fiber_session_error(_auth_id, 0);
@@ -1166,7 +1268,7 @@ namespace melon {
         // Do not need to check addressable since it will be called by
         // health checker which called `SetFailed' before
         const int expected_val = _epollout_butex->load(mutil::memory_order_relaxed);
-        EventDispatcher &edisp = GetGlobalEventDispatcher(fd, _fiber_tag);
+        EventDispatcher &edisp = GetGlobalEventDispatcher(fd, _fiber_tag, _edisp_index);
         if (edisp.AddEpollOut(id(), fd, pollin) != 0) {
             return -1;
         }
@@ -1424,6 +1526,17 @@ namespace melon {
         }
     }
 
+    void Socket::AfterTransportConnected(int err, void *data) {
+        WriteRequest *req = static_cast<WriteRequest *>(data);
+        Socket *const s = req->socket;
+        if (err == 0 && s->_app_connect) {
+            s->_app_connect->StartConnect(s, AfterAppConnected, req);
+        } else {
+            // Successfully created a connection if `err' is 0
+            AfterAppConnected(err, req);
+        }
+    }
+
     static void *RunClosure(void *arg) {
         google::protobuf::Closure *done = (google::protobuf::Closure *) arg;
         done->Run();
@@ -1459,11 +1572,10 @@ namespace melon {
         CHECK_GE(sockfd, 0);
         if (err == 0 && s->CheckConnected(sockfd) == 0
             && s->ResetFileDescriptor(sockfd) == 0) {
-            if (s->_app_connect) {
-                s->_app_connect->StartConnect(req->socket, AfterAppConnected, req);
+            if (s->_transport) {
+                s->_transport->StartConnect(AfterTransportConnected, req);
             } else {
-                // Successfully created a connection
-                AfterAppConnected(0, req);
+                AfterTransportConnected(0, req);
             }
             // Release this socket for KeepWrite
             sockfd.release();
@@ -1587,7 +1699,42 @@ namespace melon {
         return StartWrite(req, opt);
     }
 
+    int Socket::Preconnect() {
+        if (_fd.load(mutil::memory_order_consume) >= 0) {
+            return 0;
+        }
+        // An empty request which is released after the connection is made.
+        WriteRequest *req = mutil::get_object<WriteRequest>();
+        if (!req) {
+            errno = ENOMEM;
+            return -1;
+        }
+        req->next = WriteRequest::UNCONNECTED;
+        req->id_wait = INVALID_FIBER_ID;
+        req->set_pipelined_count_and_user_message(0, DUMMY_USER_MESSAGE, 0);
+        return StartWrite(req, WriteOptions());
+    }
+
+    inline int Socket::cork_us() const {
+        return _cork_us >= 0 ? _cork_us : FLAGS_socket_cork_us;
+    }
+
+    inline int Socket::cork_bytes() const {
+        return _cork_bytes >= 0 ? _cork_bytes : FLAGS_socket_cork_bytes;
+    }
+
+    void Socket::AddCorkedBytes(int64_t nbytes) {
+        const int64_t threshold = cork_bytes();
+        const int64_t prev = _corked_bytes.fetch_add(nbytes, mutil::memory_order_relaxed);
+        if (prev < threshold && prev + nbytes >= threshold) {
+            _cork_butex->fetch_add(1, mutil::memory_order_release);
+            fiber::butex_wake(_cork_butex);
+        }
+    }
+
     int Socket::StartWrite(WriteRequest *req, const WriteOptions &opt) {
+        // `req' may be written and recycled once it's in the list.
+        const int64_t nbytes = req->data.size();
         // Release fence makes sure the thread getting request sees *req
         WriteRequest *const prev_head =
                 _write_head.exchange(req, mutil::memory_order_release);
@@ -1598,6 +1745,9 @@ namespace melon {
             // depending on compiler) that the spin rarely occurs in practice
             // (I've not seen any spin in highly contended tests).
             req->next = prev_head;
+            if (_corking.load(mutil::memory_order_relaxed)) {
+                AddCorkedBytes(nbytes);
+            }
             return 0;
         }
 
@@ -1626,7 +1776,26 @@ namespace melon {
         // in some protocols(namely RTMP).
         req->Setup(this);
 
-        if (opt.write_in_background || ssl_state() != SSL_OFF) {
+        if (!opt.write_in_background && !req->data.empty() &&
+            cork_us() > 0 && (int64_t)req->data.size() < cork_bytes()) {
+            // Wait for concurrent writes in the background rather than
+            // writing the small piece by a syscall on its own.
+            _corked_bytes.store(req->data.size(), mutil::memory_order_relaxed);
+            _corking.store(true, mutil::memory_order_release);
+            g_vars->ncork << 1;
+            ReAddress(&ptr_for_keep_write);
+            req->socket = ptr_for_keep_write.release();
+            if (fiber_start_background(&th, &FIBER_ATTR_NORMAL,
+                                       KeepWriteCorked, req) != 0) {
+                LOG(FATAL) << "Fail to start KeepWriteCorked";
+                _corking.store(false, mutil::memory_order_relaxed);
+                KeepWrite(req);
+            }
+            return 0;
+        }
+
+        if (opt.write_in_background ||
+            (ssl_state() != SSL_OFF && !WriteSSLAsPlain())) {
             // Writing into SSL may block the current fiber, always write
             // in the background.
             goto KEEPWRITE_IN_BACKGROUND;
@@ -1634,11 +1803,20 @@ namespace melon {
 
         // Write once in the calling thread. If the write is not complete,
         // continue it in KeepWrite thread.
-        if (_conn) {
-            mutil::IOBuf *data_arr[1] = {&req->data};
-            nw = _conn->CutMessageIntoFileDescriptor(fd(), data_arr, 1);
+        if (req->data.empty()) {
+            // Nothing to write, see Preconnect().
+            nw = 0;
         } else {
-            nw = req->data.cut_into_file_descriptor(fd());
+            g_vars->nwrite_per_syscall << 1;
+            if (_conn) {
+                mutil::IOBuf *data_arr[1] = {&req->data};
+                nw = _conn->CutMessageIntoFileDescriptor(fd(), data_arr, 1);
+            } else if (_transport) {
+                mutil::IOBuf *data_arr[1] = {&req->data};
+                nw = _transport->Write(data_arr, 1);
+            } else {
+                nw = req->data.cut_into_file_descriptor(fd());
+            }
         }
         if (nw < 0) {
             // RTMP may return EOVERCROWDED
@@ -1679,6 +1857,29 @@ namespace melon {
 
     static const size_t DATA_LIST_MAX = 256;
 
+    void *Socket::KeepWriteCorked(void *void_arg) {
+        WriteRequest *req = static_cast<WriteRequest *>(void_arg);
+        Socket *const s = req->socket;
+        const int64_t threshold = s->cork_bytes();
+        const timespec duetime = mutil::microseconds_from_now(s->cork_us());
+        while (s->_corked_bytes.load(mutil::memory_order_relaxed) < threshold) {
+            const int expected_val = s->_cork_butex->load(mutil::memory_order_acquire);
+            if (s->_corked_bytes.load(mutil::memory_order_relaxed) >= threshold) {
+                break;
+            }
+            if (fiber::butex_wait(s->_cork_butex, expected_val, &duetime) < 0 &&
+                errno == ETIMEDOUT) {
+                break;
+            }
+        }
+        s->_corking.store(false, mutil::memory_order_relaxed);
+        // Link requests queued during corking after `req' so that they're
+        // written together by the first DoWrite in KeepWrite.
+        WriteRequest *tail = NULL;
+        s->IsWriteComplete(req, true, &tail);
+        return KeepWrite(void_arg);
+    }
+
     void *Socket::KeepWrite(void *void_arg) {
         g_vars->nkeepwrite << 1;
         WriteRequest *req = static_cast<WriteRequest *>(void_arg);
@@ -1695,7 +1896,8 @@ namespace melon {
                 req = req->next;
                 s->ReturnSuccessfulWriteRequest(saved_req);
             }
-            const ssize_t nw = s->DoWrite(req);
+            // Only the last request can be empty here, see Preconnect().
+            const ssize_t nw = req->data.empty() ? 0 : s->DoWrite(req);
             if (nw < 0) {
                 if (errno != EAGAIN && errno != EOVERCROWDED) {
                     const int saved_errno = errno;
@@ -1728,7 +1930,9 @@ namespace melon {
                         mutil::milliseconds_from_now(WAIT_EPOLLOUT_TIMEOUT_MS);
                 g_vars->nwaitepollout << 1;
                 bool pollin = (s->_on_edge_triggered_events != NULL);
-                const int rc = s->WaitEpollOut(s->fd(), pollin, &duetime);
+                const int rc = s->_transport ?
+                               s->_transport->WaitWritable(&duetime) :
+                               s->WaitEpollOut(s->fd(), pollin, &duetime);
                 if (rc < 0 && errno != ETIMEDOUT) {
                     const int saved_errno = errno;
                     PLOG(WARNING) << "Fail to wait epollout of " << *s;
@@ -1755,6 +1959,57 @@ namespace melon {
         return NULL;
     }
 
+    ZerocopyWriter *Socket::GetZerocopyWriter(mutil::IOBuf *const *data_list,
+                                              size_t ndata) {
+        ZerocopyWriter *zc = _zerocopy.load(mutil::memory_order_relaxed);
+        const int min_size = FLAGS_socket_zerocopy_min_size;
+        if (min_size <= 0 || _zerocopy_unsupported) {
+            // Blocks of previous sends are still waited to be released.
+            if (zc != NULL && zc->pending_bytes() > 0) {
+                zc->ReapCompletions(fd());
+            }
+            return NULL;
+        }
+        size_t nbytes = 0;
+        for (size_t i = 0; i < ndata && nbytes < (size_t) min_size; ++i) {
+            nbytes += data_list[i]->size();
+        }
+        if (nbytes < (size_t) min_size) {
+            if (zc != NULL && zc->pending_bytes() > 0) {
+                zc->ReapCompletions(fd());
+            }
+            return NULL;
+        }
+        if (zc == NULL) {
+            if (ZerocopyWriter::EnableOnFd(fd()) != 0) {
+                RPC_VLOG << "Fail to enable SO_ZEROCOPY on " << *this << ": "
+                         << berror();
+                _zerocopy_unsupported = true;
+                return NULL;
+            }
+            zc = new ZerocopyWriter;
+            _zerocopy.store(zc, mutil::memory_order_release);
+        }
+        return zc;
+    }
+
+    void Socket::ReleaseZerocopyWriter(int prev_fd) {
+        ZerocopyWriter *zc = _zerocopy.exchange(NULL, mutil::memory_order_relaxed);
+        if (zc == NULL) {
+            return;
+        }
+        if (zc->pending_bytes() > 0 && ValidFileDescriptor(prev_fd)) {
+            // The kernel still references blocks of unfinished zerocopy
+            // sends, keep them until the sends complete on a dup of the fd.
+            const int dup_fd = dup(prev_fd);
+            if (dup_fd >= 0) {
+                ZerocopyWriter::DrainAndDestroy(zc, dup_fd);
+                return;
+            }
+        }
+        delete zc;
+    }
+
     ssize_t Socket::DoWrite(WriteRequest *req) {
         // Group mutil::IOBuf in the list into a batch array.
         mutil::IOBuf *data_list[DATA_LIST_MAX];
@@ -1763,18 +2018,33 @@ namespace melon {
              p = p->next) {
             data_list[ndata++] = &p->data;
         }
+        g_vars->nwrite_per_syscall << ndata;
+        if (_transport) {
+            return _transport->Write(data_list, ndata);
+        }
+        return DoWriteToFd(data_list, ndata);
+    }
 
+    ssize_t Socket::DoWriteToFd(mutil::IOBuf **data_list, size_t ndata) {
         if (ssl_state() == SSL_OFF) {
             // Write IOBuf in the batch array into the fd.
             if (_conn) {
                 return _conn->CutMessageIntoFileDescriptor(fd(), data_list, ndata);
-            } else {
-                return mutil::IOBuf::cut_multiple_into_file_descriptor(
-                        fd(), data_list, ndata);
             }
+            ZerocopyWriter *zc = GetZerocopyWriter(data_list, ndata);
+            if (zc != NULL) {
+                return zc->CutMultipleIntoFileDescriptor(fd(), data_list, ndata);
+            }
+            return mutil::IOBuf::cut_multiple_into_file_descriptor(
+                    fd(), data_list, ndata);
         }
 
         CHECK_EQ(SSL_CONNECTED, ssl_state());
+        if (WriteSSLAsPlain()) {
+            // The kernel wraps written bytes into application data records.
+            return mutil::IOBuf::cut_multiple_into_file_descriptor(
+                    fd(), data_list, ndata);
+        }
         if (_conn) {
             // TODO: Separate SSL stuff from SocketConnection
             MELON_SCOPED_LOCK(_ssl_session_mutex);
@@ -1840,6 +2110,12 @@ namespace melon {
         }
 #endif
 
+        if (FLAGS_ssl_use_ktls) {
+            EnableKTLS(_ssl_session);
+        }
+        _ktls_send = false;
+        _ktls_recv = false;
+
         _ssl_state = SSL_CONNECTING;
 
         // Loop until SSL handshake has completed. For SSL_ERROR_WANT_READ/WRITE,
@@ -1876,6 +2152,8 @@ namespace melon {
                     }
                 }
 
+                _ktls_send = IsKTLSSendEnabled(_ssl_session);
+                _ktls_recv = IsKTLSRecvEnabled(_ssl_session);
                 _ssl_state = SSL_CONNECTED;
                 AddBIOBuffer(_ssl_session, fd, FLAGS_ssl_bio_buffer_size);
                 return 0;
@@ -1920,7 +2198,85 @@ namespace melon {
         }
     }
 
+    bool Socket::ReadFromDispatcher(ssize_t *nr) {
+        MELON_SCOPED_LOCK(_recv_mutex);
+        if (!_recv_buf.empty()) {
+            *nr = _recv_buf.size();
+            _read_buf.append(_recv_buf);
+            _recv_buf.clear();
+            return true;
+        }
+        if (_recv_error != 0) {
+            if (_recv_error < 0) {  // EOF
+                *nr = 0;
+            } else {
+                errno = _recv_error;
+                *nr = -1;
+            }
+            return true;
+        }
+        if (_recv_fallback) {
+            return false;
+        }
+        errno = EAGAIN;
+        *nr = -1;
+        return true;
+    }
+
     ssize_t Socket::DoRead(size_t size_hint) {
+        if (_recv_in_dispatcher.load(mutil::memory_order_acquire)) {
+            // Reap notifications of zerocopy sends as DoReadFromFd() does,
+            // the dispatcher wakes up the socket when data is received.
+            ZerocopyWriter *zc = _zerocopy.load(mutil::memory_order_acquire);
+            if (zc != NULL && zc->pending_bytes() > 0) {
+                zc->ReapCompletions(fd());
+            }
+            // SSL is never enabled on such sockets.
+            ssize_t nr = -1;
+            if (ReadFromDispatcher(&nr)) {
+                return nr;
+            }
+            // The dispatcher stopped receiving, read the fd until it's
+            // drained and then let the dispatcher receive again.
+            nr = DoReadFromFd(size_hint);
+            if (nr < 0 && errno == EAGAIN) {
+                ResumeRecvInDispatcher();
+                errno = EAGAIN;
+            }
+            return nr;
+        }
+        if (_transport != NULL) {
+            return _transport->Read(size_hint);
+        }
+        return DoReadFromFd(size_hint);
+    }
+
+    void Socket::ResumeRecvInDispatcher() {
+        uint32_t recv_generation = 0;
+        {
+            MELON_SCOPED_LOCK(_recv_mutex);
+            if (!_recv_fallback) {
+                return;
+            }
+            // Clear before resuming since the dispatcher may stop receiving
+            // again right after.
+            _recv_fallback = false;
+            recv_generation = _recv_generation;
+        }
+        EventDispatcher &edisp = GetGlobalEventDispatcher(fd(), _fiber_tag, _edisp_index);
+        const int rc = edisp.ResumeRecv(id(), fd(), recv_generation);
+        if (rc == 0) {
+            return;
+        }
+        if (rc < 0) {
+            // Read the fd by ourselves from now on.
+            _recv_in_dispatcher.store(false, mutil::memory_order_relaxed);
+        }
+        MELON_SCOPED_LOCK(_recv_mutex);
+        _recv_fallback = true;
+    }
+
+    ssize_t Socket::DoReadFromFd(size_t size_hint) {
         if (ssl_state() == SSL_UNKNOWN) {
             int error_code = 0;
             _ssl_state = DetectSSLState(fd(), &error_code);
@@ -1955,10 +2311,24 @@ namespace melon {
                 return -1;
             }
             CHECK(_rdma_state == RDMA_OFF);
+            // Notifications of zerocopy sends wake up the socket by EPOLLERR.
+            ZerocopyWriter *zc = _zerocopy.load(mutil::memory_order_acquire);
+            if (zc != NULL && zc->pending_bytes() > 0) {
+                zc->ReapCompletions(fd());
+            }
             return _read_buf.append_from_file_descriptor(fd(), size_hint);
         }
 
         CHECK_EQ(SSL_CONNECTED, ssl_state());
+        if (_ktls_recv) {
+            const ssize_t nr = _read_buf.append_from_file_descriptor(fd(), size_hint);
+            // Plain reads fail with EIO at records other than application
+            // data (alerts, session tickets, key updates...) which are
+            // handled by OpenSSL below.
+            if (nr >= 0 || errno != EIO) {
+                return nr;
+            }
+        }
         int ssl_error = 0;
         ssize_t nr = 0;
         {
@@ -2069,6 +2439,42 @@ namespace melon {
             return -1;
         }
 
+        return StartProcessEvent(s, thread_attr);
+    }
+
+    int Socket::StartInputEventWithData(SocketId id, uint32_t recv_generation,
+                                        mutil::IOBuf *data, int error_code,
+                                        const fiber_attr_t &thread_attr,
+                                        bool stop_recv) {
+        SocketUniquePtr s;
+        if (Address(id, &s) < 0) {
+            return -1;
+        }
+        bool full = false;
+        {
+            MELON_SCOPED_LOCK(s->_recv_mutex);
+            if (s->_recv_generation != recv_generation) {
+                // The fd was reset, even if the new fd has the same number,
+                // `data' belongs to the previous connection.
+                return -1;
+            }
+            if (data != NULL && !data->empty()) {
+                s->_recv_buf.append(*data);
+                data->clear();
+            }
+            if (error_code != 0 && s->_recv_error == 0) {
+                s->_recv_error = error_code;
+            }
+            if (stop_recv) {
+                s->_recv_fallback = true;
+            }
+            full = (s->_recv_buf.size() >= (size_t) FLAGS_socket_max_unconsumed_recv_bytes);
+        }
+        StartProcessEvent(s, thread_attr);
+        return full ? 1 : 0;
+    }
+
+    int Socket::StartProcessEvent(SocketUniquePtr &s, const fiber_attr_t &thread_attr) {
         // if (events & has_epollrdhup) {
         //     s->_eof = 1;
         // }
@@ -2182,7 +2588,13 @@ namespace melon {
                 os << "]\n  numfree="
                    << pool->_numfree.load(mutil::memory_order_relaxed)
                    << "\n  numinflight="
-                   << pool->_numinflight.load(mutil::memory_order_relaxed);
+                   << pool->_numinflight.load(mutil::memory_order_relaxed)
+                   << "\n  min_size="
+                   << pool->_min_size.load(mutil::memory_order_relaxed)
+                   << "\n  nhit=" << pool->_nhit.load(mutil::memory_order_relaxed)
+                   << "\n  nmiss=" << pool->_nmiss.load(mutil::memory_order_relaxed)
+                   << "\n  npreconnect="
+                   << pool->_npreconnect.load(mutil::memory_order_relaxed);
             } else {
                 os << "null";
             }
@@ -2214,6 +2626,7 @@ namespace melon {
         const int64_t cpuwide_now = mutil::cpuwide_time_us();
         os << "\nhc_count=" << ptr->_hc_count
            << "\navg_input_msg_size=" << ptr->_avg_msg_size
+           << "\nread_size_hint=" << ptr->_read_size_hint
            // NOTE: We're assuming that mutil::IOBuf.size() is thread-safe, it is now
            // however it's not guaranteed.
            << "\nread_buf=" << ptr->_read_buf.size()
@@ -2264,6 +2677,8 @@ namespace melon {
         }
         os << "\ncid=" << ptr->_correlation_id
            << "\nwrite_head=" << ptr->_write_head.load(mutil::memory_order_relaxed)
+           << "\ncork_us=" << ptr->cork_us()
+           << "\ncork_bytes=" << ptr->cork_bytes()
            << "\nssl_state=" << SSLStateToString(ssl_state);
         const SocketSSLContext *ssl_ctx = ptr->_ssl_ctx.get();
         if (ssl_ctx) {
@@ -2272,7 +2687,18 @@ namespace melon {
                 os << "\nsni_name=" << ssl_ctx->sni_name;
             }
         }
+        const ZerocopyWriter *zc = ptr->_zerocopy.load(mutil::memory_order_acquire);
+        if (zc != NULL) {
+            zc->Describe(os);
+        }
+        if (ptr->_transport) {
+            os << "\ntransport={";
+            ptr->_transport->Describe(os);
+            os << '}';
+        }
         if (ssl_state == SSL_CONNECTED) {
+            os << "\nktls_send=" << ptr->_ktls_send
+               << "\nktls_recv=" << ptr->_ktls_recv;
             os << "\nssl_session={\n  ";
             Print(os, ptr->_ssl_session, "\n  ");
             os << "\n}";
@@ -2455,7 +2881,8 @@ namespace melon {
 ////////// SocketPool //////////////
 
     inline SocketPool::SocketPool(const SocketOptions &opt)
-            : _options(opt), _remote_side(opt.remote_side), _numfree(0), _numinflight(0) {
+            : _options(opt), _remote_side(opt.remote_side), _numfree(0), _numinflight(0), _min_size(0),
+              _nhit(0), _nmiss(0), _npreconnect(0), _last_nmiss(0) {
     }
 
     inline SocketPool::~SocketPool() {
@@ -2500,12 +2927,14 @@ namespace melon {
                 // Not address inside the lock since at most time the pooled socket
                 // is likely to be valid.
                 if (Socket::Address(sid, ptr) == 0) {
+                    _nhit.fetch_add(1, mutil::memory_order_relaxed);
                     _numinflight.fetch_add(1, mutil::memory_order_relaxed);
                     return 0;
                 }
             }
         }
         // Not found in pool
+        _nmiss.fetch_add(1, mutil::memory_order_relaxed);
         SocketOptions opt = _options;
         opt.health_check_interval_s = -1;
         if (get_client_side_messenger()->Create(opt, &sid) == 0 &&
@@ -2558,6 +2987,70 @@ namespace melon {
         _mutex.unlock();
     }
 
+    void SocketPool::Warmup(int min_size) {
+        int cur = _min_size.load(mutil::memory_order_relaxed);
+        while (min_size > cur && !_min_size.compare_exchange_weak(
+                cur, min_size, mutil::memory_order_relaxed)) {}
+        Preconnect(std::min(min_size, FLAGS_max_connection_pool_size)
+                   - _numfree.load(mutil::memory_order_relaxed)
+                   - _numinflight.load(mutil::memory_order_relaxed));
+    }
+
+    void SocketPool::Preconnect(int n) {
+        for (; n > 0; --n) {
+            SocketOptions opt = _options;
+            opt.health_check_interval_s = -1;
+            SocketId sid;
+            SocketUniquePtr ptr;
+            if (get_client_side_messenger()->Create(opt, &sid) != 0 ||
+                Socket::Address(sid, &ptr) != 0) {
+                return;
+            }
+            // Connections failed later are removed in Maintain().
+            if (ptr->Preconnect() != 0) {
+                return;
+            }
+            _npreconnect.fetch_add(1, mutil::memory_order_relaxed);
+            _numfree.fetch_add(1, mutil::memory_order_relaxed);
+            MELON_SCOPED_LOCK(_mutex);
+            _pool.push_back(sid);
+        }
+    }
+
+    int SocketPool::Maintain() {
+        std::vector<SocketId> ids;
+        ListSockets(&ids, 0);
+        for (size_t i = 0; i < ids.size(); ++i) {
+            SocketUniquePtr ptr;
+            if (Socket::Address(ids[i], &ptr) == 0) {
+                continue;
+            }
+            std::unique_lock<mutil::Mutex> mu(_mutex);
+            std::vector<SocketId>::iterator it =
+                    std::find(_pool.begin(), _pool.end(), ids[i]);
+            if (it != _pool.end()) {
+                _pool.erase(it);
+                mu.unlock();
+                _numfree.fetch_sub(1, mutil::memory_order_relaxed);
+            }
+        }
+        const int max_size = FLAGS_max_connection_pool_size;
+        const int min_size = std::min(_min_size.load(mutil::memory_order_relaxed), max_size);
+        const int total = _numfree.load(mutil::memory_order_relaxed)
+                          + _numinflight.load(mutil::memory_order_relaxed);
+        const int64_t nmiss = _nmiss.load(mutil::memory_order_relaxed);
+        int n = min_size - total;
+        if (nmiss > _last_nmiss && _numfree.load(mutil::memory_order_relaxed) == 0) {
+            // Requests connected by themselves since last round and all
+            // connections are still in use: the concurrency is growing, grow
+            // the pool by as many connections ahead of the requests.
+            n = std::max<int>(n, std::min<int64_t>(nmiss - _last_nmiss, max_size - total));
+        }
+        _last_nmiss = nmiss;
+        Preconnect(n);
+        return min_size;
+    }
+
     Socket::SharedPart *Socket::GetOrNewSharedPartSlower() {
         // Create _shared_part optimistically.
         SharedPart *shared_part = GetSharedPart();
@@ -2585,15 +3078,11 @@ namespace melon {
         }
     }
 
-    int Socket::GetPooledSocket(SocketUniquePtr *pooled_socket) {
-        if (pooled_socket == NULL) {
-            LOG(ERROR) << "pooled_socket is NULL";
-            return -1;
-        }
+    SocketPool *Socket::GetOrNewSocketPool() {
         SharedPart *main_sp = GetOrNewSharedPart();
         if (main_sp == NULL) {
             LOG(ERROR) << "_shared_part is NULL";
-            return -1;
+            return NULL;
         }
         // Create socket_pool optimistically.
         SocketPool *socket_pool = main_sp->socket_pool.load(mutil::memory_order_consume);
@@ -2606,6 +3095,7 @@ namespace melon {
             opt.keytable_pool = _keytable_pool;
             opt.app_connect = _app_connect;
             opt.use_rdma = (_rdma_ep) ? true : false;
+            opt.transport = _transport_proto;
             socket_pool = new SocketPool(opt);
             SocketPool *expected = NULL;
             if (!main_sp->socket_pool.compare_exchange_strong(
@@ -2615,6 +3105,18 @@ namespace melon {
                 socket_pool = expected;
             }
         }
+        return socket_pool;
+    }
+
+    int Socket::GetPooledSocket(SocketUniquePtr *pooled_socket) {
+        if (pooled_socket == NULL) {
+            LOG(ERROR) << "pooled_socket is NULL";
+            return -1;
+        }
+        SocketPool *socket_pool = GetOrNewSocketPool();
+        if (socket_pool == NULL) {
+            return -1;
+        }
         if (socket_pool->GetSocket(pooled_socket) != 0) {
             return -1;
         }
@@ -2693,6 +3195,41 @@ namespace melon {
         return true;
     }
 
+    bool Socket::GetPooledSocketHits(int64_t *nhit, int64_t *nmiss) {
+        SharedPart *sp = GetSharedPart();
+        if (sp == NULL) {
+            return false;
+        }
+        SocketPool *pool = sp->socket_pool.load(mutil::memory_order_consume);
+        if (pool == NULL) {
+            return false;
+        }
+        *nhit = pool->_nhit.load(mutil::memory_order_relaxed);
+        *nmiss = pool->_nmiss.load(mutil::memory_order_relaxed);
+        return true;
+    }
+
+    int Socket::WarmupPooledSockets(int min_count) {
+        SocketPool *pool = GetOrNewSocketPool();
+        if (pool == NULL) {
+            return -1;
+        }
+        pool->Warmup(min_count);
+        return 0;
+    }
+
+    int Socket::MaintainSocketPool() {
+        SharedPart *sp = GetSharedPart();
+        if (sp == NULL) {
+            return 0;
+        }
+        SocketPool *pool = sp->socket_pool.load(mutil::memory_order_consume);
+        if (pool == NULL) {
+            return 0;
+        }
+        return pool->Maintain();
+    }
+
     int Socket::GetShortSocket(SocketUniquePtr *short_socket) {
         if (short_socket == NULL) {
             LOG(ERROR) << "short_socket is NULL";
@@ -2707,6 +3244,7 @@ namespace melon {
         opt.keytable_pool = _keytable_pool;
         opt.app_connect = _app_connect;
         opt.use_rdma = (_rdma_ep) ? true : false;
+        opt.transport = _transport_proto;
         if (get_client_side_messenger()->Create(opt, &id) != 0 ||
             Socket::Address(id, short_socket) != 0) {
             return -1;
@@ -59,12 +59,20 @@ namespace melon {
 
     class Socket;
 
+    class Transport;
+
+    class SocketPool;
+
     class AuthContext;
 
     class EventDispatcher;
 
     class Stream;
 
+    class GrpcStream;
+
+    class ZerocopyWriter;
+
 // A special closure for processing the about-to-recycle socket. Socket does
 // not delete SocketUser, if you want, `delete this' at the end of
 // BeforeRecycle().
@@ -146,7 +154,8 @@ namespace melon {
                 : nsocket("rpc_socket_count"), channel_conn("rpc_channel_connection_count"),
                   neventthread_second("rpc_event_thread_second", &neventthread), nhealthcheck("rpc_health_check_count"),
                   nkeepwrite_second("rpc_keepwrite_second", &nkeepwrite), nwaitepollout("rpc_waitepollout_count"),
-                  nwaitepollout_second("rpc_waitepollout_second", &nwaitepollout) {}
+                  nwaitepollout_second("rpc_waitepollout_second", &nwaitepollout),
+                  ncork("rpc_socket_cork_count"), nwrite_per_syscall("rpc_socket_write_per_syscall") {}
 
         melon::var::Adder<int64_t> nsocket;
         melon::var::Adder<int64_t> channel_conn;
@@ -157,6 +166,9 @@ namespace melon {
         melon::var::PerSecond<melon::var::Adder<int64_t> > nkeepwrite_second;
         melon::var::Adder<int64_t> nwaitepollout;
         melon::var::PerSecond<melon::var::Adder<int64_t> > nwaitepollout_second;
+        melon::var::Adder<int64_t> ncork;
+        // Average number of WriteRequests written by one syscall.
+        melon::var::IntRecorder nwrite_per_syscall;
     };
 
     struct PipelinedInfo {
@@ -219,6 +231,10 @@ namespace melon {
         bool force_ssl;
         std::shared_ptr<SocketSSLContext> initial_ssl_ctx;
         bool use_rdma;
+        // Prototype of the Transport moving bytes of the socket, usually
+        // found in TransportExtension(). NULL means reading and writing the
+        // fd directly.
+        const Transport *transport;
         fiber_keytable_pool_t *keytable_pool;
         SocketConnection *conn;
         std::shared_ptr<AppConnect> app_connect;
@@ -230,6 +246,16 @@ namespace melon {
         std::shared_ptr<SocketKeepaliveOptions> keepalive_options;
         // Tag of this socket
         fiber_tag_t fiber_tag;
+        // Events of `fd' are handled by this one of -event_dispatcher_num
+        // dispatchers of `fiber_tag'. Negative to pick one by hashing fd.
+        int event_dispatcher_index;
+        // A small write which gets the right to write waits for at most so
+        // many microseconds(or until concurrent writes have queued
+        // `cork_bytes' bytes) so that they're written by one syscall.
+        // 0 disables corking, negative values use -socket_cork_us and
+        // -socket_cork_bytes.
+        int cork_us;
+        int cork_bytes;
     };
 
 // Abstractions on reading from and writing into file descriptors.
@@ -247,6 +273,8 @@ namespace melon {
 
         friend class Stream;
 
+        friend class GrpcStream;
+
         friend class Controller;
 
         friend class policy::ConsistentHashingLoadBalancer;
@@ -259,6 +287,8 @@ namespace melon {
 
         friend class rdma::RdmaConnect;
 
+        friend class Transport;
+
         friend class HealthCheckTask;
 
         friend class OnAppHealthCheckDone;
@@ -537,6 +567,10 @@ namespace melon {
 
         void CheckEOF();
 
+        fiber_tag_t fiber_tag() const { return _fiber_tag; }
+
+        int event_dispatcher_index() const { return _edisp_index; }
+
         SSLState ssl_state() const { return _ssl_state; }
 
         bool is_ssl() const { return ssl_state() == SSL_CONNECTED; }
@@ -569,6 +603,26 @@ namespace melon {
         // Return true on success
         bool GetPooledSocketStats(int *numfree, int *numinflight);
 
+        // Get how many times GetPooledSocket() reused a connection(hit) or
+        // created a new one(miss). Return true on success
+        bool GetPooledSocketHits(int64_t *nhit, int64_t *nmiss);
+
+        // Keep at least `min_count' connections in the pool of this main
+        // socket. Missing ones are connected in background so that requests
+        // after an idle period don't pay for handshakes. The largest value
+        // ever set is kept. Returns 0 on success, -1 otherwise.
+        int WarmupPooledSockets(int min_count);
+
+        // Reconnect broken warm connections of the pool, or connect more in
+        // advance when the concurrency outgrows the pool, and return how
+        // many idle pooled connections should be kept. Called periodically
+        // by SocketMap.
+        int MaintainSocketPool();
+
+        // Connect this socket in background if it's not connected, as if
+        // something was written. Returns 0 on success, -1 otherwise.
+        int Preconnect();
+
         // Create a socket connecting to the same place as this socket.
         int GetShortSocket(SocketUniquePtr *short_socket);
 
@@ -661,16 +715,47 @@ namespace melon {
         // Returns 0 on success, -1 otherwise
         int SSLHandshake(int fd, bool server_mode);
 
+        // Read data into `_read_buf' from the Transport if it's set, from
+        // the fd otherwise. Returns read bytes on success, 0 on EOF, -1
+        // otherwise and errno is set
+        ssize_t DoRead(size_t size_hint);
+
         // Based upon whether the underlying channel is using SSL (if
         // SSLState is SSL_UNKNOWN, try to detect at first), read data
-        // using the corresponding method into `_read_buf'. Returns read
-        // bytes on success, 0 on EOF, -1 otherwise and errno is set
-        ssize_t DoRead(size_t size_hint);
+        // from the fd using the corresponding method into `_read_buf'.
+        ssize_t DoReadFromFd(size_t size_hint);
+
+        // Move data received by EventDispatcher into `_read_buf'. Returns
+        // false if the dispatcher stopped receiving for this socket and
+        // the caller should read the fd by itself, otherwise `*nr' is set
+        // in the same way as return value of DoRead.
+        bool ReadFromDispatcher(ssize_t *nr);
+
+        // Called after the fd is drained by the socket itself, let the
+        // dispatcher receive data again.
+        void ResumeRecvInDispatcher();
+
+        // Write `req' and following requests into the Transport if it's
+        // set, into the fd otherwise. Returns written bytes on success, -1
+        // otherwise and errno is set
+        ssize_t DoWrite(WriteRequest *req);
 
         // Based upon whether the underlying channel is using SSL, write
-        // `req' using the corresponding method. Returns written bytes on
-        // success, -1 otherwise and errno is set
-        ssize_t DoWrite(WriteRequest *req);
+        // `data_list' into the fd using the corresponding method.
+        ssize_t DoWriteToFd(mutil::IOBuf **data_list, size_t ndata);
+
+        // True if data can be written into the fd of an SSL connection
+        // directly, namely records are sent by kTLS.
+        bool WriteSSLAsPlain() const {
+            return _ssl_state == SSL_CONNECTED && _ktls_send && _conn == NULL;
+        }
+
+        // Get the writer for sending `data_list' with MSG_ZEROCOPY, NULL
+        // when the data should be written by copying.
+        ZerocopyWriter *GetZerocopyWriter(mutil::IOBuf *const *data_list, size_t ndata);
+
+        // Detach the zerocopy writer before `prev_fd' is closed.
+        void ReleaseZerocopyWriter(int prev_fd);
 
         // Called before returning to pool.
         void OnRecycle();
@@ -714,6 +799,17 @@ namespace melon {
 
         static void *KeepWrite(void *);
 
+        // Wait for more WriteRequests to cork and then KeepWrite.
+        static void *KeepWriteCorked(void *);
+
+        // Wake up the corking writer if `_corked_bytes' reaches the threshold
+        // after adding `nbytes'.
+        void AddCorkedBytes(int64_t nbytes);
+
+        // Corking options of this socket, see SocketOptions.cork_us.
+        int cork_us() const;
+        int cork_bytes() const;
+
         bool IsWriteComplete(WriteRequest *old_head, bool singular_node,
                              WriteRequest **new_tail);
 
@@ -733,6 +829,26 @@ namespace melon {
         // Generic callback for Socket to handle epollout event
         static int HandleEpollOut(SocketId socket_id);
 
+        // Called by EventDispatcher receiving data of the fd by itself.
+        // `recv_generation' is the one given to EventDispatcher::AddConsumer,
+        // calls for previous fds of the socket are ignored.
+        // Data in `data' (if not NULL) is moved to the socket, `error_code'
+        // is errno of the failed receiving or -1 on EOF. If `stop_recv' is
+        // true, the socket reads the fd by itself after consuming data
+        // received before, until it drains the fd and resumes receiving of
+        // the dispatcher.
+        // Returns 0 on success, 1 if the socket has more than
+        // -socket_max_unconsumed_recv_bytes data not consumed and the
+        // dispatcher should stop receiving, -1 otherwise.
+        static int StartInputEventWithData(SocketId id, uint32_t recv_generation,
+                                           mutil::IOBuf *data,
+                                           int error_code,
+                                           const fiber_attr_t &thread_attr,
+                                           bool stop_recv = false);
+
+        // Start ProcessEvent in a fiber if no one is processing events of `s'.
+        static int StartProcessEvent(SocketUniquePtr &s, const fiber_attr_t &thread_attr);
+
         class EpollOutRequest;
 
         // Callback to handle epollout event whose request data
@@ -750,6 +866,8 @@ namespace melon {
 
         static void AfterAppConnected(int err, void *data);
 
+        static void AfterTransportConnected(int err, void *data);
+
         static void CreateVarsOnce();
 
         // Default impl. of health checking.
@@ -782,6 +900,10 @@ namespace melon {
 
         SharedPart *GetOrNewSharedPartSlower();
 
+        // Get the pool of pooled sockets of this main socket, create it if
+        // absent. Returns NULL on error.
+        SocketPool *GetOrNewSocketPool();
+
         void CheckEOFInternal();
 
         // _error_code is set after a socket becomes failed, during the time
@@ -824,6 +946,7 @@ namespace melon {
         // [ Set in ResetFileDescriptor ]
         mutil::atomic<int> _fd;  // -1 when not connected.
         fiber_tag_t _fiber_tag;  // fiber tag of this socket
+        int _edisp_index;        // SocketOptions.event_dispatcher_index
         int _tos;                // Type of service which is actually only 8bits.
         int64_t _reset_fd_real_us; // When _fd was reset, in microseconds.
 
@@ -864,10 +987,33 @@ namespace melon {
         uint32_t _last_msg_size;
         // Average message size of last #MSG_SIZE_WINDOW messages (roughly)
         uint32_t _avg_msg_size;
+        // Bytes to read at least in next read, grows when reads fill the
+        // buffer (bulk data or deep pipelines) and shrinks on short reads.
+        uint32_t _read_size_hint;
 
         // Storing data read from `_fd' but cut-off yet.
         mutil::IOPortal _read_buf;
 
+        // True if data of `_fd' is received by EventDispatcher and appended
+        // into `_recv_buf' instead of being read by this socket.
+        mutil::atomic<bool> _recv_in_dispatcher;
+        mutil::Mutex _recv_mutex;
+        mutil::IOBuf _recv_buf;
+        // errno of receiving in EventDispatcher, -1 on EOF.
+        int _recv_error;
+        // EventDispatcher stopped receiving, read `_fd' after `_recv_buf'.
+        bool _recv_fallback;
+        // Increased each time `_fd' is added into EventDispatcher with
+        // receiving on. A SocketId is kept when the connection is re-created,
+        // data received from previous fds carry older generations.
+        uint32_t _recv_generation;
+
+        // Sends large writes with MSG_ZEROCOPY, created by the writing fiber
+        // when a write reaches -socket_zerocopy_min_size for the first time.
+        mutil::atomic<ZerocopyWriter *> _zerocopy;
+        // `_fd' does not support SO_ZEROCOPY. Only accessed by the writer.
+        bool _zerocopy_unsupported;
+
         // Set with cpuwide_time_us() at last read operation
         mutil::atomic<int64_t> _last_readtime_us;
 
@@ -920,12 +1066,21 @@ namespace melon {
         mutable mutil::Mutex _ssl_session_mutex;
         SSL *_ssl_session;               // owner
         std::shared_ptr<SocketSSLContext> _ssl_ctx;
+        // Records of `_ssl_session' are encrypted/decrypted by the kernel,
+        // application data go through the plain fd instead of SSL_write/read.
+        bool _ktls_send;
+        bool _ktls_recv;
 
         // The RdmaEndpoint
         rdma::RdmaEndpoint *_rdma_ep;
         // Should use RDMA or not
         RdmaState _rdma_state;
 
+        // Non-NULL if bytes of the socket go through a Transport instead of
+        // the fd, created by `_transport_proto'.
+        Transport *_transport;
+        const Transport *_transport_proto;
+
         // Pass from controller, for progressive reading.
         ConnectionType _connection_type_for_progressive_read;
         mutil::atomic<bool> _controller_released_socket;
@@ -979,6 +1134,16 @@ namespace melon {
         // Storing data that are not flushed into `fd' yet.
         mutil::atomic<WriteRequest *> _write_head;
 
+        // SocketOptions.cork_us/cork_bytes
+        int _cork_us;
+        int _cork_bytes;
+        // True when the writer is waiting for more WriteRequests.
+        mutil::atomic<bool> _corking;
+        // Bytes queued since corking started.
+        mutil::atomic<int64_t> _corked_bytes;
+        // Butex to wake up the corking writer.
+        mutil::atomic<int> *_cork_butex;
+
         mutil::Mutex _stream_mutex;
         std::set<StreamId> *_stream_set;
         mutil::atomic<int64_t> _total_streams_unconsumed_size;
@@ -62,11 +62,15 @@ inline SocketOptions::SocketOptions()
     , health_check_interval_s(-1)
     , force_ssl(false)
     , use_rdma(false)
+    , transport(NULL)
     , keytable_pool(NULL)
     , conn(NULL)
     , app_connect(NULL)
     , initial_parsing_context(NULL)
     , fiber_tag(FIBER_TAG_DEFAULT)
+    , event_dispatcher_index(-1)
+    , cork_us(-1)
+    , cork_bytes(-1)
 {}
 
 inline int Socket::Dereference() {
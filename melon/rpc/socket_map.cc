@@ -21,6 +21,7 @@
 
 #include <gflags/gflags.h>
 #include <map>
+#include <algorithm>
 #include <melon/fiber/fiber.h>
 #include <melon/utility/time.h>
 #include <melon/utility/scoped_lock.h>
@@ -94,8 +95,8 @@ SocketMap* get_or_new_client_side_socket_map() {
 
 int SocketMapInsert(const SocketMapKey& key, SocketId* id,
                     const std::shared_ptr<SocketSSLContext>& ssl_ctx,
-                    bool use_rdma) {
-    return get_or_new_client_side_socket_map()->Insert(key, id, ssl_ctx, use_rdma);
+                    bool use_rdma, const Transport* transport) {
+    return get_or_new_client_side_socket_map()->Insert(key, id, ssl_ctx, use_rdma, transport);
 }    
 
 int SocketMapFind(const SocketMapKey& key, SocketId* id) {
@@ -228,7 +229,7 @@ void SocketMap::ShowSocketMapInVarIfNeed() {
 
 int SocketMap::Insert(const SocketMapKey& key, SocketId* id,
                       const std::shared_ptr<SocketSSLContext>& ssl_ctx,
-                      bool use_rdma) {
+                      bool use_rdma, const Transport* transport) {
     ShowSocketMapInVarIfNeed();
 
     std::unique_lock<mutil::Mutex> mu(_mutex);
@@ -253,6 +254,7 @@ int SocketMap::Insert(const SocketMapKey& key, SocketId* id,
     opt.remote_side = key.peer.addr;
     opt.initial_ssl_ctx = ssl_ctx;
     opt.use_rdma = use_rdma;
+    opt.transport = transport;
     if (_options.socket_creator->CreateSocket(opt, &tmp_id) != 0) {
         PLOG(FATAL) << "Fail to create socket to " << key.peer;
         return -1;
@@ -363,19 +365,22 @@ void SocketMap::WatchConnections() {
         const int idle_seconds = _options.idle_timeout_second_dynamic ?
             *_options.idle_timeout_second_dynamic
             : _options.idle_timeout_second;
-        if (idle_seconds > 0) {
-            // Check idle pooled connections
-            List(&main_sockets);
-            for (auto main_socket : main_sockets) {
-                SocketUniquePtr s;
-                if (Socket::Address(main_socket, &s) == 0) {
-                    s->ListPooledSockets(&pooled_sockets);
-                    for (size_t i = FLAGS_reserve_one_idle_socket ? 1 : 0;
-                         i < pooled_sockets.size(); ++i) {
-                        SocketUniquePtr s2;
-                        if (Socket::Address(pooled_sockets[i], &s2) == 0) {
-                            s2->ReleaseReferenceIfIdle(idle_seconds);
-                        }
+        List(&main_sockets);
+        for (auto main_socket : main_sockets) {
+            SocketUniquePtr s;
+            if (Socket::Address(main_socket, &s) != 0) {
+                continue;
+            }
+            // Keep warm connections even if they're idle.
+            const size_t nkeep = s->MaintainSocketPool();
+            if (idle_seconds > 0) {
+                // Check idle pooled connections
+                s->ListPooledSockets(&pooled_sockets);
+                for (size_t i = std::max(nkeep, (size_t)(FLAGS_reserve_one_idle_socket ? 1 : 0));
+                     i < pooled_sockets.size(); ++i) {
+                    SocketUniquePtr s2;
+                    if (Socket::Address(pooled_sockets[i], &s2) == 0) {
+                        s2->ReleaseReferenceIfIdle(idle_seconds);
                     }
                 }
             }
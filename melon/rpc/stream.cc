@@ -33,6 +33,7 @@
 #include <melon/rpc/policy/streaming_rpc_protocol.h>
 #include <melon/rpc/policy/melon_rpc_protocol.h>
 #include <melon/rpc/stream_impl.h>
+#include <melon/rpc/grpc/grpc_stream_impl.h>
 
 
 namespace melon {
@@ -656,7 +657,12 @@ int Stream::SetFailed(StreamId id) {
         // Don't care recycled stream
         return 0;
     }
-    Stream* s = (Stream*)ptr->conn();
+    Stream* s = dynamic_cast<Stream*>(ptr->conn());
+    if (s == NULL) {
+        // Streams attached to the socket could be gRPC streams as well.
+        return GrpcStream::SetFailed(id, EFAILEDSOCKET,
+                                     "The host socket was broken", false);
+    }
     s->Close();
     return 0;
 }
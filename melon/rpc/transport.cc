@@ -0,0 +1,76 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+//
+
+#include <melon/fiber/butex.h>
+#include <melon/rpc/event_dispatcher.h>
+#include <melon/rpc/socket.h>
+#include <melon/rpc/transport.h>
+
+namespace melon {
+
+    ssize_t Transport::ReadFromFd(Socket *s, size_t size_hint) {
+        return s->DoReadFromFd(size_hint);
+    }
+
+    ssize_t Transport::WriteToFd(Socket *s, mutil::IOBuf **pieces, size_t count) {
+        return s->DoWriteToFd(pieces, count);
+    }
+
+    int Transport::WaitFdWritable(Socket *s, const timespec *abstime) {
+        return s->WaitEpollOut(s->fd(), s->_on_edge_triggered_events != NULL, abstime);
+    }
+
+    mutil::IOPortal *Transport::read_buf(Socket *s) {
+        return &s->_read_buf;
+    }
+
+    void Transport::MarkPlain(Socket *s) {
+        s->_ssl_state = SSL_OFF;
+    }
+
+    int Transport::AddInputFd(Socket *s, int fd) {
+        return GetGlobalEventDispatcher(fd, s->_fiber_tag, s->_edisp_index)
+                .AddConsumer(s->id(), fd, false);
+    }
+
+    int Transport::RemoveInputFd(Socket *s, int fd) {
+        return GetGlobalEventDispatcher(fd, s->_fiber_tag, s->_edisp_index)
+                .RemoveConsumer(fd);
+    }
+
+    int Transport::WritableVersion(Socket *s) {
+        return s->_epollout_butex->load(mutil::memory_order_relaxed);
+    }
+
+    int Transport::WaitWritableSignal(Socket *s, int expected_version,
+                                      const timespec *abstime) {
+        const int rc = fiber::butex_wait(s->_epollout_butex, expected_version, abstime);
+        if (rc < 0 && errno == EWOULDBLOCK) {
+            // Signaled before waiting.
+            return 0;
+        }
+        return rc;
+    }
+
+    void Transport::SignalWritable(Socket *s) {
+        s->_epollout_butex->fetch_add(1, mutil::memory_order_relaxed);
+        fiber::butex_wake_except(s->_epollout_butex, 0);
+    }
+
+}  // namespace melon
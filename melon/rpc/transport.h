@@ -0,0 +1,117 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+//
+
+#pragma once
+
+#include <sys/types.h>
+#include <time.h>
+#include <ostream>
+#include <melon/utility/iobuf.h>
+#include <melon/rpc/extension.h>                       // Extension<T>
+
+namespace melon {
+
+    class Socket;
+
+    // Moves bytes of a Socket. Sockets without a Transport read and write
+    // their file descriptors directly (TCP or unix sockets, optionally with
+    // SSL), which is the default. A Transport takes over the bytes after
+    // the file descriptor is connected, e.g. through shared memory or RDMA,
+    // while Socket still manages the connection, the write queue and
+    // protocols as usual, so that backends are added without changing
+    // socket.cc.
+    // A Transport is created for each Socket by the prototype registered in
+    // TransportExtension(). Reads and writes are serialized by Socket
+    // respectively but may run concurrently with each other.
+    class Transport {
+    public:
+        virtual ~Transport() {}
+
+        // Create the transport of `socket'. `server_side' is true for
+        // accepted sockets. Called on the registered prototype.
+        virtual Transport *New(Socket *socket, bool server_side) const = 0;
+
+        // Called in client side after the file descriptor is connected and
+        // before anything is written. Call done(error, data) when the
+        // transport is ready, e.g. after exchanging a handshake.
+        virtual void StartConnect(void (*done)(int err, void *data), void *data) {
+            done(0, data);
+        }
+
+        // Append at most `size_hint' bytes into read_buf() of the socket.
+        // Returns bytes read, 0 on EOF, -1 otherwise and errno is set
+        // (EAGAIN when nothing is readable now).
+        virtual ssize_t Read(size_t size_hint) = 0;
+
+        // Write bytes of `pieces' and pop written bytes from them.
+        // Returns bytes written, -1 otherwise and errno is set (EAGAIN when
+        // nothing can be written now).
+        virtual ssize_t Write(mutil::IOBuf **pieces, size_t count) = 0;
+
+        // Wait until Write() probably makes progress or `abstime' is reached.
+        // Returns 0 on success, -1 otherwise and errno is set.
+        virtual int WaitWritable(const timespec *abstime) = 0;
+
+        // Called when the file descriptor of the socket is closed. Release
+        // resources of the connection, the transport is reused if the socket
+        // reconnects.
+        virtual void Reset() = 0;
+
+        // Print states of the connection, shown in /connections.
+        virtual void Describe(std::ostream &os) const {}
+
+    protected:
+        // The built-in I/O over the file descriptor of `s', for transports
+        // falling back to plain connections.
+        static ssize_t ReadFromFd(Socket *s, size_t size_hint);
+
+        static ssize_t WriteToFd(Socket *s, mutil::IOBuf **pieces, size_t count);
+
+        static int WaitFdWritable(Socket *s, const timespec *abstime);
+
+        // The buffer where Read() appends to.
+        static mutil::IOPortal *read_buf(Socket *s);
+
+        // Tell `s' that the bytes are not SSL-encrypted, which is only known
+        // after the connection is accepted.
+        static void MarkPlain(Socket *s);
+
+        // Make events of `fd' handled like events of the file descriptor of
+        // `s', namely Read() is called when `fd' is readable.
+        // Returns 0 on success, -1 otherwise.
+        static int AddInputFd(Socket *s, int fd);
+
+        static int RemoveInputFd(Socket *s, int fd);
+
+        // Writers blocked in WaitWritableSignal() are woken up by
+        // SignalWritable(). Get WritableVersion() before checking if the
+        // transport is writable to avoid missing the signal.
+        static int WritableVersion(Socket *s);
+
+        static int WaitWritableSignal(Socket *s, int expected_version,
+                                      const timespec *abstime);
+
+        static void SignalWritable(Socket *s);
+    };
+
+    inline Extension<const Transport> *TransportExtension() {
+        return Extension<const Transport>::instance();
+    }
+
+}  // namespace melon
@@ -414,6 +414,10 @@ int tcp_connect(EndPoint point, int* self_port) {
 }
 
 int tcp_listen(EndPoint point) {
+    return tcp_listen(point, false);
+}
+
+int tcp_listen(EndPoint point, bool reuse_port) {
     struct sockaddr_storage serv_addr;
     socklen_t serv_addr_size = 0;
     if (endpoint2sockaddr(point, &serv_addr, &serv_addr_size) != 0) {
@@ -437,7 +441,18 @@ int tcp_listen(EndPoint point) {
 #endif
     }
 
-    if (FLAGS_reuse_port) {
+    if (reuse_port) {
+#if defined(SO_REUSEPORT)
+        const int on = 1;
+        if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT,
+                       &on, sizeof(on)) != 0) {
+            return -1;
+        }
+#else
+        errno = ENOPROTOOPT;
+        return -1;
+#endif
+    } else if (FLAGS_reuse_port) {
 #if defined(SO_REUSEPORT)
         const int on = 1;
         if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT,
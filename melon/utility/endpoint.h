@@ -140,6 +140,11 @@ int tcp_connect(EndPoint server, int* self_port);
 // Returns the socket descriptor, -1 otherwise and errno is set.
 int tcp_listen(EndPoint ip_and_port);
 
+// Same as above, SO_REUSEPORT is also enabled if `reuse_port' is true.
+// Sockets listening to the same port this way get connections balanced
+// by the kernel.
+int tcp_listen(EndPoint ip_and_port, bool reuse_port);
+
 // Get the local end of a socket connection
 int get_local_side(int fd, EndPoint *out);
 
@@ -37,6 +37,7 @@
 #include <turbo/log/logging.h>                  // CHECK, LOG
 #include <melon/utility/fd_guard.h>                 // mutil::fd_guard
 #include <melon/utility/iobuf.h>
+#include <melon/utility/iobuf_block_pool.h>       // block_pool_*
 
 namespace mutil {
 namespace iobuf {
@@ -166,7 +167,10 @@ void  (*blockmem_deallocate)(void*) = ::free;
 // Use default function pointers
 void reset_blockmem_allocate_and_deallocate() {
     blockmem_allocate = ::malloc;
-    blockmem_deallocate = ::free;
+    // Blocks from the pool may be still referenced, the deallocator of the
+    // pool frees other blocks with free().
+    blockmem_deallocate = (blockmem_deallocate == block_pool_deallocate ?
+                           block_pool_deallocate : ::free);
 }
 
 mutil::static_atomic<size_t> g_nblock = MUTIL_STATIC_ATOMIC_INIT(0);
@@ -1166,7 +1170,15 @@ int IOBuf::append(void const* data, size_t count) {
     }
     size_t total_nc = 0;
     while (total_nc < count) {  // excluded count == 0
-        IOBuf::Block* b = iobuf::share_tls_block();
+        IOBuf::Block* b = NULL;
+        // Fill larger blocks of the pool with large data.
+        const size_t large_size = (iobuf::block_pool_enabled() ?
+                                   iobuf::block_pool_fit_size(count - total_nc) : 0);
+        if (large_size > DEFAULT_BLOCK_SIZE) {
+            b = iobuf::create_block(large_size);
+        } else {
+            b = iobuf::share_tls_block();
+        }
         if (MELON_UNLIKELY(!b)) {
             return -1;
         }
@@ -1177,6 +1189,10 @@ int IOBuf::append(void const* data, size_t count) {
         _push_back_ref(r);
         b->size += nc;
         total_nc += nc;
+        if (large_size > DEFAULT_BLOCK_SIZE) {
+            // Share the remaining space with following appends.
+            iobuf::release_tls_block(b);
+        }
     }
     return 0;
 }
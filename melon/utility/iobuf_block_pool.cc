@@ -0,0 +1,498 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+//
+
+
+#include <sys/mman.h>                      // mmap
+#include <sys/syscall.h>                   // SYS_getcpu, SYS_mbind
+#include <unistd.h>                        // syscall
+#include <pthread.h>
+#include <stdint.h>
+#include <algorithm>                       // std::max
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gflags/gflags.h>
+#include <melon/utility/atomicops.h>                // mutil::atomic
+#include <melon/utility/macros.h>                   // ARRAY_SIZE
+#include <melon/utility/scoped_lock.h>              // MELON_SCOPED_LOCK
+#include <melon/utility/thread_local.h>             // thread_atexit
+#include <turbo/log/logging.h>
+#include <melon/utility/iobuf_block_pool.h>
+
+namespace mutil {
+
+DEFINE_int32(iobuf_block_pool_max_mb, 8192, "Address space in MB reserved by "
+             "the IOBuf block pool, read when the pool is enabled at the first time");
+DEFINE_bool(iobuf_block_pool_hugetlb, true, "Back chunks of the IOBuf block pool "
+            "with explicit hugepages if possible, otherwise transparent hugepages");
+DEFINE_bool(iobuf_block_pool_numa, true, "Bind chunks of the IOBuf block pool "
+            "to the NUMA node of the allocating thread");
+
+static bool validate_iobuf_use_block_pool(const char*, bool val) {
+    if (!val) {
+        iobuf::disable_block_pool();
+        return true;
+    }
+    return iobuf::enable_block_pool() == 0;
+}
+DEFINE_bool(iobuf_use_block_pool, false, "Allocate IOBuf blocks from the "
+            "hugepage-backed block pool");
+const bool ALLOW_UNUSED dummy_iobuf_use_block_pool =
+    ::google::RegisterFlagValidator(&FLAGS_iobuf_use_block_pool,
+                                    validate_iobuf_use_block_pool);
+
+namespace iobuf {
+
+// Defined in iobuf.cc
+extern void* (*blockmem_allocate)(size_t);
+extern void (*blockmem_deallocate)(void*);
+
+const size_t BLOCK_POOL_CLASS_SIZE[BLOCK_POOL_NCLASS] = { 8192, 65536, 1048576 };
+
+static const size_t CHUNK_SHIFT = 21;
+static const size_t CHUNK_SIZE = 1UL << CHUNK_SHIFT;
+static const int MAX_NUMA_NODES = 64;
+// Max number of free blocks cached by each thread in each size class.
+static const int TLS_CACHE_LIMIT[BLOCK_POOL_NCLASS] = { 64, 8, 2 };
+
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+struct ChunkMeta {
+    uint8_t cls;
+    uint8_t node;
+};
+
+// Free blocks of one size class in one NUMA node.
+struct FreeList {
+    pthread_mutex_t mutex;
+    FreeBlock* head;
+    size_t nfree;
+    size_t nchunk;
+};
+
+struct BlockPool {
+    char* base;
+    size_t max_nchunk;
+    mutil::atomic<size_t> nchunk;
+    mutil::atomic<size_t> nhugetlb_chunk;
+    mutil::atomic<size_t> nmalloc;
+    ChunkMeta* chunks;
+    int nnode;
+    FreeList lists[MAX_NUMA_NODES][BLOCK_POOL_NCLASS];
+};
+
+struct ThreadCache {
+    FreeBlock* head[BLOCK_POOL_NCLASS];
+    int n[BLOCK_POOL_NCLASS];
+    // NUMA node of blocks in this cache, -1 if it's not decided yet.
+    int node;
+    bool registered;
+    // Cached blocks were flushed at thread exit, don't cache any more.
+    bool exiting;
+};
+
+static mutil::static_atomic<BlockPool*> g_pool = MUTIL_STATIC_ATOMIC_INIT(NULL);
+static pthread_mutex_t g_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread ThreadCache tls_cache = { { NULL, NULL, NULL }, { 0, 0, 0 },
+                                          -1, false, false };
+
+static int get_numa_node_num() {
+    if (!FLAGS_iobuf_block_pool_numa) {
+        return 1;
+    }
+    FILE* fp = fopen("/sys/devices/system/node/online", "r");
+    if (fp == NULL) {
+        return 1;
+    }
+    // The content is like "0" or "0-3" or "0,2-3".
+    char buf[256];
+    int max_node = 0;
+    if (fgets(buf, sizeof(buf), fp) != NULL) {
+        for (char* p = buf; *p != '\0';) {
+            char* endp = NULL;
+            const long n = strtol(p, &endp, 10);
+            if (endp == p) {
+                ++p;
+                continue;
+            }
+            max_node = std::max(max_node, (int)n);
+            p = endp;
+        }
+    }
+    fclose(fp);
+    return std::min(max_node + 1, MAX_NUMA_NODES);
+}
+
+static int get_current_node(const BlockPool* pool) {
+    if (pool->nnode <= 1) {
+        return 0;
+    }
+    unsigned cpu = 0;
+    unsigned node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0 ||
+        node >= (unsigned)pool->nnode) {
+        return 0;
+    }
+    return node;
+}
+
+static BlockPool* create_block_pool() {
+    if (FLAGS_iobuf_block_pool_max_mb <= 0) {
+        LOG(ERROR) << "Invalid iobuf_block_pool_max_mb="
+                   << FLAGS_iobuf_block_pool_max_mb;
+        return NULL;
+    }
+    const size_t max_nchunk =
+        ((size_t)FLAGS_iobuf_block_pool_max_mb << 20) >> CHUNK_SHIFT;
+    if (max_nchunk == 0) {
+        LOG(ERROR) << "iobuf_block_pool_max_mb is less than a chunk";
+        return NULL;
+    }
+    // Reserve address space only, chunks are committed on demand. One more
+    // chunk is reserved to align the start address to the chunk size which
+    // is required by hugepages.
+    const size_t reserved = (max_nchunk + 1) * CHUNK_SIZE;
+    void* mem = mmap(NULL, reserved, PROT_NONE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED) {
+        PLOG(ERROR) << "Fail to reserve " << reserved << " bytes";
+        return NULL;
+    }
+    const uintptr_t begin = (uintptr_t)mem;
+    const uintptr_t aligned = (begin + CHUNK_SIZE - 1) & ~(CHUNK_SIZE - 1);
+    if (aligned != begin) {
+        munmap(mem, aligned - begin);
+    }
+    const uintptr_t end = aligned + max_nchunk * CHUNK_SIZE;
+    if (begin + reserved != end) {
+        munmap((void*)end, begin + reserved - end);
+    }
+
+    BlockPool* pool = new BlockPool;
+    pool->base = (char*)aligned;
+    pool->max_nchunk = max_nchunk;
+    pool->nchunk.store(0, mutil::memory_order_relaxed);
+    pool->nhugetlb_chunk.store(0, mutil::memory_order_relaxed);
+    pool->nmalloc.store(0, mutil::memory_order_relaxed);
+    pool->chunks = (ChunkMeta*)calloc(max_nchunk, sizeof(ChunkMeta));
+    pool->nnode = get_numa_node_num();
+    for (int i = 0; i < MAX_NUMA_NODES; ++i) {
+        for (int j = 0; j < BLOCK_POOL_NCLASS; ++j) {
+            FreeList& fl = pool->lists[i][j];
+            pthread_mutex_init(&fl.mutex, NULL);
+            fl.head = NULL;
+            fl.nfree = 0;
+            fl.nchunk = 0;
+        }
+    }
+    return pool;
+}
+
+inline bool owns(const BlockPool* pool, const void* p) {
+    return (uintptr_t)p - (uintptr_t)pool->base < pool->max_nchunk * CHUNK_SIZE;
+}
+
+inline int size_class(size_t size) {
+    for (int i = 0; i < BLOCK_POOL_NCLASS; ++i) {
+        if (size <= BLOCK_POOL_CLASS_SIZE[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Make the reserved chunk at `p' accessible, `*hugetlb' is set to true if
+// it's backed by explicit hugepages. Returns true on success.
+static bool commit_chunk_memory(char* p, int node, int nnode, bool* hugetlb) {
+    *hugetlb = false;
+    if (FLAGS_iobuf_block_pool_hugetlb) {
+        // Map hugepages elsewhere and move them onto the reserved chunk, so
+        // that the reserved range is never unmapped on failures.
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+#ifdef MAP_HUGE_2MB
+        flags |= MAP_HUGE_2MB;
+#endif
+        void* h = mmap(NULL, CHUNK_SIZE, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (h != MAP_FAILED) {
+            if (mremap(h, CHUNK_SIZE, CHUNK_SIZE,
+                       MREMAP_MAYMOVE | MREMAP_FIXED, p) == (void*)p) {
+                *hugetlb = true;
+            } else {
+                munmap(h, CHUNK_SIZE);
+            }
+        }
+    }
+    if (!*hugetlb) {
+        if (mprotect(p, CHUNK_SIZE, PROT_READ | PROT_WRITE) != 0) {
+            PLOG(ERROR) << "Fail to commit chunk=" << (void*)p;
+            return false;
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(p, CHUNK_SIZE, MADV_HUGEPAGE);
+#endif
+    }
+    if (nnode > 1) {
+        // Pages are not touched yet, prefer `node' when they're faulted in.
+        // Errors are ignored, e.g. mbind is not permitted in containers.
+        const int MPOL_PREFERRED_MODE = 1;
+        unsigned long nodemask = 1UL << node;
+        syscall(SYS_mbind, p, CHUNK_SIZE, MPOL_PREFERRED_MODE,
+                &nodemask, sizeof(nodemask) * 8, 0);
+    }
+    return true;
+}
+
+// Commit a new chunk and put its blocks into the free list.
+static bool add_chunk(BlockPool* pool, int cls, int node) {
+    size_t idx = pool->nchunk.load(mutil::memory_order_relaxed);
+    do {
+        if (idx >= pool->max_nchunk) {
+            return false;
+        }
+    } while (!pool->nchunk.compare_exchange_weak(
+                 idx, idx + 1, mutil::memory_order_relaxed));
+    char* const p = pool->base + idx * CHUNK_SIZE;
+    bool hugetlb = false;
+    if (!commit_chunk_memory(p, node, pool->nnode, &hugetlb)) {
+        // The chunk is lost, which is rare enough.
+        return false;
+    }
+    if (hugetlb) {
+        pool->nhugetlb_chunk.fetch_add(1, mutil::memory_order_relaxed);
+    }
+    ChunkMeta& meta = pool->chunks[idx];
+    meta.cls = cls;
+    meta.node = node;
+    const size_t block_size = BLOCK_POOL_CLASS_SIZE[cls];
+    const size_t n = CHUNK_SIZE / block_size;
+    FreeBlock* head = NULL;
+    for (size_t i = n; i > 0; --i) {
+        FreeBlock* b = (FreeBlock*)(p + (i - 1) * block_size);
+        b->next = head;
+        head = b;
+    }
+    FreeBlock* const tail = (FreeBlock*)(p + (n - 1) * block_size);
+    FreeList& fl = pool->lists[node][cls];
+    MELON_SCOPED_LOCK(fl.mutex);
+    tail->next = fl.head;
+    fl.head = head;
+    fl.nfree += n;
+    ++fl.nchunk;
+    return true;
+}
+
+static void push_to_free_list(BlockPool* pool, int cls, int node,
+                              FreeBlock* head, FreeBlock* tail, int n) {
+    FreeList& fl = pool->lists[node][cls];
+    MELON_SCOPED_LOCK(fl.mutex);
+    tail->next = fl.head;
+    fl.head = head;
+    fl.nfree += n;
+}
+
+static void flush_thread_cache() {
+    ThreadCache& tc = tls_cache;
+    tc.exiting = true;
+    BlockPool* pool = g_pool.load(mutil::memory_order_acquire);
+    if (pool == NULL || tc.node < 0) {
+        return;
+    }
+    for (int i = 0; i < BLOCK_POOL_NCLASS; ++i) {
+        FreeBlock* head = tc.head[i];
+        if (head == NULL) {
+            continue;
+        }
+        FreeBlock* tail = head;
+        while (tail->next) {
+            tail = tail->next;
+        }
+        push_to_free_list(pool, i, tc.node, head, tail, tc.n[i]);
+        tc.head[i] = NULL;
+        tc.n[i] = 0;
+    }
+}
+
+inline void init_thread_cache(BlockPool* pool, ThreadCache& tc) {
+    if (tc.node < 0) {
+        tc.node = get_current_node(pool);
+    }
+    if (!tc.registered) {
+        tc.registered = true;
+        mutil::thread_atexit(flush_thread_cache);
+    }
+}
+
+// Move a batch of blocks from the free list of the thread's node to the
+// cache, commit a new chunk if the free list is empty.
+static FreeBlock* refill_thread_cache(BlockPool* pool, ThreadCache& tc, int cls) {
+    init_thread_cache(pool, tc);
+    FreeList& fl = pool->lists[tc.node][cls];
+    const int batch = std::max(1, TLS_CACHE_LIMIT[cls] / 2);
+    for (int i = 0; i < 2; ++i) {
+        {
+            MELON_SCOPED_LOCK(fl.mutex);
+            int n = 0;
+            while (fl.head != NULL && n < batch) {
+                FreeBlock* b = fl.head;
+                fl.head = b->next;
+                b->next = tc.head[cls];
+                tc.head[cls] = b;
+                ++n;
+            }
+            fl.nfree -= n;
+            tc.n[cls] += n;
+        }
+        if (tc.head[cls] != NULL || !add_chunk(pool, cls, tc.node)) {
+            break;
+        }
+    }
+    return tc.head[cls];
+}
+
+void* block_pool_allocate(size_t size) {
+    BlockPool* pool = g_pool.load(mutil::memory_order_acquire);
+    const int cls = size_class(size);
+    if (pool == NULL || cls < 0) {
+        if (pool) {
+            pool->nmalloc.fetch_add(1, mutil::memory_order_relaxed);
+        }
+        return ::malloc(size);
+    }
+    ThreadCache& tc = tls_cache;
+    FreeBlock* b = tc.head[cls];
+    if (b == NULL) {
+        b = (tc.exiting ? NULL : refill_thread_cache(pool, tc, cls));
+        if (b == NULL) {
+            pool->nmalloc.fetch_add(1, mutil::memory_order_relaxed);
+            return ::malloc(size);
+        }
+    }
+    tc.head[cls] = b->next;
+    --tc.n[cls];
+    return b;
+}
+
+void block_pool_deallocate(void* p) {
+    BlockPool* pool = g_pool.load(mutil::memory_order_acquire);
+    if (pool == NULL || !owns(pool, p)) {
+        return ::free(p);
+    }
+    const ChunkMeta& meta =
+        pool->chunks[((uintptr_t)p - (uintptr_t)pool->base) >> CHUNK_SHIFT];
+    FreeBlock* b = (FreeBlock*)p;
+    ThreadCache& tc = tls_cache;
+    if (!tc.exiting) {
+        init_thread_cache(pool, tc);
+    }
+    if (tc.exiting || meta.node != tc.node) {
+        return push_to_free_list(pool, meta.cls, meta.node, b, b, 1);
+    }
+    b->next = tc.head[meta.cls];
+    tc.head[meta.cls] = b;
+    if (++tc.n[meta.cls] > TLS_CACHE_LIMIT[meta.cls]) {
+        // Give back half of the cache.
+        const int n = tc.n[meta.cls] / 2;
+        FreeBlock* head = tc.head[meta.cls];
+        FreeBlock* tail = head;
+        for (int i = 1; i < n; ++i) {
+            tail = tail->next;
+        }
+        tc.head[meta.cls] = tail->next;
+        tc.n[meta.cls] -= n;
+        push_to_free_list(pool, meta.cls, meta.node, head, tail, n);
+    }
+}
+
+int enable_block_pool() {
+    BlockPool* pool = g_pool.load(mutil::memory_order_acquire);
+    if (pool == NULL) {
+        MELON_SCOPED_LOCK(g_pool_mutex);
+        pool = g_pool.load(mutil::memory_order_relaxed);
+        if (pool == NULL) {
+            pool = create_block_pool();
+            if (pool == NULL) {
+                return -1;
+            }
+            g_pool.store(pool, mutil::memory_order_release);
+        }
+    }
+    // Deallocator must be set first to handle blocks from the pool.
+    blockmem_deallocate = block_pool_deallocate;
+    blockmem_allocate = block_pool_allocate;
+    return 0;
+}
+
+void disable_block_pool() {
+    blockmem_allocate = ::malloc;
+}
+
+bool block_pool_enabled() {
+    return blockmem_allocate == block_pool_allocate;
+}
+
+size_t block_pool_fit_size(size_t size) {
+    for (int i = BLOCK_POOL_NCLASS - 1; i >= 0; --i) {
+        if (BLOCK_POOL_CLASS_SIZE[i] <= size) {
+            return BLOCK_POOL_CLASS_SIZE[i];
+        }
+    }
+    return 0;
+}
+
+void describe_block_pool(std::ostream& os) {
+    BlockPool* pool = g_pool.load(mutil::memory_order_acquire);
+    os << "iobuf_block_pool: " << (block_pool_enabled() ? "enabled" : "disabled")
+       << '\n';
+    if (pool == NULL) {
+        return;
+    }
+    const size_t nchunk = std::min(pool->nchunk.load(mutil::memory_order_relaxed),
+                                   pool->max_nchunk);
+    os << "reserved: " << (pool->max_nchunk * CHUNK_SIZE >> 20) << "MB"
+       << " committed: " << (nchunk * CHUNK_SIZE >> 20) << "MB"
+       << " hugetlb_chunks: " << pool->nhugetlb_chunk.load(mutil::memory_order_relaxed)
+       << " malloc_blocks: " << pool->nmalloc.load(mutil::memory_order_relaxed)
+       << " numa_nodes: " << pool->nnode << '\n';
+    for (int i = 0; i < pool->nnode; ++i) {
+        for (int j = 0; j < BLOCK_POOL_NCLASS; ++j) {
+            FreeList& fl = pool->lists[i][j];
+            size_t nfree = 0;
+            size_t nchunk_of_list = 0;
+            {
+                MELON_SCOPED_LOCK(fl.mutex);
+                nfree = fl.nfree;
+                nchunk_of_list = fl.nchunk;
+            }
+            if (nchunk_of_list == 0) {
+                continue;
+            }
+            const size_t nblock = nchunk_of_list * (CHUNK_SIZE / BLOCK_POOL_CLASS_SIZE[j]);
+            // Blocks cached by threads are counted as used.
+            os << "node=" << i << " block_size=" << BLOCK_POOL_CLASS_SIZE[j]
+               << " chunks=" << nchunk_of_list
+               << " used_blocks=" << nblock - nfree
+               << " free_blocks=" << nfree << '\n';
+        }
+    }
+}
+
+}  // namespace iobuf
+}  // namespace mutil
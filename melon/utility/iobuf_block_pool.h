@@ -0,0 +1,72 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+//
+
+
+// A pool of IOBuf blocks carved from hugepage-backed chunks.
+
+#ifndef MUTIL_IOBUF_BLOCK_POOL_H
+#define MUTIL_IOBUF_BLOCK_POOL_H
+
+#include <stddef.h>                              // size_t
+#include <ostream>                               // std::ostream
+
+namespace mutil {
+namespace iobuf {
+
+// Blocks are allocated in following size classes. Allocations larger than
+// the largest class are served by malloc.
+static const int BLOCK_POOL_NCLASS = 3;
+extern const size_t BLOCK_POOL_CLASS_SIZE[BLOCK_POOL_NCLASS];  // 8K 64K 1M
+
+// The pool reserves -iobuf_block_pool_max_mb of address space at the first
+// enabling and commits it in 2MB chunks on demand. A chunk is backed by
+// an explicit hugepage when possible (transparent hugepage otherwise), is
+// bound to the NUMA node of the allocating thread and holds blocks of one
+// size class only. Freed blocks are cached in the freeing thread and
+// returned to the chunk's node in batches. Memory is never returned to
+// the system.
+//
+// Plug the pool into blockmem_allocate/blockmem_deallocate of IOBuf, so
+// that all blocks created afterwards come from the pool, and appending
+// large data to IOBuf fills 64K or 1M blocks instead of many 8K ones.
+// Returns 0 on success, -1 otherwise.
+int enable_block_pool();
+
+// Allocate new blocks by malloc again. Blocks of the pool can still be
+// released safely.
+void disable_block_pool();
+
+bool block_pool_enabled();
+
+// Allocate/deallocate memory of a block. `size' is rounded up to a size
+// class. Memory not from the pool is passed to free().
+void* block_pool_allocate(size_t size);
+void block_pool_deallocate(void* p);
+
+// Largest size class not greater than `size', 0 if there's none.
+size_t block_pool_fit_size(size_t size);
+
+// Print chunks and blocks of each size class and NUMA node, shown in
+// the /memory builtin service.
+void describe_block_pool(std::ostream& os);
+
+}  // namespace iobuf
+}  // namespace mutil
+
+#endif  // MUTIL_IOBUF_BLOCK_POOL_H
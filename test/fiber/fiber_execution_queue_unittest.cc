@@ -21,6 +21,7 @@
 #include <gtest/gtest.h>
 
 #include <melon/fiber/execution_queue.h>
+#include <melon/fiber/parallel_execution_queue.h>
 #include <melon/fiber/sys_futex.h>
 #include <melon/fiber/countdown_event.h>
 #include <melon/utility/time.h>
@@ -920,4 +921,181 @@ TEST_F(ExecutionQueueTest, cancel_unexecuted_high_priority_task) {
         test_cancel_unexecuted_high_priority_task(i);
     }
 }
+
+struct KeyedTask {
+    uint64_t key;
+    int64_t seq;
+};
+
+const int PARALLEL_NKEY_PER_THREAD = 16;
+const int PARALLEL_NTHREAD = 4;
+
+struct KeyedResult {
+    mutil::atomic<int64_t> last_seq[PARALLEL_NKEY_PER_THREAD * PARALLEL_NTHREAD];
+    mutil::atomic<int64_t> nexecuted;
+    mutil::atomic<int> nstopped;
+    mutil::atomic<int> nout_of_order;
+    int64_t work_ns;
+
+    KeyedResult() : nexecuted(0), nstopped(0), nout_of_order(0), work_ns(0) {
+        for (size_t i = 0; i < ARRAY_SIZE(last_seq); ++i) {
+            last_seq[i].store(-1, mutil::memory_order_relaxed);
+        }
+    }
+};
+
+int check_keyed_order(void* meta, fiber::TaskIterator<KeyedTask>& iter) {
+    KeyedResult* r = (KeyedResult*)meta;
+    if (iter.is_queue_stopped()) {
+        r->nstopped.fetch_add(1);
+        return 0;
+    }
+    int64_t n = 0;
+    for (; iter; ++iter) {
+        if (r->work_ns > 0) {
+            const int64_t end_ns = mutil::cpuwide_time_ns() + r->work_ns;
+            while (mutil::cpuwide_time_ns() < end_ns) {}
+        }
+        const int64_t last = r->last_seq[iter->key].exchange(
+                iter->seq, mutil::memory_order_relaxed);
+        if (last >= iter->seq) {
+            r->nout_of_order.fetch_add(1, mutil::memory_order_relaxed);
+        }
+        ++n;
+    }
+    r->nexecuted.fetch_add(n, mutil::memory_order_relaxed);
+    return 0;
+}
+
+struct KeyedPushArg {
+    fiber::ParallelExecutionQueue<KeyedTask>* q;
+    fiber::ExecutionQueueId<KeyedTask> id;
+    int thread_index;
+    int64_t ntask;
+};
+
+void* push_keyed_tasks(void* arg) {
+    KeyedPushArg* pa = (KeyedPushArg*)arg;
+    for (int64_t i = 0; i < pa->ntask; ++i) {
+        KeyedTask t;
+        t.key = pa->thread_index * PARALLEL_NKEY_PER_THREAD + i % PARALLEL_NKEY_PER_THREAD;
+        t.seq = i;
+        if (pa->q) {
+            EXPECT_EQ(0, pa->q->execute_by_key(t.key, t));
+        } else {
+            EXPECT_EQ(0, fiber::execution_queue_execute(pa->id, t));
+        }
+    }
+    return NULL;
+}
+
+void test_parallel_keyed_order(bool use_pthread) {
+    fiber::ParallelExecutionQueueOptions options;
+    options.use_pthread = use_pthread;
+    options.num_consumers = 4;
+    KeyedResult r;
+    fiber::ParallelExecutionQueue<KeyedTask> q;
+    ASSERT_EQ(0, q.start(&options, check_keyed_order, &r));
+    ASSERT_EQ(4u, q.num_consumers());
+    pthread_t threads[PARALLEL_NTHREAD];
+    KeyedPushArg args[PARALLEL_NTHREAD];
+    for (int i = 0; i < PARALLEL_NTHREAD; ++i) {
+        args[i].q = &q;
+        args[i].thread_index = i;
+        args[i].ntask = 100000;
+        pthread_create(&threads[i], NULL, push_keyed_tasks, &args[i]);
+    }
+    for (int i = 0; i < PARALLEL_NTHREAD; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    ASSERT_EQ(0, q.stop());
+    ASSERT_EQ(0, q.join());
+    ASSERT_EQ(EINVAL, q.execute_by_key(0, KeyedTask()));
+    ASSERT_EQ(PARALLEL_NTHREAD * 100000, r.nexecuted.load());
+    ASSERT_EQ(0, r.nout_of_order.load());
+    // Stop tasks of all consumers are merged into one.
+    ASSERT_EQ(1, r.nstopped.load());
+}
+
+TEST_F(ExecutionQueueTest, parallel_keyed_order) {
+    for (int i = 0; i < 2; ++i) {
+        test_parallel_keyed_order(i);
+    }
+}
+
+int count_tasks(void* meta, fiber::TaskIterator<LongIntTask>& iter) {
+    mutil::atomic<int64_t>* n = (mutil::atomic<int64_t>*)meta;
+    int64_t c = 0;
+    for (; iter; ++iter) {
+        ++c;
+    }
+    n->fetch_add(c, mutil::memory_order_relaxed);
+    return 0;
+}
+
+TEST_F(ExecutionQueueTest, parallel_execute_without_key) {
+    mutil::atomic<int64_t> n(0);
+    fiber::ParallelExecutionQueue<LongIntTask> q;
+    ASSERT_EQ(0, q.start(NULL, count_tasks, &n));
+    ASSERT_EQ((size_t)fiber_getconcurrency(), q.num_consumers());
+    for (int i = 0; i < 10000; ++i) {
+        ASSERT_EQ(0, q.execute(LongIntTask(i)));
+    }
+    ASSERT_EQ(0, q.stop());
+    ASSERT_EQ(0, q.join());
+    ASSERT_EQ(10000, n.load());
+}
+
+// Compare the single-consumer ExecutionQueue with ParallelExecutionQueue
+// running tasks which take `work_ns' each.
+void test_parallel_performance(int64_t work_ns) {
+    const int64_t NTASK = 50000;
+    pthread_t threads[PARALLEL_NTHREAD];
+    KeyedPushArg args[PARALLEL_NTHREAD];
+    int64_t elapsed_ns[2];
+    for (int parallel = 0; parallel < 2; ++parallel) {
+        KeyedResult r;
+        r.work_ns = work_ns;
+        fiber::ParallelExecutionQueue<KeyedTask> q;
+        fiber::ExecutionQueueId<KeyedTask> id = { 0 };
+        if (parallel) {
+            ASSERT_EQ(0, q.start(NULL, check_keyed_order, &r));
+        } else {
+            ASSERT_EQ(0, fiber::execution_queue_start(&id, NULL, check_keyed_order, &r));
+        }
+        mutil::Timer tm;
+        tm.start();
+        for (int i = 0; i < PARALLEL_NTHREAD; ++i) {
+            args[i].q = parallel ? &q : NULL;
+            args[i].id = id;
+            args[i].thread_index = i;
+            args[i].ntask = NTASK;
+            pthread_create(&threads[i], NULL, push_keyed_tasks, &args[i]);
+        }
+        for (int i = 0; i < PARALLEL_NTHREAD; ++i) {
+            pthread_join(threads[i], NULL);
+        }
+        if (parallel) {
+            ASSERT_EQ(0, q.stop());
+            ASSERT_EQ(0, q.join());
+        } else {
+            ASSERT_EQ(0, fiber::execution_queue_stop(id));
+            ASSERT_EQ(0, fiber::execution_queue_join(id));
+        }
+        tm.stop();
+        ASSERT_EQ(PARALLEL_NTHREAD * NTASK, r.nexecuted.load());
+        ASSERT_EQ(0, r.nout_of_order.load());
+        elapsed_ns[parallel] = tm.n_elapsed();
+    }
+    const int64_t total = PARALLEL_NTHREAD * NTASK;
+    LOG(INFO) << "work_ns=" << work_ns
+              << " single consumer: " << total * 1000000000L / elapsed_ns[0] << " tasks/s"
+              << ", " << fiber_getconcurrency() << " consumers: "
+              << total * 1000000000L / elapsed_ns[1] << " tasks/s";
+}
+
+TEST_F(ExecutionQueueTest, parallel_performance) {
+    test_parallel_performance(0);
+    test_parallel_performance(1000);
+}
 } // namespace
@@ -23,6 +23,7 @@
 #include <melon/fiber/sys_futex.h>
 #include <melon/fiber/timer_thread.h>
 #include <melon/fiber/fiber.h>
+#include <melon/utility/fast_rand.h>
 #include <turbo/log/logging.h>
 
 namespace {
@@ -254,4 +255,133 @@ namespace {
         keeper5.expect_first_run();
     }
 
+    TEST(TimerThreadTest, run_tasks_with_timing_wheel) {
+        fiber::TimerThread timer_thread;
+        fiber::TimerThreadOptions options;
+        options.use_timing_wheel = true;
+        ASSERT_EQ(0, timer_thread.start(&options));
+
+        // Run times cover several levels of the wheel.
+        TimeKeeper keeper1(mutil::milliseconds_from_now(1), "keeper1");
+        keeper1.schedule(&timer_thread);
+        TimeKeeper keeper2(mutil::milliseconds_from_now(100), "keeper2");
+        keeper2.schedule(&timer_thread);
+        TimeKeeper keeper3(mutil::milliseconds_from_now(1500), "keeper3");
+        keeper3.schedule(&timer_thread);
+        TimeKeeper keeper4(mutil::milliseconds_from_now(1500), "keeper4");
+        keeper4.schedule(&timer_thread);
+        TimeKeeper keeper5(mutil::seconds_from_now(100), "keeper5");
+        keeper5.schedule(&timer_thread);
+        timespec old_time = {0, 0};
+        TimeKeeper keeper6(old_time, "keeper6");
+        keeper6.schedule(&timer_thread);
+        const timespec keeper6_addtime = mutil::seconds_from_now(0);
+
+        ASSERT_EQ(0, timer_thread.unschedule(keeper4._task_id));
+        sleep(2);
+        ASSERT_EQ(0, timer_thread.unschedule(keeper5._task_id));
+        timer_thread.stop_and_join();
+
+        keeper1.expect_first_run();
+        keeper2.expect_first_run();
+        keeper3.expect_first_run();
+        keeper4.expect_not_run();
+        keeper5.expect_not_run();
+        keeper6.expect_first_run(keeper6_addtime);
+    }
+
+    struct PerfTask {
+        int64_t run_time_us;
+        int64_t delay_us;
+        mutil::atomic<int> *nrun;
+    };
+
+    void perf_routine(void *arg) {
+        PerfTask *task = (PerfTask *) arg;
+        task->delay_us = mutil::gettimeofday_us() - task->run_time_us;
+        task->nrun->fetch_add(1, mutil::memory_order_relaxed);
+    }
+
+    struct PerfArg {
+        fiber::TimerThread *timer_thread;
+        std::vector<PerfTask> *tasks;
+        size_t begin;
+        size_t end;
+    };
+
+    // Schedule tasks with deadlines spread over 500ms like RPC timeouts and
+    // unschedule every other one like RPCs which finish in time.
+    void *schedule_perf_tasks(void *void_arg) {
+        PerfArg *arg = (PerfArg *) void_arg;
+        for (size_t i = arg->begin; i < arg->end; ++i) {
+            PerfTask &task = (*arg->tasks)[i];
+            task.run_time_us = mutil::gettimeofday_us() + 1000 + mutil::fast_rand_less_than(500000);
+            const fiber::TimerThread::TaskId id = arg->timer_thread->schedule(
+                    perf_routine, &task, mutil::microseconds_to_timespec(task.run_time_us));
+            if (i % 2 == 0) {
+                arg->timer_thread->unschedule(id);
+            }
+        }
+        return NULL;
+    }
+
+    void run_timer_perf(bool use_timing_wheel) {
+        const size_t NTHREAD = 4;
+        const size_t NTASK = 400000;
+        std::vector<PerfTask> tasks(NTASK);
+        mutil::atomic<int> nrun(0);
+        for (size_t i = 0; i < NTASK; ++i) {
+            tasks[i].delay_us = -1;
+            tasks[i].nrun = &nrun;
+        }
+        fiber::TimerThread timer_thread;
+        fiber::TimerThreadOptions options;
+        options.use_timing_wheel = use_timing_wheel;
+        ASSERT_EQ(0, timer_thread.start(&options));
+        clockid_t cid;
+        ASSERT_EQ(0, pthread_getcpuclockid(timer_thread.thread_id(), &cid));
+        timespec cpu_begin;
+        clock_gettime(cid, &cpu_begin);
+
+        pthread_t th[NTHREAD];
+        PerfArg args[NTHREAD];
+        mutil::Timer tm;
+        tm.start();
+        for (size_t i = 0; i < NTHREAD; ++i) {
+            args[i].timer_thread = &timer_thread;
+            args[i].tasks = &tasks;
+            args[i].begin = NTASK * i / NTHREAD;
+            args[i].end = NTASK * (i + 1) / NTHREAD;
+            ASSERT_EQ(0, pthread_create(&th[i], NULL, schedule_perf_tasks, &args[i]));
+        }
+        for (size_t i = 0; i < NTHREAD; ++i) {
+            pthread_join(th[i], NULL);
+        }
+        tm.stop();
+        while (nrun.load(mutil::memory_order_relaxed) < (int) (NTASK / 2)) {
+            usleep(10000);
+        }
+        timespec cpu_end;
+        clock_gettime(cid, &cpu_end);
+        timer_thread.stop_and_join();
+
+        int64_t sum_delay = 0;
+        int64_t max_delay = 0;
+        for (size_t i = 1; i < NTASK; i += 2) {
+            ASSERT_GE(tasks[i].delay_us, 0);
+            sum_delay += tasks[i].delay_us;
+            max_delay = std::max(max_delay, tasks[i].delay_us);
+        }
+        LOG(INFO) << (use_timing_wheel ? "timing wheel" : "heap")
+                  << ": schedule+unschedule=" << tm.n_elapsed() * 2 / NTASK << "ns"
+                  << " timer_thread_cpu=" << timespec_diff_us(cpu_end, cpu_begin) << "us"
+                  << " avg_delay=" << sum_delay / (long) (NTASK / 2) << "us"
+                  << " max_delay=" << max_delay << "us";
+    }
+
+    TEST(TimerThreadTest, heap_vs_timing_wheel_perf) {
+        run_timer_perf(false);
+        run_timer_perf(true);
+    }
+
 } // end namespace
@@ -20,6 +20,7 @@
 
 #include <execinfo.h>
 #include <gtest/gtest.h>
+#include <gflags/gflags.h>
 #include <melon/utility/time.h>
 #include <melon/utility/macros.h>
 #include <turbo/log/logging.h>
@@ -28,9 +29,12 @@
 #include <melon/fiber/fiber.h>
 #include <melon/fiber/unstable.h>
 #include <melon/fiber/task_meta.h>
+#include <melon/var/variable.h>
+#include <melon/fiber/config.h>
 
 namespace fiber {
     extern __thread fiber::LocalStorage tls_bls;
+    void print_sched_latency(std::ostream &os);
 }
 
 namespace {
@@ -412,6 +416,80 @@ TEST_F(FiberTest, start_latency_when_high_idle) {
               << elp2 / REP << "ns";
 }
 
+static long background_start_latency_ns(int rep) {
+    long elp = 0;
+    for (int i = 0; i < rep; ++i) {
+        mutil::Timer tm;
+        tm.start();
+        fiber_t th;
+        fiber_start_background(&th, NULL, log_start_latency, &tm);
+        fiber_join(th, NULL);
+        elp += tm.n_elapsed();
+        // Let workers become idle.
+        usleep(20);
+    }
+    return elp / rep;
+}
+
+TEST_F(FiberTest, start_latency_with_busy_poll) {
+    ASSERT_EQ(0, fiber_get_busy_poll_by_tag(FIBER_TAG_DEFAULT));
+    ASSERT_EQ(EINVAL, fiber_set_busy_poll_by_tag(-1, FIBER_TAG_DEFAULT));
+    ASSERT_EQ(EINVAL, fiber_set_busy_poll_by_tag(10, FIBER_TAG_INVALID));
+
+    background_start_latency_ns(100);  // warmup
+    const long parked_ns = background_start_latency_ns(2000);
+
+    ASSERT_EQ(0, fiber_set_busy_poll_by_tag(100, FIBER_TAG_DEFAULT));
+    ASSERT_EQ(100, fiber_get_busy_poll_by_tag(FIBER_TAG_DEFAULT));
+    background_start_latency_ns(100);
+    const long spin_ns = background_start_latency_ns(2000);
+    ASSERT_EQ(0, fiber_set_busy_poll_by_tag(0, FIBER_TAG_DEFAULT));
+
+    const std::string hit = melon::var::Variable::describe_exposed("fiber_busy_poll_hit_0");
+    const std::string miss = melon::var::Variable::describe_exposed("fiber_busy_poll_miss_0");
+    const std::string usage = melon::var::Variable::describe_exposed("fiber_busy_poll_usage_0");
+    ASSERT_FALSE(hit.empty());
+    ASSERT_GT(atol(hit.c_str()) + atol(miss.c_str()), 0);
+    LOG(INFO) << "start_background parked=" << parked_ns << "ns busy_poll="
+              << spin_ns << "ns hit=" << hit << " miss=" << miss
+              << " usage=" << usage;
+}
+
+void* spin_and_yield(void*) {
+    for (int i = 0; i < 3; ++i) {
+        const int64_t end_ns = mutil::cpuwide_time_ns() + 100000;
+        while (mutil::cpuwide_time_ns() < end_ns) {}
+        fiber_yield();
+    }
+    return NULL;
+}
+
+TEST_F(FiberTest, sched_latency_in_vars) {
+    fiber_t th[32];
+    {
+        // Stop sampling after the fibers are joined.
+        google::FlagSaver saver;
+        fiber::FLAGS_show_fiber_sched_latency_in_vars = true;
+        for (size_t i = 0; i < ARRAY_SIZE(th); ++i) {
+            ASSERT_EQ(0, fiber_start_background(&th[i], NULL, spin_and_yield, NULL));
+        }
+        for (size_t i = 0; i < ARRAY_SIZE(th); ++i) {
+            ASSERT_EQ(0, fiber_join(th[i], NULL));
+        }
+    }
+
+    const std::string rq_wait =
+        melon::var::Variable::describe_exposed("fiber_rq_wait_0_count");
+    const std::string oncpu =
+        melon::var::Variable::describe_exposed("fiber_oncpu_0_count");
+    ASSERT_GE(atol(rq_wait.c_str()), (long)ARRAY_SIZE(th) * 3);
+    ASSERT_GE(atol(oncpu.c_str()), (long)ARRAY_SIZE(th));
+    std::ostringstream os;
+    fiber::print_sched_latency(os);
+    ASSERT_NE(std::string::npos, os.str().find("\nfn=")) << os.str();
+    LOG(INFO) << "\n" << os.str();
+}
+
 void* sleep_for_awhile_with_sleep(void* arg) {
     fiber_usleep((intptr_t)arg);
     return NULL;
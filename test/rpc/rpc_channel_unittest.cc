@@ -30,6 +30,8 @@
 #include <melon/utility/time.h>
 #include <melon/utility/macros.h>
 #include <turbo/log/logging.h>
+#include <melon/utility/strings/string_number_conversions.h>
+#include <melon/var/variable.h>
 #include "melon/utility/files/temp_file.h"
 #include <melon/rpc/socket.h>
 #include <melon/rpc/acceptor.h>
@@ -2269,6 +2271,47 @@ TEST_F(ChannelTest, success) {
     }
 }
 
+static int64_t GetVarValue(const std::string& name) {
+    int64_t value = 0;
+    mutil::StringToInt64(melon::var::Variable::describe_exposed(name), &value);
+    return value;
+}
+
+TEST_F(ChannelTest, batch_requests) {
+    ASSERT_EQ(0, StartAccept(_ep));
+    melon::ChannelOptions opt;
+    opt.max_retry = 0;
+    opt.batch_max_calls = 4;
+    opt.batch_window_us = 1000;
+    melon::Channel channel;
+    ASSERT_EQ(0, channel.Init(_ep, &opt));
+
+    const int64_t nframe0 = GetVarValue("rpc_melon_std_batch_frame_count");
+    const int64_t ncall0 = GetVarValue("rpc_melon_std_batched_call_count");
+    // 4 calls are written as one full batch, the other 2 are written when
+    // the window expires.
+    const size_t N = 6;
+    melon::Controller cntl[N];
+    test::EchoRequest req[N];
+    test::EchoResponse res[N];
+    for (size_t i = 0; i < N; ++i) {
+        req[i].set_message("batch" + std::to_string(i));
+        ::test::EchoService::Stub(&channel).Echo(
+            &cntl[i], &req[i], &res[i], melon::DoNothing());
+    }
+    for (size_t i = 0; i < N; ++i) {
+        melon::Join(cntl[i].call_id());
+        ASSERT_EQ(0, cntl[i].ErrorCode()) << cntl[i].ErrorText();
+        EXPECT_EQ("received batch" + std::to_string(i), res[i].message());
+    }
+    // At least the full batch arrived as one frame, the rest may be sent
+    // alone if the window expired between the calls.
+    EXPECT_GE(GetVarValue("rpc_melon_std_batch_frame_count") - nframe0, 1);
+    EXPECT_GE(GetVarValue("rpc_melon_std_batched_call_count") - ncall0, 4);
+    EXPECT_EQ(1ul, _messenger.ConnectionCount());
+    StopAndJoin();
+}
+
 TEST_F(ChannelTest, success_parallel) {
     for (int i = 0; i <= 1; ++i) { // Flag SingleServer 
         for (int j = 0; j <= 1; ++j) { // Flag Asynchronous
@@ -26,6 +26,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <gtest/gtest.h>
+#include <gflags/gflags.h>
 #include <melon/utility/gperftools_profiler.h>
 #include <melon/utility/time.h>
 #include <melon/utility/macros.h>
@@ -33,6 +34,10 @@
 #include <melon/rpc/event_dispatcher.h>
 #include <melon/rpc/details/has_epollrdhup.h>
 
+namespace melon {
+DECLARE_bool(event_dispatcher_use_io_uring);
+}
+
 class EventDispatcherTest : public ::testing::Test{
 protected:
     EventDispatcherTest(){
@@ -55,6 +60,23 @@ TEST_F(EventDispatcherTest, versioned_ref) {
     ASSERT_EQ(melon::MakeVRef(1, 1), versioned_ref);
 }
 
+#if defined(OS_LINUX)
+TEST_F(EventDispatcherTest, io_uring_start_and_stop) {
+    melon::FLAGS_event_dispatcher_use_io_uring = true;
+    {
+        // Falls back to epoll if io_uring is not available.
+        melon::EventDispatcher edisp;
+        ASSERT_EQ(0, edisp.Start(NULL));
+        ASSERT_TRUE(edisp.Running());
+        LOG(INFO) << "recv_in_dispatcher=" << edisp.RecvInDispatcher();
+        edisp.Stop();
+        edisp.Join();
+        ASSERT_FALSE(edisp.Running());
+    }
+    melon::FLAGS_event_dispatcher_use_io_uring = false;
+}
+#endif
+
 std::vector<int> err_fd;
 pthread_mutex_t err_fd_mutex = PTHREAD_MUTEX_INITIALIZER;
 
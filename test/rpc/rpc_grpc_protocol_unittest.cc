@@ -25,9 +25,14 @@
 #include <melon/rpc/server.h>
 #include <melon/rpc/channel.h>
 #include <melon/rpc/grpc/grpc.h>
+#include <melon/rpc/grpc/grpc_stream.h>
 #include <melon/utility/time.h>
 #include "grpc.pb.h"
 
+namespace melon {
+DECLARE_uint64(max_body_size);
+}
+
 int main(int argc, char* argv[]) {
     testing::InitGoogleTest(&argc, argv);
     google::ParseCommandLineFlags(&argc, &argv, true);
@@ -87,10 +92,174 @@ public:
     }
 };
 
+mutil::IOBuf ToGrpcStreamMessage(const std::string& str) {
+    test::GrpcStreamMessage msg;
+    msg.set_message(str);
+    mutil::IOBuf buf;
+    mutil::IOBufAsZeroCopyOutputStream wrapper(&buf);
+    EXPECT_TRUE(msg.SerializeToZeroCopyStream(&wrapper));
+    return buf;
+}
+
+int WriteGrpcStreamMessage(melon::GrpcStreamId stream, const std::string& str) {
+    const mutil::IOBuf msg = ToGrpcStreamMessage(str);
+    int rc = 0;
+    while ((rc = melon::GrpcStreamWrite(stream, msg)) == EAGAIN) {
+        rc = melon::GrpcStreamWait(stream, NULL);
+        if (rc != 0) {
+            break;
+        }
+    }
+    return rc;
+}
+
+class GrpcStreamCollector : public melon::GrpcStreamInputHandler {
+public:
+    GrpcStreamCollector() : _closed(false), _error_code(0) {}
+
+    int on_received_messages(melon::GrpcStreamId,
+                             mutil::IOBuf *const messages[],
+                             size_t size) {
+        MELON_SCOPED_LOCK(_mutex);
+        for (size_t i = 0; i < size; ++i) {
+            test::GrpcStreamMessage msg;
+            mutil::IOBufAsZeroCopyInputStream wrapper(*messages[i]);
+            EXPECT_TRUE(msg.ParseFromZeroCopyStream(&wrapper));
+            _messages.push_back(msg.message());
+        }
+        return 0;
+    }
+
+    void on_closed(melon::GrpcStreamId, int error_code,
+                   const std::string& error_text) {
+        MELON_SCOPED_LOCK(_mutex);
+        _error_code = error_code;
+        _error_text = error_text;
+        _closed = true;
+    }
+
+    bool WaitForClosed() {
+        for (int i = 0; i < 2000; ++i) {
+            {
+                MELON_SCOPED_LOCK(_mutex);
+                if (_closed) {
+                    return true;
+                }
+            }
+            usleep(1000);
+        }
+        return false;
+    }
+
+    mutil::Mutex _mutex;
+    bool _closed;
+    int _error_code;
+    std::string _error_text;
+    std::vector<std::string> _messages;
+};
+
+mutil::atomic<int> g_echo_close_error(0);
+
+// Echo messages in bidi-streaming or join them in client-streaming, then
+// close the stream after the client half-closes.
+class EchoStreamHandler : public melon::GrpcStreamInputHandler {
+public:
+    explicit EchoStreamHandler(bool echo_each) : _echo_each(echo_each) {}
+
+    int on_received_messages(melon::GrpcStreamId id,
+                             mutil::IOBuf *const messages[],
+                             size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            test::GrpcStreamMessage msg;
+            mutil::IOBufAsZeroCopyInputStream wrapper(*messages[i]);
+            EXPECT_TRUE(msg.ParseFromZeroCopyStream(&wrapper));
+            if (_echo_each) {
+                EXPECT_EQ(0, WriteGrpcStreamMessage(id, msg.message()));
+            } else {
+                _joined.append(msg.message());
+            }
+        }
+        return 0;
+    }
+
+    void on_closed(melon::GrpcStreamId id, int error_code, const std::string&) {
+        g_echo_close_error = error_code;
+        if (error_code != 0) {
+            delete this;
+            return;
+        }
+        if (!_echo_each) {
+            EXPECT_EQ(0, WriteGrpcStreamMessage(id, _joined));
+        }
+        melon::GrpcStreamClose(id);
+        delete this;
+    }
+
+private:
+    bool _echo_each;
+    std::string _joined;
+};
+
+class MyGrpcStreamService : public ::test::GrpcStreamService {
+public:
+    void ServerStreaming(::google::protobuf::RpcController* cntl_base,
+                         const ::test::GrpcStreamMessage* req,
+                         ::test::GrpcStreamMessage*,
+                         ::google::protobuf::Closure* done) {
+        melon::Controller* cntl = static_cast<melon::Controller*>(cntl_base);
+        melon::ClosureGuard done_guard(done);
+        melon::GrpcStreamId stream;
+        ASSERT_EQ(0, melon::GrpcStreamAccept(&stream, *cntl, NULL));
+        if (req->message() == "error") {
+            melon::GrpcStreamClose(stream, melon::EINTERNAL, "%s", g_prefix.c_str());
+            return;
+        }
+        if (req->message() == "big") {
+            EXPECT_EQ(0, WriteGrpcStreamMessage(stream, std::string(64 * 1024, 'x')));
+            melon::GrpcStreamClose(stream);
+            return;
+        }
+        // Messages are sent after the response headers.
+        for (int i = 0; i < 3; ++i) {
+            EXPECT_EQ(0, WriteGrpcStreamMessage(stream, req->message() + std::to_string(i)));
+        }
+        melon::GrpcStreamClose(stream);
+    }
+
+    void ClientStreaming(::google::protobuf::RpcController* cntl_base,
+                         const ::test::GrpcStreamMessage*,
+                         ::test::GrpcStreamMessage*,
+                         ::google::protobuf::Closure* done) {
+        Accept(cntl_base, done, false);
+    }
+
+    void BidiStreaming(::google::protobuf::RpcController* cntl_base,
+                       const ::test::GrpcStreamMessage*,
+                       ::test::GrpcStreamMessage*,
+                       ::google::protobuf::Closure* done) {
+        Accept(cntl_base, done, true);
+    }
+
+private:
+    void Accept(::google::protobuf::RpcController* cntl_base,
+                ::google::protobuf::Closure* done, bool echo_each) {
+        melon::Controller* cntl = static_cast<melon::Controller*>(cntl_base);
+        melon::ClosureGuard done_guard(done);
+        melon::GrpcStreamOptions opt;
+        opt.handler = new EchoStreamHandler(echo_each);
+        melon::GrpcStreamId stream;
+        if (melon::GrpcStreamAccept(&stream, *cntl, &opt) != 0) {
+            delete opt.handler;
+            cntl->SetFailed(melon::EREQUEST, "Fail to accept grpc stream");
+        }
+    }
+};
+
 class GrpcTest : public ::testing::Test {
 protected:
     GrpcTest() {
         EXPECT_EQ(0, _server.AddService(&_svc, melon::SERVER_DOESNT_OWN_SERVICE));
+        EXPECT_EQ(0, _server.AddService(&_stream_svc, melon::SERVER_DOESNT_OWN_SERVICE));
         EXPECT_EQ(0, _server.Start(g_server_addr.c_str(), NULL));
         melon::ChannelOptions options;
         options.protocol = g_protocol;
@@ -121,6 +290,7 @@ protected:
 
     melon::Server _server;
     MyGrpcService _svc;
+    MyGrpcStreamService _stream_svc;
     melon::Channel _channel;
 };
 
@@ -271,4 +441,160 @@ TEST_F(GrpcTest, GrpcTimeOut) {
     }
 }
 
-} // namespace 
+TEST_F(GrpcTest, server_streaming) {
+    GrpcStreamCollector collector;
+    melon::GrpcStreamOptions opt;
+    opt.handler = &collector;
+    melon::Controller cntl;
+    melon::GrpcStreamId stream;
+    ASSERT_EQ(0, melon::GrpcStreamCreate(&stream, cntl, &opt));
+    test::GrpcStreamMessage req;
+    test::GrpcStreamMessage res;
+    req.set_message(g_req);
+    test::GrpcStreamService_Stub stub(&_channel);
+    stub.ServerStreaming(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_TRUE(collector.WaitForClosed());
+    EXPECT_EQ(0, collector._error_code) << collector._error_text;
+    ASSERT_EQ(3u, collector._messages.size());
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_EQ(g_req + std::to_string(i), collector._messages[i]);
+    }
+}
+
+TEST_F(GrpcTest, server_streaming_error) {
+    GrpcStreamCollector collector;
+    melon::GrpcStreamOptions opt;
+    opt.handler = &collector;
+    melon::Controller cntl;
+    melon::GrpcStreamId stream;
+    ASSERT_EQ(0, melon::GrpcStreamCreate(&stream, cntl, &opt));
+    test::GrpcStreamMessage req;
+    test::GrpcStreamMessage res;
+    req.set_message("error");
+    test::GrpcStreamService_Stub stub(&_channel);
+    stub.ServerStreaming(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_TRUE(collector.WaitForClosed());
+    EXPECT_EQ(melon::EINTERNAL, collector._error_code);
+    EXPECT_EQ(g_prefix, collector._error_text);
+    EXPECT_TRUE(collector._messages.empty());
+}
+
+TEST_F(GrpcTest, client_streaming) {
+    GrpcStreamCollector collector;
+    melon::GrpcStreamOptions opt;
+    opt.handler = &collector;
+    melon::Controller cntl;
+    melon::GrpcStreamId stream;
+    ASSERT_EQ(0, melon::GrpcStreamCreate(&stream, cntl, &opt));
+    test::GrpcStreamMessage req;
+    test::GrpcStreamMessage res;
+    test::GrpcStreamService_Stub stub(&_channel);
+    stub.ClientStreaming(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_EQ(0, WriteGrpcStreamMessage(stream, std::to_string(i)));
+    }
+    melon::GrpcStreamClose(stream);
+    EXPECT_EQ(EINVAL, melon::GrpcStreamWrite(stream, ToGrpcStreamMessage(g_req)));
+    ASSERT_TRUE(collector.WaitForClosed());
+    EXPECT_EQ(0, collector._error_code) << collector._error_text;
+    ASSERT_EQ(1u, collector._messages.size());
+    EXPECT_EQ("012", collector._messages[0]);
+}
+
+TEST_F(GrpcTest, bidi_streaming) {
+    GrpcStreamCollector collector;
+    melon::GrpcStreamOptions opt;
+    opt.handler = &collector;
+    melon::Controller cntl;
+    melon::GrpcStreamId stream;
+    ASSERT_EQ(0, melon::GrpcStreamCreate(&stream, cntl, &opt));
+    test::GrpcStreamMessage req;
+    test::GrpcStreamMessage res;
+    test::GrpcStreamService_Stub stub(&_channel);
+    stub.BidiStreaming(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    // Larger than the stream-level window to exercise the flow control.
+    const std::string big(300 * 1024, 'x');
+    const int N = 20;
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, WriteGrpcStreamMessage(stream, i % 2 ? big : std::to_string(i)));
+    }
+    melon::GrpcStreamClose(stream);
+    ASSERT_TRUE(collector.WaitForClosed());
+    EXPECT_EQ(0, collector._error_code) << collector._error_text;
+    ASSERT_EQ((size_t)N, collector._messages.size());
+    for (int i = 0; i < N; ++i) {
+        EXPECT_EQ(i % 2 ? big : std::to_string(i), collector._messages[i]);
+    }
+}
+
+TEST_F(GrpcTest, server_streaming_oversize_message) {
+    google::FlagSaver saver;
+    melon::FLAGS_max_body_size = 1024;
+    GrpcStreamCollector collector;
+    melon::GrpcStreamOptions opt;
+    opt.handler = &collector;
+    melon::Controller cntl;
+    melon::GrpcStreamId stream;
+    ASSERT_EQ(0, melon::GrpcStreamCreate(&stream, cntl, &opt));
+    test::GrpcStreamMessage req;
+    test::GrpcStreamMessage res;
+    req.set_message("big");
+    test::GrpcStreamService_Stub stub(&_channel);
+    stub.ServerStreaming(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_TRUE(collector.WaitForClosed());
+    EXPECT_EQ(melon::ELIMIT, collector._error_code) << collector._error_text;
+    EXPECT_TRUE(collector._messages.empty());
+}
+
+TEST_F(GrpcTest, client_streaming_oversize_message) {
+    google::FlagSaver saver;
+    melon::FLAGS_max_body_size = 1024;
+    g_echo_close_error = 0;
+    GrpcStreamCollector collector;
+    melon::GrpcStreamOptions opt;
+    opt.handler = &collector;
+    melon::Controller cntl;
+    melon::GrpcStreamId stream;
+    ASSERT_EQ(0, melon::GrpcStreamCreate(&stream, cntl, &opt));
+    test::GrpcStreamMessage req;
+    test::GrpcStreamMessage res;
+    test::GrpcStreamService_Stub stub(&_channel);
+    stub.ClientStreaming(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_EQ(0, WriteGrpcStreamMessage(stream, "small"));
+    // The length-prefix is rejected before the message is received, the
+    // server responds with RESOURCE_EXHAUSTED at once.
+    ASSERT_EQ(0, WriteGrpcStreamMessage(stream, std::string(64 * 1024, 'x')));
+    ASSERT_TRUE(collector.WaitForClosed());
+    EXPECT_EQ(melon::ELIMIT, collector._error_code) << collector._error_text;
+    EXPECT_TRUE(collector._messages.empty());
+    EXPECT_EQ(melon::ELIMIT, g_echo_close_error.load());
+    melon::GrpcStreamClose(stream);
+}
+
+TEST_F(GrpcTest, stream_not_accepted) {
+    GrpcStreamCollector collector;
+    melon::GrpcStreamOptions opt;
+    opt.handler = &collector;
+    melon::Controller cntl;
+    melon::GrpcStreamId stream;
+    ASSERT_EQ(0, melon::GrpcStreamCreate(&stream, cntl, &opt));
+    test::GrpcRequest req;
+    test::GrpcResponse res;
+    req.set_message(g_req);
+    req.set_gzip(false);
+    req.set_return_error(false);
+    test::GrpcService_Stub stub(&_channel);
+    stub.Method(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    EXPECT_EQ(g_prefix + g_req, res.message());
+    ASSERT_TRUE(collector.WaitForClosed());
+    EXPECT_EQ(melon::EREQUEST, collector._error_code);
+}
+
+} // namespace
@@ -24,6 +24,7 @@
 #include <melon/utility/time.h>
 #include <turbo/log/logging.h>
 #include <melon/rpc/http/http_parser.h>
+#include <melon/rpc/http/http_scan.h>
 #include <melon/builtin/common.h>  // AppendFileName
 
 using melon::http_parser;
@@ -172,3 +173,128 @@ TEST_F(HttpParserTest, append_filename) {
     melon::AppendFileName(&dir, "..");
     ASSERT_EQ("/", dir);
 }
+
+TEST_F(HttpParserTest, scan) {
+    const char chars[] = "\r\nab-Z09:x \x80\t";
+    for (int i = 0; i < 100000; ++i) {
+        std::string s;
+        const int len = rand() % 100;
+        for (int j = 0; j < len; ++j) {
+            s.push_back(chars[rand() % (sizeof(chars) - 1)]);
+        }
+        const char* const begin = s.data();
+        const char* const end = begin + s.size();
+        const char* crlf = begin;
+        while (crlf != end && *crlf != '\r' && *crlf != '\n') {
+            ++crlf;
+        }
+        ASSERT_EQ(crlf, melon::http_find_crlf(begin, end)) << s;
+        const char* non_name = begin;
+        while (non_name != end && (*non_name == '-' ||
+               ((unsigned char)*non_name < 0x80 && isalnum(*non_name)))) {
+            ++non_name;
+        }
+        ASSERT_EQ(non_name, melon::http_find_non_name_char(begin, end)) << s;
+    }
+}
+
+static std::string g_headers;
+static char g_last_callback = 0;
+
+// Fragments of one header may be passed by several callbacks when the
+// message is parsed in pieces, separators are only added between different
+// callbacks so that the result does not depend on how the message is cut.
+static int append_header_field(http_parser *, const char *at, const size_t length) {
+    if (g_last_callback != 'F') {
+        g_headers.push_back('\n');
+        g_last_callback = 'F';
+    }
+    g_headers.append(at, length);
+    return 0;
+}
+
+static int append_header_value(http_parser *, const char *at, const size_t length) {
+    if (g_last_callback != 'V') {
+        g_headers.push_back(':');
+        g_last_callback = 'V';
+    }
+    g_headers.append(at, length);
+    return 0;
+}
+
+static const char* const s_headers_request =
+    "GET /path/file.html?sdfsdf=sdfs HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 "
+    "(KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: en-US,en;q=0.9\r\n"
+    "Cookie: session=0123456789abcdef0123456789abcdef; theme=dark\r\n"
+    "X-Forwarded-For: 10.0.0.1, 10.0.0.2\r\n"
+    "X_Request_Id: 4bf92f3577b34da6a3ce929d0e0e4736\r\n"
+    "Content-Type: application/json\r\n"
+    "Content-Length: 19\r\n"
+    "\r\n"
+    "Message Body sdfsdf";
+
+TEST_F(HttpParserTest, headers_across_blocks) {
+    http_parser_settings settings;
+    memset(&settings, 0, sizeof(settings));
+    settings.on_header_field = append_header_field;
+    settings.on_header_value = append_header_value;
+    const std::string req = s_headers_request;
+
+    http_parser parser;
+    http_parser_init(&parser, melon::HTTP_REQUEST);
+    g_headers.clear();
+    g_last_callback = 0;
+    ASSERT_EQ(req.size(), http_parser_execute(&parser, &settings, req.data(), req.size()));
+    const std::string expected = g_headers;
+    ASSERT_NE(std::string::npos, expected.find(
+                  "\nX_Request_Id:4bf92f3577b34da6a3ce929d0e0e4736\n")) << expected;
+    ASSERT_NE(std::string::npos, expected.find("\nX-Forwarded-For:10.0.0.1, 10.0.0.2\n"));
+
+    for (size_t cut = 1; cut < req.size(); ++cut) {
+        http_parser_init(&parser, melon::HTTP_REQUEST);
+        g_headers.clear();
+        g_last_callback = 0;
+        ASSERT_EQ(cut, http_parser_execute(&parser, &settings, req.data(), cut));
+        ASSERT_EQ(req.size() - cut, http_parser_execute(
+                      &parser, &settings, req.data() + cut, req.size() - cut));
+        ASSERT_EQ(expected, g_headers) << "cut=" << cut;
+    }
+}
+
+TEST_F(HttpParserTest, header_overflow) {
+    http_parser_settings settings;
+    memset(&settings, 0, sizeof(settings));
+    const std::string req = "GET / HTTP/1.1\r\nX-Long: "
+        + std::string(MELON_HTTP_MAX_HEADER_SIZE, 'a') + "\r\n\r\n";
+    http_parser parser;
+    http_parser_init(&parser, melon::HTTP_REQUEST);
+    http_parser_execute(&parser, &settings, req.data(), req.size());
+    ASSERT_EQ(melon::HPE_HEADER_OVERFLOW, (melon::http_errno)parser.http_errno);
+}
+
+TEST_F(HttpParserTest, parse_headers_perf) {
+    http_parser_settings settings;
+    memset(&settings, 0, sizeof(settings));
+    settings.on_header_field = append_header_field;
+    settings.on_header_value = append_header_value;
+    const size_t len = strlen(s_headers_request);
+    const size_t loops = 1000000;
+    mutil::Timer timer;
+    timer.start();
+    for (size_t i = 0; i < loops; ++i) {
+        g_headers.clear();
+        http_parser parser;
+        http_parser_init(&parser, melon::HTTP_REQUEST);
+        http_parser_execute(&parser, &settings, s_headers_request, len);
+    }
+    timer.stop();
+    std::cout << "It takes " << timer.n_elapsed() / loops
+              << "ns to parse a http request of " << len << " bytes ("
+              << len * loops * 1000 / timer.n_elapsed() << "MB/s)"
+              << std::endl;
+}
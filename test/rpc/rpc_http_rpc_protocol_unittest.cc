@@ -36,6 +36,7 @@
 #include <google/protobuf/text_format.h>
 #include <unistd.h>
 #include <melon/utility/strings/string_number_conversions.h>
+#include <melon/utility/sys_byteorder.h>
 #include <melon/rpc/policy/http_rpc_protocol.h>
 #include <turbo/strings/escaping.h>
 #include <melon/rpc/http/http_method.h>
@@ -52,6 +53,7 @@
 #include "echo.pb.h"
 #include <melon/rpc/policy/http_rpc_protocol.h>
 #include <melon/rpc/policy/http2_rpc_protocol.h>
+#include <melon/rpc/grpc/grpc_stream_impl.h>
 #include "melon/json2pb/pb_to_json.h"
 #include "melon/json2pb/json_to_pb.h"
 #include <melon/rpc/details/method_status.h>
@@ -618,6 +620,48 @@ public:
         CHECK_LT(pa->Write(buf, sizeof(buf)), 0);
         CHECK_EQ(errno, ECANCELED);
     }
+
+    void DownloadJson(::google::protobuf::RpcController* cntl_base,
+                      const ::test::HttpRequest*,
+                      ::test::HttpResponse*,
+                      ::google::protobuf::Closure* done) {
+        melon::ClosureGuard done_guard(done);
+        melon::Controller* cntl =
+            static_cast<melon::Controller*>(cntl_base);
+        cntl->http_response().set_content_type("application/json");
+        mutil::intrusive_ptr<melon::ProgressiveAttachment> pa
+            = cntl->CreateProgressiveAttachment();
+        if (pa == NULL) {
+            cntl->SetFailed("The socket was just failed");
+            return;
+        }
+        json2pb::Pb2JsonOptions options;
+        std::string error;
+        {
+            // Buffered in the attachment before the RPC is done.
+            test::EchoRequest before;
+            before.set_message("before");
+            melon::ProgressiveJsonWriter writer(pa, 1024);
+            CHECK(json2pb::ProtoMessageToJson(before, &writer, options, &error));
+        }
+        {
+            // More than -socket_max_unwritten_bytes(set in main) can't be
+            // buffered and nothing drains the attachment before the RPC is
+            // done, the writer fails instead of blocking forever.
+            test::EchoRequest overcrowded;
+            overcrowded.set_message(std::string(4000000, 'c'));
+            melon::ProgressiveJsonWriter writer(pa, 1024);
+            CHECK(!json2pb::ProtoMessageToJson(overcrowded, &writer, options, &error));
+            _last_errno = errno;
+        }
+        done_guard.reset(NULL);
+        test::EchoRequest req;
+        req.set_message(std::string(_nrep, 'a'));
+        melon::ProgressiveJsonWriter writer(pa, 1024);
+        if (json2pb::ProtoMessageToJson(req, &writer, options, &error)) {
+            _nwritten = req.message().size();
+        }
+    }
     
     void set_done_place(DonePlace done_place) { _done_place = done_place; }
     size_t written_bytes() const { return _nwritten; }
@@ -681,6 +725,42 @@ TEST_F(HttpTest, read_failed_chunked_response) {
     ASSERT_EQ(0, svc.last_errno());
 }
 
+TEST_F(HttpTest, write_progressive_json) {
+    const int port = 8923;
+    melon::Server server;
+    const size_t N = 1024 * 1024;
+    DownloadServiceImpl svc(DONE_BEFORE_CREATE_PA, N);
+    EXPECT_EQ(0, server.AddService(&svc, melon::SERVER_DOESNT_OWN_SERVICE));
+    EXPECT_EQ(0, server.Start(port, NULL));
+
+    melon::Channel channel;
+    melon::ChannelOptions options;
+    options.protocol = melon::PROTOCOL_HTTP;
+    ASSERT_EQ(0, channel.Init(mutil::EndPoint(mutil::my_ip(), port), &options));
+    melon::Controller cntl;
+    cntl.http_request().uri() = "/DownloadService/DownloadJson";
+    channel.CallMethod(NULL, &cntl, NULL, NULL, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_EQ(melon::EOVERCROWDED, svc.last_errno());
+    ASSERT_EQ(N, svc.written_bytes());
+
+    // The body is the json written before done->Run(), a part of the
+    // overcrowded one and the json written after done->Run().
+    const std::string body = cntl.response_attachment().to_string();
+    test::EchoRequest before;
+    json2pb::Json2PbOptions json_options;
+    json_options.allow_remaining_bytes_after_parsing = true;
+    ASSERT_TRUE(json2pb::JsonToProtoMessage(body, &before, json_options));
+    ASSERT_EQ("before", before.message());
+
+    test::EchoRequest req;
+    req.set_message(std::string(N, 'a'));
+    std::string json;
+    ASSERT_TRUE(json2pb::ProtoMessageToJson(req, &json));
+    ASSERT_GT(body.size(), json.size());
+    ASSERT_EQ(json, body.substr(body.size() - json.size()));
+}
+
 class ReadBody : public melon::ProgressiveReader,
                  public melon::SharedObject {
 public:
@@ -1377,6 +1457,159 @@ TEST_F(HttpTest, http2_settings) {
     ASSERT_TRUE(ctx->_remote_settings.stream_window_size == (1u << 29) - 1);
 }
 
+TEST_F(HttpTest, http2_bdp_probe) {
+    melon::policy::H2Context* ctx = new melon::policy::H2Context(_socket.get(), NULL);
+    CHECK_EQ(ctx->Init(), 0);
+    _socket->initialize_parsing_context(&ctx);
+    ctx->_conn_state = melon::policy::H2_CONNECTION_READY;
+    melon::policy::H2StreamContext* sctx = new melon::policy::H2StreamContext(false);
+    sctx->Init(ctx, 1);
+    ASSERT_EQ(0, ctx->TryToInsertStream(1, sctx));
+    const int64_t window_size = ctx->_unack_local_settings.stream_window_size;
+    const int64_t conn_window_size = ctx->_unack_local_settings.connection_window_size;
+
+    const size_t frame_size = melon::H2Settings::DEFAULT_MAX_FRAME_SIZE;
+    std::string data_frame(melon::policy::FRAME_HEAD_SIZE + frame_size, 'a');
+    melon::policy::SerializeFrameHead(&data_frame[0], frame_size,
+                                      melon::policy::H2_FRAME_DATA, 0, 1);
+    mutil::IOBuf buf;
+    buf.append(data_frame);
+    melon::policy::ParseH2Message(&buf, _socket.get(), false, NULL);
+
+    // The first DATA triggers a PING.
+    mutil::IOPortal response_buf;
+    ASSERT_EQ((ssize_t)melon::policy::FRAME_HEAD_SIZE + 8,
+              response_buf.append_from_file_descriptor(_pipe_fds[0], 1024));
+    melon::policy::H2FrameHead frame_head;
+    mutil::IOBufBytesIterator it(response_buf);
+    ctx->ConsumeFrameHead(it, &frame_head);
+    ASSERT_EQ(melon::policy::H2_FRAME_PING, frame_head.type);
+    ASSERT_EQ(0, frame_head.flags);
+    char ping_ack[melon::policy::FRAME_HEAD_SIZE + 8];
+    melon::policy::SerializeFrameHead(ping_ack, 8, melon::policy::H2_FRAME_PING,
+                                      0x01 /* H2_FLAGS_ACK */, 0);
+    it.copy_and_forward(ping_ack + melon::policy::FRAME_HEAD_SIZE, 8);
+
+    // A whole window of DATA is received during the round trip, the windows
+    // are limiting the bandwidth.
+    for (int64_t n = 0; n < window_size; n += frame_size) {
+        buf.append(data_frame);
+        melon::policy::ParseH2Message(&buf, _socket.get(), false, NULL);
+    }
+    int bytes_in_pipe = 0;
+    ioctl(_pipe_fds[0], FIONREAD, &bytes_in_pipe);
+    response_buf.clear();
+    ASSERT_EQ((ssize_t)bytes_in_pipe,
+              response_buf.append_from_file_descriptor(_pipe_fds[0], 1024 * 1024));
+    ASSERT_EQ(1, ctx->_bdp_ping_count);
+
+    buf.append(ping_ack, sizeof(ping_ack));
+    melon::policy::ParseH2Message(&buf, _socket.get(), false, NULL);
+    ASSERT_EQ(2 * window_size, ctx->_bdp_estimate);
+    ASSERT_EQ(2 * window_size, ctx->_unack_local_settings.stream_window_size);
+    ASSERT_EQ(2 * window_size, ctx->max_local_stream_window_size());
+    ASSERT_EQ(1, ctx->_window_grow_count);
+
+    // New SETTINGS followed by a connection-level WINDOW_UPDATE.
+    response_buf.clear();
+    ASSERT_GT(response_buf.append_from_file_descriptor(_pipe_fds[0], 1024), 0);
+    mutil::IOBufBytesIterator it2(response_buf);
+    ctx->ConsumeFrameHead(it2, &frame_head);
+    ASSERT_EQ(melon::policy::H2_FRAME_SETTINGS, frame_head.type);
+    ASSERT_EQ(0, frame_head.flags);
+    int64_t initial_window_size = -1;
+    for (uint32_t i = 0; i < frame_head.payload_size; i += 6) {
+        uint8_t setting[6];
+        it2.copy_and_forward(setting, sizeof(setting));
+        if (setting[1] == 0x4 /* SETTINGS_INITIAL_WINDOW_SIZE */) {
+            initial_window_size = ((int64_t)setting[2] << 24) | (setting[3] << 16) |
+                                  (setting[4] << 8) | setting[5];
+        }
+    }
+    ASSERT_EQ(2 * window_size, initial_window_size);
+    ctx->ConsumeFrameHead(it2, &frame_head);
+    ASSERT_EQ(melon::policy::H2_FRAME_WINDOW_UPDATE, frame_head.type);
+    ASSERT_EQ(0, frame_head.stream_id);
+    uint8_t inc[4];
+    it2.copy_and_forward(inc, sizeof(inc));
+    ASSERT_EQ(8 * window_size - conn_window_size,
+              ((int64_t)inc[0] << 24) | (inc[1] << 16) | (inc[2] << 8) | inc[3]);
+    ASSERT_EQ(8 * window_size,
+              (int64_t)ctx->_unack_local_settings.connection_window_size);
+
+    // Windows larger than the previous one are accepted once acked.
+    char settings_ack[melon::policy::FRAME_HEAD_SIZE];
+    melon::policy::SerializeFrameHead(settings_ack, 0, melon::policy::H2_FRAME_SETTINGS,
+                                      0x01 /* H2_FLAGS_ACK */, 0);
+    buf.append(settings_ack, sizeof(settings_ack));
+    melon::policy::ParseH2Message(&buf, _socket.get(), false, NULL);
+    ASSERT_EQ(2 * window_size, (int64_t)ctx->local_settings().stream_window_size);
+}
+
+TEST_F(HttpTest, http2_grpc_stream_window_violation) {
+    melon::policy::H2Context* ctx = new melon::policy::H2Context(_socket.get(), NULL);
+    CHECK_EQ(ctx->Init(), 0);
+    _socket->initialize_parsing_context(&ctx);
+    ctx->_conn_state = melon::policy::H2_CONNECTION_READY;
+    melon::GrpcStreamId grpc_stream;
+    ASSERT_EQ(0, melon::GrpcStream::Create(NULL, true, &grpc_stream));
+    melon::policy::H2StreamContext* sctx = new melon::policy::H2StreamContext(false);
+    sctx->Init(ctx, 1);
+    sctx->_grpc_stream = grpc_stream;
+    sctx->_grpc_headers_dispatched = true;
+    ASSERT_EQ(0, ctx->TryToInsertStream(1, sctx));
+
+    // One uncompressed gRPC message in each DATA frame.
+    const size_t frame_size = melon::H2Settings::DEFAULT_MAX_FRAME_SIZE;
+    std::string data_frame(melon::policy::FRAME_HEAD_SIZE + frame_size, 'a');
+    melon::policy::SerializeFrameHead(&data_frame[0], frame_size,
+                                      melon::policy::H2_FRAME_DATA, 0, 1);
+    data_frame[melon::policy::FRAME_HEAD_SIZE] = 0;
+    const uint32_t message_size = mutil::HostToNet32(frame_size - 5);
+    memcpy(&data_frame[melon::policy::FRAME_HEAD_SIZE + 1], &message_size, 4);
+
+    // Messages are kept until the stream is accepted, the window is never
+    // given back and the peer must stop after a window of DATA.
+    const int64_t window_size = ctx->max_local_stream_window_size();
+    for (int64_t sent = 0; sent + (int64_t)frame_size <= window_size; sent += frame_size) {
+        mutil::IOBuf buf;
+        buf.append(data_frame);
+        ASSERT_TRUE(melon::policy::ParseH2Message(&buf, _socket.get(), false, NULL).is_ok());
+        ASSERT_EQ(sctx, ctx->FindStream(1));
+    }
+    mutil::IOBuf buf;
+    buf.append(data_frame);
+    ASSERT_TRUE(melon::policy::ParseH2Message(&buf, _socket.get(), false, NULL).is_ok());
+    ASSERT_TRUE(ctx->FindStream(1) == NULL);
+    melon::SocketUniquePtr ptr;
+    ASSERT_TRUE(melon::GrpcStream::Address(grpc_stream, &ptr) == NULL);
+
+    int bytes_in_pipe = 0;
+    ioctl(_pipe_fds[0], FIONREAD, &bytes_in_pipe);
+    mutil::IOPortal response_buf;
+    ASSERT_EQ((ssize_t)bytes_in_pipe,
+              response_buf.append_from_file_descriptor(_pipe_fds[0], 1024 * 1024));
+    mutil::IOBufBytesIterator it(response_buf);
+    bool reset = false;
+    while (it.bytes_left() >= melon::policy::FRAME_HEAD_SIZE) {
+        melon::policy::H2FrameHead frame_head;
+        ASSERT_TRUE(ctx->ConsumeFrameHead(it, &frame_head).is_ok());
+        if (frame_head.type == melon::policy::H2_FRAME_RST_STREAM) {
+            ASSERT_EQ(1, frame_head.stream_id);
+            uint8_t error[4];
+            it.copy_and_forward(error, sizeof(error));
+            ASSERT_EQ(melon::H2_FLOW_CONTROL_ERROR, error[3]);
+            reset = true;
+        } else {
+            // No stream-level WINDOW_UPDATE before the messages are consumed.
+            ASSERT_TRUE(frame_head.type != melon::policy::H2_FRAME_WINDOW_UPDATE ||
+                        frame_head.stream_id == 0);
+            it.forward(frame_head.payload_size);
+        }
+    }
+    ASSERT_TRUE(reset);
+}
+
 TEST_F(HttpTest, http2_invalid_settings) {
     {
         melon::Server server;
@@ -26,6 +26,7 @@
 #include <sys/socket.h>
 #include <netdb.h>                   //
 #include <gtest/gtest.h>
+#include <gflags/gflags.h>
 #include <melon/utility/gperftools_profiler.h>
 #include <melon/utility/time.h>
 #include <melon/utility/macros.h>
@@ -35,10 +36,21 @@
 #include <melon/rpc/acceptor.h>
 #include <melon/rpc/policy/hulu_pbrpc_protocol.h>
 
+namespace melon {
+DECLARE_int32(max_messages_per_fiber);
+}
+
 void EmptyProcessHuluRequest(melon::InputMessageBase* msg_base) {
     melon::DestroyingPtr<melon::InputMessageBase> a(msg_base);
 }
 
+mutil::atomic<size_t> g_nprocessed(0);
+
+void CountProcessHuluRequest(melon::InputMessageBase* msg_base) {
+    melon::DestroyingPtr<melon::InputMessageBase> a(msg_base);
+    g_nprocessed.fetch_add(1, mutil::memory_order_relaxed);
+}
+
 int main(int argc, char* argv[]) {
     testing::InitGoogleTest(&argc, argv);
     melon::Protocol dummy_protocol =
@@ -221,3 +233,47 @@ TEST_F(MessengerTest, dispatch_tasks) {
     sleep(1);
     LOG(WARNING) << "begin to exit!!!!";
 }
+
+TEST_F(MessengerTest, process_small_messages_in_batch) {
+    google::FlagSaver saver;
+    melon::FLAGS_max_messages_per_fiber = 16;
+    g_nprocessed.store(0);
+
+    melon::Acceptor messenger;
+    const melon::InputMessageHandler handler =
+        { melon::policy::ParseHuluMessage,
+          CountProcessHuluRequest, NULL, NULL, "dummy_hulu" };
+    const char* socket_name = "input_messenger.batch.socket";
+    int listening_fd = mutil::unix_socket_listen(socket_name);
+    ASSERT_TRUE(listening_fd > 0);
+    mutil::make_non_blocking(listening_fd);
+    ASSERT_EQ(0, messenger.AddHandler(handler));
+    ASSERT_EQ(0, messenger.StartAccept(listening_fd, -1, NULL, false));
+
+    // Pipelined small messages, most of which are processed in batches.
+    const size_t buf_cap = NMESSAGE * MESSAGE_SIZE;
+    std::unique_ptr<char[]> buf(new char[buf_cap]);
+    for (size_t i = 0; i < NMESSAGE; ++i) {
+        memcpy(buf.get() + i * MESSAGE_SIZE, "HULU", 4);
+        *(uint32_t*)(buf.get() + i * MESSAGE_SIZE + 4) = MESSAGE_SIZE - 12;
+        *(uint32_t*)(buf.get() + i * MESSAGE_SIZE + 8) = 4;
+    }
+    mutil::fd_guard fd(mutil::unix_socket_connect(socket_name));
+    ASSERT_GE(fd, 0);
+    const int NROUND = 10;
+    for (int i = 0; i < NROUND; ++i) {
+        size_t offset = 0;
+        while (offset < buf_cap) {
+            const ssize_t n = write(fd, buf.get() + offset, buf_cap - offset);
+            ASSERT_GT(n, 0);
+            offset += n;
+        }
+    }
+    for (int i = 0; i < 500 && g_nprocessed.load() < NROUND * NMESSAGE; ++i) {
+        usleep(10000);
+    }
+    ASSERT_EQ(NROUND * NMESSAGE, g_nprocessed.load());
+
+    messenger.StopAccept(0);
+    messenger.Join();
+}
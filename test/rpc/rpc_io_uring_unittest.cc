@@ -0,0 +1,156 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+//
+
+// Moves rpc traffic through the io_uring event dispatcher, including
+// messages larger than the provided buffer pool which make multishot recv
+// fall back to reading the fd and resume afterwards.
+
+#include <string>
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include <turbo/log/logging.h>
+#include <melon/utility/strings/string_number_conversions.h>
+#include <melon/var/variable.h>
+#include <melon/rpc/channel.h>
+#include <melon/rpc/server.h>
+#include <melon/rpc/event_dispatcher.h>
+#include "echo.pb.h"
+
+namespace melon {
+    DECLARE_bool(event_dispatcher_use_io_uring);
+    DECLARE_int32(io_uring_recv_buffer_num);
+    DECLARE_int32(io_uring_recv_buffer_size);
+    DECLARE_int64(socket_max_unconsumed_recv_bytes);
+}
+
+int main(int argc, char* argv[]) {
+    // Global dispatchers are created at the first use, enable io_uring
+    // before any socket is created. A small pool (256KB) is exhausted by
+    // the large messages below.
+    melon::FLAGS_event_dispatcher_use_io_uring = true;
+    melon::FLAGS_io_uring_recv_buffer_num = 64;
+    melon::FLAGS_io_uring_recv_buffer_size = 4096;
+    testing::InitGoogleTest(&argc, argv);
+    google::ParseCommandLineFlags(&argc, &argv, true);
+    return RUN_ALL_TESTS();
+}
+
+namespace {
+
+const int PORT = 8621;
+
+class EchoServiceImpl : public ::test::EchoService {
+public:
+    void Echo(google::protobuf::RpcController* cntl_base,
+              const ::test::EchoRequest* request,
+              ::test::EchoResponse* response,
+              google::protobuf::Closure* done) override {
+        melon::ClosureGuard done_guard(done);
+        melon::Controller* cntl = static_cast<melon::Controller*>(cntl_base);
+        response->set_message(request->message());
+        cntl->response_attachment().append(cntl->request_attachment());
+    }
+};
+
+int64_t GetVar(const std::string& name) {
+    int64_t value = 0;
+    mutil::StringToInt64(melon::var::Variable::describe_exposed(name), &value);
+    return value;
+}
+
+class IOUringTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ASSERT_EQ(0, _server.AddService(&_svc, melon::SERVER_DOESNT_OWN_SERVICE));
+        ASSERT_EQ(0, _server.Start(PORT, NULL));
+        melon::ChannelOptions options;
+        options.timeout_ms = 10000;
+        ASSERT_EQ(0, _channel.Init("127.0.0.1", PORT, &options));
+    }
+
+    void TearDown() override {
+        _server.Stop(0);
+        _server.Join();
+    }
+
+    static bool RecvInDispatcher() {
+        return melon::GetGlobalEventDispatcher(0, FIBER_TAG_DEFAULT).RecvInDispatcher();
+    }
+
+    // Sends `n' requests with `attachment_size'-byte attachments and checks
+    // that every byte comes back.
+    void EchoMany(int n, size_t attachment_size) {
+        test::EchoService_Stub stub(&_channel);
+        for (int i = 0; i < n; ++i) {
+            std::string payload(attachment_size, 'a' + i % 26);
+            melon::Controller cntl;
+            test::EchoRequest req;
+            test::EchoResponse res;
+            req.set_message("hello " + std::to_string(i));
+            cntl.request_attachment().append(payload);
+            stub.Echo(&cntl, &req, &res, NULL);
+            ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+            ASSERT_EQ(req.message(), res.message());
+            ASSERT_EQ(payload, cntl.response_attachment().to_string());
+        }
+    }
+
+    EchoServiceImpl _svc;
+    melon::Server _server;
+    melon::Channel _channel;
+};
+
+TEST_F(IOUringTest, echo_small_messages) {
+    if (!RecvInDispatcher()) {
+        LOG(WARNING) << "multishot recv of io_uring is not available, skip";
+        return;
+    }
+    EchoMany(1000, 100);
+}
+
+TEST_F(IOUringTest, large_messages_fall_back_and_resume) {
+    if (!RecvInDispatcher()) {
+        LOG(WARNING) << "multishot recv of io_uring is not available, skip";
+        return;
+    }
+    const int64_t fallback0 = GetVar("rpc_io_uring_recv_fallback_count");
+    const int64_t resume0 = GetVar("rpc_io_uring_recv_resume_count");
+    // Each message is 4 times of the pool.
+    EchoMany(20, 1024 * 1024);
+    ASSERT_GT(GetVar("rpc_io_uring_recv_fallback_count"), fallback0);
+    ASSERT_GT(GetVar("rpc_io_uring_recv_resume_count"), resume0);
+    // Recv in the dispatcher still works after resuming.
+    EchoMany(100, 100);
+}
+
+TEST_F(IOUringTest, backpressure_on_unconsumed_bytes) {
+    if (!RecvInDispatcher()) {
+        LOG(WARNING) << "multishot recv of io_uring is not available, skip";
+        return;
+    }
+    google::FlagSaver saver;
+    // Pause recv of a socket once it buffers more than 16KB.
+    melon::FLAGS_socket_max_unconsumed_recv_bytes = 16 * 1024;
+    const int64_t fallback0 = GetVar("rpc_io_uring_recv_fallback_count");
+    EchoMany(20, 200 * 1024);
+    ASSERT_GT(GetVar("rpc_io_uring_recv_fallback_count"), fallback0);
+    EchoMany(100, 100);
+}
+
+}  // namespace
@@ -21,8 +21,15 @@
 #include <iostream>
 #include <melon/utility/time.h>
 #include <turbo/log/logging.h>
+#include <map>
+#include <melon/utility/endpoint.h>
+#include <melon/utility/fd_guard.h>
+#include <melon/utility/sys_byteorder.h>
 #include <melon/rpc/memcache/memcache.h>
+#include <melon/rpc/memcache/memcache_service.h>
+#include <melon/rpc/policy/memcache_binary_header.h>
 #include <melon/rpc/channel.h>
+#include <melon/rpc/server.h>
 #include <gtest/gtest.h>
 
 namespace melon {
@@ -211,4 +218,217 @@ TEST_F(MemcacheTest, version) {
     ASSERT_TRUE(response.PopVersion(&version)) << response.LastError();
     std::cout << "version=" << version << std::endl;
 }
+// Keeps values in IOBuf so that responses of get reference them.
+class KVCommandHandler : public melon::MemcacheCommandHandler {
+public:
+    int Run(const melon::MemcacheCommand* commands, size_t count,
+            melon::MemcacheResponseWriter* output) override {
+        batch_sizes.push_back(count);
+        for (size_t i = 0; i < count; ++i) {
+            const melon::MemcacheCommand& cmd = commands[i];
+            switch (cmd.command) {
+            case melon::policy::MC_BINARY_GET:
+            case melon::policy::MC_BINARY_GETK:
+            case melon::policy::MC_BINARY_GETKQ: {
+                auto it = kv.find(cmd.key.as_string());
+                if (it != kv.end()) {
+                    output->AppendGet(cmd, it->second.flags, it->second.value, 1);
+                } else {
+                    output->AppendStatus(cmd, melon::MemcacheResponse::STATUS_KEY_ENOENT);
+                }
+                break;
+            }
+            case melon::policy::MC_BINARY_SET: {
+                uint32_t raw_flags = 0;
+                memcpy(&raw_flags, cmd.extras.data(), sizeof(raw_flags));
+                Item& item = kv[cmd.key.as_string()];
+                item.flags = mutil::NetToHost32(raw_flags);
+                item.value.clear();
+                item.value.append(cmd.value.data(), cmd.value.size());
+                output->AppendStatus(cmd, melon::MemcacheResponse::STATUS_SUCCESS, 1);
+                break;
+            }
+            case melon::policy::MC_BINARY_INCREMENT: {
+                uint64_t raw_delta = 0;
+                uint64_t raw_initial = 0;
+                memcpy(&raw_delta, cmd.extras.data(), sizeof(raw_delta));
+                memcpy(&raw_initial, cmd.extras.data() + 8, sizeof(raw_initial));
+                auto it = counters.find(cmd.key.as_string());
+                if (it == counters.end()) {
+                    it = counters.insert(std::make_pair(
+                        cmd.key.as_string(), mutil::NetToHost64(raw_initial))).first;
+                } else {
+                    it->second += mutil::NetToHost64(raw_delta);
+                }
+                output->AppendCounter(cmd, it->second, 1);
+                break;
+            }
+            case melon::policy::MC_BINARY_VERSION:
+                output->AppendVersion(cmd, "melon");
+                break;
+            default:
+                output->AppendStatus(cmd, melon::MemcacheResponse::STATUS_UNKNOWN_COMMAND);
+                break;
+            }
+        }
+        return 0;
+    }
+
+    struct Item {
+        uint32_t flags;
+        mutil::IOBuf value;
+    };
+    std::map<std::string, Item> kv;
+    std::map<std::string, uint64_t> counters;
+    std::vector<size_t> batch_sizes;
+};
+
+class MemcacheServiceImpl : public melon::MemcacheService {
+public:
+    explicit MemcacheServiceImpl(KVCommandHandler* handler) {
+        EXPECT_TRUE(AddCommandHandler(melon::policy::MC_BINARY_GET, handler));
+        EXPECT_TRUE(AddCommandHandler(melon::policy::MC_BINARY_GETK, handler));
+        EXPECT_TRUE(AddCommandHandler(melon::policy::MC_BINARY_GETKQ, handler));
+        EXPECT_TRUE(AddCommandHandler(melon::policy::MC_BINARY_SET, handler));
+        EXPECT_TRUE(AddCommandHandler(melon::policy::MC_BINARY_INCREMENT, handler));
+        EXPECT_TRUE(AddCommandHandler(melon::policy::MC_BINARY_VERSION, handler));
+        EXPECT_FALSE(AddCommandHandler(melon::policy::MC_BINARY_GET, handler));
+    }
+};
+
+TEST_F(MemcacheTest, server_sanity) {
+    KVCommandHandler handler;
+    melon::Server server;
+    melon::ServerOptions server_options;
+    server_options.memcache_service = new MemcacheServiceImpl(&handler);
+    melon::PortRange pr(8081, 8900);
+    ASSERT_EQ(0, server.Start("127.0.0.1", pr, &server_options));
+
+    melon::ChannelOptions options;
+    options.protocol = melon::PROTOCOL_MEMCACHE;
+    melon::Channel channel;
+    ASSERT_EQ(0, channel.Init("127.0.0.1", server.listen_address().port, &options));
+
+    const std::string big_value(4096, 'x');
+    melon::MemcacheRequest request;
+    melon::MemcacheResponse response;
+    melon::Controller cntl;
+    ASSERT_TRUE(request.Set("key1", "value1", 0xdeadbeef, 10, 0));
+    ASSERT_TRUE(request.Set("key2", big_value, 2, 10, 0));
+    ASSERT_TRUE(request.Get("key1"));
+    ASSERT_TRUE(request.Get("key2"));
+    ASSERT_TRUE(request.Get("not_exist"));
+    ASSERT_TRUE(request.Increment("counter", 2, 10, 0));
+    ASSERT_TRUE(request.Increment("counter", 2, 10, 0));
+    ASSERT_TRUE(request.Version());
+    ASSERT_TRUE(request.Delete("key1"));
+    channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    // Consecutive commands of the handler are run together.
+    ASSERT_EQ(1u, handler.batch_sizes.size());
+    ASSERT_EQ(8u, handler.batch_sizes[0]);
+
+    uint64_t cas_value = 0;
+    ASSERT_TRUE(response.PopSet(&cas_value)) << response.LastError();
+    ASSERT_TRUE(response.PopSet(&cas_value)) << response.LastError();
+    std::string value;
+    uint32_t flags = 0;
+    ASSERT_TRUE(response.PopGet(&value, &flags, &cas_value)) << response.LastError();
+    ASSERT_EQ("value1", value);
+    ASSERT_EQ(0xdeadbeef, flags);
+    ASSERT_TRUE(response.PopGet(&value, &flags, &cas_value)) << response.LastError();
+    ASSERT_EQ(big_value, value);
+    ASSERT_EQ(2u, flags);
+    ASSERT_FALSE(response.PopGet(&value, &flags, &cas_value));
+    uint64_t new_value = 0;
+    ASSERT_TRUE(response.PopIncrement(&new_value, &cas_value)) << response.LastError();
+    ASSERT_EQ(10ul, new_value);
+    ASSERT_TRUE(response.PopIncrement(&new_value, &cas_value)) << response.LastError();
+    ASSERT_EQ(12ul, new_value);
+    std::string version;
+    ASSERT_TRUE(response.PopVersion(&version)) << response.LastError();
+    ASSERT_EQ("melon", version);
+    ASSERT_FALSE(response.PopDelete());
+    ASSERT_EQ(melon::MemcacheResponse::status_str(
+                  melon::MemcacheResponse::STATUS_UNKNOWN_COMMAND),
+              response.LastError());
+}
+
+static void AppendRawRequest(mutil::IOBuf* buf, uint8_t command,
+                             const std::string& key, uint32_t opaque) {
+    const melon::policy::MemcacheRequestHeader header = {
+        melon::policy::MC_MAGIC_REQUEST,
+        command,
+        mutil::HostToNet16(key.size()),
+        0,
+        melon::policy::MC_BINARY_RAW_BYTES,
+        0,
+        mutil::HostToNet32(key.size()),
+        mutil::HostToNet32(opaque),
+        0
+    };
+    buf->append(&header, sizeof(header));
+    buf->append(key);
+}
+
+TEST_F(MemcacheTest, server_multi_get_with_getkq) {
+    KVCommandHandler handler;
+    handler.kv["key1"].value.append("value1");
+    handler.kv["key2"].value.append(std::string(4096, 'y'));
+    melon::Server server;
+    melon::ServerOptions server_options;
+    server_options.memcache_service = new MemcacheServiceImpl(&handler);
+    melon::PortRange pr(8081, 8900);
+    ASSERT_EQ(0, server.Start("127.0.0.1", pr, &server_options));
+
+    // MemcacheRequest does not send quiet commands, talk in raw bytes.
+    mutil::IOBuf request;
+    AppendRawRequest(&request, melon::policy::MC_BINARY_GETKQ, "key1", 1);
+    AppendRawRequest(&request, melon::policy::MC_BINARY_GETKQ, "not_exist", 2);
+    AppendRawRequest(&request, melon::policy::MC_BINARY_GETKQ, "key2", 3);
+    AppendRawRequest(&request, melon::policy::MC_BINARY_NOOP, "", 4);
+    mutil::EndPoint ep;
+    ASSERT_EQ(0, mutil::str2endpoint("127.0.0.1", server.listen_address().port, &ep));
+    mutil::fd_guard fd(mutil::tcp_connect(ep, NULL));
+    ASSERT_GE(fd, 0);
+    while (!request.empty()) {
+        ASSERT_GT(request.cut_into_file_descriptor(fd), 0);
+    }
+
+    // Expect hits of key1 and key2, then NOOP which ends the batch.
+    const uint8_t expected_commands[] = { melon::policy::MC_BINARY_GETKQ,
+                                          melon::policy::MC_BINARY_GETKQ,
+                                          melon::policy::MC_BINARY_NOOP };
+    const uint32_t expected_opaques[] = { 1, 3, 4 };
+    const std::string expected_keys[] = { "key1", "key2", "" };
+    const std::string expected_values[] = { "value1", std::string(4096, 'y'), "" };
+    mutil::IOPortal response;
+    for (size_t i = 0; i < arraysize(expected_commands); ++i) {
+        melon::policy::MemcacheResponseHeader header;
+        while (response.size() < sizeof(header)) {
+            ASSERT_GT(response.append_from_file_descriptor(fd, 65536), 0);
+        }
+        response.copy_to(&header, sizeof(header));
+        const uint32_t body_length = mutil::NetToHost32(header.total_body_length);
+        while (response.size() < sizeof(header) + body_length) {
+            ASSERT_GT(response.append_from_file_descriptor(fd, 65536), 0);
+        }
+        ASSERT_EQ((uint8_t)melon::policy::MC_MAGIC_RESPONSE, header.magic);
+        ASSERT_EQ(expected_commands[i], header.command);
+        ASSERT_EQ(0, header.status);
+        ASSERT_EQ(expected_opaques[i], mutil::NetToHost32(header.opaque));
+        const uint16_t key_length = mutil::NetToHost16(header.key_length);
+        response.pop_front(sizeof(header) + header.extras_length);
+        std::string key;
+        response.cutn(&key, key_length);
+        ASSERT_EQ(expected_keys[i], key);
+        std::string value;
+        response.cutn(&value, body_length - header.extras_length - key_length);
+        ASSERT_EQ(expected_values[i], value);
+    }
+    ASSERT_TRUE(response.empty());
+    // The GETKQs are run together, NOOP is responded by the server.
+    ASSERT_EQ(1u, handler.batch_sizes.size());
+    ASSERT_EQ(3u, handler.batch_sizes[0]);
+}
 } //namespace
@@ -23,6 +23,8 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <vector>
+#include <limits>
 #include <google/protobuf/text_format.h>
 #include <melon/utility/iobuf.h>
 #include <melon/utility/string_printf.h>
@@ -641,6 +643,44 @@ TEST_F(ProtobufJsonTest, json_to_pb_to_string_complex_perf_case) {
     printf("avg time to convert json to pb is %fus\n", avg_time1);
 }
 
+TEST_F(ProtobufJsonTest, json_to_pb_sax_vs_dom_perf_case) {
+    std::string info3 = "{\"content\":[{\"distance\":1.0,\
+                          \"ext\":{\"age\":1666666666, \"databyte\":\"d2VsY29tZQ==\", \"enumtype\":1},\
+                          \"uid\":\"welcome\"}], \"judge\":false, \"spur\":2.0, \"data\":[1,2,3]}";
+
+    printf("----------test json to pb sax vs dom performance------------\n\n");
+
+    std::string error;
+    // Messages are converted by events of the reader when the whole input
+    // is parsed, otherwise from the document.
+    json2pb::Json2PbOptions sax_options;
+    json2pb::Json2PbOptions dom_options;
+    dom_options.allow_remaining_bytes_after_parsing = true;
+
+    mutil::Timer timer;
+    float avg_time1 = 0;
+    float avg_time2 = 0;
+    const int times = 100000;
+    for (int i = 0; i < times; i++) {
+        JsonContextBody data1;
+        timer.start();
+        ASSERT_TRUE(json2pb::JsonToProtoMessage(info3, &data1, sax_options, &error));
+        timer.stop();
+        avg_time1 += timer.u_elapsed();
+
+        JsonContextBody data2;
+        timer.start();
+        ASSERT_TRUE(json2pb::JsonToProtoMessage(info3, &data2, dom_options, &error));
+        timer.stop();
+        avg_time2 += timer.u_elapsed();
+        ASSERT_EQ(data1.SerializeAsString(), data2.SerializeAsString());
+    }
+    avg_time1 /= times;
+    avg_time2 /= times;
+    printf("avg time to convert json to pb by sax is %fus\n", avg_time1);
+    printf("avg time to convert json to pb by dom is %fus\n", avg_time2);
+}
+
 TEST_F(ProtobufJsonTest, pb_to_json_normal_case) {
     AddressBook address_book;
 
@@ -1517,6 +1557,97 @@ TEST_F(ProtobufJsonTest, zero_copy_stream_to_json_normal_case) {
     ASSERT_EQ(1, person.datafloat());
 }
 
+TEST_F(ProtobufJsonTest, zero_copy_stream_to_json_large_case) {
+    // Larger than the fast path takes, parsed from the blocks of the IOBuf.
+    std::string name;
+    for (int i = 0; i < 200000; ++i) {
+        name.push_back('a' + i % 26);
+    }
+    const std::string json = "{\"name\":\"" + name +
+        "\",\"id\":9,\"datadouble\":2.2,\"datafloat\":1.0}";
+    mutil::IOBuf iobuf;
+    iobuf.append(json);
+    ASSERT_GT(iobuf.backing_block_num(), 1u);
+    mutil::IOBufAsZeroCopyInputStream wrapper(iobuf);
+    Person person;
+    std::string error;
+    ASSERT_TRUE(json2pb::JsonToProtoMessage(&wrapper, &person, &error)) << error;
+    ASSERT_EQ(name, person.name());
+    ASSERT_EQ(9, person.id());
+    ASSERT_EQ(2.2, person.datadouble());
+    ASSERT_EQ(1, person.datafloat());
+
+    Person person2;
+    ASSERT_TRUE(json2pb::JsonToProtoMessage(json, &person2, &error)) << error;
+    ASSERT_EQ(person.SerializeAsString(), person2.SerializeAsString());
+
+    // Remaining bytes are still rejected.
+    iobuf.append(" {}");
+    mutil::IOBufAsZeroCopyInputStream wrapper2(iobuf);
+    Person person3;
+    ASSERT_FALSE(json2pb::JsonToProtoMessage(&wrapper2, &person3, &error));
+    ASSERT_FALSE(error.empty());
+}
+
+class CollectJsonChunks : public json2pb::JsonChunkWriter {
+public:
+    CollectJsonChunks(size_t chunk_size, int max_chunks)
+        : json2pb::JsonChunkWriter(chunk_size), _max_chunks(max_chunks) {}
+
+    int WriteChunk(mutil::IOBuf* chunk) {
+        if ((int)chunk_sizes.size() >= _max_chunks) {
+            return -1;
+        }
+        chunk_sizes.push_back(chunk->size());
+        json.append(*chunk);
+        return 0;
+    }
+
+    std::vector<size_t> chunk_sizes;
+    mutil::IOBuf json;
+
+private:
+    int _max_chunks;
+};
+
+TEST_F(ProtobufJsonTest, pb_to_json_chunks_case) {
+    AddressBook address_book;
+    for (int i = 0; i < 1000; ++i) {
+        Person* person = address_book.add_person();
+        person->set_name("person" + std::to_string(i));
+        person->set_id(i);
+        person->set_datadouble(i * 0.5);
+        person->set_databyte("bytes of person");
+        Person::PhoneNumber* phone_number = person->add_phone();
+        phone_number->set_number("number" + std::to_string(i));
+        phone_number->set_type(Person::WORK);
+    }
+    json2pb::Pb2JsonOptions options;
+    std::string expected;
+    ASSERT_TRUE(json2pb::ProtoMessageToJson(address_book, &expected, options));
+
+    mutil::IOBuf buf;
+    ASSERT_TRUE(json2pb::ProtoMessageToJson(address_book, &buf, options));
+    ASSERT_EQ(expected, buf.to_string());
+
+    const size_t chunk_size = 1024;
+    CollectJsonChunks chunks(chunk_size, std::numeric_limits<int>::max());
+    ASSERT_TRUE(json2pb::ProtoMessageToJson(address_book, &chunks, options));
+    ASSERT_EQ(expected, chunks.json.to_string());
+    ASSERT_GT(chunks.chunk_sizes.size(), 1u);
+    for (size_t i = 0; i + 1 < chunks.chunk_sizes.size(); ++i) {
+        ASSERT_GE(chunks.chunk_sizes[i], chunk_size);
+    }
+
+    // The conversion stops soon after the writer failed.
+    CollectJsonChunks failed_chunks(chunk_size, 2);
+    std::string error;
+    ASSERT_FALSE(json2pb::ProtoMessageToJson(address_book, &failed_chunks, options, &error));
+    ASSERT_EQ("Fail to write json", error);
+    ASSERT_EQ(2u, failed_chunks.chunk_sizes.size());
+    ASSERT_EQ(expected.substr(0, failed_chunks.json.size()), failed_chunks.json.to_string());
+}
+
 TEST_F(ProtobufJsonTest, extension_case) {
     std::string json = "{\"name\":\"hello\",\"id\":9,\"datadouble\":2.2,\"datafloat\":1.0,\"hobby\":\"coding\"}";
     Person person;
@@ -0,0 +1,400 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+//
+
+
+#include <map>
+#include <string>
+#include <vector>
+#include <turbo/log/logging.h>
+#include <melon/utility/scoped_lock.h>
+#include <melon/utility/synchronization/lock.h>
+#include <melon/fiber/countdown_event.h>
+#include <melon/fiber/fiber.h>
+#include <melon/utility/time.h>
+#include <melon/rpc/redis/redis.h>
+#include <melon/rpc/redis/redis_cluster_channel.h>
+#include <melon/rpc/server.h>
+#include <gtest/gtest.h>
+
+namespace melon {
+DECLARE_int32(idle_timeout_second);
+}
+
+int main(int argc, char* argv[]) {
+    melon::FLAGS_idle_timeout_second = 0;
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+namespace {
+
+const int NODE_COUNT = 3;
+
+// A redis cluster stand-in made of melon redis servers in this process.
+// Each node serves the keys in its slots and redirects others by MOVED,
+// keys of a migrating slot not found in the owner are redirected by ASK.
+struct FakeCluster {
+    FakeCluster() : moved_count(0), ask_count(0), asking_count(0) {
+        owners.resize(melon::RedisClusterChannel::SLOT_COUNT);
+        importers.resize(melon::RedisClusterChannel::SLOT_COUNT, -1);
+        for (int i = 0; i < melon::RedisClusterChannel::SLOT_COUNT; ++i) {
+            owners[i] = i * NODE_COUNT / melon::RedisClusterChannel::SLOT_COUNT;
+        }
+    }
+
+    mutil::Mutex mutex;
+    std::vector<std::string> addresses;
+    std::vector<int> owners;
+    // Node importing the slot by ASK, -1 if not migrating.
+    std::vector<int> importers;
+    std::map<std::string, std::string> kv[NODE_COUNT];
+    int moved_count;
+    int ask_count;
+    int asking_count;
+};
+
+class ClusterCommandHandler : public melon::RedisCommandHandler {
+public:
+    explicit ClusterCommandHandler(FakeCluster* cluster) : _cluster(cluster) {}
+
+    melon::RedisCommandHandlerResult Run(const std::vector<mutil::StringPiece>& args,
+                                         melon::RedisReply* output,
+                                         bool /*flush_batched*/) override {
+        if (args.size() != 2 || args[1] != "slots") {
+            output->SetError("ERR only CLUSTER SLOTS is supported");
+            return melon::REDIS_CMD_HANDLED;
+        }
+        MELON_SCOPED_LOCK(_cluster->mutex);
+        std::vector<std::pair<int, int> > ranges;
+        const std::vector<int>& owners = _cluster->owners;
+        for (int i = 0; i < (int)owners.size(); ++i) {
+            if (i == 0 || owners[i] != owners[i - 1]) {
+                ranges.push_back(std::make_pair(i, i));
+            } else {
+                ranges.back().second = i;
+            }
+        }
+        output->SetArray(ranges.size());
+        for (size_t i = 0; i < ranges.size(); ++i) {
+            const std::string& address = _cluster->addresses[owners[ranges[i].first]];
+            const size_t colon = address.rfind(':');
+            melon::RedisReply& range = (*output)[i];
+            range.SetArray(3);
+            range[0].SetInteger(ranges[i].first);
+            range[1].SetInteger(ranges[i].second);
+            range[2].SetArray(2);
+            range[2][0].SetString(address.substr(0, colon));
+            range[2][1].SetInteger(atoi(address.c_str() + colon + 1));
+        }
+        return melon::REDIS_CMD_HANDLED;
+    }
+
+private:
+    FakeCluster* _cluster;
+};
+
+class AskingCommandHandler : public melon::RedisCommandHandler {
+public:
+    explicit AskingCommandHandler(FakeCluster* cluster) : _cluster(cluster) {}
+
+    melon::RedisCommandHandlerResult Run(const std::vector<mutil::StringPiece>&,
+                                         melon::RedisReply* output,
+                                         bool /*flush_batched*/) override {
+        MELON_SCOPED_LOCK(_cluster->mutex);
+        ++_cluster->asking_count;
+        output->SetStatus("OK");
+        return melon::REDIS_CMD_HANDLED;
+    }
+
+private:
+    FakeCluster* _cluster;
+};
+
+class KVCommandHandler : public melon::RedisCommandHandler {
+public:
+    KVCommandHandler(FakeCluster* cluster, int node)
+        : _cluster(cluster), _node(node) {}
+
+    melon::RedisCommandHandlerResult Run(const std::vector<mutil::StringPiece>& args,
+                                         melon::RedisReply* output,
+                                         bool /*flush_batched*/) override {
+        if (args.size() < 2) {
+            output->SetError("ERR wrong number of arguments");
+            return melon::REDIS_CMD_HANDLED;
+        }
+        const std::string key = args[1].as_string();
+        const uint16_t slot = melon::RedisClusterChannel::GetSlot(key);
+        MELON_SCOPED_LOCK(_cluster->mutex);
+        std::map<std::string, std::string>& kv = _cluster->kv[_node];
+        const int owner = _cluster->owners[slot];
+        const int importer = _cluster->importers[slot];
+        if (owner != _node && importer != _node) {
+            ++_cluster->moved_count;
+            output->SetError("MOVED " + std::to_string(slot) + " " +
+                             _cluster->addresses[owner]);
+            return melon::REDIS_CMD_HANDLED;
+        }
+        if (owner == _node && importer >= 0 && kv.find(key) == kv.end()) {
+            ++_cluster->ask_count;
+            output->SetError("ASK " + std::to_string(slot) + " " +
+                             _cluster->addresses[importer]);
+            return melon::REDIS_CMD_HANDLED;
+        }
+        if (args[0] == "set" && args.size() == 3) {
+            kv[key] = args[2].as_string();
+            output->SetStatus("OK");
+        } else if (args[0] == "get") {
+            auto it = kv.find(key);
+            if (it != kv.end()) {
+                output->SetString(it->second);
+            } else {
+                output->SetNullString();
+            }
+        } else {
+            output->SetError("ERR unknown command");
+        }
+        return melon::REDIS_CMD_HANDLED;
+    }
+
+private:
+    FakeCluster* _cluster;
+    int _node;
+};
+
+// Reply OK after sleeping, for testing timeout and cancellation.
+class SlowCommandHandler : public melon::RedisCommandHandler {
+public:
+    melon::RedisCommandHandlerResult Run(const std::vector<mutil::StringPiece>&,
+                                         melon::RedisReply* output,
+                                         bool /*flush_batched*/) override {
+        fiber_usleep(500000);
+        output->SetStatus("OK");
+        return melon::REDIS_CMD_HANDLED;
+    }
+};
+
+class RedisClusterChannelTest : public testing::Test {
+protected:
+    void SetUp() override {
+        for (int i = 0; i < NODE_COUNT; ++i) {
+            melon::RedisService* service = new melon::RedisService;
+            ASSERT_TRUE(service->AddCommandHandler("cluster", new ClusterCommandHandler(&_cluster)));
+            ASSERT_TRUE(service->AddCommandHandler("asking", new AskingCommandHandler(&_cluster)));
+            KVCommandHandler* kv_handler = new KVCommandHandler(&_cluster, i);
+            ASSERT_TRUE(service->AddCommandHandler("get", kv_handler));
+            ASSERT_TRUE(service->AddCommandHandler("set", kv_handler));
+            ASSERT_TRUE(service->AddCommandHandler("slow", new SlowCommandHandler));
+            melon::ServerOptions options;
+            options.redis_service = service;
+            melon::PortRange pr(8081, 8900);
+            ASSERT_EQ(0, _servers[i].Start("127.0.0.1", pr, &options));
+            _cluster.addresses.push_back(
+                "127.0.0.1:" + std::to_string(_servers[i].listen_address().port));
+        }
+    }
+
+    void TearDown() override {
+        for (int i = 0; i < NODE_COUNT; ++i) {
+            _servers[i].Stop(0);
+            _servers[i].Join();
+        }
+    }
+
+    FakeCluster _cluster;
+    melon::Server _servers[NODE_COUNT];
+};
+
+TEST_F(RedisClusterChannelTest, slot) {
+    ASSERT_EQ(12182, melon::RedisClusterChannel::GetSlot("foo"));
+    ASSERT_EQ(5061, melon::RedisClusterChannel::GetSlot("bar"));
+    ASSERT_EQ(melon::RedisClusterChannel::GetSlot("user1000"),
+              melon::RedisClusterChannel::GetSlot("{user1000}.following"));
+    ASSERT_EQ(melon::RedisClusterChannel::GetSlot("user1000"),
+              melon::RedisClusterChannel::GetSlot("foo{user1000}{bar}"));
+    // Empty hash tag is not a hash tag.
+    ASSERT_NE(melon::RedisClusterChannel::GetSlot(""),
+              melon::RedisClusterChannel::GetSlot("{}.x"));
+}
+
+TEST_F(RedisClusterChannelTest, pipeline_to_nodes) {
+    melon::RedisClusterChannel channel;
+    ASSERT_EQ(0, channel.Init(_cluster.addresses[0].c_str(), NULL));
+
+    const int N = 30;
+    melon::RedisRequest request;
+    for (int i = 0; i < N; ++i) {
+        ASSERT_TRUE(request.AddCommand("set key_%d value_%d", i, i));
+    }
+    for (int i = 0; i < N; ++i) {
+        ASSERT_TRUE(request.AddCommand("get key_%d", i));
+    }
+    ASSERT_TRUE(request.AddCommand("get not_exist"));
+    melon::RedisResponse response;
+    melon::Controller cntl;
+    channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_EQ(2 * N + 1, response.reply_size());
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ("OK", response.reply(i).data());
+        ASSERT_EQ("value_" + std::to_string(i), response.reply(N + i).data());
+    }
+    ASSERT_TRUE(response.reply(2 * N).is_nil());
+    // Commands were sent to the owners directly.
+    ASSERT_EQ(0, _cluster.moved_count);
+    for (int node = 0; node < NODE_COUNT; ++node) {
+        ASSERT_FALSE(_cluster.kv[node].empty());
+        for (auto& kv : _cluster.kv[node]) {
+            ASSERT_EQ(node, _cluster.owners[melon::RedisClusterChannel::GetSlot(kv.first)]);
+        }
+    }
+}
+
+TEST_F(RedisClusterChannelTest, moved) {
+    melon::RedisClusterChannel channel;
+    ASSERT_EQ(0, channel.Init(_cluster.addresses[0].c_str(), NULL));
+
+    const uint16_t slot = melon::RedisClusterChannel::GetSlot("foo");
+    const int old_owner = _cluster.owners[slot];
+    const int new_owner = (old_owner + 1) % NODE_COUNT;
+    {
+        MELON_SCOPED_LOCK(_cluster.mutex);
+        _cluster.owners[slot] = new_owner;
+        _cluster.kv[new_owner]["foo"] = "bar";
+    }
+    for (int i = 0; i < 2; ++i) {
+        melon::RedisRequest request;
+        melon::RedisResponse response;
+        melon::Controller cntl;
+        ASSERT_TRUE(request.AddCommand("get foo"));
+        channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(1, response.reply_size());
+        ASSERT_EQ("bar", response.reply(0).data());
+        // Only the first call was redirected, the slot map was refreshed.
+        ASSERT_EQ(1, _cluster.moved_count);
+    }
+}
+
+TEST_F(RedisClusterChannelTest, ask) {
+    melon::RedisClusterChannel channel;
+    ASSERT_EQ(0, channel.Init(_cluster.addresses[0].c_str(), NULL));
+
+    const uint16_t slot = melon::RedisClusterChannel::GetSlot("foo");
+    const int owner = _cluster.owners[slot];
+    const int importer = (owner + 1) % NODE_COUNT;
+    {
+        MELON_SCOPED_LOCK(_cluster.mutex);
+        _cluster.importers[slot] = importer;
+        _cluster.kv[importer]["foo"] = "migrated";
+        _cluster.kv[owner]["{foo}.old"] = "not migrated";
+    }
+    melon::RedisRequest request;
+    melon::RedisResponse response;
+    melon::Controller cntl;
+    ASSERT_TRUE(request.AddCommand("get foo"));
+    ASSERT_TRUE(request.AddCommand("get {foo}.old"));
+    channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_EQ(2, response.reply_size());
+    ASSERT_EQ("migrated", response.reply(0).data());
+    ASSERT_EQ("not migrated", response.reply(1).data());
+    ASSERT_EQ(1, _cluster.ask_count);
+    ASSERT_EQ(1, _cluster.asking_count);
+    ASSERT_EQ(0, _cluster.moved_count);
+}
+
+TEST_F(RedisClusterChannelTest, async_call) {
+    melon::RedisClusterChannel channel;
+    ASSERT_EQ(0, channel.Init(_cluster.addresses[0].c_str(), NULL));
+
+    melon::RedisRequest* request = new melon::RedisRequest;
+    ASSERT_TRUE(request->AddCommand("set key1 value1"));
+    ASSERT_TRUE(request->AddCommand("set key2 value2"));
+    ASSERT_TRUE(request->AddCommand("get key1"));
+    ASSERT_TRUE(request->AddCommand("get key2"));
+    melon::RedisResponse response;
+    melon::Controller cntl;
+    fiber::CountdownEvent event(1);
+    channel.CallMethod(NULL, &cntl, request, &response,
+                       melon::NewCallback(&event, &fiber::CountdownEvent::signal, 1, false));
+    // The request can be deleted after the asynchronous call is issued.
+    delete request;
+    event.wait();
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_EQ(4, response.reply_size());
+    ASSERT_EQ("value1", response.reply(2).data());
+    ASSERT_EQ("value2", response.reply(3).data());
+}
+
+TEST_F(RedisClusterChannelTest, join_call_id) {
+    melon::RedisClusterChannel channel;
+    ASSERT_EQ(0, channel.Init(_cluster.addresses[0].c_str(), NULL));
+
+    melon::RedisRequest request;
+    ASSERT_TRUE(request.AddCommand("set key1 value1"));
+    ASSERT_TRUE(request.AddCommand("get key1"));
+    melon::RedisResponse response;
+    melon::Controller cntl;
+    channel.CallMethod(NULL, &cntl, &request, &response, melon::DoNothing());
+    melon::Join(cntl.call_id());
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_EQ(2, response.reply_size());
+    ASSERT_EQ("OK", response.reply(0).data());
+    ASSERT_EQ("value1", response.reply(1).data());
+    ASSERT_GT(cntl.latency_us(), 0);
+    const int owner = _cluster.owners[melon::RedisClusterChannel::GetSlot("key1")];
+    ASSERT_EQ(_cluster.addresses[owner], mutil::endpoint2str(cntl.remote_side()).c_str());
+}
+
+TEST_F(RedisClusterChannelTest, timeout) {
+    melon::RedisClusterChannel channel;
+    ASSERT_EQ(0, channel.Init(_cluster.addresses[0].c_str(), NULL));
+
+    melon::RedisRequest request;
+    ASSERT_TRUE(request.AddCommand("set key1 value1"));
+    ASSERT_TRUE(request.AddCommand("slow key2"));
+    melon::RedisResponse response;
+    melon::Controller cntl;
+    cntl.set_timeout_ms(50);
+    const int64_t start_us = mutil::gettimeofday_us();
+    channel.CallMethod(NULL, &cntl, &request, &response, melon::DoNothing());
+    melon::Join(cntl.call_id());
+    ASSERT_EQ(melon::ERPCTIMEDOUT, cntl.ErrorCode()) << cntl.ErrorText();
+    // Pending sub calls were canceled without waiting for the replies.
+    ASSERT_LT(mutil::gettimeofday_us() - start_us, 400000);
+    ASSERT_EQ(0, response.reply_size());
+}
+
+TEST_F(RedisClusterChannelTest, cancel) {
+    melon::RedisClusterChannel channel;
+    ASSERT_EQ(0, channel.Init(_cluster.addresses[0].c_str(), NULL));
+
+    melon::RedisRequest request;
+    ASSERT_TRUE(request.AddCommand("slow key1"));
+    melon::RedisResponse response;
+    melon::Controller cntl;
+    const int64_t start_us = mutil::gettimeofday_us();
+    channel.CallMethod(NULL, &cntl, &request, &response, melon::DoNothing());
+    melon::StartCancel(cntl.call_id());
+    melon::Join(cntl.call_id());
+    ASSERT_EQ(ECANCELED, cntl.ErrorCode()) << cntl.ErrorText();
+    ASSERT_LT(mutil::gettimeofday_us() - start_us, 400000);
+}
+
+} // namespace
@@ -1227,4 +1227,136 @@ TEST_F(RedisTest, server_handle_pipeline) {
     ASSERT_STREQ(response.reply(7).c_str(), "world");
 }
 
+// Keeps values in IOBuf so that GET replies reference them.
+class BatchKVCommandHandler : public melon::RedisBatchCommandHandler {
+public:
+    BatchKVCommandHandler() : _batch_count(0) {}
+
+    int RunBatch(const std::vector<mutil::StringPiece>* commands, size_t count,
+                 melon::RedisReplyWriter* output) override {
+        for (size_t i = 0; i < count; ++i) {
+            const std::vector<mutil::StringPiece>& args = commands[i];
+            if (args[0] == "set" && args.size() == 3) {
+                mutil::IOBuf& value = _kv[args[1].as_string()];
+                value.clear();
+                value.append(args[2].data(), args[2].size());
+                output->AppendStatus("OK");
+            } else if (args[0] == "get" && args.size() == 2) {
+                auto it = _kv.find(args[1].as_string());
+                if (it != _kv.end()) {
+                    output->AppendString(it->second);
+                } else {
+                    output->AppendNullString();
+                }
+            } else {
+                output->AppendError("ERR wrong number of arguments");
+            }
+        }
+        ++_batch_count;
+        return 0;
+    }
+
+    std::unordered_map<std::string, mutil::IOBuf> _kv;
+    int _batch_count;
+};
+
+TEST_F(RedisTest, server_batch_command_handler) {
+    melon::Server server;
+    melon::ServerOptions server_options;
+    RedisServiceImpl* rsimpl = new RedisServiceImpl;
+    BatchKVCommandHandler* bh = new BatchKVCommandHandler;
+    ASSERT_TRUE(rsimpl->AddBatchCommandHandler("get", bh));
+    ASSERT_TRUE(rsimpl->AddBatchCommandHandler("set", bh));
+    ASSERT_TRUE(rsimpl->AddCommandHandler("incr", new IncrCommandHandler));
+    GetCommandHandler gh(rsimpl);
+    ASSERT_FALSE(rsimpl->AddCommandHandler("get", &gh));
+    server_options.redis_service = rsimpl;
+    melon::PortRange pr(8081, 8900);
+    ASSERT_EQ(0, server.Start("127.0.0.1", pr, &server_options));
+
+    melon::ChannelOptions options;
+    options.protocol = melon::PROTOCOL_REDIS;
+    melon::Channel channel;
+    ASSERT_EQ(0, channel.Init("127.0.0.1", server.listen_address().port, &options));
+
+    const std::string big_value(4096, 'x');
+    melon::RedisRequest request;
+    melon::RedisResponse response;
+    melon::Controller cntl;
+    ASSERT_TRUE(request.AddCommand("set key1 value1"));
+    ASSERT_TRUE(request.AddCommand("set key2 %s", big_value.c_str()));
+    ASSERT_TRUE(request.AddCommand("get key1"));
+    ASSERT_TRUE(request.AddCommand("get key2"));
+    ASSERT_TRUE(request.AddCommand("incr batch_count"));
+    ASSERT_TRUE(request.AddCommand("get key2"));
+    ASSERT_TRUE(request.AddCommand("get not_exist"));
+    ASSERT_TRUE(request.AddCommand("set key3"));
+    channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_EQ(8, response.reply_size());
+    ASSERT_EQ(2, bh->_batch_count);
+    ASSERT_STREQ("OK", response.reply(0).c_str());
+    ASSERT_STREQ("OK", response.reply(1).c_str());
+    ASSERT_STREQ("value1", response.reply(2).c_str());
+    ASSERT_EQ(big_value, response.reply(3).data());
+    ASSERT_TRUE(response.reply(4).is_integer());
+    ASSERT_EQ(big_value, response.reply(5).data());
+    ASSERT_TRUE(response.reply(6).is_nil());
+    ASSERT_TRUE(response.reply(7).is_error());
+}
+
+static void RunPipelinedGet(melon::Channel* channel, const char* name) {
+    const int kPipelineSize = 100;
+    const int kRound = 1000;
+    melon::RedisRequest request;
+    for (int i = 0; i < kPipelineSize; ++i) {
+        ASSERT_TRUE(request.AddCommand("get key_%d", i % 10));
+    }
+    mutil::Timer tm;
+    tm.start();
+    for (int i = 0; i < kRound; ++i) {
+        melon::RedisResponse response;
+        melon::Controller cntl;
+        channel->CallMethod(NULL, &cntl, &request, &response, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(kPipelineSize, response.reply_size());
+    }
+    tm.stop();
+    LOG(INFO) << name << " pipelined get qps="
+              << kPipelineSize * kRound * 1000000L / std::max(tm.u_elapsed(), (int64_t)1);
+}
+
+// Compares qps of pipelined gets served by a RedisCommandHandler and by a
+// RedisBatchCommandHandler, nothing is asserted. Run it explicitly by
+// --gtest_also_run_disabled_tests --gtest_filter=*server_batch_command_handler_perf
+TEST_F(RedisTest, DISABLED_server_batch_command_handler_perf) {
+    const std::string value(1024, 'v');
+    RedisServiceImpl* rsimpl = new RedisServiceImpl;
+    ASSERT_TRUE(rsimpl->AddCommandHandler("get", new GetCommandHandler(rsimpl)));
+    RedisServiceImpl* batch_rsimpl = new RedisServiceImpl;
+    BatchKVCommandHandler* bh = new BatchKVCommandHandler;
+    ASSERT_TRUE(batch_rsimpl->AddBatchCommandHandler("get", bh));
+    for (int i = 0; i < 10; ++i) {
+        const std::string key = "key_" + std::to_string(i);
+        m[key] = value;
+        bh->_kv[key].append(value);
+    }
+
+    melon::Server servers[2];
+    RedisServiceImpl* services[2] = { rsimpl, batch_rsimpl };
+    const char* names[2] = { "RedisCommandHandler", "RedisBatchCommandHandler" };
+    for (int i = 0; i < 2; ++i) {
+        melon::ServerOptions server_options;
+        server_options.redis_service = services[i];
+        melon::PortRange pr(8081, 8900);
+        ASSERT_EQ(0, servers[i].Start("127.0.0.1", pr, &server_options));
+
+        melon::ChannelOptions options;
+        options.protocol = melon::PROTOCOL_REDIS;
+        melon::Channel channel;
+        ASSERT_EQ(0, channel.Init("127.0.0.1", servers[i].listen_address().port, &options));
+        RunPipelinedGet(&channel, names[i]);
+    }
+}
+
 } //namespace
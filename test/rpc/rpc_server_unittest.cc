@@ -54,6 +54,7 @@
 #include <melon/rpc/channel.h>
 #include <melon/rpc/socket_map.h>
 #include <melon/rpc/controller.h>
+#include <melon/rpc/details/method_status.h>
 #include "echo.pb.h"
 #include "v1.pb.h"
 #include "v2.pb.h"
@@ -1395,6 +1396,239 @@ TEST_F(ServerTest, serving_requests) {
     ASSERT_EQ(0, server.Join());
 }
 
+TEST_F(ServerTest, multiple_acceptors) {
+    EchoServiceImpl echo_svc;
+    melon::Server server;
+    ASSERT_EQ(0, server.AddService(&echo_svc,
+                                   melon::SERVER_DOESNT_OWN_SERVICE));
+    mutil::EndPoint ep;
+    ASSERT_EQ(0, str2endpoint("127.0.0.1:8613", &ep));
+    melon::ServerOptions opt;
+    opt.num_acceptors = 4;
+    ASSERT_EQ(0, server.Start(ep, &opt));
+
+    const int NCONN = 16;
+    int cfds[NCONN];
+    for (int i = 0; i < NCONN; ++i) {
+        cfds[i] = tcp_connect(ep, NULL);
+        ASSERT_GT(cfds[i], 0);
+    }
+    usleep(10000);
+    melon::ServerStatistics stat;
+    server.GetStat(&stat);
+    ASSERT_EQ((size_t)NCONN, stat.connection_count);
+    for (int i = 0; i < NCONN; ++i) {
+        close(cfds[i]);
+    }
+
+    const int NUM = 4;
+    const int COUNT = 10;
+    pthread_t tids[NUM];
+    for (int i = 0; i < NUM; ++i) {
+        google::protobuf::Closure* thrd_func = 
+                melon::NewCallback(SendMultipleRPC, ep, COUNT);
+        EXPECT_EQ(0, pthread_create(&tids[i], NULL, RunClosure, thrd_func));
+    }
+    for (int i = 0; i < NUM; ++i) {
+        pthread_join(tids[i], NULL);
+    }
+    ASSERT_EQ(NUM * COUNT, echo_svc.count.load());
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+
+    // Restart with a single acceptor on the same port.
+    ASSERT_EQ(0, server.Start(ep, NULL));
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
+class ArenaEchoServiceImpl : public EchoServiceImpl {
+public:
+    ArenaEchoServiceImpl() : on_arena_count(0) {}
+    virtual void ComboEcho(google::protobuf::RpcController* cntl_base,
+                           const test::ComboRequest* request,
+                           test::ComboResponse* response,
+                           google::protobuf::Closure* done) {
+        melon::Controller* cntl = (melon::Controller*)cntl_base;
+        if (cntl->arena() != NULL &&
+            request->GetArena() == cntl->arena() &&
+            response->GetArena() == cntl->arena()) {
+            on_arena_count.fetch_add(1, mutil::memory_order_relaxed);
+        }
+        EchoServiceImpl::ComboEcho(cntl_base, request, response, done);
+    }
+
+    mutil::atomic<int> on_arena_count;
+};
+
+TEST_F(ServerTest, use_arena) {
+    ArenaEchoServiceImpl echo_svc;
+    melon::Server server;
+    ASSERT_EQ(0, server.AddService(&echo_svc,
+                                   melon::SERVER_DOESNT_OWN_SERVICE));
+    mutil::EndPoint ep;
+    ASSERT_EQ(0, str2endpoint("127.0.0.1:8613", &ep));
+    melon::ServerOptions opt;
+    opt.use_arena = true;
+    ASSERT_EQ(0, server.Start(ep, &opt));
+
+    const char* protocols[] = { "baidu_std", "melon_std", "hulu_pbrpc", "http" };
+    const int COUNT = 10;
+    for (size_t i = 0; i < ARRAY_SIZE(protocols); ++i) {
+        melon::ChannelOptions copt;
+        copt.protocol = protocols[i];
+        melon::Channel channel;
+        ASSERT_EQ(0, channel.Init(ep, &copt));
+        test::EchoService_Stub stub(&channel);
+        for (int j = 0; j < COUNT; ++j) {
+            melon::Controller cntl;
+            test::ComboRequest req;
+            test::ComboResponse res;
+            for (int k = 0; k < 100; ++k) {
+                req.add_requests()->set_message(EXP_REQUEST);
+            }
+            stub.ComboEcho(&cntl, &req, &res, NULL);
+            ASSERT_FALSE(cntl.Failed()) << protocols[i] << ": " << cntl.ErrorText();
+            ASSERT_EQ(100, res.responses_size());
+            ASSERT_EQ(EXP_REQUEST, res.responses(99).message());
+        }
+    }
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+    ASSERT_EQ((int)ARRAY_SIZE(protocols) * COUNT, echo_svc.on_arena_count.load());
+
+    // Arenas of following calls start with blocks fitting the messages.
+    const melon::Server::MethodProperty* mp =
+        server.FindMethodPropertyByFullName("test.EchoService.ComboEcho");
+    ASSERT_TRUE(mp != NULL && mp->status != NULL);
+    ASSERT_GT(mp->status->arena_start_block_size(), 100 * EXP_REQUEST.size());
+}
+
+#if GOOGLE_PROTOBUF_VERSION >= 3021000
+// Message of `T' which can't live on arenas: New(arena) creates it on the
+// heap and lets `arena' own it, GetArena() of it is NULL, as protobuf does
+// for such types.
+template <typename T>
+class HeapMessage : public google::protobuf::Message {
+public:
+    T& msg() { return _msg; }
+    const T& msg() const { return _msg; }
+
+    HeapMessage* New(google::protobuf::Arena* arena) const override {
+        HeapMessage* m = new HeapMessage;
+        if (arena != NULL) {
+            arena->Own(m);
+        }
+        return m;
+    }
+    std::string GetTypeName() const override { return _msg.GetTypeName(); }
+    void Clear() override { _msg.Clear(); }
+    bool IsInitialized() const override { return _msg.IsInitialized(); }
+    void CheckTypeAndMergeFrom(const google::protobuf::MessageLite& other) override {
+        _msg.MergeFrom(static_cast<const HeapMessage&>(other)._msg);
+    }
+    void MergeFrom(const google::protobuf::Message& other) override {
+        _msg.MergeFrom(static_cast<const HeapMessage&>(other)._msg);
+    }
+    size_t ByteSizeLong() const override { return _msg.ByteSizeLong(); }
+    int GetCachedSize() const override { return _msg.GetCachedSize(); }
+    const char* _InternalParse(const char* ptr,
+                               google::protobuf::internal::ParseContext* ctx) override {
+        return _msg._InternalParse(ptr, ctx);
+    }
+    uint8_t* _InternalSerialize(
+        uint8_t* target, google::protobuf::io::EpsCopyOutputStream* stream) const override {
+        return _msg._InternalSerialize(target, stream);
+    }
+
+protected:
+    google::protobuf::Metadata GetMetadata() const override {
+        google::protobuf::Metadata metadata;
+        metadata.descriptor = T::descriptor();
+        metadata.reflection = NULL;
+        return metadata;
+    }
+
+private:
+    T _msg;
+};
+
+typedef HeapMessage<test::EchoRequest> HeapEchoRequest;
+typedef HeapMessage<test::EchoResponse> HeapEchoResponse;
+
+class HeapEchoServiceImpl : public test::EchoService {
+public:
+    HeapEchoServiceImpl() : count(0) {}
+
+    const google::protobuf::Message& GetRequestPrototype(
+        const google::protobuf::MethodDescriptor*) const override {
+        return _req_prototype;
+    }
+    const google::protobuf::Message& GetResponsePrototype(
+        const google::protobuf::MethodDescriptor*) const override {
+        return _res_prototype;
+    }
+    // Only Echo is called.
+    void CallMethod(const google::protobuf::MethodDescriptor*,
+                    google::protobuf::RpcController* cntl_base,
+                    const google::protobuf::Message* request,
+                    google::protobuf::Message* response,
+                    google::protobuf::Closure* done) override {
+        melon::ClosureGuard done_guard(done);
+        melon::Controller* cntl = (melon::Controller*)cntl_base;
+        const HeapEchoRequest* req = static_cast<const HeapEchoRequest*>(request);
+        HeapEchoResponse* res = static_cast<HeapEchoResponse*>(response);
+        if (cntl->arena() != NULL && req->GetArena() == NULL &&
+            res->GetArena() == NULL) {
+            count.fetch_add(1, mutil::memory_order_relaxed);
+        }
+        res->msg().set_message(req->msg().message());
+    }
+
+    mutil::atomic<int> count;
+
+private:
+    HeapEchoRequest _req_prototype;
+    HeapEchoResponse _res_prototype;
+};
+
+TEST_F(ServerTest, use_arena_with_messages_not_on_arena) {
+    // Messages created by New(arena) but not on the arena are destroyed
+    // by the arena only.
+    HeapEchoServiceImpl echo_svc;
+    melon::Server server;
+    ASSERT_EQ(0, server.AddService(&echo_svc,
+                                   melon::SERVER_DOESNT_OWN_SERVICE));
+    mutil::EndPoint ep;
+    ASSERT_EQ(0, str2endpoint("127.0.0.1:8613", &ep));
+    melon::ServerOptions opt;
+    opt.use_arena = true;
+    ASSERT_EQ(0, server.Start(ep, &opt));
+
+    const char* protocols[] = { "baidu_std", "melon_std", "hulu_pbrpc", "h2:grpc" };
+    const int COUNT = 10;
+    for (size_t i = 0; i < ARRAY_SIZE(protocols); ++i) {
+        melon::ChannelOptions copt;
+        copt.protocol = protocols[i];
+        melon::Channel channel;
+        ASSERT_EQ(0, channel.Init(ep, &copt));
+        test::EchoService_Stub stub(&channel);
+        for (int j = 0; j < COUNT; ++j) {
+            melon::Controller cntl;
+            test::EchoRequest req;
+            test::EchoResponse res;
+            req.set_message(EXP_REQUEST);
+            stub.Echo(&cntl, &req, &res, NULL);
+            ASSERT_FALSE(cntl.Failed()) << protocols[i] << ": " << cntl.ErrorText();
+            ASSERT_EQ(EXP_REQUEST, res.message());
+        }
+    }
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+    ASSERT_EQ((int)ARRAY_SIZE(protocols) * COUNT, echo_svc.count.load());
+}
+#endif  // GOOGLE_PROTOBUF_VERSION >= 3021000
+
 TEST_F(ServerTest, create_pid_file) {
     {
         melon::Server server;
@@ -27,6 +27,7 @@
 #include <melon/rpc/socket.h>
 #include <melon/rpc/socket_map.h>
 #include <melon/rpc/reloadable_flags.h>
+#include <melon/utility/fd_guard.h>
 
 namespace melon {
 DECLARE_int32(idle_timeout_second);
@@ -143,6 +144,41 @@ TEST_F(SocketMapTest, max_pool_size) {
         EXPECT_TRUE(ptrs[i]->Failed());
     }
 }
+
+TEST_F(SocketMapTest, warmup_pool) {
+    const int MINSIZE = 3;
+    mutil::fd_guard listening_fd(mutil::tcp_listen(mutil::EndPoint(mutil::IP_ANY, 0)));
+    ASSERT_GT(listening_fd, 0);
+    mutil::EndPoint local;
+    ASSERT_EQ(0, mutil::get_local_side(listening_fd, &local));
+    mutil::EndPoint remote;
+    ASSERT_EQ(0, mutil::str2endpoint("127.0.0.1", local.port, &remote));
+    melon::SocketMapKey key(remote);
+
+    melon::SocketId main_id;
+    ASSERT_EQ(0, melon::SocketMapInsert(key, &main_id));
+    melon::SocketUniquePtr main_ptr;
+    ASSERT_EQ(0, melon::Socket::Address(main_id, &main_ptr));
+    ASSERT_EQ(0, main_ptr->WarmupPooledSockets(MINSIZE));
+    std::vector<melon::SocketId> ids;
+    main_ptr->ListPooledSockets(&ids);
+    ASSERT_EQ(MINSIZE, (int)ids.size());
+    // Warm connections are never released as idle.
+    ASSERT_EQ(MINSIZE, main_ptr->MaintainSocketPool());
+
+    melon::SocketUniquePtr ptr;
+    ASSERT_EQ(0, main_ptr->GetPooledSocket(&ptr));
+    int64_t nhit = 0;
+    int64_t nmiss = 0;
+    ASSERT_TRUE(main_ptr->GetPooledSocketHits(&nhit, &nmiss));
+    EXPECT_EQ(1, nhit);
+    EXPECT_EQ(0, nmiss);
+    ASSERT_EQ(0, ptr->ReturnToPool());
+    main_ptr->ListPooledSockets(&ids);
+    EXPECT_EQ(MINSIZE, (int)ids.size());
+    main_ptr.reset();
+    melon::SocketMapRemove(key);
+}
 } //namespace
 
 int main(int argc, char* argv[]) {
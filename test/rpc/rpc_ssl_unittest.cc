@@ -23,7 +23,10 @@
 // Date: Sun Jul 13 15:04:18 CST 2014
 
 #include <fstream>
+#include <netinet/in.h>
 #include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include <openssl/ssl.h>
 #include <google/protobuf/descriptor.h>
 #include <melon/utility/time.h>
 #include <melon/utility/macros.h>
@@ -31,6 +34,7 @@
 #include <melon/utility/files/scoped_file.h>
 #include <melon/rpc/global.h>
 #include <melon/rpc/socket.h>
+#include <melon/rpc/acceptor.h>
 #include <melon/rpc/server.h>
 #include <melon/rpc/channel.h>
 #include <melon/rpc/socket_map.h>
@@ -38,6 +42,7 @@
 #include "echo.pb.h"
 
 namespace melon {
+DECLARE_bool(ssl_use_ktls);
 
 void ExtractHostnames(X509* x, std::vector<std::string>* hostnames);
 } // namespace melon
@@ -179,6 +184,86 @@ TEST_F(SSLTest, sanity) {
     ASSERT_EQ(0, server.Join());
 }
 
+// Returns true if the kernel has the "tls" ULP which kTLS is built on.
+static bool KernelSupportsKTLS() {
+#if defined(OS_LINUX)
+    mutil::fd_guard listen_fd(socket(AF_INET, SOCK_STREAM, 0));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addrlen = sizeof(addr);
+    if (listen_fd < 0 ||
+        bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(listen_fd, 1) != 0 ||
+        getsockname(listen_fd, (sockaddr*)&addr, &addrlen) != 0) {
+        return false;
+    }
+    mutil::fd_guard fd(socket(AF_INET, SOCK_STREAM, 0));
+    if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        return false;
+    }
+    // TCP_ULP is 31 in linux/tcp.h
+    return setsockopt(fd, IPPROTO_TCP, 31, "tls", sizeof("tls")) == 0;
+#else
+    return false;
+#endif
+}
+
+TEST_F(SSLTest, ktls) {
+#ifndef SSL_OP_ENABLE_KTLS
+    LOG(WARNING) << "OpenSSL is built without kTLS, skip";
+    return;
+#endif
+    if (!KernelSupportsKTLS()) {
+        LOG(WARNING) << "The kernel does not support kTLS, skip";
+        return;
+    }
+    google::FlagSaver saver;
+    melon::FLAGS_ssl_use_ktls = true;
+    const int port = 8613;
+    melon::Server server;
+    melon::ServerOptions options;
+
+    melon::CertInfo cert;
+    cert.certificate = "cert1.crt";
+    cert.private_key = "cert1.key";
+    options.mutable_ssl_options()->default_cert = cert;
+
+    EchoServiceImpl echo_svc;
+    ASSERT_EQ(0, server.AddService(
+        &echo_svc, melon::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start(port, &options));
+
+    const char* protocols[] = { "melon_std", "http" };
+    for (size_t i = 0; i < ARRAY_SIZE(protocols); ++i) {
+        melon::Channel channel;
+        melon::ChannelOptions coptions;
+        coptions.protocol = protocols[i];
+        coptions.mutable_ssl_options();
+        coptions.mutable_ssl_options()->sni_name = "localhost";
+        ASSERT_EQ(0, channel.Init("127.0.0.1", port, &coptions));
+        SendMultipleRPC(&channel, 100);
+
+        // Records of the accepted connections are sent by the kernel.
+        std::vector<melon::SocketId> conns;
+        server._am->ListConnections(&conns);
+        ASSERT_FALSE(conns.empty()) << protocols[i];
+        for (size_t j = 0; j < conns.size(); ++j) {
+            melon::SocketUniquePtr s;
+            if (melon::Socket::Address(conns[j], &s) != 0) {
+                continue;
+            }
+            ASSERT_EQ(melon::SSL_CONNECTED, s->ssl_state()) << protocols[i];
+            ASSERT_TRUE(s->_ktls_send) << protocols[i];
+            LOG(INFO) << protocols[i] << ": ktls_recv=" << s->_ktls_recv;
+        }
+    }
+
+    ASSERT_EQ(0, server.Stop(0));
+    ASSERT_EQ(0, server.Join());
+}
+
 TEST_F(SSLTest, force_ssl) {
     const int port = 8613;
     melon::Server server;
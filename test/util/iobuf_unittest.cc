@@ -31,6 +31,7 @@
 #include <melon/utility/time.h>                 // Timer
 #include <melon/utility/fd_utility.h>           // make_non_blocking
 #include <melon/utility/iobuf.h>
+#include <melon/utility/iobuf_block_pool.h>
 #include <turbo/log/logging.h>
 #include <melon/utility/fd_guard.h>
 #include <melon/utility/errno.h>
@@ -1789,4 +1790,93 @@ TEST_F(IOBufTest, acquire_tls_block) {
     ASSERT_NE(mutil::iobuf::block_cap(b), mutil::iobuf::block_size(b));
 }
 
+// Run `fn' with blocks allocated from the block pool. Allocators are
+// restored afterwards so that the debug allocator is not confused.
+template <typename Fn>
+void run_with_block_pool(const Fn& fn) {
+    void* (*saved_allocate)(size_t) = mutil::iobuf::blockmem_allocate;
+    void (*saved_deallocate)(void*) = mutil::iobuf::blockmem_deallocate;
+    mutil::iobuf::remove_tls_block_chain();
+    ASSERT_EQ(0, mutil::iobuf::enable_block_pool());
+    ASSERT_TRUE(mutil::iobuf::block_pool_enabled());
+    fn();
+    mutil::iobuf::remove_tls_block_chain();
+    mutil::iobuf::disable_block_pool();
+    ASSERT_FALSE(mutil::iobuf::block_pool_enabled());
+    mutil::iobuf::blockmem_allocate = saved_allocate;
+    mutil::iobuf::blockmem_deallocate = saved_deallocate;
+}
+
+void* destroy_iobuf(void* arg) {
+    delete (mutil::IOBuf*)arg;
+    return NULL;
+}
+
+TEST_F(IOBufTest, block_pool) {
+    const size_t nblock_before = mutil::IOBuf::block_count();
+    run_with_block_pool([] {
+        std::string data(3 * 1024 * 1024 + 100, '\0');
+        for (size_t i = 0; i < data.size(); ++i) {
+            data[i] = mutil::fast_rand_less_than(256);
+        }
+        mutil::IOBuf* buf = new mutil::IOBuf;
+        buf->append(data);
+        ASSERT_EQ(data, buf->to_string());
+        // Large data is put into blocks of larger size classes.
+        ASSERT_GT(buf->backing_block(0).size(), (size_t)mutil::IOBuf::DEFAULT_BLOCK_SIZE);
+        ASSERT_LT(buf->backing_block_num(), 8u);
+
+        mutil::IOBuf small;
+        small.append("small");
+        small.push_back('!');
+        ASSERT_EQ("small!", small.to_string());
+
+        mutil::IOBuf cut;
+        buf->cutn(&cut, 1024 * 1024 + 7);
+        ASSERT_EQ(data.substr(0, 1024 * 1024 + 7), cut.to_string());
+        ASSERT_EQ(data.substr(1024 * 1024 + 7), buf->to_string());
+
+        std::ostringstream os;
+        mutil::iobuf::describe_block_pool(os);
+        ASSERT_NE(std::string::npos, os.str().find("enabled")) << os.str();
+        ASSERT_NE(std::string::npos, os.str().find("block_size=1048576")) << os.str();
+        LOG(INFO) << "\n" << os.str();
+
+        // Release blocks in another thread.
+        pthread_t th;
+        ASSERT_EQ(0, pthread_create(&th, NULL, destroy_iobuf, buf));
+        ASSERT_EQ(0, pthread_join(th, NULL));
+    });
+    ASSERT_EQ(nblock_before, mutil::IOBuf::block_count());
+}
+
+// Append large payloads and cut them out, which is the pattern of sending
+// large responses.
+static void append_and_cut_large_payload(const char* name) {
+    const std::string payload(1024 * 1024, 'x');
+    const size_t N = 500;
+    mutil::Timer tm;
+    tm.start();
+    for (size_t i = 0; i < N; ++i) {
+        mutil::IOBuf buf;
+        buf.append(payload);
+        mutil::IOBuf out;
+        while (!buf.empty()) {
+            buf.cutn(&out, 65536);
+        }
+        ASSERT_EQ(payload.size(), out.size());
+    }
+    tm.stop();
+    LOG(INFO) << name << ": append+cut " << N * payload.size() / tm.u_elapsed()
+              << "MB/s";
+}
+
+TEST_F(IOBufTest, block_pool_perf) {
+    mutil::iobuf::remove_tls_block_chain();
+    append_and_cut_large_payload("malloc");
+    run_with_block_pool([] {
+        append_and_cut_large_payload("block_pool");
+    });
+}
+
 } // namespace